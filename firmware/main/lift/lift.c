@@ -2,11 +2,13 @@
 
 #include <driver/ledc.h>
 #include <esp_err.h>
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
 #include <freertos/task.h>
 
 #include <logger.h>
+#include <services/metrics_service.h>
 
 #define MOTORS_ENABLED 0
 #define MOTORS_DISABLED 1
@@ -17,6 +19,9 @@
 #define DIR_DOWN 0
 #define DIR_UP 1
 
+// How often the estimated position is reported while the lift is moving
+#define POSITION_EVENT_INTERVAL_US (100 * 1000)
+
 static const char             TAG[] = "lift";
 static const ledc_timer_bit_t DUTY_RESOLUTION = LEDC_TIMER_13_BIT;
 
@@ -24,22 +29,24 @@ typedef enum lift_command_e
 {
     LIFT_COMMAND_STOP,
     LIFT_COMMAND_UP,
-    LIFT_COMMAND_DOWN
+    LIFT_COMMAND_DOWN,
+    LIFT_COMMAND_MOVE_TO
 } lift_command_t;
 
-typedef enum lift_state_e
+typedef struct lift_command_message_s
 {
-    LIFT_STATE_STOPPED_DOWN = 0,
-    LIFT_STATE_MOVING_UP,
-    LIFT_STATE_STOPPED_MID,
-    LIFT_STATE_REACHED_UP,
-    LIFT_STATE_SETTLING_UP,
-    LIFT_STATE_STOPPED_UP,
-    LIFT_STATE_MOVING_DOWN,
-    LIFT_STATE_REACHED_DOWN,
-    LIFT_STATE_SETTLING_DOWN,
-
-} lift_state_t;
+    lift_command_t command;
+
+    // Only used by LIFT_COMMAND_MOVE_TO
+    int32_t        position;
+} lift_command_message_t;
+
+static metric_counter_t commandMetrics[] = {
+    [LIFT_COMMAND_STOP] = METRIC_COUNTER("tvlift_lift_commands_total", "Number of commands sent to the lift.", "command=\"stop\""),
+    [LIFT_COMMAND_UP] = METRIC_COUNTER("tvlift_lift_commands_total", "Number of commands sent to the lift.", "command=\"up\""),
+    [LIFT_COMMAND_DOWN] = METRIC_COUNTER("tvlift_lift_commands_total", "Number of commands sent to the lift.", "command=\"down\""),
+    [LIFT_COMMAND_MOVE_TO] = METRIC_COUNTER("tvlift_lift_commands_total", "Number of commands sent to the lift.", "command=\"move_to\"")
+};
 
 typedef struct lift_endstop_config_s
 {
@@ -62,8 +69,51 @@ struct lift_device_s
     QueueHandle_t commandEvtQueue;
     lift_state_t  state;
     TaskHandle_t  monitorTaskHandle;
+
+    lift_event_handler_t eventHandler;
+    void*                eventHandlerUserData;
+
+    // The position is not measured, it is integrated from the speed since the last time the lift
+    // started moving, changed speed, or stopped. Guarded by positionLock, the speed can be changed from other tasks.
+    portMUX_TYPE positionLock;
+    int32_t      position;
+    int32_t      direction;
+    int64_t      positionTimestamp;
+    int64_t      positionEventTimestamp;
+
+    // Set while moving to a position, the lift stops when the estimated position reaches it
+    bool         hasTargetPosition;
+    int32_t      targetPosition;
 };
 
+static int32_t lift_get_position(const lift_device_handle_t handle, int64_t now)
+{
+    return handle->position + (int32_t)(handle->direction * (int64_t)handle->speed * (now - handle->positionTimestamp) / 1000000);
+}
+
+static void lift_update_position(const lift_device_handle_t handle, int32_t direction)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&handle->positionLock);
+    handle->position = lift_get_position(handle, now);
+    handle->direction = direction;
+    handle->positionTimestamp = now;
+    portEXIT_CRITICAL(&handle->positionLock);
+}
+
+static void lift_send_event(const lift_device_handle_t handle, lift_event_type_t type)
+{
+    if (handle->eventHandler == NULL)
+    {
+        return;
+    }
+
+    lift_status_t status;
+    lift_get_status(handle, &status);
+    handle->eventHandler(type, &status, handle->eventHandlerUserData);
+}
+
 static lift_err_t lift_start_pul(const lift_device_handle_t handle)
 {
     LOG_D(TAG, "Start lift pulse");
@@ -92,6 +142,9 @@ static lift_err_t lift_stop_pul(const lift_device_handle_t handle)
 {
     esp_err_t err = ledc_stop(LEDC_HIGH_SPEED_MODE, LEDC_CHANNEL_0, 0);
 
+    lift_update_position(handle, 0);
+    handle->hasTargetPosition = false;
+
     return err == ESP_OK ? LIFT_OK : LIFT_FAIL;
 }
 
@@ -117,7 +170,13 @@ static lift_err_t lift_move_up(const lift_device_handle_t handle)
     gpio_set_level(handle->gpioEna, MOTORS_ENABLED);
 
     // Start moving
-    return lift_start_pul(handle);
+    lift_err_t liftErr = lift_start_pul(handle);
+    if (liftErr == LIFT_OK)
+    {
+        lift_update_position(handle, 1);
+    }
+
+    return liftErr;
 }
 
 static lift_err_t lift_move_down(const lift_device_handle_t handle)
@@ -142,7 +201,13 @@ static lift_err_t lift_move_down(const lift_device_handle_t handle)
     gpio_set_level(handle->gpioEna, MOTORS_ENABLED);
 
     // Start moving
-    return lift_start_pul(handle);
+    lift_err_t liftErr = lift_start_pul(handle);
+    if (liftErr == LIFT_OK)
+    {
+        lift_update_position(handle, -1);
+    }
+
+    return liftErr;
 }
 
 static void IRAM_ATTR endstop_isr_handler(void* arg)
@@ -151,17 +216,51 @@ static void IRAM_ATTR endstop_isr_handler(void* arg)
     xQueueSendFromISR(endstopConfig->endstopEvtQueue, &endstopConfig->gpio, NULL);
 }
 
+static lift_command_t lift_resolve_move_to(const lift_device_handle_t handle, int32_t targetPosition)
+{
+    portENTER_CRITICAL(&handle->positionLock);
+    int32_t position = lift_get_position(handle, esp_timer_get_time());
+    portEXIT_CRITICAL(&handle->positionLock);
+
+    LOG_I(TAG, "Moving lift from position %d to %d", position, targetPosition);
+
+    if (targetPosition == position)
+    {
+        return LIFT_COMMAND_STOP;
+    }
+
+    handle->targetPosition = targetPosition;
+    handle->hasTargetPosition = true;
+    return targetPosition > position ? LIFT_COMMAND_UP : LIFT_COMMAND_DOWN;
+}
+
+static bool lift_is_target_position_reached(const lift_device_handle_t handle)
+{
+    if (!handle->hasTargetPosition || handle->direction == 0)
+    {
+        return false;
+    }
+
+    portENTER_CRITICAL(&handle->positionLock);
+    int32_t position = lift_get_position(handle, esp_timer_get_time());
+    portEXIT_CRITICAL(&handle->positionLock);
+
+    return handle->direction > 0 ? position >= handle->targetPosition : position <= handle->targetPosition;
+}
+
 static void lift_monitor_task(void* arg)
 {
     lift_device_handle_t handle = (lift_device_handle_t)arg;
 
-    gpio_num_t     endstopGpio;
-    lift_command_t command;
+    gpio_num_t             endstopGpio;
+    lift_command_message_t commandMessage;
+    lift_command_t         command;
     for (;;)
     {
         if (xQueueReceive(handle->endstopDownConfig.endstopEvtQueue, &endstopGpio, 1))
         {
             bool isEndstopActive = gpio_get_level(endstopGpio) == ENDSTOP_ACTIVE;
+            lift_state_t previousState = handle->state;
 
             // If any endstop is depressed, just stop the lift immediately
             if (isEndstopActive)
@@ -174,6 +273,11 @@ static void lift_monitor_task(void* arg)
                 LOG_I(TAG, "Endstop down triggered");
 
                 handle->state = LIFT_STATE_REACHED_DOWN;
+
+                // The down endstop is the reference point for the position
+                portENTER_CRITICAL(&handle->positionLock);
+                handle->position = 0;
+                portEXIT_CRITICAL(&handle->positionLock);
             }
             else if (endstopGpio == handle->endstopUpConfig.gpio && isEndstopActive)
             {
@@ -181,10 +285,25 @@ static void lift_monitor_task(void* arg)
 
                 handle->state = LIFT_STATE_REACHED_UP;
             }
+
+            lift_send_event(handle, LIFT_EVENT_ENDSTOP_CHANGED);
+            if (handle->state != previousState)
+            {
+                lift_send_event(handle, LIFT_EVENT_STATE_CHANGED);
+            }
         }
 
-        if (xQueueReceive(handle->commandEvtQueue, &command, 1))
+        if (xQueueReceive(handle->commandEvtQueue, &commandMessage, 1))
         {
+            // Moving to a position is moving up or down until the position is reached,
+            // every other command cancels moving to a position
+            command = commandMessage.command;
+            handle->hasTargetPosition = false;
+            if (command == LIFT_COMMAND_MOVE_TO)
+            {
+                command = lift_resolve_move_to(handle, commandMessage.position);
+            }
+
             // Stop immediately and figure out state later if we need to stop
             if (command == LIFT_COMMAND_STOP)
             {
@@ -311,6 +430,28 @@ static void lift_monitor_task(void* arg)
             }
 
             LOG_I(TAG, "State: %i, Command: %i, New State: %i", currentState, command, handle->state);
+
+            if (handle->state != currentState)
+            {
+                lift_send_event(handle, LIFT_EVENT_STATE_CHANGED);
+            }
+        }
+
+        if (lift_is_target_position_reached(handle))
+        {
+            LOG_I(TAG, "Lift reached position %d", handle->targetPosition);
+
+            lift_stop_pul(handle);
+            handle->state = LIFT_STATE_STOPPED_MID;
+            lift_send_event(handle, LIFT_EVENT_STATE_CHANGED);
+        }
+
+        // Report the estimated position regularly while moving
+        int64_t now = esp_timer_get_time();
+        if (handle->direction != 0 && now - handle->positionEventTimestamp >= POSITION_EVENT_INTERVAL_US)
+        {
+            handle->positionEventTimestamp = now;
+            lift_send_event(handle, LIFT_EVENT_POSITION_CHANGED);
         }
     }
 }
@@ -341,6 +482,11 @@ lift_err_t lift_add_device(
     // Assign the new handle
     *handle = newHandle;
 
+    for (size_t i = 0; i < sizeof(commandMetrics) / sizeof(commandMetrics[0]); ++i)
+    {
+        metrics_service_register(&commandMetrics[i].metric);
+    }
+
     // Configure output pins with pullup
     gpio_config_t pullupOutputIoConf = {
         .pin_bit_mask = BIT(gpioEna),
@@ -391,7 +537,7 @@ lift_err_t lift_add_device(
         return LIFT_FAIL;
     }
 
-    QueueHandle_t commandEvtQueue = xQueueCreate(10, sizeof(lift_command_t));
+    QueueHandle_t commandEvtQueue = xQueueCreate(10, sizeof(lift_command_message_t));
     if (commandEvtQueue == NULL)
     {
         LOG_E(TAG, "Can not allocate memory for command event queue");
@@ -409,6 +555,7 @@ lift_err_t lift_add_device(
     newHandle->max_speed = max_speed;
     newHandle->settle_speed = newHandle->speed / 2;
     newHandle->commandEvtQueue = commandEvtQueue;
+    newHandle->positionLock = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
 
     // Check endstops before initializing state
     bool isDown = gpio_get_level(gpioEndstopDown) == ENDSTOP_ACTIVE;
@@ -519,10 +666,16 @@ void lift_remove_device(lift_device_handle_t handle)
     }
 }
 
-static lift_err_t lift_send_command(const lift_device_handle_t handle, const lift_command_t command)
+static lift_err_t lift_send_command(const lift_device_handle_t handle, const lift_command_t command, int32_t position)
 {
+    lift_command_message_t commandMessage = {
+        .command = command,
+        .position = position
+    };
+
     // Queue the command
-    xQueueSendToBack(handle->commandEvtQueue, &command, portMAX_DELAY);
+    xQueueSendToBack(handle->commandEvtQueue, &commandMessage, portMAX_DELAY);
+    metrics_counter_inc(&commandMetrics[command]);
 
     // TODO: Propper return value: wait for state machine
     return LIFT_OK;
@@ -530,12 +683,17 @@ static lift_err_t lift_send_command(const lift_device_handle_t handle, const lif
 
 lift_err_t lift_up(const lift_device_handle_t handle)
 {
-    return lift_send_command(handle, LIFT_COMMAND_UP);
+    return lift_send_command(handle, LIFT_COMMAND_UP, 0);
 }
 
 lift_err_t lift_down(const lift_device_handle_t handle)
 {
-    return lift_send_command(handle, LIFT_COMMAND_DOWN);
+    return lift_send_command(handle, LIFT_COMMAND_DOWN, 0);
+}
+
+lift_err_t lift_move_to(const lift_device_handle_t handle, int32_t position)
+{
+    return lift_send_command(handle, LIFT_COMMAND_MOVE_TO, position);
 }
 
 lift_err_t lift_stop(const lift_device_handle_t handle)
@@ -543,7 +701,7 @@ lift_err_t lift_stop(const lift_device_handle_t handle)
     // Remove all pending commands from the queue
     xQueueReset(handle->commandEvtQueue);
 
-    return lift_send_command(handle, LIFT_COMMAND_STOP);
+    return lift_send_command(handle, LIFT_COMMAND_STOP, 0);
 }
 
 // lift_err_t lift_disable(const lift_device_handle_t handle)
@@ -578,7 +736,15 @@ lift_err_t lift_set_speed(lift_device_handle_t handle, uint32_t speed)
         return LIFT_FAIL;
     }
 
+    // Integrate the position up to now with the old speed before changing it
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&handle->positionLock);
+    handle->position = lift_get_position(handle, now);
+    handle->positionTimestamp = now;
     handle->speed = speed;
+    portEXIT_CRITICAL(&handle->positionLock);
+
+    lift_send_event(handle, LIFT_EVENT_SPEED_CHANGED);
     return LIFT_OK;
 }
 
@@ -602,4 +768,22 @@ lift_err_t lift_set_speed_limits(lift_device_handle_t handle, uint32_t minSpeed,
     }
 
     return LIFT_OK;
+}
+
+void lift_get_status(const lift_device_handle_t handle, lift_status_t* status)
+{
+    status->state = handle->state;
+    status->speed = handle->speed;
+    status->endstop_down = gpio_get_level(handle->endstopDownConfig.gpio) == ENDSTOP_ACTIVE;
+    status->endstop_up = gpio_get_level(handle->endstopUpConfig.gpio) == ENDSTOP_ACTIVE;
+
+    portENTER_CRITICAL(&handle->positionLock);
+    status->position = lift_get_position(handle, esp_timer_get_time());
+    portEXIT_CRITICAL(&handle->positionLock);
+}
+
+void lift_set_event_handler(lift_device_handle_t handle, lift_event_handler_t handler, void* userData)
+{
+    handle->eventHandlerUserData = userData;
+    handle->eventHandler = handler;
 }
\ No newline at end of file
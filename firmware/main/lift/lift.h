@@ -1,6 +1,9 @@
 #ifndef LIFT_H
 #define LIFT_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include <driver/gpio.h>
 
 typedef enum 
@@ -14,8 +17,52 @@ typedef enum
     LIFT_LIMITS_INVALID
 } lift_err_t;
 
+typedef enum lift_state_e
+{
+    LIFT_STATE_STOPPED_DOWN = 0,
+    LIFT_STATE_MOVING_UP,
+    LIFT_STATE_STOPPED_MID,
+    LIFT_STATE_REACHED_UP,
+    LIFT_STATE_SETTLING_UP,
+    LIFT_STATE_STOPPED_UP,
+    LIFT_STATE_MOVING_DOWN,
+    LIFT_STATE_REACHED_DOWN,
+    LIFT_STATE_SETTLING_DOWN,
+
+} lift_state_t;
+
+typedef enum lift_event_type_e
+{
+    LIFT_EVENT_STATE_CHANGED,
+    LIFT_EVENT_SPEED_CHANGED,
+    LIFT_EVENT_POSITION_CHANGED,
+    LIFT_EVENT_ENDSTOP_CHANGED
+} lift_event_type_t;
+
+typedef struct lift_status_s
+{
+    lift_state_t state;
+    uint32_t     speed;
+
+    // Estimated number of steps above the down endstop, integrated from speed and time spent moving
+    int32_t      position;
+
+    bool         endstop_down;
+    bool         endstop_up;
+} lift_status_t;
+
 typedef struct lift_device_s* lift_device_handle_t;
 
+/**
+ * @brief Called when the status of the lift changes. Called from the lift monitor task, or from the task
+ * that changed the speed, so handlers must return quickly and must not call back into the lift.
+ * 
+ * @param[in] type What changed.
+ * @param[in] status The status of the lift after the change.
+ * @param[in] userData The user data passed to lift_set_event_handler.
+ */
+typedef void (*lift_event_handler_t)(lift_event_type_t type, const lift_status_t* status, void* userData);
+
 lift_err_t lift_add_device(
     gpio_num_t gpioEna,
     gpio_num_t gpioDir,
@@ -32,8 +79,22 @@ lift_err_t lift_up(const lift_device_handle_t handle);
 lift_err_t lift_down(const lift_device_handle_t handle);
 lift_err_t lift_stop(const lift_device_handle_t handle);
 
+/**
+ * @brief Moves the lift up or down until its estimated position reaches the given position.
+ * Any other command cancels moving to the position.
+ * 
+ * @param[in] handle The lift.
+ * @param[in] position The position to move to, in steps above the down endstop.
+ * 
+ * @return lift_err_t LIFT_OK if the command was queued.
+ */
+lift_err_t lift_move_to(const lift_device_handle_t handle, int32_t position);
+
 uint32_t lift_get_speed(const lift_device_handle_t handle);
 lift_err_t lift_set_speed(lift_device_handle_t handle, uint32_t speed);
 lift_err_t lift_set_speed_limits(lift_device_handle_t handle, uint32_t minSpeed, uint32_t maxSpeed);
 
+void lift_get_status(const lift_device_handle_t handle, lift_status_t* status);
+void lift_set_event_handler(lift_device_handle_t handle, lift_event_handler_t handler, void* userData);
+
 #endif // LIFT_H
\ No newline at end of file
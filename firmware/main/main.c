@@ -10,6 +10,7 @@
 #include <freertos/task.h>
 #include <esp_log.h>
 #include <esp_system.h>
+#include <esp_heap_caps.h>
 #include <esp_event.h>
 #include <nvs_flash.h>
 #include <esp_ota_ops.h>
@@ -30,9 +31,13 @@
 #include <logger.h>
 
 #include <sdkconfig.h>
+#include <services/asset_service.h>
 #include <services/lift_service.h>
+#include <services/metrics_service.h>
+#include <services/ota_service.h>
 #include <services/spiffs_service.h>
 #include <tasks/blink/blink_task.h>
+#include <tasks/update/update_task.h>
 #include <tasks/webserver/webserver_task.h>
 
 const char hostname[] = "tvlift";
@@ -40,6 +45,46 @@ const char hostname[] = "tvlift";
 static const char* TAG = "APP";
 static bool shuttingDown = false;
 static esp_netif_t* espNetifInstance;
+static TaskHandle_t blinkTaskHandle = NULL;
+static TaskHandle_t webserverTaskHandle = NULL;
+static TaskHandle_t updateTaskHandle = NULL;
+
+static int32_t read_free_heap(void* userData)
+{
+    return (int32_t)heap_caps_get_free_size(MALLOC_CAP_8BIT);
+}
+
+static int32_t read_minimum_free_heap(void* userData)
+{
+    return (int32_t)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+}
+
+static int32_t read_largest_free_block(void* userData)
+{
+    return (int32_t)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+}
+
+static int32_t read_wifi_rssi(void* userData)
+{
+    wifi_ap_record_t apInfo;
+    return esp_wifi_sta_get_ap_info(&apInfo) == ESP_OK ? apInfo.rssi : 0;
+}
+
+static int32_t read_stack_free_bytes(void* userData)
+{
+    TaskHandle_t handle = *(TaskHandle_t*)userData;
+    return handle != NULL ? uxTaskGetStackHighWaterMark(handle) : 0;
+}
+
+static metric_gauge_t systemMetrics[] = {
+    METRIC_GAUGE("tvlift_heap_free_bytes", "Free heap.", NULL, read_free_heap, NULL),
+    METRIC_GAUGE("tvlift_heap_minimum_free_bytes", "Least amount of free heap since boot.", NULL, read_minimum_free_heap, NULL),
+    METRIC_GAUGE("tvlift_heap_largest_free_block_bytes", "Largest block that can be allocated.", NULL, read_largest_free_block, NULL),
+    METRIC_GAUGE("tvlift_wifi_rssi_dbm", "Signal strength of the access point, 0 when not connected.", NULL, read_wifi_rssi, NULL),
+    METRIC_GAUGE("tvlift_task_stack_free_bytes", "Least amount of free stack space a task ever had.", "task=\"" BLINK_TASK_TAG "\"", read_stack_free_bytes, &blinkTaskHandle),
+    METRIC_GAUGE("tvlift_task_stack_free_bytes", "Least amount of free stack space a task ever had.", "task=\"" WEBSERVER_TASK_TAG "\"", read_stack_free_bytes, &webserverTaskHandle),
+    METRIC_GAUGE("tvlift_task_stack_free_bytes", "Least amount of free stack space a task ever had.", "task=\"" UPDATE_TASK_TAG "\"", read_stack_free_bytes, &updateTaskHandle)
+};
 
 static void shutdown_handler(void)
 {
@@ -304,8 +349,13 @@ void initialize_app(void)
         LOG_I(TAG, "Current partition is pending verification");
     }
 
+    // The data partition either holds an asset pack that is served straight from flash, or a SPIFFS filesystem.
+    // Check for the asset pack first, mounting would format the partition because it is not a valid filesystem.
     const char* spiffsPartitionLabel = spiffs_service_get_spiffs_partition_label_for_app_partition(currentPartition->label);
-    spiffs_service_mount(spiffsPartitionLabel, "/data");
+    if (asset_service_map(spiffsPartitionLabel) != ASSET_SERVICE_OK)
+    {
+        spiffs_service_mount(spiffsPartitionLabel, "/data");
+    }
 
     // I2C conflicts with Lift Pul and Lift Dir on current board
     // initialize_i2c();
@@ -343,8 +393,8 @@ void initialize_app(void)
     initialize_sntp();
 
     lift_service_init();
+    ota_service_init();
 
-    TaskHandle_t blinkTaskHandle = NULL; 
     xTaskCreatePinnedToCore(
         blink_task_main,
         BLINK_TASK_TAG,
@@ -354,7 +404,6 @@ void initialize_app(void)
         &blinkTaskHandle,
         PRO_CPU_NUM);
 
-    TaskHandle_t webserverTaskHandle = NULL; 
     xTaskCreatePinnedToCore(
         webserver_task_main,
         WEBSERVER_TASK_TAG,
@@ -364,6 +413,21 @@ void initialize_app(void)
         &webserverTaskHandle,
         PRO_CPU_NUM);
 
+    // Runs below the webserver, and on the other core then the writer task of the update it pulls
+    xTaskCreatePinnedToCore(
+        update_task_main,
+        UPDATE_TASK_TAG,
+        UPDATE_TASK_STACK_SIZE_KB * STACK_KB,
+        NULL,
+        tskIDLE_PRIORITY+5,
+        &updateTaskHandle,
+        APP_CPU_NUM);
+
+    for (size_t i = 0; i < sizeof(systemMetrics) / sizeof(systemMetrics[0]); ++i)
+    {
+        metrics_service_register(&systemMetrics[i].metric);
+    }
+
     // If we get this far, assume app is functioning
     // TODO: Check workings of tasks
     esp_ota_mark_app_valid_cancel_rollback();
@@ -0,0 +1,144 @@
+#include "asset_service.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include <esp_err.h>
+#include <esp_partition.h>
+
+#include <logger.h>
+
+// Asset pack layout, created by pack_assets.py:
+// header, followed by nr_of_assets entries sorted by path, followed by the asset data.
+// All offsets are relative to the start of the pack.
+#define ASSET_PACK_MAGIC   0x4B415754
+#define ASSET_PACK_VERSION 1
+
+#define PATH_SIZE         48
+#define CONTENT_TYPE_SIZE 32
+#define ETAG_SIZE         20
+
+typedef struct asset_pack_header_s
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t nr_of_assets;
+    uint32_t size;
+} asset_pack_header_t;
+
+typedef struct asset_pack_entry_s
+{
+    char     path[PATH_SIZE];
+    char     content_type[CONTENT_TYPE_SIZE];
+    char     etag[ETAG_SIZE];
+    uint32_t offset;
+    uint32_t length;
+    uint32_t gzip_offset;
+    uint32_t gzip_length;
+} asset_pack_entry_t;
+
+static_assert(sizeof(asset_pack_header_t) == 12, "asset_pack_header_t does not match the asset pack format");
+static_assert(sizeof(asset_pack_entry_t) == 116, "asset_pack_entry_t does not match the asset pack format");
+
+static const char TAG[] = "Asset Service";
+
+static const char* _pack = NULL;
+static const asset_pack_header_t* _header = NULL;
+static const asset_pack_entry_t* _entries = NULL;
+static spi_flash_mmap_handle_t _mmapHandle;
+
+asset_service_err_t asset_service_map(const char* partitionLabel)
+{
+    esp_err_t err;
+
+    const esp_partition_t* partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, partitionLabel);
+    if (partition == NULL)
+    {
+        LOG_E(TAG, "Failed to find partition %s", partitionLabel);
+        return ASSET_SERVICE_FAIL;
+    }
+
+    // Check the header before mapping the whole partition
+    asset_pack_header_t header;
+    err = esp_partition_read(partition, 0, &header, sizeof(header));
+    if (err != ESP_OK)
+    {
+        LOG_E(TAG, "Failed to read partition %s (%s)", partitionLabel, esp_err_to_name(err));
+        return ASSET_SERVICE_FAIL;
+    }
+
+    if (header.magic != ASSET_PACK_MAGIC || header.version != ASSET_PACK_VERSION || header.size > partition->size)
+    {
+        LOG_I(TAG, "Partition %s does not contain an asset pack", partitionLabel);
+        return ASSET_SERVICE_ERR_NO_ASSET_PACK;
+    }
+
+    const void* pack;
+    err = esp_partition_mmap(partition, 0, header.size, SPI_FLASH_MMAP_DATA, &pack, &_mmapHandle);
+    if (err != ESP_OK)
+    {
+        LOG_E(TAG, "Failed to map partition %s (%s)", partitionLabel, esp_err_to_name(err));
+        return ASSET_SERVICE_FAIL;
+    }
+
+    _pack = (const char*)pack;
+    _header = (const asset_pack_header_t*)_pack;
+    _entries = (const asset_pack_entry_t*)(_pack + sizeof(asset_pack_header_t));
+
+    LOG_I(TAG, "Mapped asset pack in partition %s: %u assets, %u bytes", partitionLabel, _header->nr_of_assets, _header->size);
+
+    return ASSET_SERVICE_OK;
+}
+
+bool asset_service_is_mapped(void)
+{
+    return _pack != NULL;
+}
+
+asset_service_err_t asset_service_find(const char* path, size_t pathLength, asset_t* asset)
+{
+    if (_pack == NULL || pathLength >= PATH_SIZE)
+    {
+        return ASSET_SERVICE_ERR_NOT_FOUND;
+    }
+
+    // Entries are sorted by path
+    size_t low = 0;
+    size_t high = _header->nr_of_assets;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        const asset_pack_entry_t* entry = &_entries[middle];
+
+        int cmp = strncmp(entry->path, path, pathLength);
+        if (cmp == 0 && entry->path[pathLength] != '\0')
+        {
+            // Entry path is longer than the path that is looked for
+            cmp = 1;
+        }
+
+        if (cmp < 0)
+        {
+            low = middle + 1;
+        }
+        else if (cmp > 0)
+        {
+            high = middle;
+        }
+        else
+        {
+            asset->path = entry->path;
+            asset->content_type = entry->content_type;
+            asset->etag = entry->etag;
+            asset->data = _pack + entry->offset;
+            asset->length = entry->length;
+            asset->gzip_data = entry->gzip_length > 0 ? _pack + entry->gzip_offset : NULL;
+            asset->gzip_length = entry->gzip_length;
+
+            return ASSET_SERVICE_OK;
+        }
+    }
+
+    return ASSET_SERVICE_ERR_NOT_FOUND;
+}
\ No newline at end of file
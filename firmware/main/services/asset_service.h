@@ -0,0 +1,62 @@
+#ifndef ASSET_SERVICE_H
+#define ASSET_SERVICE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum 
+{
+    ASSET_SERVICE_OK = 0,
+    ASSET_SERVICE_FAIL = -1,
+
+    ASSET_SERVICE_ERR_NOT_FOUND = 1,
+    ASSET_SERVICE_ERR_NO_ASSET_PACK
+
+} asset_service_err_t;
+
+typedef struct asset_s
+{
+    const char* path;
+    const char* content_type;
+    const char* etag;
+
+    // Point directly into mapped flash
+    const char* data;
+    size_t      length;
+
+    // NULL if the asset has no gzipped variant
+    const char* gzip_data;
+    size_t      gzip_length;
+} asset_t;
+
+/**
+ * @brief Maps the asset pack in the given partition into the address space.
+ * 
+ * @param[in] partitionLabel Label of the partition that holds the asset pack.
+ * 
+ * @return asset_service_err_t ASSET_SERVICE_OK if the asset pack was mapped,
+ * ASSET_SERVICE_ERR_NO_ASSET_PACK if the partition does not contain an asset pack, or
+ * ASSET_SERVICE_FAIL if the partition could not be mapped.
+ */
+asset_service_err_t asset_service_map(const char* partitionLabel);
+
+/**
+ * @brief Checks if an asset pack is mapped.
+ * 
+ * @return true if assets are served from an asset pack.
+ */
+bool asset_service_is_mapped(void);
+
+/**
+ * @brief Looks up an asset by path.
+ * 
+ * @param[in] path The path of the asset, starting with a '/'. Does not need to be null terminated.
+ * @param[in] pathLength The length of path.
+ * @param[out] asset The asset, valid as long as the asset pack stays mapped.
+ * 
+ * @return asset_service_err_t ASSET_SERVICE_OK if the asset was found, or
+ * ASSET_SERVICE_ERR_NOT_FOUND if there is no asset with the given path.
+ */
+asset_service_err_t asset_service_find(const char* path, size_t pathLength, asset_t* asset);
+
+#endif // ASSET_SERVICE_H
\ No newline at end of file
@@ -1,11 +1,96 @@
 #include "lift_service.h"
 
+#include <stddef.h>
+
+#include <esp_timer.h>
+#include <map.h>
+
 #include <pins.h>
+#include <services/metrics_service.h>
 #include <services/settings_service.h>
 
 static lift_device_handle_t _liftHandle = NULL;
 static settings_service_registration_handle_t _settingsChangeHandle;
 
+// Handles start at 1, handle 0 marks the end of the registrations when iterating
+static lift_service_registration_handle_t _registrationCounter = 1;
+static map _registrations = NULL;
+
+static int32_t read_position(void* userData);
+static int32_t read_speed(void* userData);
+
+// Move durations in milliseconds
+static const uint32_t moveDurationBounds[] = { 500, 1000, 2000, 5000, 10000, 20000, 30000, 60000 };
+
+static metric_counter_t _movesUpMetric = METRIC_COUNTER("tvlift_lift_moves_total", "Number of times the lift started moving.", "direction=\"up\"");
+static metric_counter_t _movesDownMetric = METRIC_COUNTER("tvlift_lift_moves_total", "Number of times the lift started moving.", "direction=\"down\"");
+static metric_histogram_t _moveDurationMetric = METRIC_HISTOGRAM("tvlift_lift_move_duration_seconds", "Time the lift spent moving per move.", NULL, moveDurationBounds, 1000);
+static metric_gauge_t _positionMetric = METRIC_GAUGE("tvlift_lift_position_steps", "Estimated number of steps above the down endstop.", NULL, read_position, NULL);
+static metric_gauge_t _speedMetric = METRIC_GAUGE("tvlift_lift_speed", "Current speed of the lift.", NULL, read_speed, NULL);
+
+// Start of the current move in microseconds, 0 while not moving
+static int64_t _moveStartTime = 0;
+
+static int32_t read_position(void* userData)
+{
+    lift_status_t status;
+    lift_get_status(_liftHandle, &status);
+    return status.position;
+}
+
+static int32_t read_speed(void* userData)
+{
+    lift_status_t status;
+    lift_get_status(_liftHandle, &status);
+    return (int32_t)status.speed;
+}
+
+static void update_move_metrics(const lift_status_t* status)
+{
+    bool isMoving = status->state == LIFT_STATE_MOVING_UP || status->state == LIFT_STATE_MOVING_DOWN;
+
+    if(isMoving && _moveStartTime == 0)
+    {
+        _moveStartTime = esp_timer_get_time();
+        metrics_counter_inc(status->state == LIFT_STATE_MOVING_UP ? &_movesUpMetric : &_movesDownMetric);
+    }
+    else if(!isMoving && _moveStartTime != 0)
+    {
+        metrics_histogram_observe(&_moveDurationMetric, (uint32_t)((esp_timer_get_time() - _moveStartTime) / 1000));
+        _moveStartTime = 0;
+    }
+}
+
+static void on_lift_event(lift_event_type_t type, const lift_status_t* status, void* userData)
+{
+    if(type == LIFT_EVENT_STATE_CHANGED)
+    {
+        update_move_metrics(status);
+    }
+
+    if(_registrations == NULL)
+    {
+        return;
+    }
+
+    map_iter iter;
+    map_iter_new(_registrations, &iter);
+
+    lift_service_registration_handle_t registrationHandle = 0;
+    on_lift_event_t callback = NULL;
+    do
+    {
+        map_iter_next(iter, (void**)&registrationHandle, (void**)&callback);
+        
+        if(callback != NULL)
+        {
+            callback(type, status);
+        }
+    } while(registrationHandle != 0);
+    
+    map_iter_delete(iter);
+}
+
 static settings_change_err_t on_settings_changed(const settings_t* new, const settings_t* old)
 {
     if(lift_set_speed_limits(_liftHandle, new->lift_min_speed, new->lift_max_speed) != LIFT_OK)
@@ -39,12 +124,21 @@ lift_service_err_t lift_service_init(void)
     }
 
     _settingsChangeHandle = settings_service_register(on_settings_changed);
+    lift_set_event_handler(_liftHandle, on_lift_event, NULL);
+
+    metrics_service_register(&_movesUpMetric.metric);
+    metrics_service_register(&_movesDownMetric.metric);
+    metrics_service_register(&_moveDurationMetric.metric);
+    metrics_service_register(&_positionMetric.metric);
+    metrics_service_register(&_speedMetric.metric);
 
     return LIFT_SERVICE_OK;
 }
 
 void lift_service_free(void)
 {
+    metrics_service_unregister(&_positionMetric.metric);
+    metrics_service_unregister(&_speedMetric.metric);
     settings_service_unregister(_settingsChangeHandle);
     lift_remove_device(_liftHandle);
 }
@@ -52,4 +146,23 @@ void lift_service_free(void)
 lift_device_handle_t lift_service_get_lift_device_handle()
 {
     return _liftHandle;
+}
+
+lift_service_registration_handle_t lift_service_register(on_lift_event_t callback)
+{
+    if(_registrations == NULL)
+    {
+        map_new(&_registrations);
+    }
+
+    lift_service_registration_handle_t handle = _registrationCounter++;
+
+    map_add(_registrations, (void*)handle, callback);
+
+    return handle;
+}
+
+void lift_service_unregister(lift_service_registration_handle_t handle)
+{
+    map_remove(_registrations, (void*)handle);
 }
\ No newline at end of file
@@ -1,8 +1,12 @@
 #ifndef LIFT_SRVICE_H
 #define LIFT_SERVICE_H
 
+#include <stdint.h>
+
 #include <lift/lift.h>
 
+typedef uint32_t lift_service_registration_handle_t;
+
 typedef enum 
 {
     LIFT_SERVICE_OK = 0,
@@ -10,9 +14,14 @@ typedef enum
 
 } lift_service_err_t;
 
+typedef void (*on_lift_event_t)(lift_event_type_t type, const lift_status_t* status);
+
 lift_service_err_t lift_service_init(void);
 void lift_service_free(void);
 
 lift_device_handle_t lift_service_get_lift_device_handle();
 
+lift_service_registration_handle_t  lift_service_register(on_lift_event_t callback);
+void                                lift_service_unregister(lift_service_registration_handle_t handle);
+
 #endif // LIFT_SERVICE_H
\ No newline at end of file
@@ -0,0 +1,262 @@
+#include "metrics_service.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+
+#include <logger.h>
+
+#define MAX_LINE_LENGTH 160
+
+static const char TAG[] = "Metrics Service";
+
+// Metrics of the same family are kept next to each other, so every family is printed as one block
+static metric_t* metrics = NULL;
+static portMUX_TYPE metricsLock = portMUX_INITIALIZER_UNLOCKED;
+
+static bool is_same_family(const metric_t* a, const metric_t* b)
+{
+    return a != NULL && b != NULL && strcmp(a->name, b->name) == 0;
+}
+
+static const char* metric_type_to_str(metric_type_t type)
+{
+    switch (type)
+    {
+    case METRIC_TYPE_COUNTER:
+        return "counter";
+    case METRIC_TYPE_GAUGE:
+        return "gauge";
+    case METRIC_TYPE_HISTOGRAM:
+    default:
+        return "histogram";
+    }
+}
+
+// Prints an integer value divided by a power of 10 scale, without floating point
+static int format_scaled(char* buffer, size_t size, uint64_t value, uint32_t scale)
+{
+    if (scale <= 1)
+    {
+        return snprintf(buffer, size, "%llu", value);
+    }
+
+    int nrOfDecimals = 0;
+    for (uint32_t s = scale; s > 1; s /= 10)
+    {
+        nrOfDecimals++;
+    }
+
+    return snprintf(buffer, size, "%llu.%0*llu", value / scale, nrOfDecimals, value % scale);
+}
+
+static void print_line(metrics_printer_t printer, void* userData, const metric_t* metric, const char* suffix, const char* extraLabel, const char* value)
+{
+    char line[MAX_LINE_LENGTH];
+    const char* labels[] = { metric->labels, metric->extra_labels, extraLabel };
+
+    int length = snprintf(line, sizeof(line), "%s%s", metric->name, suffix);
+    bool hasLabels = false;
+    for (size_t i = 0; i < sizeof(labels) / sizeof(labels[0]); ++i)
+    {
+        if (labels[i] != NULL && length < (int)sizeof(line))
+        {
+            length += snprintf(line + length, sizeof(line) - length, "%c%s", hasLabels ? ',' : '{', labels[i]);
+            hasLabels = true;
+        }
+    }
+
+    if (length < (int)sizeof(line))
+    {
+        length += snprintf(line + length, sizeof(line) - length, "%s %s\n", hasLabels ? "}" : "", value);
+    }
+
+    if (length >= (int)sizeof(line))
+    {
+        LOG_W(TAG, "Metric line of %s does not fit in %d bytes", metric->name, MAX_LINE_LENGTH);
+        return;
+    }
+
+    printer(line, length, userData);
+}
+
+static void print_counter(metrics_printer_t printer, void* userData, const metric_counter_t* counter)
+{
+    uint64_t total = 0;
+    for (size_t core = 0; core < portNUM_PROCESSORS; ++core)
+    {
+        total += __atomic_load_n(&counter->values[core], __ATOMIC_RELAXED);
+    }
+
+    char value[24];
+    snprintf(value, sizeof(value), "%llu", total);
+    print_line(printer, userData, &counter->metric, "", NULL, value);
+}
+
+static void print_gauge(metrics_printer_t printer, void* userData, const metric_gauge_t* gauge)
+{
+    int32_t gaugeValue = gauge->read != NULL ? gauge->read(gauge->user_data) : __atomic_load_n(&gauge->value, __ATOMIC_RELAXED);
+
+    char value[16];
+    snprintf(value, sizeof(value), "%d", gaugeValue);
+    print_line(printer, userData, &gauge->metric, "", NULL, value);
+}
+
+static void print_histogram(metrics_printer_t printer, void* userData, const metric_histogram_t* histogram)
+{
+    char value[24];
+    char le[32];
+    uint64_t cumulative = 0;
+    uint64_t sum = 0;
+
+    for (size_t core = 0; core < portNUM_PROCESSORS; ++core)
+    {
+        sum += __atomic_load_n(&histogram->sums[core], __ATOMIC_RELAXED);
+    }
+
+    // Prometheus buckets are cumulative, the last one is +Inf and holds the total count
+    for (size_t bucket = 0; bucket <= histogram->nr_of_bounds; ++bucket)
+    {
+        for (size_t core = 0; core < portNUM_PROCESSORS; ++core)
+        {
+            cumulative += __atomic_load_n(&histogram->buckets[core][bucket], __ATOMIC_RELAXED);
+        }
+
+        if (bucket < histogram->nr_of_bounds)
+        {
+            int length = snprintf(le, sizeof(le), "le=\"");
+            length += format_scaled(le + length, sizeof(le) - length, histogram->bounds[bucket], histogram->scale);
+            snprintf(le + length, sizeof(le) - length, "\"");
+        }
+        else
+        {
+            snprintf(le, sizeof(le), "le=\"+Inf\"");
+        }
+
+        snprintf(value, sizeof(value), "%llu", cumulative);
+        print_line(printer, userData, &histogram->metric, "_bucket", le, value);
+    }
+
+    format_scaled(value, sizeof(value), sum, histogram->scale);
+    print_line(printer, userData, &histogram->metric, "_sum", NULL, value);
+
+    snprintf(value, sizeof(value), "%llu", cumulative);
+    print_line(printer, userData, &histogram->metric, "_count", NULL, value);
+}
+
+void metrics_service_register(metric_t* metric)
+{
+    if (metric->type == METRIC_TYPE_HISTOGRAM && ((metric_histogram_t*)metric)->nr_of_bounds > METRICS_MAX_BUCKETS)
+    {
+        LOG_E(TAG, "Histogram %s has more then %d buckets", metric->name, METRICS_MAX_BUCKETS);
+        return;
+    }
+
+    portENTER_CRITICAL(&metricsLock);
+
+    // Insert after the last metric of the same family, or at the end
+    metric_t** link = &metrics;
+    metric_t* familyEnd = NULL;
+    bool isRegistered = false;
+    for (metric_t* m = metrics; m != NULL; m = m->next)
+    {
+        isRegistered = isRegistered || m == metric;
+        if (is_same_family(m, metric))
+        {
+            familyEnd = m;
+        }
+        link = &m->next;
+    }
+
+    if (!isRegistered)
+    {
+        if (familyEnd != NULL)
+        {
+            link = &familyEnd->next;
+        }
+
+        // Link the metric in completely before publishing it, printing does not take the lock
+        metric->next = *link;
+        __atomic_store_n(link, metric, __ATOMIC_RELEASE);
+    }
+
+    portEXIT_CRITICAL(&metricsLock);
+}
+
+void metrics_service_unregister(metric_t* metric)
+{
+    portENTER_CRITICAL(&metricsLock);
+
+    for (metric_t** link = &metrics; *link != NULL; link = &(*link)->next)
+    {
+        if (*link == metric)
+        {
+            *link = metric->next;
+            metric->next = NULL;
+            break;
+        }
+    }
+
+    portEXIT_CRITICAL(&metricsLock);
+}
+
+void metrics_service_print(metrics_printer_t printer, void* userData)
+{
+    const metric_t* previous = NULL;
+    for (const metric_t* metric = __atomic_load_n(&metrics, __ATOMIC_ACQUIRE); metric != NULL; metric = __atomic_load_n(&metric->next, __ATOMIC_ACQUIRE))
+    {
+        if (!is_same_family(previous, metric))
+        {
+            char line[MAX_LINE_LENGTH];
+            int length = snprintf(
+                line,
+                sizeof(line),
+                "# HELP %s %s\n# TYPE %s %s\n",
+                metric->name,
+                metric->help,
+                metric->name,
+                metric_type_to_str(metric->type));
+            printer(line, length < (int)sizeof(line) ? length : (int)sizeof(line) - 1, userData);
+        }
+
+        switch (metric->type)
+        {
+        case METRIC_TYPE_COUNTER:
+            print_counter(printer, userData, (const metric_counter_t*)metric);
+            break;
+        case METRIC_TYPE_GAUGE:
+            print_gauge(printer, userData, (const metric_gauge_t*)metric);
+            break;
+        case METRIC_TYPE_HISTOGRAM:
+            print_histogram(printer, userData, (const metric_histogram_t*)metric);
+            break;
+        }
+
+        previous = metric;
+    }
+}
+
+void metrics_counter_add(metric_counter_t* counter, uint32_t value)
+{
+    // A task can be preempted by another task on the same core, so the slot is still updated atomically
+    __atomic_fetch_add(&counter->values[xPortGetCoreID()], value, __ATOMIC_RELAXED);
+}
+
+void metrics_gauge_set(metric_gauge_t* gauge, int32_t value)
+{
+    __atomic_store_n(&gauge->value, value, __ATOMIC_RELAXED);
+}
+
+void metrics_histogram_observe(metric_histogram_t* histogram, uint32_t value)
+{
+    size_t bucket = 0;
+    while (bucket < histogram->nr_of_bounds && value > histogram->bounds[bucket])
+    {
+        bucket++;
+    }
+
+    BaseType_t core = xPortGetCoreID();
+    __atomic_fetch_add(&histogram->buckets[core][bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->sums[core], value, __ATOMIC_RELAXED);
+}
\ No newline at end of file
@@ -0,0 +1,124 @@
+#ifndef METRICS_SERVICE_H
+#define METRICS_SERVICE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <freertos/FreeRTOS.h>
+
+// Histograms can have at most this many buckets, not counting the +Inf bucket
+#define METRICS_MAX_BUCKETS 10
+
+typedef enum metric_type_e
+{
+    METRIC_TYPE_COUNTER,
+    METRIC_TYPE_GAUGE,
+    METRIC_TYPE_HISTOGRAM
+} metric_type_t;
+
+/**
+ * @brief Called to print the metrics, the text is not null terminated.
+ */
+typedef void (*metrics_printer_t)(const char* text, size_t length, void* userData);
+
+/**
+ * @brief Reads the current value of a gauge when the metrics are printed.
+ */
+typedef int32_t (*metric_gauge_reader_t)(void* userData);
+
+/**
+ * @brief Common part of every metric. Metrics with the same name form one family,
+ * they must have the same type and help and are told apart by their labels.
+ * Metrics are meant to be static, see the METRIC_ macros.
+ */
+typedef struct metric_s
+{
+    const char*      name;
+    const char*      help;
+    metric_type_t    type;
+    // Optional, comma separated prometheus labels like route="/api/lift" and code="2xx"
+    const char*      labels;
+    const char*      extra_labels;
+    struct metric_s* next;
+} metric_t;
+
+/**
+ * @brief A value that only goes up. Every core counts in its own slot, so updates never contend.
+ * The value is 32 bit and wraps, which prometheus treats like a counter reset.
+ */
+typedef struct metric_counter_s
+{
+    metric_t metric;
+    uint32_t values[portNUM_PROCESSORS];
+} metric_counter_t;
+
+/**
+ * @brief A value that goes up and down, either set directly or read when the metrics are printed.
+ */
+typedef struct metric_gauge_s
+{
+    metric_t              metric;
+    int32_t               value;
+    metric_gauge_reader_t read;
+    void*                 user_data;
+} metric_gauge_t;
+
+/**
+ * @brief Counts observations in fixed buckets. Every core counts in its own buckets, so updates never contend.
+ * Values are observed in integer units and divided by scale when printed,
+ * so microseconds with a scale of 1000000 are printed as seconds. Scale must be a power of 10.
+ */
+typedef struct metric_histogram_s
+{
+    metric_t        metric;
+    const uint32_t* bounds;
+    size_t          nr_of_bounds;
+    uint32_t        scale;
+    uint32_t        buckets[portNUM_PROCESSORS][METRICS_MAX_BUCKETS + 1];
+    uint32_t        sums[portNUM_PROCESSORS];
+} metric_histogram_t;
+
+#define METRIC_COUNTER(metricName, metricHelp, metricLabels) \
+    { .metric = { .name = metricName, .help = metricHelp, .type = METRIC_TYPE_COUNTER, .labels = metricLabels } }
+
+#define METRIC_GAUGE(metricName, metricHelp, metricLabels, reader, userData) \
+    { .metric = { .name = metricName, .help = metricHelp, .type = METRIC_TYPE_GAUGE, .labels = metricLabels }, .read = reader, .user_data = userData }
+
+#define METRIC_HISTOGRAM(metricName, metricHelp, metricLabels, histogramBounds, histogramScale) \
+    { .metric = { .name = metricName, .help = metricHelp, .type = METRIC_TYPE_HISTOGRAM, .labels = metricLabels }, \
+      .bounds = histogramBounds, .nr_of_bounds = sizeof(histogramBounds) / sizeof(histogramBounds[0]), .scale = histogramScale }
+
+/**
+ * @brief Adds a metric to the registry, it is printed from then on.
+ * Registering a metric that is already registered does nothing.
+ *
+ * @param[in] metric The metric to add, must stay valid until it is unregistered.
+ */
+void metrics_service_register(metric_t* metric);
+
+/**
+ * @brief Removes a metric from the registry. Must not be called while the metrics are printed.
+ *
+ * @param[in] metric The metric to remove.
+ */
+void metrics_service_unregister(metric_t* metric);
+
+/**
+ * @brief Prints all registered metrics in the prometheus text format.
+ *
+ * @param[in] printer Called with consecutive pieces of the text, at most a line at a time.
+ * @param[in] userData Passed to the printer.
+ */
+void metrics_service_print(metrics_printer_t printer, void* userData);
+
+void metrics_counter_add(metric_counter_t* counter, uint32_t value);
+void metrics_gauge_set(metric_gauge_t* gauge, int32_t value);
+void metrics_histogram_observe(metric_histogram_t* histogram, uint32_t value);
+
+static inline void metrics_counter_inc(metric_counter_t* counter)
+{
+    metrics_counter_add(counter, 1);
+}
+
+#endif // METRICS_SERVICE_H
\ No newline at end of file
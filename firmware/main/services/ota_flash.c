@@ -0,0 +1,97 @@
+#include "ota_flash.h"
+
+#include <esp_timer.h>
+
+static void add_time(int64_t* time, int64_t start)
+{
+    *time += esp_timer_get_time() - start;
+}
+
+const esp_partition_t* ota_flash_get_boot_partition(void)
+{
+    return esp_ota_get_boot_partition();
+}
+
+const esp_partition_t* ota_flash_get_running_partition(void)
+{
+    return esp_ota_get_running_partition();
+}
+
+const esp_partition_t* ota_flash_get_next_update_partition(void)
+{
+    return esp_ota_get_next_update_partition(NULL);
+}
+
+const esp_partition_t* ota_flash_find_spiffs_partition(const char* label)
+{
+    return esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, label);
+}
+
+const esp_app_desc_t* ota_flash_get_app_description(void)
+{
+    return esp_ota_get_app_description();
+}
+
+esp_err_t ota_flash_erase(const esp_partition_t* partition, size_t offset, size_t length, ota_flash_timing_t* timing)
+{
+    const int64_t start = esp_timer_get_time();
+    esp_err_t err = esp_partition_erase_range(partition, offset, length);
+    if (timing)
+    {
+        add_time(&timing->erase_time, start);
+    }
+
+    return err;
+}
+
+esp_err_t ota_flash_write(const esp_partition_t* partition, size_t offset, const void* data, size_t length, ota_flash_timing_t* timing)
+{
+    const int64_t start = esp_timer_get_time();
+    esp_err_t err = esp_partition_write(partition, offset, data, length);
+    if (timing)
+    {
+        add_time(&timing->write_time, start);
+    }
+
+    return err;
+}
+
+esp_err_t ota_flash_read(const esp_partition_t* partition, size_t offset, void* data, size_t length)
+{
+    return esp_partition_read(partition, offset, data, length);
+}
+
+esp_err_t ota_flash_app_begin(const esp_partition_t* partition, size_t imageLength, esp_ota_handle_t* appHandle, ota_flash_timing_t* timing)
+{
+    // Most of the time of esp_ota_begin goes to erasing the sectors of the image
+    const int64_t start = esp_timer_get_time();
+    esp_err_t err = esp_ota_begin(partition, imageLength, appHandle);
+    if (timing)
+    {
+        add_time(&timing->erase_time, start);
+    }
+
+    return err;
+}
+
+esp_err_t ota_flash_app_write(esp_ota_handle_t appHandle, const void* data, size_t length, ota_flash_timing_t* timing)
+{
+    const int64_t start = esp_timer_get_time();
+    esp_err_t err = esp_ota_write(appHandle, data, length);
+    if (timing)
+    {
+        add_time(&timing->write_time, start);
+    }
+
+    return err;
+}
+
+esp_err_t ota_flash_app_end(esp_ota_handle_t appHandle)
+{
+    return esp_ota_end(appHandle);
+}
+
+esp_err_t ota_flash_set_boot_partition(const esp_partition_t* partition)
+{
+    return esp_ota_set_boot_partition(partition);
+}
\ No newline at end of file
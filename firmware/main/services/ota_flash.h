@@ -0,0 +1,90 @@
+#ifndef OTA_FLASH_H
+#define OTA_FLASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <esp_err.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+
+// Everything the ota service does to flash and partitions goes through these functions. The host build in firmware/test
+// links the ota service against an in-memory implementation of them instead, so updates can be tested off the board.
+
+/**
+ * @brief Time spent erasing and writing flash, in microseconds. Optional for every function that takes it.
+ */
+typedef struct ota_flash_timing_s
+{
+    int64_t erase_time;
+    int64_t write_time;
+} ota_flash_timing_t;
+
+/**
+ * @brief Gets the app partition the bootloader is configured to start.
+ */
+const esp_partition_t* ota_flash_get_boot_partition(void);
+
+/**
+ * @brief Gets the app partition that is running.
+ */
+const esp_partition_t* ota_flash_get_running_partition(void);
+
+/**
+ * @brief Gets the app partition the next update is written to, or NULL if there is none.
+ */
+const esp_partition_t* ota_flash_get_next_update_partition(void);
+
+/**
+ * @brief Finds a spiffs data partition by its label, or NULL if there is none.
+ */
+const esp_partition_t* ota_flash_find_spiffs_partition(const char* label);
+
+/**
+ * @brief Gets the description of the running app.
+ */
+const esp_app_desc_t* ota_flash_get_app_description(void);
+
+/**
+ * @brief Erases a range of a partition, the offset and length must be whole sectors.
+ */
+esp_err_t ota_flash_erase(const esp_partition_t* partition, size_t offset, size_t length, ota_flash_timing_t* timing);
+
+/**
+ * @brief Writes to an erased range of a partition.
+ */
+esp_err_t ota_flash_write(const esp_partition_t* partition, size_t offset, const void* data, size_t length, ota_flash_timing_t* timing);
+
+/**
+ * @brief Reads from a partition.
+ */
+esp_err_t ota_flash_read(const esp_partition_t* partition, size_t offset, void* data, size_t length);
+
+/**
+ * @brief Begins writing an app image to an app partition, which erases the sectors the image needs.
+ *
+ * @param[in] partition The app partition to write.
+ * @param[in] imageLength Length of the image in bytes.
+ * @param[out] appHandle Handle for writing the image.
+ * @param[in,out] timing The time spent erasing is added to it, may be NULL.
+ *
+ * @return esp_err_t The result of esp_ota_begin.
+ */
+esp_err_t ota_flash_app_begin(const esp_partition_t* partition, size_t imageLength, esp_ota_handle_t* appHandle, ota_flash_timing_t* timing);
+
+/**
+ * @brief Writes the next part of an app image.
+ */
+esp_err_t ota_flash_app_write(esp_ota_handle_t appHandle, const void* data, size_t length, ota_flash_timing_t* timing);
+
+/**
+ * @brief Ends writing an app image, which validates it. Also releases the handle of an incomplete image.
+ */
+esp_err_t ota_flash_app_end(esp_ota_handle_t appHandle);
+
+/**
+ * @brief Makes the system boot the app partition on the next restart.
+ */
+esp_err_t ota_flash_set_boot_partition(const esp_partition_t* partition);
+
+#endif // OTA_FLASH_H
\ No newline at end of file
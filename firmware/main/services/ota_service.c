@@ -2,13 +2,23 @@
 
 #include <string.h>
 #include <assert.h>
+#include <inttypes.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
 
 #include <esp_err.h>
-#include <esp_ota_ops.h>
-#include <esp_flash_partitions.h>
-#include <esp_partition.h>
+#include <esp_timer.h>
+#include <esp32/rom/miniz.h>
+#include <mbedtls/sha256.h>
+#include <mbedtls/pk.h>
 
+#include <services/metrics_service.h>
+#include <services/ota_flash.h>
 #include <services/spiffs_service.h>
+#include <shared.h>
 #include <logger.h>
 
 static const char TAG[] = "Ota Service";
@@ -16,15 +26,159 @@ static const char TAG[] = "Ota Service";
 static inline int max ( int a, int b ) { return a > b ? a : b; }
 static inline int min ( int a, int b ) { return a < b ? a : b; }
 
-typedef enum ota_progress_state_e
+// Compressed updates start with this header, followed by a raw deflate stream of the plain update
+#define OTA_COMPRESSED_MAGIC 0x5A4F5754  // "TWOZ"
+#define OTA_MIN_WINDOW_BITS  9
+#define OTA_MAX_WINDOW_BITS  15
+
+typedef enum ota_encoding_e
+{
+    // Not enough bytes received yet to tell
+    OTA_ENCODING_UNKNOWN,
+    OTA_ENCODING_PLAIN,
+    OTA_ENCODING_DEFLATE
+} ota_encoding_t;
+
+typedef struct ota_compressed_header_s
+{
+    uint32_t magic;
+    uint32_t size;
+    uint8_t  window_bits;
+    uint8_t  reserved[3];
+} ota_compressed_header_t;
+
+static_assert(sizeof(ota_compressed_header_t) == 12, "ota_compressed_header_s is not packed");
+
+// Inflates into a circular window, the compressor limits back references to the window size.
+// Output is processed straight from the window, so nothing is copied.
+typedef struct ota_inflater_s
+{
+    tinfl_decompressor decompressor;
+    size_t             window_offset;
+    size_t             window_size;
+    bool               done;
+    uint8_t            window[];
+} ota_inflater_t;
+
+// Updates are packages: a manifest that describes the sections, followed by the sections in manifest order
+#define OTA_PACKAGE_MAGIC       0x504F5754  // "TWOP"
+#define OTA_PACKAGE_VERSION     1
+#define OTA_MAX_MANIFEST_LENGTH 8192
+
+typedef enum ota_section_type_e
+{
+    OTA_SECTION_TYPE_SPIFFS = 1,
+    OTA_SECTION_TYPE_APP = 2,
+    // A patch that turns the running app image into the new one
+    OTA_SECTION_TYPE_APP_DELTA = 3,
+    // An ECDSA signature over the manifest, its hash in the manifest is not used
+    OTA_SECTION_TYPE_SIGNATURE = 4
+} ota_section_type_t;
+
+// The rest of the partition after the section must read as erased flash, which a spiffs image relies on.
+// The packager strips the erased tail of such images, so only the bytes that are present are sent.
+#define OTA_SECTION_FLAG_BLANK_REST 0x01
+// The manifest has a hash of every 4 KB sector of the section, padded with erased flash to a whole sector.
+// Sectors whose flash already has that hash are neither erased nor written.
+#define OTA_SECTION_FLAG_SECTOR_HASHES 0x02
+
+// Sector hashes are truncated SHA-256 hashes, they only tell changed sectors apart
+#define OTA_SECTOR_HASH_LENGTH 16
+
+// Runs of changed sectors are erased at most this many bytes at a time, so the flash can erase whole blocks
+#define OTA_ERASE_BLOCK_SIZE 0x10000
+
+// Base image bytes are read and patched this many bytes at a time
+#define OTA_DELTA_BUFFER_SIZE 1024
+
+// A DER encoded ECDSA P-256 signature is at most this long
+#define OTA_MAX_SIGNATURE_LENGTH 72
+
+// The update is recieved into buffers of one sector, which the writer task decodes and writes to flash.
+// While the writer task is busy with one buffer, the next one is filled from the network.
+// The host tests build with smaller buffers as well, so the decoder gets its data cut at other places in the package.
+#ifndef OTA_BUFFER_SIZE
+#define OTA_BUFFER_SIZE         SPI_FLASH_SEC_SIZE
+#endif
+#define OTA_NR_OF_BUFFERS       2
+#define OTA_NO_BUFFER           0xFF
+
+#define OTA_WRITER_TASK_TAG         "OtaWriter"
+#define OTA_WRITER_STACK_SIZE_KB    4
+
+// Progress is reported at most this often, besides changes of state and the end of the update
+#define OTA_PROGRESS_REPORT_INTERVAL_US 500000
+
+typedef struct ota_package_header_s
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t nr_of_sections;
+    // Length of the header and everything that follows it up to the first section
+    uint32_t manifest_length;
+} ota_package_header_t;
+
+typedef struct ota_section_s
+{
+    uint8_t  type;
+    uint8_t  flags;
+    // Offset of extra information in the manifest: the sector hashes of a spiffs section, or the delta info of an app delta section
+    uint16_t info_offset;
+    uint32_t length;
+    uint8_t  sha256[32];
+} ota_section_t;
+
+// Describes the image an app delta section applies to, and the image it produces
+typedef struct ota_delta_info_s
 {
-    OTA_PROGRESS_SPIFFS,
-    OTA_PROGRESS_APP_HEADER,
-    OTA_PROGRESS_APP_DATA,
+    // The app_elf_sha256 of the app description of the base image
+    uint8_t  base_elf_sha256[32];
+    uint32_t base_length;
+    uint32_t target_length;
+} ota_delta_info_t;
 
-    OTA_PROGRESS_OTA_FAILED
-} ota_progress_state_t;
+// The patch is a list of commands, every command is followed by its diff bytes and its extra bytes.
+// Diff bytes are added to the base image bytes at the base offset, extra bytes are copied as they are.
+// After both the base offset moves by seek, which can be negative.
+typedef struct ota_delta_command_s
+{
+    uint32_t diff_length;
+    uint32_t extra_length;
+    int32_t  seek;
+} ota_delta_command_t;
+
+static_assert(sizeof(ota_package_header_t) == 12, "ota_package_header_s is not packed");
+static_assert(sizeof(ota_section_t) == 40, "ota_section_s is not packed");
+static_assert(sizeof(ota_delta_info_t) == 40, "ota_delta_info_s is not packed");
+static_assert(sizeof(ota_delta_command_t) == 12, "ota_delta_command_s is not packed");
+
+typedef struct ota_delta_s
+{
+    ota_delta_info_t    info;
+    const esp_partition_t* base_partition;
+    size_t              base_offset;
+    size_t              nr_of_target_bytes_remaining;
+    ota_delta_command_t command;
+    size_t              command_length;
+    uint8_t             buffer[OTA_DELTA_BUFFER_SIZE];
+} ota_delta_t;
 
+typedef enum ota_writer_message_type_e
+{
+    // A buffer of update data to decode and write
+    OTA_WRITER_MESSAGE_DATA,
+    // All data was sent, the writer finishes the update
+    OTA_WRITER_MESSAGE_END,
+    // The update is no longer used, the writer abandons it if it did not finish, frees it and stops
+    OTA_WRITER_MESSAGE_CLOSE
+} ota_writer_message_type_t;
+
+typedef struct ota_writer_message_s
+{
+    ota_writer_message_type_t type;
+    uint8_t buffer;
+    size_t length;
+} ota_writer_message_t;
 
 typedef struct app_header_s
 {
@@ -33,24 +187,93 @@ typedef struct app_header_s
     esp_app_desc_t app_desc;  
 } app_header_t;
 
+static metric_counter_t bytesMetric = METRIC_COUNTER("tvlift_ota_bytes_total", "Number of firmware update bytes written.", NULL);
+static metric_counter_t updatesOkMetric = METRIC_COUNTER("tvlift_ota_updates_total", "Number of firmware updates.", "result=\"ok\"");
+static metric_counter_t updatesFailedMetric = METRIC_COUNTER("tvlift_ota_updates_total", "Number of firmware updates.", "result=\"failed\"");
+static metric_counter_t sectorsSkippedMetric = METRIC_COUNTER("tvlift_ota_spiffs_sectors_total", "Number of spiffs sectors in firmware updates.", "result=\"skipped\"");
+static metric_counter_t sectorsWrittenMetric = METRIC_COUNTER("tvlift_ota_spiffs_sectors_total", "Number of spiffs sectors in firmware updates.", "result=\"written\"");
+static metric_gauge_t throughputMetric = METRIC_GAUGE("tvlift_ota_throughput_bytes_per_second", "Average throughput of the last firmware update.", NULL, NULL, NULL);
+static metric_gauge_t writerThroughputMetric = METRIC_GAUGE("tvlift_ota_writer_throughput_bytes_per_second", "Throughput of the writer task of the last firmware update while it was busy, the most the flash could take.", NULL, NULL, NULL);
+static metric_counter_t stallsMetric = METRIC_COUNTER("tvlift_ota_buffer_stalls_total", "Number of times firmware update data had to wait for the writer task to free a buffer.", NULL);
+
+// Updates write the same partitions, uploads and pulled updates can not run at the same time
+static bool updateInProgress = false;
+
+static portMUX_TYPE progressLock = portMUX_INITIALIZER_UNLOCKED;
+static ota_service_progress_t lastProgress = { .running = false, .state = OTA_PROGRESS_MANIFEST, .result = OTA_SERVICE_OK };
+static ota_service_progress_listener_t progressListener = NULL;
+
 static_assert(sizeof(app_header_t) == (sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)), "app_header_s is not packed");
 
 struct ota_state_s
 {
     // Progress
+    size_t nr_of_bytes_received;
     size_t nr_of_bytes_processed;
     ota_progress_state_t progress;
+    int64_t start_time;
+
+    // Pipeline, the fill buffer is used by the task that writes the update, the rest of the state by the writer task
+    char* buffers;
+    QueueHandle_t free_buffers;
+    QueueHandle_t writer_queue;
+    SemaphoreHandle_t done_semaphore;
+    uint8_t fill_buffer;
+    size_t fill_length;
+    bool end_sent;
+    ota_service_notify_t notify;
+    void* notify_user_data;
+    // Written by the writer task, read by the task that writes the update
+    ota_service_err_t result;
+    bool done;
+    size_t nr_of_stalls;
+    int64_t writer_busy_time;
+
+    // Progress reports, only used by the writer task
+    size_t nr_of_bytes_total;
+    ota_flash_timing_t flash_timing;
+    int64_t report_time;
+    size_t report_bytes;
+    ota_progress_state_t report_state;
+
+    // Flash writes are collected into whole sectors
+    uint8_t* flash_buffer;
+    size_t flash_buffer_length;
+
+    // Encoding
+    ota_encoding_t encoding;
+    ota_compressed_header_t compressed_header;
+    size_t compressed_header_length;
+    ota_inflater_t* inflater;
 
     // Data
     const char* data;
     size_t length;
 
+    // Package
+    ota_package_header_t package_header;
+    uint8_t* manifest;
+    const ota_section_t* sections;
+    size_t section_index;
+    size_t nr_of_section_bytes_processed;
+    // Every section is hashed as it is processed and checked against the manifest at its end
+    mbedtls_sha256_context section_hash;
+    uint8_t manifest_hash[32];
+    uint8_t signature[OTA_MAX_SIGNATURE_LENGTH];
+
     // SPIFFS
     const esp_partition_t* spiffs_update_partition;
+    size_t nr_of_spiffs_bytes_erased;
+    // One bit per sector of the section, set for sectors that already hold the right bytes
+    uint32_t* spiffs_unchanged_sectors;
 
     // App
+    size_t app_image_length;
+    size_t nr_of_app_bytes_written;
+    ota_delta_t* delta;
     app_header_t app_header;
     esp_ota_handle_t app_update_handle;
+    bool app_update_begun;
     const esp_partition_t* app_update_partition;
 };
 
@@ -61,16 +284,53 @@ static const char * read_handle_data(ota_state_handle_t handle, size_t length)
     handle->data += length;
     handle->length -= length;
     handle->nr_of_bytes_processed += length;
+    metrics_counter_add(&bytesMetric, length);
 
-    LOG_V(TAG, "Firmware update processed %i bytes", handle->nr_of_bytes_processed);
+    if (handle->progress != OTA_PROGRESS_MANIFEST)
+    {
+        mbedtls_sha256_update_ret(&handle->section_hash, (const unsigned char*)data, length);
+    }
+
+    LOG_V(TAG, "Firmware update processed %zu bytes", handle->nr_of_bytes_processed);
 
     return data;
 }
 
+static const ota_section_t* current_section(ota_state_handle_t handle)
+{
+    return &handle->sections[handle->section_index];
+}
+
+static size_t nr_of_sectors(size_t length)
+{
+    return (length + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE;
+}
+
+static bool is_sector_unchanged(ota_state_handle_t handle, size_t sector)
+{
+    return handle->spiffs_unchanged_sectors != NULL && (handle->spiffs_unchanged_sectors[sector / 32] & (1u << (sector % 32))) != 0;
+}
+
+// A section is checked when its last byte was processed, so a corrupt section is rejected before the next one is written
+static ota_service_err_t ota_service_verify_section(ota_state_handle_t handle)
+{
+    uint8_t hash[32];
+
+    mbedtls_sha256_finish_ret(&handle->section_hash, hash);
+    if (memcmp(hash, current_section(handle)->sha256, sizeof(hash)) != 0)
+    {
+        LOG_E(TAG, "Section %zu does not match its hash in the manifest", handle->section_index);
+        handle->progress = OTA_PROGRESS_OTA_FAILED;
+        return OTA_SERVICE_ERR_CORRUPT;
+    }
+
+    return OTA_SERVICE_OK;
+}
+
 static ota_service_err_t ota_service_app_update_begin(ota_state_handle_t handle)
 {
-    const esp_partition_t* configured = esp_ota_get_boot_partition();
-    const esp_partition_t* running = esp_ota_get_running_partition();
+    const esp_partition_t* configured = ota_flash_get_boot_partition();
+    const esp_partition_t* running = ota_flash_get_running_partition();
 
     if (configured != running) 
     {
@@ -78,7 +338,7 @@ static ota_service_err_t ota_service_app_update_begin(ota_state_handle_t handle)
         LOG_W(TAG, "(This can happen if either the OTA boot data or preferred boot image become corrupted somehow)");
     }
 
-    handle->app_update_partition = esp_ota_get_next_update_partition(NULL);
+    handle->app_update_partition = ota_flash_get_next_update_partition();
     if(handle->app_update_partition == NULL)
     {
         LOG_E(TAG, "No valid ota partition found");
@@ -93,11 +353,9 @@ static ota_service_err_t ota_service_app_update_begin(ota_state_handle_t handle)
 
 static ota_service_err_t ota_service_spiffs_update_begin(ota_state_handle_t handle)
 {
-    esp_err_t err;
-
     const char* spiffsLabel = spiffs_service_get_spiffs_partition_label_for_app_partition(handle->app_update_partition->label);
 
-    handle->spiffs_update_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, spiffsLabel);
+    handle->spiffs_update_partition = ota_flash_find_spiffs_partition(spiffsLabel);
     if(handle->spiffs_update_partition == NULL)
     {
         LOG_E(TAG, "No valid spiffs partition found");
@@ -107,7 +365,15 @@ static ota_service_err_t ota_service_spiffs_update_begin(ota_state_handle_t hand
 
     LOG_I(TAG, "Flashing spiffs partition %s", handle->spiffs_update_partition->label);
 
-    err = esp_partition_erase_range(handle->spiffs_update_partition, 0, handle->spiffs_update_partition->size);
+    // Sectors are erased as the section is written, so only the sectors that are present are erased
+    handle->nr_of_spiffs_bytes_erased = 0;
+
+    return OTA_SERVICE_OK;
+}
+
+static ota_service_err_t ota_service_spiffs_erase(ota_state_handle_t handle, size_t offset, size_t length)
+{
+    esp_err_t err = ota_flash_erase(handle->spiffs_update_partition, offset, length, &handle->flash_timing);
     if (err != ESP_OK) 
     {
         LOG_E(TAG, "esp_partition_erase_range failed (%s)", esp_err_to_name(err));
@@ -118,179 +384,1490 @@ static ota_service_err_t ota_service_spiffs_update_begin(ota_state_handle_t hand
     return OTA_SERVICE_OK;
 }
 
-static ota_service_err_t ota_service_spiffs_update_write(ota_state_handle_t handle)
+static bool is_blank(const esp_partition_t* partition, size_t offset, size_t length)
 {
-    esp_err_t err;
+    uint32_t buffer[64];
+
+    while (length > 0)
+    {
+        const size_t nrOfBytesToRead = min(length, sizeof(buffer));
+        if (ota_flash_read(partition, offset, buffer, nrOfBytesToRead) != ESP_OK)
+        {
+            // Erasing is always safe
+            return false;
+        }
+
+        for (size_t i = 0; i < nrOfBytesToRead / sizeof(buffer[0]); ++i)
+        {
+            if (buffer[i] != 0xFFFFFFFF)
+            {
+                return false;
+            }
+        }
 
-    const size_t nrOfSpiffsBytesProcessed = handle->nr_of_bytes_processed;
-    const size_t nrOfSpiffsBytesRemaining = handle->spiffs_update_partition->size - nrOfSpiffsBytesProcessed;
-    const size_t nrOfSpiffsBytesToWrite = min(handle->length, nrOfSpiffsBytesRemaining);
+        offset += nrOfBytesToRead;
+        length -= nrOfBytesToRead;
+    }
 
-    err = esp_partition_write(handle->spiffs_update_partition, nrOfSpiffsBytesProcessed, (const void *)read_handle_data(handle, nrOfSpiffsBytesToWrite), nrOfSpiffsBytesToWrite);
-    if (err != ESP_OK) 
+    return true;
+}
+
+static bool hash_sector(const esp_partition_t* partition, size_t offset, uint8_t hash[32])
+{
+    uint32_t buffer[64];
+    mbedtls_sha256_context context;
+    bool ok = true;
+
+    mbedtls_sha256_init(&context);
+    mbedtls_sha256_starts_ret(&context, 0);
+
+    for (size_t length = 0; ok && length < SPI_FLASH_SEC_SIZE; length += sizeof(buffer))
     {
-        LOG_E(TAG, "esp_partition_write failed (%s)", esp_err_to_name(err));
-        handle->progress = OTA_PROGRESS_OTA_FAILED;
-        return OTA_SERVICE_FAIL;
+        ok = ota_flash_read(partition, offset + length, buffer, sizeof(buffer)) == ESP_OK
+            && mbedtls_sha256_update_ret(&context, (const unsigned char*)buffer, sizeof(buffer)) == 0;
     }
 
-    if(handle->nr_of_bytes_processed == handle->spiffs_update_partition->size)
+    ok = ok && mbedtls_sha256_finish_ret(&context, hash) == 0;
+    mbedtls_sha256_free(&context);
+
+    return ok;
+}
+
+// Reading flash is a lot faster then erasing and writing it, so the sectors of the section are compared with flash before anything is written.
+// Most updates change only a few assets, which leaves most sectors of the partition as they are.
+static void ota_service_spiffs_compare_sectors(ota_state_handle_t handle)
+{
+    const ota_section_t* section = current_section(handle);
+    const uint8_t* sectorHashes = handle->manifest + section->info_offset;
+    const size_t nrOfSectors = nr_of_sectors(section->length);
+    size_t nrOfUnchangedSectors = 0;
+
+    handle->spiffs_unchanged_sectors = (uint32_t*)calloc((nrOfSectors + 31) / 32, sizeof(uint32_t));
+    if (handle->spiffs_unchanged_sectors == NULL)
     {
-        // All spiffs bytes received
-        LOG_I(TAG, "OTA_PROGRESS_APP_HEADER");
-        handle->progress = OTA_PROGRESS_APP_HEADER;
+        LOG_W(TAG, "Can not allocate memory to compare spiffs sectors, writing all of them");
+        return;
     }
 
-    return OTA_SERVICE_OK; 
+    for (size_t sector = 0; sector < nrOfSectors; ++sector)
+    {
+        uint8_t hash[32];
+        if (hash_sector(handle->spiffs_update_partition, sector * SPI_FLASH_SEC_SIZE, hash)
+            && memcmp(hash, sectorHashes + sector * OTA_SECTOR_HASH_LENGTH, OTA_SECTOR_HASH_LENGTH) == 0)
+        {
+            handle->spiffs_unchanged_sectors[sector / 32] |= 1u << (sector % 32);
+            nrOfUnchangedSectors++;
+        }
+    }
+
+    metrics_counter_add(&sectorsSkippedMetric, nrOfUnchangedSectors);
+    LOG_I(TAG, "%zu of %zu spiffs sectors are unchanged and skipped", nrOfUnchangedSectors, nrOfSectors);
 }
 
-static ota_service_err_t ota_service_app_update_write_header(ota_state_handle_t handle)
+// Erases the run of changed sectors that starts at sector, up to the end of its erase block
+static ota_service_err_t ota_service_spiffs_erase_changed(ota_state_handle_t handle, size_t sector)
 {
-    esp_err_t err;
-    
-    const size_t nrOfAppBytesProcessed = handle->nr_of_bytes_processed - handle->spiffs_update_partition->size;
-    const size_t nrOfHeaderBytesRemaining = sizeof(handle->app_header) - nrOfAppBytesProcessed;
-    const size_t nrOfHeaderBytesToWrite = min(handle->length, nrOfHeaderBytesRemaining);
+    const size_t sectorsPerBlock = OTA_ERASE_BLOCK_SIZE / SPI_FLASH_SEC_SIZE;
+    const size_t blockEnd = min((sector / sectorsPerBlock + 1) * sectorsPerBlock, nr_of_sectors(current_section(handle)->length));
 
-    memcpy(&handle->app_header + nrOfAppBytesProcessed, read_handle_data(handle, nrOfHeaderBytesToWrite), nrOfHeaderBytesToWrite);
+    size_t end = sector + 1;
+    while (end < blockEnd && !is_sector_unchanged(handle, end))
+    {
+        end++;
+    }
 
-    if(handle->nr_of_bytes_processed - handle->spiffs_update_partition->size == sizeof(handle->app_header))
+    if (ota_service_spiffs_erase(handle, sector * SPI_FLASH_SEC_SIZE, (end - sector) * SPI_FLASH_SEC_SIZE) != OTA_SERVICE_OK)
     {
-        // All header bytes received, read header and begin update
-        LOG_I(TAG, "Read header");
-        LOG_I(TAG, "New firmware version: %s", handle->app_header.app_desc.version);
+        return OTA_SERVICE_FAIL;
+    }
 
-        // Begin OTA
-        err = esp_ota_begin(handle->app_update_partition, OTA_SIZE_UNKNOWN, &handle->app_update_handle);
-        if (err != ESP_OK) 
+    metrics_counter_add(&sectorsWrittenMetric, end - sector);
+    handle->nr_of_spiffs_bytes_erased = end * SPI_FLASH_SEC_SIZE;
+    return OTA_SERVICE_OK;
+}
+
+// Reading flash is a lot faster then erasing it, so only the sectors after the image that are not blank yet are erased
+static ota_service_err_t ota_service_spiffs_blank_rest(ota_state_handle_t handle)
+{
+    const esp_partition_t* partition = handle->spiffs_update_partition;
+    const size_t restStart = nr_of_sectors(current_section(handle)->length) * SPI_FLASH_SEC_SIZE;
+    size_t nrOfSectorsErased = 0;
+    size_t eraseStart = restStart;
+
+    for (size_t offset = restStart; offset < partition->size; offset += SPI_FLASH_SEC_SIZE)
+    {
+        if (!is_blank(partition, offset, SPI_FLASH_SEC_SIZE))
         {
-            LOG_E(TAG, "esp_ota_begin failed (%s)", esp_err_to_name(err));
-            handle->progress = OTA_PROGRESS_OTA_FAILED;
-            return OTA_SERVICE_FAIL;
+            nrOfSectorsErased++;
+            continue;
         }
 
-        // Write the header OTA
-        err = esp_ota_write(handle->app_update_handle, (const void *)&handle->app_header, sizeof(handle->app_header));
-        if (err != ESP_OK) 
+        // Erase runs of sectors at once, so larger blocks can be erased
+        if (offset > eraseStart && ota_service_spiffs_erase(handle, eraseStart, offset - eraseStart) != OTA_SERVICE_OK)
         {
-            LOG_E(TAG, "esp_ota_write failed (%s)", esp_err_to_name(err));
-            handle->progress = OTA_PROGRESS_OTA_FAILED;
             return OTA_SERVICE_FAIL;
         }
+        eraseStart = offset + SPI_FLASH_SEC_SIZE;
+    }
 
-        LOG_I(TAG, "OTA_PROGRESS_APP_DATA");
-        handle->progress = OTA_PROGRESS_APP_DATA;
+    if (partition->size > eraseStart && ota_service_spiffs_erase(handle, eraseStart, partition->size - eraseStart) != OTA_SERVICE_OK)
+    {
+        return OTA_SERVICE_FAIL;
     }
 
+    LOG_I(
+        TAG,
+        "Erased %zu of %zu sectors after the spiffs image",
+        nrOfSectorsErased,
+        (partition->size - restStart) / SPI_FLASH_SEC_SIZE);
+
     return OTA_SERVICE_OK;
 }
 
-static ota_service_err_t ota_service_app_update_write_data(ota_state_handle_t handle)
+static ota_service_err_t ota_service_app_delta_begin(ota_state_handle_t handle)
 {
-    esp_err_t err;
-
-    const size_t nrOfAppBytesToWrite = handle->length;
-
-    err = esp_ota_write(handle->app_update_handle, (const void *)read_handle_data(handle, nrOfAppBytesToWrite), nrOfAppBytesToWrite);
-    if (err != ESP_OK) 
+    handle->delta = (ota_delta_t*)malloc(sizeof(*handle->delta));
+    if (handle->delta == NULL)
     {
-        LOG_E(TAG, "esp_ota_write failed (%s)", esp_err_to_name(err));
+        LOG_E(TAG, "Can not allocate memory to apply an app delta");
         handle->progress = OTA_PROGRESS_OTA_FAILED;
         return OTA_SERVICE_FAIL;
     }
 
-    return OTA_SERVICE_OK; 
+    // The info in the manifest is not aligned
+    ota_delta_t* delta = handle->delta;
+    memcpy(&delta->info, handle->manifest + current_section(handle)->info_offset, sizeof(delta->info));
+    delta->base_partition = ota_flash_get_running_partition();
+    delta->base_offset = 0;
+    delta->nr_of_target_bytes_remaining = delta->info.target_length;
+    delta->command_length = 0;
+
+    handle->app_image_length = delta->info.target_length;
+
+    LOG_I(TAG, "Patching app image of %u bytes from partition %s", delta->info.target_length, delta->base_partition->label);
+    return OTA_SERVICE_OK;
 }
 
-ota_service_err_t ota_service_firmware_update_begin(ota_state_handle_t* handle)
+static ota_service_err_t ota_service_next_section(ota_state_handle_t handle)
 {
-    ota_state_handle_t newHandle = (ota_state_handle_t)malloc(sizeof(*newHandle));
-    if(newHandle == NULL)
+    while (handle->section_index < handle->package_header.nr_of_sections)
     {
-        LOG_E(TAG, "Can not allocate memory for firmware update ota state");
-        return OTA_SERVICE_FAIL;
-    }
+        const ota_section_t* section = current_section(handle);
+        handle->nr_of_section_bytes_processed = 0;
+        mbedtls_sha256_starts_ret(&handle->section_hash, 0);
 
-    // Initialize handle
-    newHandle->nr_of_bytes_processed = 0;
-    newHandle->progress = OTA_PROGRESS_SPIFFS;
+        if (section->type == OTA_SECTION_TYPE_SIGNATURE)
+        {
+            LOG_I(TAG, "OTA_PROGRESS_SIGNATURE");
+            handle->progress = OTA_PROGRESS_SIGNATURE;
+            return OTA_SERVICE_OK;
+        }
 
-    newHandle->data = NULL;
-    newHandle->length = 0;
+        if (section->type == OTA_SECTION_TYPE_APP)
+        {
+            LOG_I(TAG, "OTA_PROGRESS_APP_HEADER");
+            handle->app_image_length = section->length;
+            handle->progress = OTA_PROGRESS_APP_HEADER;
+            return OTA_SERVICE_OK;
+        }
 
-    ota_service_app_update_begin(newHandle);
-    ota_service_spiffs_update_begin(newHandle);
+        if (section->type == OTA_SECTION_TYPE_APP_DELTA)
+        {
+            LOG_I(TAG, "OTA_PROGRESS_APP_DELTA");
+            handle->progress = OTA_PROGRESS_APP_DELTA;
+            return ota_service_app_delta_begin(handle);
+        }
 
-    *handle = newHandle;
+        LOG_I(TAG, "OTA_PROGRESS_SPIFFS");
+        handle->progress = OTA_PROGRESS_SPIFFS;
+        if (section->length > 0)
+        {
+            if (section->flags & OTA_SECTION_FLAG_SECTOR_HASHES)
+            {
+                ota_service_spiffs_compare_sectors(handle);
+            }
+            return OTA_SERVICE_OK;
+        }
+
+        // An empty image has nothing to write, the partition only needs to be blank
+        if (ota_service_verify_section(handle) != OTA_SERVICE_OK)
+        {
+            return OTA_SERVICE_ERR_CORRUPT;
+        }
+
+        if ((section->flags & OTA_SECTION_FLAG_BLANK_REST) && ota_service_spiffs_blank_rest(handle) != OTA_SERVICE_OK)
+        {
+            return OTA_SERVICE_FAIL;
+        }
+        handle->section_index++;
+    }
 
-    LOG_I(TAG, "OTA_PROGRESS_SPIFFS");
+    LOG_I(TAG, "OTA_PROGRESS_DONE");
+    handle->progress = OTA_PROGRESS_DONE;
     return OTA_SERVICE_OK;
 }
 
-ota_service_err_t ota_service_firmware_update_write(ota_state_handle_t handle, const char* data, size_t length)
+static bool is_in_manifest(ota_state_handle_t handle, size_t offset, size_t length)
 {
-    ota_service_err_t err = OTA_SERVICE_OK;
+    const size_t sectionsEnd = sizeof(ota_package_header_t) + handle->package_header.nr_of_sections * sizeof(ota_section_t);
 
-    handle->data = data;
-    handle->length = length;
+    return offset >= sectionsEnd && offset + length <= handle->package_header.manifest_length;
+}
 
-    while(handle->length > 0)
+static bool has_valid_sector_hashes(ota_state_handle_t handle, const ota_section_t* section)
+{
+    return section->type == OTA_SECTION_TYPE_SPIFFS && is_in_manifest(handle, section->info_offset, nr_of_sectors(section->length) * OTA_SECTOR_HASH_LENGTH);
+}
+
+// A patch only applies to the image it was made against, which is identified by the hash in its app description
+static ota_service_err_t ota_service_verify_delta(ota_state_handle_t handle, const ota_section_t* section)
+{
+    ota_delta_info_t info;
+
+    if (!is_in_manifest(handle, section->info_offset, sizeof(info)) || section->length < sizeof(ota_delta_command_t))
     {
-        switch(handle->progress)
+        LOG_E(TAG, "App delta section has its info outside of the manifest");
+        return OTA_SERVICE_ERR_INVALID_PACKAGE;
+    }
+    memcpy(&info, handle->manifest + section->info_offset, sizeof(info));
+
+    if (info.target_length < sizeof(app_header_t) || info.target_length > handle->app_update_partition->size)
+    {
+        LOG_E(TAG, "App delta of %u bytes does not fit partition %s", info.target_length, handle->app_update_partition->label);
+        return OTA_SERVICE_ERR_INVALID_PACKAGE;
+    }
+
+    const esp_app_desc_t* running = ota_flash_get_app_description();
+    if (memcmp(info.base_elf_sha256, running->app_elf_sha256, sizeof(info.base_elf_sha256)) != 0
+        || info.base_length > ota_flash_get_running_partition()->size)
+    {
+        LOG_E(TAG, "App delta does not apply to the running firmware version %s, a full update is needed", running->version);
+        return OTA_SERVICE_ERR_BASE_MISMATCH;
+    }
+
+    return OTA_SERVICE_OK;
+}
+
+static ota_service_err_t ota_service_verify_manifest(ota_state_handle_t handle)
+{
+    const ota_package_header_t* header = &handle->package_header;
+    bool hasSpiffs = false;
+    bool hasApp = false;
+    bool hasSignature = false;
+
+    for (size_t i = 0; i < header->nr_of_sections; ++i)
+    {
+        const ota_section_t* section = &handle->sections[i];
+
+        switch (section->type)
         {
-            case OTA_PROGRESS_SPIFFS:
-                err = ota_service_spiffs_update_write(handle);
-                break;
+        case OTA_SECTION_TYPE_SPIFFS:
+            if (hasSpiffs || section->length > handle->spiffs_update_partition->size)
+            {
+                LOG_E(TAG, "Spiffs section of %u bytes does not fit partition %s", section->length, handle->spiffs_update_partition->label);
+                return OTA_SERVICE_ERR_INVALID_PACKAGE;
+            }
+            hasSpiffs = true;
+            break;
 
-            case OTA_PROGRESS_APP_HEADER:
-                err = ota_service_app_update_write_header(handle);
-                break;
+        case OTA_SECTION_TYPE_APP:
+            if (hasApp || section->length < sizeof(app_header_t) || section->length > handle->app_update_partition->size)
+            {
+                LOG_E(TAG, "App section of %u bytes does not fit partition %s", section->length, handle->app_update_partition->label);
+                return OTA_SERVICE_ERR_INVALID_PACKAGE;
+            }
+            hasApp = true;
+            break;
 
-            case OTA_PROGRESS_APP_DATA:
-                err =  ota_service_app_update_write_data(handle);
-                break;
-            
-            case OTA_PROGRESS_OTA_FAILED:
-            default:
-                // Update failed or unknown state
-                return OTA_SERVICE_FAIL;
+        case OTA_SECTION_TYPE_APP_DELTA:
+        {
+            if (hasApp)
+            {
+                LOG_E(TAG, "Firmware update package has more then one app section");
+                return OTA_SERVICE_ERR_INVALID_PACKAGE;
+            }
+
+            // Checked before anything is written, so a package for another base leaves the device as it is
+            ota_service_err_t err = ota_service_verify_delta(handle, section);
+            if (err != OTA_SERVICE_OK)
+            {
+                return err;
+            }
+            hasApp = true;
+            break;
         }
 
-        if(err != OTA_SERVICE_OK)
+        case OTA_SECTION_TYPE_SIGNATURE:
+            // The signature is checked before any other section is written, so it must come first
+            if (i != 0 || section->length == 0 || section->length > OTA_MAX_SIGNATURE_LENGTH)
+            {
+                LOG_E(TAG, "Signature section of %u bytes is not valid as section %zu", section->length, i);
+                return OTA_SERVICE_ERR_INVALID_PACKAGE;
+            }
+            hasSignature = true;
+            break;
+
+        default:
+            LOG_E(TAG, "Firmware update package has a section of unknown type %u", section->type);
+            return OTA_SERVICE_ERR_INVALID_PACKAGE;
+        }
+
+        if ((section->flags & OTA_SECTION_FLAG_SECTOR_HASHES) && !has_valid_sector_hashes(handle, section))
         {
-            return err;
+            LOG_E(TAG, "Section %zu has sector hashes outside of the manifest", i);
+            return OTA_SERVICE_ERR_INVALID_PACKAGE;
         }
+
+        LOG_I(TAG, "Section %zu: type %u, %u bytes", i, section->type, section->length);
+    }
+
+    // The spiffs partition belongs to the app partition, updating only one of them would leave the pair inconsistent
+    if (!hasSpiffs || !hasApp)
+    {
+        LOG_E(TAG, "Firmware update package must have both a spiffs and an app section");
+        return OTA_SERVICE_ERR_INVALID_PACKAGE;
+    }
+
+#ifdef CONFIG_OTA_SIGNATURE_VERIFY
+    if (!hasSignature)
+    {
+        LOG_E(TAG, "Firmware update package is not signed");
+        return OTA_SERVICE_ERR_BAD_SIGNATURE;
+    }
+#else
+    if (hasSignature)
+    {
+        LOG_W(TAG, "Firmware update package is signed, but signature verification is not enabled");
     }
+#endif
 
     return OTA_SERVICE_OK;
 }
 
-ota_service_err_t ota_service_firmware_update_end(ota_state_handle_t handle)
+#ifdef CONFIG_OTA_SIGNATURE_VERIFY
+extern const uint8_t otaPublicKeyStart[] asm("_binary_ota_public_key_pem_start");
+extern const uint8_t otaPublicKeyEnd[] asm("_binary_ota_public_key_pem_end");
+
+// The signature is over the hash of the manifest, which has the hashes of all other sections
+static ota_service_err_t ota_service_verify_signature(ota_state_handle_t handle)
 {
-    esp_err_t err;
+    mbedtls_pk_context key;
+    ota_service_err_t result = OTA_SERVICE_OK;
 
-    // First end app update
-    err = esp_ota_end(handle->app_update_handle);
-    if (err != ESP_OK) 
+    mbedtls_pk_init(&key);
+
+    // The embedded PEM is null terminated, its length includes the terminator as mbedtls expects
+    int err = mbedtls_pk_parse_public_key(&key, otaPublicKeyStart, otaPublicKeyEnd - otaPublicKeyStart);
+    if (err != 0)
+    {
+        LOG_E(TAG, "Can not parse the firmware update public key (-0x%04x)", -err);
+        result = OTA_SERVICE_FAIL;
+    }
+    else
+    {
+        err = mbedtls_pk_verify(
+            &key,
+            MBEDTLS_MD_SHA256,
+            handle->manifest_hash,
+            sizeof(handle->manifest_hash),
+            handle->signature,
+            current_section(handle)->length);
+
+        if (err != 0)
+        {
+            LOG_E(TAG, "Firmware update package signature is not valid (-0x%04x)", -err);
+            result = OTA_SERVICE_ERR_BAD_SIGNATURE;
+        }
+    }
+
+    mbedtls_pk_free(&key);
+    return result;
+}
+#else
+static ota_service_err_t ota_service_verify_signature(ota_state_handle_t handle)
+{
+    (void)handle;
+    return OTA_SERVICE_OK;
+}
+#endif
+
+static ota_service_err_t ota_service_signature_write(ota_state_handle_t handle)
+{
+    const ota_section_t* section = current_section(handle);
+    const size_t nrOfSignatureBytesToRead = min(handle->length, section->length - handle->nr_of_section_bytes_processed);
+
+    memcpy(handle->signature + handle->nr_of_section_bytes_processed, read_handle_data(handle, nrOfSignatureBytesToRead), nrOfSignatureBytesToRead);
+    handle->nr_of_section_bytes_processed += nrOfSignatureBytesToRead;
+
+    if (handle->nr_of_section_bytes_processed < section->length)
+    {
+        return OTA_SERVICE_OK;
+    }
+
+    ota_service_err_t err = ota_service_verify_signature(handle);
+    if (err != OTA_SERVICE_OK)
     {
-        LOG_E(TAG, "esp_ota_end failed (%s)", esp_err_to_name(err));
         handle->progress = OTA_PROGRESS_OTA_FAILED;
-        return OTA_SERVICE_ERR_OTA_END_FAILED;
+        return err;
     }
 
-    // Set new boot partition
-    err = esp_ota_set_boot_partition(handle->app_update_partition);
+    handle->section_index++;
+    return ota_service_next_section(handle);
+}
 
-    // Free resources
-    free(handle);
+static ota_service_err_t ota_service_manifest_begin(ota_state_handle_t handle)
+{
+    const ota_package_header_t* header = &handle->package_header;
 
-    // Error checking
-    if (err != ESP_OK) 
+    if (header->magic != OTA_PACKAGE_MAGIC)
     {
-        LOG_E(TAG, "esp_ota_set_boot_partition failed");
-        return OTA_SERVICE_ERR_SET_BOOT_PARTITON_FAILED;
+        LOG_E(TAG, "Firmware update is not a package (magic 0x%08x)", header->magic);
+        return OTA_SERVICE_ERR_INVALID_PACKAGE;
     }
 
-    LOG_I(TAG, "Firmware update done");
+    if (header->version != OTA_PACKAGE_VERSION)
+    {
+        LOG_E(TAG, "Firmware update package version %u is not supported", header->version);
+        return OTA_SERVICE_ERR_INVALID_PACKAGE;
+    }
+
+    if (header->manifest_length < sizeof(*header) + header->nr_of_sections * sizeof(ota_section_t) || header->manifest_length > OTA_MAX_MANIFEST_LENGTH)
+    {
+        LOG_E(TAG, "Firmware update package manifest of %u bytes is not valid for %u sections", header->manifest_length, header->nr_of_sections);
+        return OTA_SERVICE_ERR_INVALID_PACKAGE;
+    }
+
+    handle->manifest = (uint8_t*)malloc(header->manifest_length);
+    if (handle->manifest == NULL)
+    {
+        LOG_E(TAG, "Can not allocate memory for a %u byte firmware update manifest", header->manifest_length);
+        return OTA_SERVICE_FAIL;
+    }
+
+    memcpy(handle->manifest, header, sizeof(*header));
+    handle->sections = (const ota_section_t*)(handle->manifest + sizeof(*header));
+
     return OTA_SERVICE_OK;
+}
+
+static ota_service_err_t ota_service_manifest_write(ota_state_handle_t handle)
+{
+    ota_service_err_t err;
+
+    // The manifest is at the start of the package, so the processed bytes are the offset in it
+    if (handle->manifest == NULL)
+    {
+        // Reading the data moves the processed bytes on, so the offset is taken first
+        const size_t headerOffset = handle->nr_of_bytes_processed;
+        const size_t nrOfHeaderBytesToRead = min(handle->length, sizeof(handle->package_header) - headerOffset);
+        memcpy((char*)&handle->package_header + headerOffset, read_handle_data(handle, nrOfHeaderBytesToRead), nrOfHeaderBytesToRead);
+
+        if (handle->nr_of_bytes_processed < sizeof(handle->package_header))
+        {
+            return OTA_SERVICE_OK;
+        }
+
+        err = ota_service_manifest_begin(handle);
+        if (err != OTA_SERVICE_OK)
+        {
+            handle->progress = OTA_PROGRESS_OTA_FAILED;
+            return err;
+        }
+    }
+
+    const size_t nrOfManifestBytesToRead = min(handle->length, handle->package_header.manifest_length - handle->nr_of_bytes_processed);
+    const size_t offset = handle->nr_of_bytes_processed;
+    memcpy(handle->manifest + offset, read_handle_data(handle, nrOfManifestBytesToRead), nrOfManifestBytesToRead);
+
+    if (handle->nr_of_bytes_processed < handle->package_header.manifest_length)
+    {
+        return OTA_SERVICE_OK;
+    }
+
+    err = ota_service_verify_manifest(handle);
+    if (err != OTA_SERVICE_OK)
+    {
+        handle->progress = OTA_PROGRESS_OTA_FAILED;
+        return err;
+    }
+
+    mbedtls_sha256_ret(handle->manifest, handle->package_header.manifest_length, handle->manifest_hash, 0);
+
+    handle->nr_of_bytes_total = handle->package_header.manifest_length;
+    for (size_t i = 0; i < handle->package_header.nr_of_sections; ++i)
+    {
+        handle->nr_of_bytes_total += handle->sections[i].length;
+    }
+
+    handle->section_index = 0;
+    return ota_service_next_section(handle);
+}
+
+static ota_service_err_t ota_service_spiffs_update_write(ota_state_handle_t handle)
+{
+    esp_err_t err;
+    const ota_section_t* section = current_section(handle);
+
+    // Every call handles the data of one sector at most, a sector is either skipped or written as a whole
+    const size_t nrOfSpiffsBytesProcessed = handle->nr_of_section_bytes_processed;
+    const size_t sector = nrOfSpiffsBytesProcessed / SPI_FLASH_SEC_SIZE;
+    const size_t sectorEnd = min((sector + 1) * SPI_FLASH_SEC_SIZE, section->length);
+    const size_t nrOfSpiffsBytesToWrite = min(handle->length, sectorEnd - nrOfSpiffsBytesProcessed);
+
+    if (is_sector_unchanged(handle, sector))
+    {
+        read_handle_data(handle, nrOfSpiffsBytesToWrite);
+    }
+    else
+    {
+        // The sector is collected in the flash buffer, so it is written at once however the data arrives
+        memcpy(handle->flash_buffer + handle->flash_buffer_length, read_handle_data(handle, nrOfSpiffsBytesToWrite), nrOfSpiffsBytesToWrite);
+        handle->flash_buffer_length += nrOfSpiffsBytesToWrite;
+
+        if (nrOfSpiffsBytesProcessed + nrOfSpiffsBytesToWrite == sectorEnd)
+        {
+            // Erase the sector before writing it, erase_range needs whole sectors
+            if (sector * SPI_FLASH_SEC_SIZE >= handle->nr_of_spiffs_bytes_erased && ota_service_spiffs_erase_changed(handle, sector) != OTA_SERVICE_OK)
+            {
+                return OTA_SERVICE_FAIL;
+            }
+
+            err = ota_flash_write(handle->spiffs_update_partition, sector * SPI_FLASH_SEC_SIZE, handle->flash_buffer, handle->flash_buffer_length, &handle->flash_timing);
+            if (err != ESP_OK)
+            {
+                LOG_E(TAG, "esp_partition_write failed (%s)", esp_err_to_name(err));
+                handle->progress = OTA_PROGRESS_OTA_FAILED;
+                return OTA_SERVICE_FAIL;
+            }
+
+            handle->flash_buffer_length = 0;
+        }
+    }
+
+    handle->nr_of_section_bytes_processed += nrOfSpiffsBytesToWrite;
+    if(handle->nr_of_section_bytes_processed == section->length)
+    {
+        // All spiffs bytes received
+        if (ota_service_verify_section(handle) != OTA_SERVICE_OK)
+        {
+            return OTA_SERVICE_ERR_CORRUPT;
+        }
+
+        if ((section->flags & OTA_SECTION_FLAG_BLANK_REST) && ota_service_spiffs_blank_rest(handle) != OTA_SERVICE_OK)
+        {
+            return OTA_SERVICE_FAIL;
+        }
+
+        handle->section_index++;
+        return ota_service_next_section(handle);
+    }
+
+    return OTA_SERVICE_OK; 
+}
+
+static ota_service_err_t ota_service_app_update_begin_image(ota_state_handle_t handle)
+{
+    esp_err_t err;
+
+    // All header bytes received, read header and begin update
+    LOG_I(TAG, "Read header");
+    if (handle->app_header.image_header.magic != ESP_IMAGE_HEADER_MAGIC)
+    {
+        LOG_E(TAG, "App section is not an app image (magic 0x%02x)", handle->app_header.image_header.magic);
+        handle->progress = OTA_PROGRESS_OTA_FAILED;
+        return OTA_SERVICE_ERR_INVALID_PACKAGE;
+    }
+    LOG_I(TAG, "New firmware version: %s", handle->app_header.app_desc.version);
+
+    // Begin OTA, with the image size only the sectors the image needs are erased
+    err = ota_flash_app_begin(handle->app_update_partition, handle->app_image_length, &handle->app_update_handle, &handle->flash_timing);
+    if (err != ESP_OK) 
+    {
+        LOG_E(TAG, "esp_ota_begin failed (%s)", esp_err_to_name(err));
+        handle->progress = OTA_PROGRESS_OTA_FAILED;
+        return OTA_SERVICE_FAIL;
+    }
+    handle->app_update_begun = true;
+
+    // The header is written along with the first sector of the image
+    memcpy(handle->flash_buffer, &handle->app_header, sizeof(handle->app_header));
+    handle->flash_buffer_length = sizeof(handle->app_header);
+
+    if (handle->progress == OTA_PROGRESS_APP_HEADER)
+    {
+        LOG_I(TAG, "OTA_PROGRESS_APP_DATA");
+        handle->progress = OTA_PROGRESS_APP_DATA;
+    }
+
+    return OTA_SERVICE_OK;
+}
+
+static ota_service_err_t ota_service_app_flush(ota_state_handle_t handle)
+{
+    esp_err_t err = ota_flash_app_write(handle->app_update_handle, (const void *)handle->flash_buffer, handle->flash_buffer_length, &handle->flash_timing);
+    if (err != ESP_OK) 
+    {
+        LOG_E(TAG, "esp_ota_write failed (%s)", esp_err_to_name(err));
+        handle->progress = OTA_PROGRESS_OTA_FAILED;
+        return OTA_SERVICE_FAIL;
+    }
+
+    handle->flash_buffer_length = 0;
+    return OTA_SERVICE_OK;
+}
+
+// Writes the next bytes of the new app image, whether they come from a full image or from a patch.
+// The bytes are collected in the flash buffer and written a whole sector at a time.
+static ota_service_err_t ota_service_app_write(ota_state_handle_t handle, const char* data, size_t length)
+{
+    if (handle->nr_of_app_bytes_written < sizeof(handle->app_header))
+    {
+        const size_t nrOfHeaderBytesToWrite = min(length, sizeof(handle->app_header) - handle->nr_of_app_bytes_written);
+
+        memcpy((char*)&handle->app_header + handle->nr_of_app_bytes_written, data, nrOfHeaderBytesToWrite);
+        handle->nr_of_app_bytes_written += nrOfHeaderBytesToWrite;
+        data += nrOfHeaderBytesToWrite;
+        length -= nrOfHeaderBytesToWrite;
+
+        if (handle->nr_of_app_bytes_written < sizeof(handle->app_header))
+        {
+            return OTA_SERVICE_OK;
+        }
+
+        ota_service_err_t otaErr = ota_service_app_update_begin_image(handle);
+        if (otaErr != OTA_SERVICE_OK)
+        {
+            return otaErr;
+        }
+    }
+
+    while (length > 0)
+    {
+        const size_t nrOfBytesToBuffer = min(length, SPI_FLASH_SEC_SIZE - handle->flash_buffer_length);
+
+        memcpy(handle->flash_buffer + handle->flash_buffer_length, data, nrOfBytesToBuffer);
+        handle->flash_buffer_length += nrOfBytesToBuffer;
+        handle->nr_of_app_bytes_written += nrOfBytesToBuffer;
+        data += nrOfBytesToBuffer;
+        length -= nrOfBytesToBuffer;
+
+        if (handle->flash_buffer_length == SPI_FLASH_SEC_SIZE && ota_service_app_flush(handle) != OTA_SERVICE_OK)
+        {
+            return OTA_SERVICE_FAIL;
+        }
+    }
+
+    // The last sector of the image is written as soon as it is complete
+    if (handle->nr_of_app_bytes_written == handle->app_image_length && handle->flash_buffer_length > 0)
+    {
+        return ota_service_app_flush(handle);
+    }
+
+    return OTA_SERVICE_OK;
+}
+
+static ota_service_err_t ota_service_app_update_write_image(ota_state_handle_t handle)
+{
+    const ota_section_t* section = current_section(handle);
+
+    const size_t nrOfAppBytesToWrite = min(handle->length, section->length - handle->nr_of_section_bytes_processed);
+
+    ota_service_err_t err = ota_service_app_write(handle, read_handle_data(handle, nrOfAppBytesToWrite), nrOfAppBytesToWrite);
+    if (err != OTA_SERVICE_OK)
+    {
+        return err;
+    }
+
+    handle->nr_of_section_bytes_processed += nrOfAppBytesToWrite;
+    if (handle->nr_of_section_bytes_processed == section->length)
+    {
+        if (ota_service_verify_section(handle) != OTA_SERVICE_OK)
+        {
+            return OTA_SERVICE_ERR_CORRUPT;
+        }
+
+        handle->section_index++;
+        return ota_service_next_section(handle);
+    }
+
+    return OTA_SERVICE_OK; 
+}
+
+static ota_service_err_t ota_service_app_delta_read_command(ota_state_handle_t handle)
+{
+    ota_delta_t* delta = handle->delta;
+
+    const size_t nrOfCommandBytesToRead = min(handle->length, sizeof(delta->command) - delta->command_length);
+    memcpy((char*)&delta->command + delta->command_length, read_handle_data(handle, nrOfCommandBytesToRead), nrOfCommandBytesToRead);
+    delta->command_length += nrOfCommandBytesToRead;
+    handle->nr_of_section_bytes_processed += nrOfCommandBytesToRead;
+
+    if (delta->command_length < sizeof(delta->command))
+    {
+        return OTA_SERVICE_OK;
+    }
+
+    // The patch must stay within both images
+    const ota_delta_command_t* command = &delta->command;
+    if ((uint64_t)command->diff_length + command->extra_length > delta->nr_of_target_bytes_remaining
+        || delta->base_offset + command->diff_length > delta->info.base_length)
+    {
+        LOG_E(TAG, "App delta command reaches outside of the images");
+        handle->progress = OTA_PROGRESS_OTA_FAILED;
+        return OTA_SERVICE_ERR_INVALID_PACKAGE;
+    }
+
+    delta->nr_of_target_bytes_remaining -= command->diff_length + command->extra_length;
+    return OTA_SERVICE_OK;
+}
+
+static ota_service_err_t ota_service_app_delta_write_diff(ota_state_handle_t handle)
+{
+    ota_delta_t* delta = handle->delta;
+
+    const size_t nrOfDiffBytesToWrite = min(min(handle->length, delta->command.diff_length), sizeof(delta->buffer));
+
+    esp_err_t err = ota_flash_read(delta->base_partition, delta->base_offset, delta->buffer, nrOfDiffBytesToWrite);
+    if (err != ESP_OK)
+    {
+        LOG_E(TAG, "esp_partition_read failed (%s)", esp_err_to_name(err));
+        handle->progress = OTA_PROGRESS_OTA_FAILED;
+        return OTA_SERVICE_FAIL;
+    }
+
+    const uint8_t* diff = (const uint8_t*)read_handle_data(handle, nrOfDiffBytesToWrite);
+    for (size_t i = 0; i < nrOfDiffBytesToWrite; ++i)
+    {
+        delta->buffer[i] += diff[i];
+    }
+
+    delta->base_offset += nrOfDiffBytesToWrite;
+    delta->command.diff_length -= nrOfDiffBytesToWrite;
+    handle->nr_of_section_bytes_processed += nrOfDiffBytesToWrite;
+
+    return ota_service_app_write(handle, (const char*)delta->buffer, nrOfDiffBytesToWrite);
+}
+
+static ota_service_err_t ota_service_app_delta_write_extra(ota_state_handle_t handle)
+{
+    ota_delta_t* delta = handle->delta;
+
+    const size_t nrOfExtraBytesToWrite = min(handle->length, delta->command.extra_length);
+
+    delta->command.extra_length -= nrOfExtraBytesToWrite;
+    handle->nr_of_section_bytes_processed += nrOfExtraBytesToWrite;
+
+    return ota_service_app_write(handle, read_handle_data(handle, nrOfExtraBytesToWrite), nrOfExtraBytesToWrite);
+}
+
+static ota_service_err_t ota_service_app_delta_write(ota_state_handle_t handle)
+{
+    ota_service_err_t err;
+    ota_delta_t* delta = handle->delta;
+    const ota_section_t* section = current_section(handle);
+
+    if (delta->command_length < sizeof(delta->command))
+    {
+        err = ota_service_app_delta_read_command(handle);
+    }
+    else if (delta->command.diff_length > 0)
+    {
+        err = ota_service_app_delta_write_diff(handle);
+    }
+    else
+    {
+        err = ota_service_app_delta_write_extra(handle);
+    }
+
+    if (err != OTA_SERVICE_OK)
+    {
+        return err;
+    }
+
+    // When all bytes of a command are written, the base offset moves on for the next command
+    if (delta->command_length == sizeof(delta->command) && delta->command.diff_length == 0 && delta->command.extra_length == 0)
+    {
+        const int64_t baseOffset = (int64_t)delta->base_offset + delta->command.seek;
+        if (baseOffset < 0 || baseOffset > delta->info.base_length)
+        {
+            LOG_E(TAG, "App delta seeks outside of the base image");
+            handle->progress = OTA_PROGRESS_OTA_FAILED;
+            return OTA_SERVICE_ERR_INVALID_PACKAGE;
+        }
+
+        delta->base_offset = (size_t)baseOffset;
+        delta->command_length = 0;
+    }
+
+    if (handle->nr_of_section_bytes_processed < section->length)
+    {
+        return OTA_SERVICE_OK;
+    }
+
+    if (delta->command_length != 0 || delta->nr_of_target_bytes_remaining != 0)
+    {
+        LOG_E(TAG, "App delta ended before the whole image was written");
+        handle->progress = OTA_PROGRESS_OTA_FAILED;
+        return OTA_SERVICE_ERR_INVALID_PACKAGE;
+    }
+
+    if (ota_service_verify_section(handle) != OTA_SERVICE_OK)
+    {
+        return OTA_SERVICE_ERR_CORRUPT;
+    }
+
+    LOG_I(TAG, "Patched app image of %zu bytes from a delta of %u bytes", handle->nr_of_app_bytes_written, section->length);
+    handle->section_index++;
+    return ota_service_next_section(handle);
+}
+
+void ota_service_init(void)
+{
+    metrics_service_register(&bytesMetric.metric);
+    metrics_service_register(&updatesOkMetric.metric);
+    metrics_service_register(&updatesFailedMetric.metric);
+    metrics_service_register(&sectorsSkippedMetric.metric);
+    metrics_service_register(&sectorsWrittenMetric.metric);
+    metrics_service_register(&throughputMetric.metric);
+    metrics_service_register(&writerThroughputMetric.metric);
+    metrics_service_register(&stallsMetric.metric);
+}
+
+static void ota_service_free(ota_state_handle_t handle)
+{
+    free(handle->inflater);
+    free(handle->manifest);
+    free(handle->spiffs_unchanged_sectors);
+    free(handle->delta);
+    free(handle->flash_buffer);
+    free(handle->buffers);
+    mbedtls_sha256_free(&handle->section_hash);
+
+    if (handle->free_buffers != NULL)
+    {
+        vQueueDelete(handle->free_buffers);
+    }
+    if (handle->writer_queue != NULL)
+    {
+        vQueueDelete(handle->writer_queue);
+    }
+    if (handle->done_semaphore != NULL)
+    {
+        vSemaphoreDelete(handle->done_semaphore);
+    }
+
+    free(handle);
+    __atomic_store_n(&updateInProgress, false, __ATOMIC_RELEASE);
+}
+
+static void ota_service_writer_task(void* arg);
+
+ota_service_err_t ota_service_firmware_update_begin(ota_state_handle_t* handle, ota_service_notify_t notify, void* userData)
+{
+    if (__atomic_exchange_n(&updateInProgress, true, __ATOMIC_ACQUIRE))
+    {
+        LOG_W(TAG, "Another firmware update is in progress");
+        return OTA_SERVICE_ERR_IN_PROGRESS;
+    }
+
+    // Zeroed, so ota_service_free can be called whatever was set up
+    ota_state_handle_t newHandle = (ota_state_handle_t)calloc(1, sizeof(*newHandle));
+    if(newHandle == NULL)
+    {
+        LOG_E(TAG, "Can not allocate memory for firmware update ota state");
+        metrics_counter_inc(&updatesFailedMetric);
+        __atomic_store_n(&updateInProgress, false, __ATOMIC_RELEASE);
+        return OTA_SERVICE_FAIL;
+    }
+
+    // Initialize handle
+    newHandle->nr_of_bytes_processed = 0;
+    newHandle->progress = OTA_PROGRESS_MANIFEST;
+    newHandle->start_time = esp_timer_get_time();
+    newHandle->app_update_begun = false;
+    newHandle->nr_of_bytes_received = 0;
+    newHandle->encoding = OTA_ENCODING_UNKNOWN;
+    newHandle->compressed_header_length = 0;
+    newHandle->inflater = NULL;
+    newHandle->manifest = NULL;
+    newHandle->sections = NULL;
+    newHandle->section_index = 0;
+    newHandle->nr_of_section_bytes_processed = 0;
+    newHandle->spiffs_unchanged_sectors = NULL;
+    newHandle->app_image_length = 0;
+    newHandle->nr_of_app_bytes_written = 0;
+    newHandle->delta = NULL;
+    mbedtls_sha256_init(&newHandle->section_hash);
+
+    newHandle->data = NULL;
+    newHandle->length = 0;
+
+    newHandle->fill_buffer = OTA_NO_BUFFER;
+    newHandle->fill_length = 0;
+    newHandle->end_sent = false;
+    newHandle->notify = notify;
+    newHandle->notify_user_data = userData;
+    newHandle->result = OTA_SERVICE_OK;
+    newHandle->done = false;
+    newHandle->nr_of_stalls = 0;
+    newHandle->writer_busy_time = 0;
+    newHandle->nr_of_bytes_total = 0;
+    newHandle->flash_timing.erase_time = 0;
+    newHandle->flash_timing.write_time = 0;
+    newHandle->report_time = newHandle->start_time;
+    newHandle->report_bytes = 0;
+    newHandle->report_state = OTA_PROGRESS_MANIFEST;
+    newHandle->flash_buffer_length = 0;
+
+    newHandle->buffers = (char*)malloc(OTA_NR_OF_BUFFERS * OTA_BUFFER_SIZE);
+    newHandle->flash_buffer = (uint8_t*)malloc(SPI_FLASH_SEC_SIZE);
+    newHandle->free_buffers = xQueueCreate(OTA_NR_OF_BUFFERS, sizeof(uint8_t));
+    // Every buffer, the end and the close fit in the queue at once, so sending to the writer task never waits
+    newHandle->writer_queue = xQueueCreate(OTA_NR_OF_BUFFERS + 2, sizeof(ota_writer_message_t));
+    newHandle->done_semaphore = xSemaphoreCreateBinary();
+
+    if (newHandle->buffers == NULL || newHandle->flash_buffer == NULL || newHandle->free_buffers == NULL || newHandle->writer_queue == NULL || newHandle->done_semaphore == NULL)
+    {
+        LOG_E(TAG, "Can not allocate memory for firmware update buffers");
+        metrics_counter_inc(&updatesFailedMetric);
+        ota_service_free(newHandle);
+        return OTA_SERVICE_FAIL;
+    }
+
+    for (uint8_t i = 0; i < OTA_NR_OF_BUFFERS; ++i)
+    {
+        xQueueSend(newHandle->free_buffers, &i, 0);
+    }
+
+    // Without partitions to write to, the update is refused before the client sends any of it
+    if (ota_service_app_update_begin(newHandle) != OTA_SERVICE_OK || ota_service_spiffs_update_begin(newHandle) != OTA_SERVICE_OK)
+    {
+        metrics_counter_inc(&updatesFailedMetric);
+        ota_service_free(newHandle);
+        return OTA_SERVICE_FAIL;
+    }
+
+    // The writer task runs below the webserver, so recieving the update is not held up by decoding it
+    BaseType_t taskCreateResult = xTaskCreatePinnedToCore(
+        ota_service_writer_task,
+        OTA_WRITER_TASK_TAG,
+        OTA_WRITER_STACK_SIZE_KB * STACK_KB,
+        newHandle,
+        tskIDLE_PRIORITY+10,
+        NULL,
+        PRO_CPU_NUM);
+
+    if (taskCreateResult != pdPASS)
+    {
+        LOG_E(TAG, "Can not start the firmware update writer task");
+        metrics_counter_inc(&updatesFailedMetric);
+        ota_service_free(newHandle);
+        return OTA_SERVICE_FAIL;
+    }
+
+    // The writer task reports from here on, it only gets to run once data was written
+    portENTER_CRITICAL(&progressLock);
+    lastProgress = (ota_service_progress_t){ .running = true, .state = OTA_PROGRESS_MANIFEST, .result = OTA_SERVICE_OK };
+    portEXIT_CRITICAL(&progressLock);
+
+    *handle = newHandle;
+
+    LOG_I(TAG, "OTA_PROGRESS_MANIFEST");
+    return OTA_SERVICE_OK;
+}
+
+static ota_service_err_t ota_service_process(ota_state_handle_t handle, const char* data, size_t length)
+{
+    ota_service_err_t err = OTA_SERVICE_OK;
+
+    handle->data = data;
+    handle->length = length;
+
+    while(handle->length > 0)
+    {
+        switch(handle->progress)
+        {
+            case OTA_PROGRESS_MANIFEST:
+                err = ota_service_manifest_write(handle);
+                break;
+
+            case OTA_PROGRESS_SIGNATURE:
+                err = ota_service_signature_write(handle);
+                break;
+
+            case OTA_PROGRESS_SPIFFS:
+                err = ota_service_spiffs_update_write(handle);
+                break;
+
+            case OTA_PROGRESS_APP_HEADER:
+            case OTA_PROGRESS_APP_DATA:
+                err = ota_service_app_update_write_image(handle);
+                break;
+
+            case OTA_PROGRESS_APP_DELTA:
+                err = ota_service_app_delta_write(handle);
+                break;
+
+            case OTA_PROGRESS_DONE:
+                LOG_E(TAG, "Firmware update has more data then its manifest describes");
+                handle->progress = OTA_PROGRESS_OTA_FAILED;
+                err = OTA_SERVICE_ERR_INVALID_PACKAGE;
+                break;
+            
+            case OTA_PROGRESS_OTA_FAILED:
+            default:
+                // Update failed or unknown state
+                return OTA_SERVICE_FAIL;
+        }
+
+        if(err != OTA_SERVICE_OK)
+        {
+            metrics_counter_inc(&updatesFailedMetric);
+            return err;
+        }
+    }
+
+    return OTA_SERVICE_OK;
+}
+
+static ota_service_err_t ota_service_inflate(ota_state_handle_t handle, const char* data, size_t length)
+{
+    ota_inflater_t* inflater = handle->inflater;
+
+    // Keep going while there is input, or while the window filled up before all output of the input was written
+    tinfl_status status = TINFL_STATUS_HAS_MORE_OUTPUT;
+    while (!inflater->done && (length > 0 || status == TINFL_STATUS_HAS_MORE_OUTPUT))
+    {
+        size_t inSize = length;
+        size_t outSize = inflater->window_size - inflater->window_offset;
+        uint8_t* out = inflater->window + inflater->window_offset;
+
+        status = tinfl_decompress(
+            &inflater->decompressor,
+            (const mz_uint8*)data,
+            &inSize,
+            inflater->window,
+            out,
+            &outSize,
+            TINFL_FLAG_HAS_MORE_INPUT);
+
+        data += inSize;
+        length -= inSize;
+
+        if (status < TINFL_STATUS_DONE)
+        {
+            LOG_E(TAG, "Decompressing firmware update failed (%d)", status);
+            handle->progress = OTA_PROGRESS_OTA_FAILED;
+            metrics_counter_inc(&updatesFailedMetric);
+            return OTA_SERVICE_FAIL;
+        }
+
+        inflater->window_offset = (inflater->window_offset + outSize) & (inflater->window_size - 1);
+        inflater->done = status == TINFL_STATUS_DONE;
+
+        if (outSize > 0)
+        {
+            ota_service_err_t err = ota_service_process(handle, (const char*)out, outSize);
+            if (err != OTA_SERVICE_OK)
+            {
+                return err;
+            }
+        }
+    }
+
+    if (inflater->done && length > 0)
+    {
+        LOG_W(TAG, "Ignoring %zu bytes after the end of the compressed firmware update", length);
+    }
+
+    return OTA_SERVICE_OK;
+}
+
+static ota_service_err_t ota_service_begin_encoding(ota_state_handle_t handle)
+{
+    const ota_compressed_header_t* header = &handle->compressed_header;
+
+    if (header->magic != OTA_COMPRESSED_MAGIC)
+    {
+        // A plain update, the bytes read so far are the start of it
+        handle->encoding = OTA_ENCODING_PLAIN;
+        return ota_service_process(handle, (const char*)header, sizeof(*header));
+    }
+
+    if (header->window_bits < OTA_MIN_WINDOW_BITS || header->window_bits > OTA_MAX_WINDOW_BITS)
+    {
+        LOG_E(TAG, "Compressed firmware update has an unsupported window of %u bits", header->window_bits);
+        handle->progress = OTA_PROGRESS_OTA_FAILED;
+        metrics_counter_inc(&updatesFailedMetric);
+        return OTA_SERVICE_FAIL;
+    }
+
+    size_t windowSize = (size_t)1 << header->window_bits;
+    handle->inflater = (ota_inflater_t*)malloc(sizeof(*handle->inflater) + windowSize);
+    if (handle->inflater == NULL)
+    {
+        LOG_E(TAG, "Can not allocate memory for a %zu byte decompression window", windowSize);
+        handle->progress = OTA_PROGRESS_OTA_FAILED;
+        metrics_counter_inc(&updatesFailedMetric);
+        return OTA_SERVICE_FAIL;
+    }
+
+    tinfl_init(&handle->inflater->decompressor);
+    handle->inflater->window_offset = 0;
+    handle->inflater->window_size = windowSize;
+    handle->inflater->done = false;
+    handle->encoding = OTA_ENCODING_DEFLATE;
+
+    LOG_I(TAG, "Compressed firmware update of %u bytes, window %zu bytes", header->size, windowSize);
+    return OTA_SERVICE_OK;
+}
+
+static ota_service_err_t ota_service_decode(ota_state_handle_t handle, const char* data, size_t length)
+{
+    handle->nr_of_bytes_received += length;
+
+    // The first bytes tell if the update is compressed, they may arrive over more then one buffer
+    if (handle->encoding == OTA_ENCODING_UNKNOWN)
+    {
+        const size_t nrOfHeaderBytes = min(length, sizeof(handle->compressed_header) - handle->compressed_header_length);
+        memcpy((char*)&handle->compressed_header + handle->compressed_header_length, data, nrOfHeaderBytes);
+        handle->compressed_header_length += nrOfHeaderBytes;
+        data += nrOfHeaderBytes;
+        length -= nrOfHeaderBytes;
+
+        if (handle->compressed_header_length < sizeof(handle->compressed_header))
+        {
+            return OTA_SERVICE_OK;
+        }
+
+        ota_service_err_t err = ota_service_begin_encoding(handle);
+        if (err != OTA_SERVICE_OK)
+        {
+            return err;
+        }
+    }
+
+    if (handle->encoding == OTA_ENCODING_DEFLATE)
+    {
+        return ota_service_inflate(handle, data, length);
+    }
+
+    return ota_service_process(handle, data, length);
+}
+
+static ota_service_err_t ota_service_finish(ota_state_handle_t handle)
+{
+    esp_err_t err;
+
+    if (handle->encoding == OTA_ENCODING_DEFLATE && !handle->inflater->done)
+    {
+        LOG_E(TAG, "Compressed firmware update ended before the end of the compressed data");
+        handle->progress = OTA_PROGRESS_OTA_FAILED;
+        metrics_counter_inc(&updatesFailedMetric);
+        return OTA_SERVICE_ERR_INCOMPLETE;
+    }
+
+    if (handle->progress != OTA_PROGRESS_DONE)
+    {
+        LOG_E(TAG, "Firmware update ended after %zu bytes, before all sections were written", handle->nr_of_bytes_processed);
+        handle->progress = OTA_PROGRESS_OTA_FAILED;
+        metrics_counter_inc(&updatesFailedMetric);
+        return OTA_SERVICE_ERR_INCOMPLETE;
+    }
+
+    // First end app update
+    err = ota_flash_app_end(handle->app_update_handle);
+    handle->app_update_begun = false;
+    if (err != ESP_OK) 
+    {
+        LOG_E(TAG, "esp_ota_end failed (%s)", esp_err_to_name(err));
+        handle->progress = OTA_PROGRESS_OTA_FAILED;
+        metrics_counter_inc(&updatesFailedMetric);
+        return OTA_SERVICE_ERR_OTA_END_FAILED;
+    }
+
+    // Set new boot partition
+    err = ota_flash_set_boot_partition(handle->app_update_partition);
+
+    const int64_t duration = esp_timer_get_time() - handle->start_time;
+    if (duration > 0)
+    {
+        metrics_gauge_set(&throughputMetric, (int32_t)((int64_t)handle->nr_of_bytes_processed * 1000000 / duration));
+    }
+
+    // What the writer task managed while it was busy is what the flash sustains, the rest of the time it waited for the network
+    if (handle->writer_busy_time > 0)
+    {
+        metrics_gauge_set(&writerThroughputMetric, (int32_t)((int64_t)handle->nr_of_bytes_processed * 1000000 / handle->writer_busy_time));
+    }
+
+    LOG_I(
+        TAG,
+        "Firmware update wrote %zu bytes from %zu received bytes (%u%%) in %" PRId64 " ms",
+        handle->nr_of_bytes_processed,
+        handle->nr_of_bytes_received,
+        handle->nr_of_bytes_processed > 0 ? (unsigned int)((uint64_t)handle->nr_of_bytes_received * 100 / handle->nr_of_bytes_processed) : 0,
+        duration / 1000);
+
+    LOG_I(
+        TAG,
+        "Writer task was busy for %" PRId64 " ms (%u%%), received data waited for a free buffer %zu times",
+        handle->writer_busy_time / 1000,
+        duration > 0 ? (unsigned int)(handle->writer_busy_time * 100 / duration) : 0,
+        handle->nr_of_stalls);
+
+    // Error checking
+    if (err != ESP_OK) 
+    {
+        LOG_E(TAG, "esp_ota_set_boot_partition failed");
+        metrics_counter_inc(&updatesFailedMetric);
+        return OTA_SERVICE_ERR_SET_BOOT_PARTITON_FAILED;
+    }
+
+    metrics_counter_inc(&updatesOkMetric);
+
+    LOG_I(TAG, "Firmware update done");
+    return OTA_SERVICE_OK;
+}
+
+// Publishes the progress for readers on other tasks and tells the listener, unless it was reported very recently
+static void ota_service_report_progress(ota_state_handle_t handle, bool running)
+{
+    const int64_t now = esp_timer_get_time();
+    const int64_t sinceReport = now - handle->report_time;
+
+    if (running && handle->progress == handle->report_state && sinceReport < OTA_PROGRESS_REPORT_INTERVAL_US)
+    {
+        return;
+    }
+
+    ota_service_err_t result = __atomic_load_n(&handle->result, __ATOMIC_ACQUIRE);
+    if (!running && result == OTA_SERVICE_OK && !handle->done)
+    {
+        // Abandoned before it finished
+        result = OTA_SERVICE_FAIL;
+    }
+
+    const ota_service_progress_t progress = {
+        .running = running,
+        .state = handle->progress,
+        .result = result,
+        .nr_of_bytes_processed = handle->nr_of_bytes_processed,
+        .nr_of_bytes_total = handle->nr_of_bytes_total,
+        .nr_of_bytes_received = handle->nr_of_bytes_received,
+        .throughput = sinceReport > 0 ? (uint32_t)((int64_t)(handle->nr_of_bytes_processed - handle->report_bytes) * 1000000 / sinceReport) : 0,
+        .elapsed_ms = (uint32_t)((now - handle->start_time) / 1000),
+        .erase_ms = (uint32_t)(handle->flash_timing.erase_time / 1000),
+        .write_ms = (uint32_t)(handle->flash_timing.write_time / 1000)
+    };
+
+    handle->report_time = now;
+    handle->report_bytes = handle->nr_of_bytes_processed;
+    handle->report_state = handle->progress;
+
+    portENTER_CRITICAL(&progressLock);
+    lastProgress = progress;
+    portEXIT_CRITICAL(&progressLock);
+
+    ota_service_progress_listener_t listener = __atomic_load_n(&progressListener, __ATOMIC_ACQUIRE);
+    if (listener != NULL)
+    {
+        listener(&progress);
+    }
+}
+
+static void ota_service_close(ota_state_handle_t handle)
+{
+    // Ending an incomplete update fails, but it does release the update handle
+    if (handle->app_update_begun)
+    {
+        ota_flash_app_end(handle->app_update_handle);
+    }
+
+    // Updates that finished or failed were already counted
+    if (!handle->done && handle->progress != OTA_PROGRESS_OTA_FAILED)
+    {
+        LOG_W(TAG, "Firmware update aborted after %zu bytes", handle->nr_of_bytes_processed);
+        metrics_counter_inc(&updatesFailedMetric);
+    }
+
+    ota_service_report_progress(handle, false);
+    ota_service_free(handle);
+}
+
+// Decodes the buffers of an update and writes them to flash, until the update is closed
+static void ota_service_writer_task(void* arg)
+{
+    ota_state_handle_t handle = (ota_state_handle_t)arg;
+    ota_writer_message_t message;
+
+    while (xQueueReceive(handle->writer_queue, &message, portMAX_DELAY) == pdTRUE && message.type != OTA_WRITER_MESSAGE_CLOSE)
+    {
+        const int64_t start = esp_timer_get_time();
+        ota_service_err_t err = handle->result;
+
+        // After a failure the buffers are only handed back, until the update is closed
+        if (err == OTA_SERVICE_OK)
+        {
+            err = message.type == OTA_WRITER_MESSAGE_DATA
+                ? ota_service_decode(handle, handle->buffers + message.buffer * OTA_BUFFER_SIZE, message.length)
+                : ota_service_finish(handle);
+        }
+
+        handle->writer_busy_time += esp_timer_get_time() - start;
+        __atomic_store_n(&handle->result, err, __ATOMIC_RELEASE);
+        ota_service_report_progress(handle, true);
+
+        if (message.type == OTA_WRITER_MESSAGE_DATA)
+        {
+            xQueueSend(handle->free_buffers, &message.buffer, 0);
+        }
+        else
+        {
+            __atomic_store_n(&handle->done, true, __ATOMIC_RELEASE);
+            xSemaphoreGive(handle->done_semaphore);
+        }
+
+        if (handle->notify != NULL)
+        {
+            handle->notify(handle->notify_user_data);
+        }
+    }
+
+    ota_service_close(handle);
+    vTaskDelete(NULL);
+}
+
+static void ota_service_send_to_writer(ota_state_handle_t handle, ota_writer_message_type_t type)
+{
+    const ota_writer_message_t message = {
+        .type = type,
+        .buffer = handle->fill_buffer,
+        .length = handle->fill_length
+    };
+
+    xQueueSend(handle->writer_queue, &message, 0);
+}
+
+ota_service_err_t ota_service_firmware_update_write(ota_state_handle_t handle, const char* data, size_t length, size_t* nrOfBytesAccepted)
+{
+    ota_service_err_t err = __atomic_load_n(&handle->result, __ATOMIC_ACQUIRE);
+    size_t nrOfBytesCopied = 0;
+
+    while (err == OTA_SERVICE_OK && nrOfBytesCopied < length)
+    {
+        if (handle->fill_buffer == OTA_NO_BUFFER)
+        {
+            if (xQueueReceive(handle->free_buffers, &handle->fill_buffer, 0) != pdTRUE)
+            {
+                handle->nr_of_stalls++;
+                metrics_counter_inc(&stallsMetric);
+
+                // A caller that can not wait is notified when the writer task frees a buffer
+                if (nrOfBytesAccepted != NULL || xQueueReceive(handle->free_buffers, &handle->fill_buffer, portMAX_DELAY) != pdTRUE)
+                {
+                    break;
+                }
+            }
+
+            handle->fill_length = 0;
+        }
+
+        const size_t nrOfBytesToCopy = min(length - nrOfBytesCopied, OTA_BUFFER_SIZE - handle->fill_length);
+        memcpy(handle->buffers + handle->fill_buffer * OTA_BUFFER_SIZE + handle->fill_length, data + nrOfBytesCopied, nrOfBytesToCopy);
+        handle->fill_length += nrOfBytesToCopy;
+        nrOfBytesCopied += nrOfBytesToCopy;
+
+        if (handle->fill_length == OTA_BUFFER_SIZE)
+        {
+            ota_service_send_to_writer(handle, OTA_WRITER_MESSAGE_DATA);
+            handle->fill_buffer = OTA_NO_BUFFER;
+        }
+    }
+
+    if (nrOfBytesAccepted != NULL)
+    {
+        *nrOfBytesAccepted = nrOfBytesCopied;
+    }
+
+    return err;
+}
+
+ota_service_err_t ota_service_firmware_update_finish(ota_state_handle_t handle)
+{
+    if (!handle->end_sent)
+    {
+        // The last buffer is only partly filled
+        if (handle->fill_buffer != OTA_NO_BUFFER)
+        {
+            ota_service_send_to_writer(handle, OTA_WRITER_MESSAGE_DATA);
+            handle->fill_buffer = OTA_NO_BUFFER;
+        }
+
+        ota_service_send_to_writer(handle, OTA_WRITER_MESSAGE_END);
+        handle->end_sent = true;
+    }
+
+    if (!__atomic_load_n(&handle->done, __ATOMIC_ACQUIRE))
+    {
+        return OTA_SERVICE_ERR_BUSY;
+    }
+
+    const ota_service_err_t err = handle->result;
+    ota_service_send_to_writer(handle, OTA_WRITER_MESSAGE_CLOSE);
+    return err;
+}
+
+ota_service_err_t ota_service_firmware_update_end(ota_state_handle_t handle)
+{
+    ota_service_err_t err = ota_service_firmware_update_finish(handle);
+    if (err == OTA_SERVICE_ERR_BUSY)
+    {
+        xSemaphoreTake(handle->done_semaphore, portMAX_DELAY);
+        err = ota_service_firmware_update_finish(handle);
+    }
+
+    return err;
+}
+
+void ota_service_firmware_update_abort(ota_state_handle_t handle)
+{
+    // The writer task owns the state from here on, it abandons the update once it is done with the buffers it already has
+    ota_service_send_to_writer(handle, OTA_WRITER_MESSAGE_CLOSE);
+}
+
+void ota_service_get_progress(ota_service_progress_t* progress)
+{
+    portENTER_CRITICAL(&progressLock);
+    *progress = lastProgress;
+    portEXIT_CRITICAL(&progressLock);
+}
+
+const char* ota_service_progress_state_name(ota_progress_state_t state)
+{
+    switch (state)
+    {
+    case OTA_PROGRESS_MANIFEST:
+        return "manifest";
+    case OTA_PROGRESS_SIGNATURE:
+        return "signature";
+    case OTA_PROGRESS_SPIFFS:
+        return "spiffs";
+    case OTA_PROGRESS_APP_HEADER:
+        return "app_header";
+    case OTA_PROGRESS_APP_DATA:
+        return "app_data";
+    case OTA_PROGRESS_APP_DELTA:
+        return "app_delta";
+    case OTA_PROGRESS_DONE:
+        return "done";
+    case OTA_PROGRESS_OTA_FAILED:
+    default:
+        return "failed";
+    }
+}
+
+void ota_service_set_progress_listener(ota_service_progress_listener_t listener)
+{
+    __atomic_store_n(&progressListener, listener, __ATOMIC_RELEASE);
 }
\ No newline at end of file
@@ -11,41 +11,174 @@ typedef enum
     OTA_SERVICE_FAIL = -1,
 
     OTA_SERVICE_ERR_OTA_END_FAILED = 1,
-    OTA_SERVICE_ERR_SET_BOOT_PARTITON_FAILED
+    OTA_SERVICE_ERR_SET_BOOT_PARTITON_FAILED,
+    OTA_SERVICE_ERR_INCOMPLETE,
+    OTA_SERVICE_ERR_INVALID_PACKAGE,
+    OTA_SERVICE_ERR_BASE_MISMATCH,
+    OTA_SERVICE_ERR_BUSY,
+    OTA_SERVICE_ERR_CORRUPT,
+    OTA_SERVICE_ERR_BAD_SIGNATURE,
+    OTA_SERVICE_ERR_IN_PROGRESS
 
 } ota_service_err_t;
 
+typedef enum ota_progress_state_e
+{
+    OTA_PROGRESS_MANIFEST,
+    OTA_PROGRESS_SIGNATURE,
+    OTA_PROGRESS_SPIFFS,
+    OTA_PROGRESS_APP_HEADER,
+    OTA_PROGRESS_APP_DATA,
+    OTA_PROGRESS_APP_DELTA,
+    OTA_PROGRESS_DONE,
+
+    OTA_PROGRESS_OTA_FAILED
+} ota_progress_state_t;
+
+/**
+ * @brief Progress of the running firmware update, or of the last one once it is no longer running.
+ * Byte counts are in package bytes, which is what is written for an uncompressed package.
+ */
+typedef struct ota_service_progress_s
+{
+    // False before the first update, and after an update finished or was abandoned
+    bool running;
+    ota_progress_state_t state;
+    // OTA_SERVICE_OK while running, the result of the update once it is no longer running
+    ota_service_err_t result;
+    uint32_t nr_of_bytes_processed;
+    // 0 until the manifest of the package was read
+    uint32_t nr_of_bytes_total;
+    // Bytes of the update file, less then the processed bytes for a compressed package
+    uint32_t nr_of_bytes_received;
+    // Over the last progress report
+    uint32_t throughput;
+    uint32_t elapsed_ms;
+    uint32_t erase_ms;
+    uint32_t write_ms;
+} ota_service_progress_t;
+
+/**
+ * @brief Called with the progress of a firmware update a few times per second, when its state changes and when it ends.
+ * Runs on the writer task of the update, it must not block.
+ *
+ * @param[in] progress The progress of the update, only valid during the call.
+ */
+typedef void (*ota_service_progress_listener_t)(const ota_service_progress_t* progress);
+
 typedef struct ota_state_s* ota_state_handle_t;
 
 /**
- * @brief Initializes a firmware update and allocates memory for the state pointed to by handle.
+ * @brief Called by the writer task of a firmware update when it freed a buffer, and when it finished the update.
+ * Runs on the writer task, it must not wait for the task that writes the update.
+ * 
+ * @param[in] userData The user data that was passed to ota_service_firmware_update_begin.
+ */
+typedef void (*ota_service_notify_t)(void* userData);
+
+/**
+ * @brief Registers the metrics of firmware updates, called once at startup before any update.
+ */
+void ota_service_init(void);
+
+/**
+ * @brief Initializes a firmware update, allocates memory for the state pointed to by handle
+ * and starts the writer task that writes the update to flash.
  * 
  * @param[out] handle Pointer to handle that will hold resources for the firmware update.
+ * @param[in] notify Called when the update can take more data or finished, may be NULL for callers that only use blocking writes.
+ * @param[in] userData Passed to notify.
  * 
- * @return ota_service_err_t OTA_SERVICE_OK if initialization succeeded, or
+ * @return ota_service_err_t OTA_SERVICE_OK if initialization succeeded,
+ * OTA_SERVICE_ERR_IN_PROGRESS if another update has not finished yet, or
  * OTA_SERVICE_FAIL if it did not.
  */
-ota_service_err_t ota_service_firmware_update_begin(ota_state_handle_t* handle);
+ota_service_err_t ota_service_firmware_update_begin(ota_state_handle_t* handle, ota_service_notify_t notify, void* userData);
 
 /**
  * @brief Write a chunck of data for the firmware.
+ * The data is copied into one of two sector sized buffers, the writer task decodes a full buffer and writes it to flash
+ * while the other one is filled, so the caller does not wait for the flash.
+ * The update is either the plain update package, or the compressed package which is decompressed as it is written.
+ * Which one it is follows from the first bytes that are written.
+ * A package starts with a manifest that lists its sections, only the bytes of those sections are erased and written.
+ * Spiffs sectors that already hold the bytes of the package are not erased or written at all.
+ * The app is either a full image, or a delta that is applied to the running image while it is written.
+ * Every section is hashed while it is written and checked against the manifest at its end, a signed package
+ * has its manifest checked against the signature before any section is written.
  * 
  * @param[in] handle Handle that holds resources for the firmware update.
  * @param[in] data The firware data bytes to write.
  * @param[in] length The amount of bytes in data.
- * @return ota_service_err_t
+ * @param[out] nrOfBytesAccepted How many bytes of data were accepted. When both buffers are full this is less then length,
+ * and notify is called once the writer task freed a buffer. If NULL, the call waits for the writer task until all data is accepted.
+ * @return ota_service_err_t OTA_SERVICE_OK if the data was accepted,
+ * OTA_SERVICE_ERR_INVALID_PACKAGE if the data is not a valid update package,
+ * OTA_SERVICE_ERR_BASE_MISMATCH if the package has an app delta for another firmware than the running one,
+ * OTA_SERVICE_ERR_CORRUPT if a section does not match its hash in the manifest,
+ * OTA_SERVICE_ERR_BAD_SIGNATURE if the signature of the package is not valid, or missing while signatures are required, or
+ * OTA_SERVICE_FAIL if writing failed.
+ * Errors are found by the writer task, so they are returned by the first write after the data that caused them.
+ */
+ota_service_err_t ota_service_firmware_update_write(ota_state_handle_t handle, const char* data, size_t length, size_t* nrOfBytesAccepted);
+
+/**
+ * @brief Finalizes the firmware update without waiting for the writer task.
+ * Returns OTA_SERVICE_ERR_BUSY as long as the writer task is still writing, notify is called when it is done
+ * and this is called again for the result. Once anything else is returned, the resources of the update are freed.
+ * 
+ * @param[in] handle Handle that holds resources for the firmware update.
+ * Will be invalid after this call returned anything but OTA_SERVICE_ERR_BUSY.
+ * 
+ * @return ota_service_err_t OTA_SERVICE_ERR_BUSY if the writer task is not done yet, or
+ * any of the results of ota_service_firmware_update_end.
  */
-ota_service_err_t ota_service_firmware_update_write(ota_state_handle_t handle, const char* data, size_t length);
+ota_service_err_t ota_service_firmware_update_finish(ota_state_handle_t handle);
 
 /**
- * @brief Finalizes the firmware update and frees resources of the state pointed to by handle.
+ * @brief Finalizes the firmware update, waits for the writer task and frees resources of the state pointed to by handle.
  * 
  * @param[in] handle Handle that holds resources for the firmware update.
  * Will be invalid after this call wether the update succeeded or not.
  * 
- * @return ota_service_err_t OTA_SERVICE_OK if finalization succeeded, or
- * OTA_SERVICE_ERR_SET_BOOT_PARTITON_FAILED if the new boot partition could not be set.
+ * @return ota_service_err_t OTA_SERVICE_OK if finalization succeeded,
+ * OTA_SERVICE_ERR_INCOMPLETE if the update ended before all sections were written,
+ * OTA_SERVICE_ERR_OTA_END_FAILED if the new app image is not valid,
+ * OTA_SERVICE_ERR_SET_BOOT_PARTITON_FAILED if the new boot partition could not be set, or
+ * any of the errors of ota_service_firmware_update_write.
  */
 ota_service_err_t ota_service_firmware_update_end(ota_state_handle_t handle);
 
+/**
+ * @brief Abandons an unfinished firmware update and frees resources of the state pointed to by handle.
+ * The boot partition is left as it is. The writer task frees the resources once it is done with the buffers it already has,
+ * the call does not wait for that.
+ * 
+ * @param[in] handle Handle that holds resources for the firmware update. Will be invalid after this call.
+ */
+void ota_service_firmware_update_abort(ota_state_handle_t handle);
+
+/**
+ * @brief Gets the progress of the running firmware update, or of the last one. Safe to call from any task.
+ *
+ * @param[out] progress The progress of the update.
+ */
+void ota_service_get_progress(ota_service_progress_t* progress);
+
+/**
+ * @brief Gets the name of a progress state, for clients that are shown the progress.
+ *
+ * @param[in] state The progress state.
+ *
+ * @return The name of the state, like "spiffs" or "app_data".
+ */
+const char* ota_service_progress_state_name(ota_progress_state_t state);
+
+/**
+ * @brief Sets the listener that is called with the progress of firmware updates. There is one listener, setting another replaces it.
+ *
+ * @param[in] listener The listener, or NULL to stop listening.
+ */
+void ota_service_set_progress_listener(ota_service_progress_listener_t listener);
+
 #endif // OTA_SERVICE_H
\ No newline at end of file
@@ -0,0 +1,509 @@
+#include "update_task.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+
+#include <esp_http_client.h>
+#include <esp_system.h>
+#include <nvs.h>
+#include <sdkconfig.h>
+#ifdef CONFIG_MBEDTLS_CERTIFICATE_BUNDLE
+#include <esp_crt_bundle.h>
+#endif
+
+#include <logger.h>
+#include <services/metrics_service.h>
+
+#define UPDATE_NAMESPACE    "update"
+#define LAST_MODIFIED_KEY   "modified"
+
+// Long enough for an http date
+#define LAST_MODIFIED_LENGTH 40
+
+// A request that does not get data for this long is retried
+#define UPDATE_REQUEST_TIMEOUT_MS 10000
+// The delay before a retry grows by this much with every retry, so a restarting server is not hammered
+#define UPDATE_RETRY_DELAY_MS 2000
+// Time the status of a finished update can be read before the system restarts into the new firmware
+#define UPDATE_RESTART_DELAY_MS 1000
+// Scheduled pulls of a fleet are spread over this long, so the devices do not all hit the server at once
+#define UPDATE_SCHEDULE_JITTER_S 60
+
+typedef struct update_request_s
+{
+    char url[UPDATE_TASK_MAX_URL_LENGTH];
+    // Scheduled pulls skip a package that was not modified since the last pulled update
+    bool if_modified;
+} update_request_t;
+
+// Headers of the current response, collected by the event handler of the http client
+typedef struct update_response_s
+{
+    char last_modified[LAST_MODIFIED_LENGTH];
+    // Start of the range the server sent, -1 if it sent the whole package
+    long range_start;
+} update_response_t;
+
+typedef struct update_pull_s
+{
+    ota_state_handle_t ota;
+    char* buffer;
+    update_response_t response;
+    // Identifies the package, so a download is not continued with another package
+    char last_modified[LAST_MODIFIED_LENGTH];
+    update_status_t status;
+} update_pull_t;
+
+// Result of a single request of a pull
+typedef enum fetch_result_e
+{
+    FETCH_DONE,
+    // The request failed or the connection dropped, the pull continues with another request
+    FETCH_RETRY,
+    FETCH_NOT_MODIFIED,
+    // Retrying would not help
+    FETCH_FAILED
+} fetch_result_t;
+
+static const char* TAG = UPDATE_TASK_TAG;
+
+static QueueHandle_t updateQueue = NULL;
+
+static portMUX_TYPE statusLock = portMUX_INITIALIZER_UNLOCKED;
+static update_status_t updateStatus = { .state = UPDATE_STATE_IDLE };
+
+static metric_counter_t pullsOkMetric = METRIC_COUNTER("tvlift_update_pulls_total", "Number of pulled firmware updates.", "result=\"ok\"");
+static metric_counter_t pullsUpToDateMetric = METRIC_COUNTER("tvlift_update_pulls_total", "Number of pulled firmware updates.", "result=\"up_to_date\"");
+static metric_counter_t pullsFailedMetric = METRIC_COUNTER("tvlift_update_pulls_total", "Number of pulled firmware updates.", "result=\"failed\"");
+static metric_counter_t retriesMetric = METRIC_COUNTER("tvlift_update_retries_total", "Number of requests of pulled firmware updates that were retried.", NULL);
+
+static void publish_status(const update_status_t* status)
+{
+    portENTER_CRITICAL(&statusLock);
+    updateStatus = *status;
+    portEXIT_CRITICAL(&statusLock);
+}
+
+static bool load_last_modified(char* lastModified)
+{
+    nvs_handle_t handle;
+    size_t length = LAST_MODIFIED_LENGTH;
+
+    if (nvs_open(UPDATE_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+    {
+        return false;
+    }
+
+    esp_err_t err = nvs_get_str(handle, LAST_MODIFIED_KEY, lastModified, &length);
+    nvs_close(handle);
+
+    return err == ESP_OK;
+}
+
+static void store_last_modified(const char* lastModified)
+{
+    nvs_handle_t handle;
+
+    if (nvs_open(UPDATE_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+    {
+        LOG_W(TAG, "Can not open nvs, the next scheduled pull installs the same update again");
+        return;
+    }
+
+    if (nvs_set_str(handle, LAST_MODIFIED_KEY, lastModified) != ESP_OK || nvs_commit(handle) != ESP_OK)
+    {
+        LOG_W(TAG, "Can not store when the update was modified, the next scheduled pull installs it again");
+    }
+
+    nvs_close(handle);
+}
+
+static esp_err_t on_http_event(esp_http_client_event_t* event)
+{
+    update_response_t* response = (update_response_t*)event->user_data;
+
+    if (event->event_id != HTTP_EVENT_ON_HEADER)
+    {
+        return ESP_OK;
+    }
+
+    if (strcasecmp(event->header_key, "Last-Modified") == 0)
+    {
+        strlcpy(response->last_modified, event->header_value, sizeof(response->last_modified));
+    }
+    else if (strcasecmp(event->header_key, "Content-Range") == 0)
+    {
+        // bytes <start>-<end>/<length>
+        if (sscanf(event->header_value, "bytes %ld-", &response->range_start) != 1)
+        {
+            response->range_start = -1;
+        }
+    }
+
+    return ESP_OK;
+}
+
+static fetch_result_t fetch(esp_http_client_handle_t client, update_pull_t* pull)
+{
+    update_status_t* status = &pull->status;
+    update_response_t* response = &pull->response;
+
+    response->last_modified[0] = '\0';
+    response->range_start = -1;
+
+    if (status->offset > 0)
+    {
+        char range[24];
+        snprintf(range, sizeof(range), "bytes=%u-", status->offset);
+        esp_http_client_set_header(client, "Range", range);
+
+        // The server only sends the rest if the package did not change, the whole package otherwise
+        if (pull->last_modified[0] != '\0')
+        {
+            esp_http_client_set_header(client, "If-Range", pull->last_modified);
+        }
+    }
+
+    esp_err_t err = esp_http_client_open(client, 0);
+    if (err != ESP_OK)
+    {
+        LOG_W(TAG, "Can not connect to the update server: %s", esp_err_to_name(err));
+        status->http_status = 0;
+        return FETCH_RETRY;
+    }
+
+    const int contentLength = esp_http_client_fetch_headers(client);
+    status->http_status = esp_http_client_get_status_code(client);
+
+    if (status->http_status == 304)
+    {
+        return FETCH_NOT_MODIFIED;
+    }
+
+    if (status->http_status >= 500)
+    {
+        LOG_W(TAG, "Update server responded with %d", status->http_status);
+        return FETCH_RETRY;
+    }
+
+    if (status->http_status != 200 && status->http_status != 206)
+    {
+        LOG_E(TAG, "Update server responded with %d", status->http_status);
+        return FETCH_FAILED;
+    }
+
+    if (contentLength <= 0)
+    {
+        LOG_E(TAG, "Update server did not send the length of the package");
+        return FETCH_FAILED;
+    }
+
+    // Servers without range support send the whole package again, the part that was already written is skipped
+    size_t nrOfBytesToSkip = status->offset;
+    uint32_t length = contentLength;
+    if (status->http_status == 206)
+    {
+        if (response->range_start != (long)status->offset)
+        {
+            LOG_E(TAG, "Update server sent a range that starts at %ld instead of %u", response->range_start, status->offset);
+            return FETCH_FAILED;
+        }
+
+        nrOfBytesToSkip = 0;
+        length = status->offset + contentLength;
+    }
+
+    if (status->length == 0)
+    {
+        status->length = length;
+        strlcpy(pull->last_modified, response->last_modified, sizeof(pull->last_modified));
+    }
+    else if (length != status->length || strcmp(pull->last_modified, response->last_modified) != 0)
+    {
+        LOG_E(TAG, "Update package changed on the server during the download");
+        return FETCH_FAILED;
+    }
+
+    // Nothing is written to flash before the server answered, so a package that is not modified costs no erases
+    if (pull->ota == NULL)
+    {
+        status->ota_result = ota_service_firmware_update_begin(&pull->ota, NULL, NULL);
+        if (status->ota_result != OTA_SERVICE_OK)
+        {
+            pull->ota = NULL;
+            return FETCH_FAILED;
+        }
+
+        LOG_I(TAG, "Pulling update package of %u bytes", status->length);
+    }
+
+    publish_status(status);
+
+    while (status->offset < status->length)
+    {
+        const int nrOfBytesRead = esp_http_client_read(client, pull->buffer, CONFIG_OTA_PULL_CHUNK_SIZE);
+        if (nrOfBytesRead <= 0)
+        {
+            LOG_W(TAG, "Connection to the update server dropped at %u of %u bytes", status->offset, status->length);
+            return FETCH_RETRY;
+        }
+
+        const size_t nrOfBytesSkipped = nrOfBytesToSkip < (size_t)nrOfBytesRead ? nrOfBytesToSkip : (size_t)nrOfBytesRead;
+        nrOfBytesToSkip -= nrOfBytesSkipped;
+        if (nrOfBytesSkipped == (size_t)nrOfBytesRead)
+        {
+            continue;
+        }
+
+        // Waits while the writer task has no free buffer, which holds back reading from the server
+        status->ota_result = ota_service_firmware_update_write(pull->ota, pull->buffer + nrOfBytesSkipped, nrOfBytesRead - nrOfBytesSkipped, NULL);
+        if (status->ota_result != OTA_SERVICE_OK)
+        {
+            return FETCH_FAILED;
+        }
+
+        status->offset += nrOfBytesRead - nrOfBytesSkipped;
+        status->retries = 0;
+        publish_status(status);
+    }
+
+    return FETCH_DONE;
+}
+
+static update_state_t pull(const update_request_t* request)
+{
+    update_pull_t pull = {
+        .ota = NULL,
+        .last_modified = { 0 },
+        .status = {
+            .state = UPDATE_STATE_DOWNLOADING,
+            .offset = 0,
+            .length = 0,
+            .retries = 0,
+            .http_status = 0,
+            .ota_result = OTA_SERVICE_OK
+        }
+    };
+    strlcpy(pull.status.url, request->url, sizeof(pull.status.url));
+
+    LOG_I(TAG, "Pulling update from %s", request->url);
+
+    pull.buffer = (char*)malloc(CONFIG_OTA_PULL_CHUNK_SIZE);
+    if (pull.buffer == NULL)
+    {
+        LOG_E(TAG, "Can not allocate memory to download the update");
+        pull.status.state = UPDATE_STATE_FAILED;
+        publish_status(&pull.status);
+        return pull.status.state;
+    }
+
+    const esp_http_client_config_t config = {
+        .url = request->url,
+        .timeout_ms = UPDATE_REQUEST_TIMEOUT_MS,
+        .event_handler = on_http_event,
+        .user_data = &pull.response,
+#ifdef CONFIG_MBEDTLS_CERTIFICATE_BUNDLE
+        .crt_bundle_attach = esp_crt_bundle_attach,
+#endif
+    };
+
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client == NULL)
+    {
+        LOG_E(TAG, "Can not create a http client for %s", request->url);
+        free(pull.buffer);
+        pull.status.state = UPDATE_STATE_FAILED;
+        publish_status(&pull.status);
+        return pull.status.state;
+    }
+
+    char lastModified[LAST_MODIFIED_LENGTH];
+    if (request->if_modified && load_last_modified(lastModified))
+    {
+        esp_http_client_set_header(client, "If-Modified-Since", lastModified);
+    }
+
+    fetch_result_t result;
+    while ((result = fetch(client, &pull)) == FETCH_RETRY)
+    {
+        esp_http_client_close(client);
+
+        if (pull.status.retries == CONFIG_OTA_PULL_RETRIES)
+        {
+            LOG_E(TAG, "Giving up on the update after %u retries", pull.status.retries);
+            result = FETCH_FAILED;
+            break;
+        }
+
+        pull.status.retries++;
+        metrics_counter_inc(&retriesMetric);
+        publish_status(&pull.status);
+
+        const uint32_t delay = UPDATE_RETRY_DELAY_MS * pull.status.retries;
+        LOG_W(TAG, "Retrying at %u of %u bytes in %u ms", pull.status.offset, pull.status.length, delay);
+        vTaskDelay(pdMS_TO_TICKS(delay));
+    }
+
+    esp_http_client_cleanup(client);
+    free(pull.buffer);
+
+    if (result == FETCH_DONE)
+    {
+        pull.status.ota_result = ota_service_firmware_update_end(pull.ota);
+        pull.ota = NULL;
+    }
+    else if (pull.ota != NULL)
+    {
+        ota_service_firmware_update_abort(pull.ota);
+        pull.ota = NULL;
+    }
+
+    if (result == FETCH_NOT_MODIFIED)
+    {
+        LOG_I(TAG, "Update package was not modified since the last update");
+        pull.status.state = UPDATE_STATE_UP_TO_DATE;
+    }
+    else if (result == FETCH_DONE && pull.status.ota_result == OTA_SERVICE_OK)
+    {
+        LOG_I(TAG, "Update of %u bytes installed", pull.status.length);
+        if (pull.last_modified[0] != '\0')
+        {
+            store_last_modified(pull.last_modified);
+        }
+        pull.status.state = UPDATE_STATE_DONE;
+    }
+    else
+    {
+        LOG_E(TAG, "Pulling update failed with ota result %d", pull.status.ota_result);
+        pull.status.state = UPDATE_STATE_FAILED;
+    }
+
+    publish_status(&pull.status);
+    return pull.status.state;
+}
+
+static update_task_err_t start_pull(const char* url, bool ifModified)
+{
+    update_request_t request = {
+        .if_modified = ifModified
+    };
+
+    if (url == NULL)
+    {
+        url = CONFIG_OTA_PULL_URL;
+    }
+
+    if (url[0] == '\0')
+    {
+        return UPDATE_TASK_ERR_NO_URL;
+    }
+
+    if (updateQueue == NULL || strlcpy(request.url, url, sizeof(request.url)) >= sizeof(request.url))
+    {
+        return UPDATE_TASK_FAIL;
+    }
+
+    // Claimed before it is queued, so a second pull is refused until this one finished
+    bool isBusy;
+    portENTER_CRITICAL(&statusLock);
+    isBusy = updateStatus.state == UPDATE_STATE_DOWNLOADING || updateStatus.state == UPDATE_STATE_DONE;
+    if (!isBusy)
+    {
+        updateStatus.state = UPDATE_STATE_DOWNLOADING;
+        strlcpy(updateStatus.url, request.url, sizeof(updateStatus.url));
+        updateStatus.offset = 0;
+        updateStatus.length = 0;
+        updateStatus.retries = 0;
+        updateStatus.http_status = 0;
+        updateStatus.ota_result = OTA_SERVICE_OK;
+    }
+    portEXIT_CRITICAL(&statusLock);
+
+    if (isBusy)
+    {
+        return UPDATE_TASK_ERR_BUSY;
+    }
+
+    // The queue has room for one request and only a claimed pull is queued, so this does not wait
+    xQueueSend(updateQueue, &request, 0);
+    return UPDATE_TASK_OK;
+}
+
+static TickType_t time_to_next_scheduled_pull(void)
+{
+    if (CONFIG_OTA_PULL_INTERVAL_MIN == 0 || CONFIG_OTA_PULL_URL[0] == '\0')
+    {
+        return portMAX_DELAY;
+    }
+
+    // In seconds, the interval in milliseconds overflows the tick count
+    return (TickType_t)CONFIG_OTA_PULL_INTERVAL_MIN * 60 * configTICK_RATE_HZ
+        + esp_random() % (UPDATE_SCHEDULE_JITTER_S * configTICK_RATE_HZ);
+}
+
+update_task_err_t update_task_pull(const char* url)
+{
+    return start_pull(url, false);
+}
+
+void update_task_get_status(update_status_t* status)
+{
+    portENTER_CRITICAL(&statusLock);
+    *status = updateStatus;
+    portEXIT_CRITICAL(&statusLock);
+}
+
+void update_task_main(void* pvParameters)
+{
+    LOG_I(TAG, "Starting task");
+
+    metrics_service_register(&pullsOkMetric.metric);
+    metrics_service_register(&pullsUpToDateMetric.metric);
+    metrics_service_register(&pullsFailedMetric.metric);
+    metrics_service_register(&retriesMetric.metric);
+
+    updateQueue = xQueueCreate(1, sizeof(update_request_t));
+    if (updateQueue == NULL)
+    {
+        LOG_E(TAG, "Can not create the update queue");
+        vTaskDelete(NULL);
+        return;
+    }
+
+    while (1)
+    {
+        update_request_t request;
+        if (xQueueReceive(updateQueue, &request, time_to_next_scheduled_pull()) != pdTRUE)
+        {
+            // The pull is picked up by the next receive, unless one was requested in the meantime
+            start_pull(NULL, true);
+            continue;
+        }
+
+        switch (pull(&request))
+        {
+        case UPDATE_STATE_DONE:
+            metrics_counter_inc(&pullsOkMetric);
+            LOG_I(TAG, "Restarting system!");
+            vTaskDelay(pdMS_TO_TICKS(UPDATE_RESTART_DELAY_MS));
+            esp_restart();
+            break;
+
+        case UPDATE_STATE_UP_TO_DATE:
+            metrics_counter_inc(&pullsUpToDateMetric);
+            break;
+
+        default:
+            metrics_counter_inc(&pullsFailedMetric);
+            break;
+        }
+    }
+
+    vTaskDelete(NULL);
+}
\ No newline at end of file
@@ -0,0 +1,76 @@
+#ifndef UPDATE_TASK_H
+#define UPDATE_TASK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <services/ota_service.h>
+
+#define UPDATE_TASK_TAG "Update"
+// The http client needs room for a tls handshake when the update server uses https
+#define UPDATE_TASK_STACK_SIZE_KB 8
+
+// Long enough for the url of an update package on a local server
+#define UPDATE_TASK_MAX_URL_LENGTH 128
+
+typedef enum
+{
+    UPDATE_TASK_OK = 0,
+    UPDATE_TASK_FAIL = -1,
+
+    UPDATE_TASK_ERR_BUSY = 1,
+    UPDATE_TASK_ERR_NO_URL
+
+} update_task_err_t;
+
+typedef enum update_state_e
+{
+    UPDATE_STATE_IDLE,
+    UPDATE_STATE_DOWNLOADING,
+    // The server had no newer package then the one that was installed last
+    UPDATE_STATE_UP_TO_DATE,
+    // The update was installed, the system restarts into it
+    UPDATE_STATE_DONE,
+    UPDATE_STATE_FAILED
+} update_state_t;
+
+typedef struct update_status_s
+{
+    update_state_t state;
+    char url[UPDATE_TASK_MAX_URL_LENGTH];
+    // Bytes of the package written so far, and its length once the server sent it
+    uint32_t offset;
+    uint32_t length;
+    // Requests that failed since the download last made progress
+    uint32_t retries;
+    // Status code of the last response, 0 if the server could not be reached
+    int http_status;
+    ota_service_err_t ota_result;
+} update_status_t;
+
+void update_task_main(void* pvParameters);
+
+/**
+ * @brief Asks the update task to pull an update package from a server and install it.
+ * The package is downloaded in chunks and streamed into the ota service as it arrives. A dropped connection is
+ * retried and continued with a range request from where it stopped, servers that ignore the range are also fine.
+ * A package that was not modified since the last pulled update is still installed, unlike a scheduled pull.
+ * The system restarts into the new firmware once the update was installed.
+ *
+ * @param[in] url Url of the update package, or NULL for the url from the configuration. Copied, so it need not outlive the call.
+ *
+ * @return update_task_err_t UPDATE_TASK_OK if the pull was started,
+ * UPDATE_TASK_ERR_BUSY if a pull is already in progress,
+ * UPDATE_TASK_ERR_NO_URL if no url was given and none is configured, or
+ * UPDATE_TASK_FAIL if the url is too long or the task is not running.
+ */
+update_task_err_t update_task_pull(const char* url);
+
+/**
+ * @brief Gets the progress of the current pull, or the result of the last one. Safe to call from any task.
+ *
+ * @param[out] status The status of the pull.
+ */
+void update_task_get_status(update_status_t* status);
+
+#endif // UPDATE_TASK_H
\ No newline at end of file
@@ -0,0 +1,146 @@
+#include "connection_manager.h"
+
+#include <sdkconfig.h>
+
+#include <logger.h>
+
+#include "static_file_server.h"
+#include "controllers/controller_base.h"
+
+#define MAX_CONNECTIONS     CONFIG_WEBSERVER_MAX_CONNECTIONS
+#define IDLE_TIMEOUT_S      CONFIG_WEBSERVER_IDLE_TIMEOUT_S
+#define SEND_BUFFER_LIMIT   CONFIG_WEBSERVER_SEND_BUFFER_LIMIT
+#define RECV_BUFFER_LIMIT   CONFIG_WEBSERVER_RECV_BUFFER_LIMIT
+
+// A connection needs to be idle for at least this long before it can be evicted to make room for a new one
+#define MIN_EVICTION_IDLE_S 1
+
+static const char TAG[] = "Connection Manager";
+
+static struct mg_mgr* connectionManager = NULL;
+static connection_stats_t stats = {
+    .max_connections = MAX_CONNECTIONS
+};
+
+static bool is_idle_http_connection(const struct mg_connection* nc, time_t now, time_t minIdleTime)
+{
+    // Only accepted connections count, not the listening socket or internal sockets
+    return nc->listener != NULL &&
+        !(nc->flags & (MG_F_IS_WEBSOCKET | MG_F_CLOSE_IMMEDIATELY | MG_F_SEND_AND_CLOSE)) &&
+        nc->send_mbuf.len == 0 &&
+        nc->recv_mbuf.len == 0 &&
+        !static_file_server_is_transferring(nc) &&
+        !stream_request_is_paused(nc) &&
+        now - nc->last_io_time >= minIdleTime;
+}
+
+static struct mg_connection* find_least_recently_used(const struct mg_connection* except)
+{
+    time_t now = (time_t) mg_time();
+
+    struct mg_connection* leastRecentlyUsed = NULL;
+    for (struct mg_connection* nc = mg_next(connectionManager, NULL); nc != NULL; nc = mg_next(connectionManager, nc))
+    {
+        if (nc != except &&
+            is_idle_http_connection(nc, now, MIN_EVICTION_IDLE_S) &&
+            (leastRecentlyUsed == NULL || nc->last_io_time < leastRecentlyUsed->last_io_time))
+        {
+            leastRecentlyUsed = nc;
+        }
+    }
+
+    return leastRecentlyUsed;
+}
+
+static void handle_accept(struct mg_connection* nc)
+{
+    nc->recv_mbuf_limit = RECV_BUFFER_LIMIT;
+
+    stats.connections++;
+    if (stats.connections > stats.peak_connections)
+    {
+        stats.peak_connections = stats.connections;
+    }
+
+    if (stats.connections <= MAX_CONNECTIONS)
+    {
+        return;
+    }
+
+    struct mg_connection* leastRecentlyUsed = find_least_recently_used(nc);
+    if (leastRecentlyUsed != NULL)
+    {
+        LOG_D(TAG, "Connection budget of %d exceeded, evicting least recently used connection", MAX_CONNECTIONS);
+        leastRecentlyUsed->flags |= MG_F_CLOSE_IMMEDIATELY;
+        stats.evictions++;
+    }
+    else
+    {
+        LOG_W(TAG, "Connection budget of %d exceeded and no connection is idle, refusing connection", MAX_CONNECTIONS);
+        nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+        stats.refused++;
+    }
+}
+
+void connection_manager_start(struct mg_mgr* manager)
+{
+    connectionManager = manager;
+    stats.connections = 0;
+}
+
+void connection_manager_stop(void)
+{
+    connectionManager = NULL;
+    stats.connections = 0;
+}
+
+void connection_manager_handle_event(struct mg_connection* nc, int ev)
+{
+    if (nc->listener == NULL)
+    {
+        return;
+    }
+
+    if (ev == MG_EV_ACCEPT)
+    {
+        handle_accept(nc);
+    }
+    else if (ev == MG_EV_CLOSE && stats.connections > 0)
+    {
+        stats.connections--;
+    }
+}
+
+void connection_manager_poll(void)
+{
+    if (connectionManager == NULL)
+    {
+        return;
+    }
+
+    time_t now = (time_t) mg_time();
+    for (struct mg_connection* nc = mg_next(connectionManager, NULL); nc != NULL; nc = mg_next(connectionManager, nc))
+    {
+        if (is_idle_http_connection(nc, now, IDLE_TIMEOUT_S))
+        {
+            nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+            stats.idle_closed++;
+        }
+    }
+}
+
+bool connection_manager_can_send(const struct mg_connection* nc, size_t length)
+{
+    if (nc->send_mbuf.len + length > SEND_BUFFER_LIMIT)
+    {
+        stats.dropped_frames++;
+        return false;
+    }
+
+    return true;
+}
+
+void connection_manager_get_stats(connection_stats_t* connectionStats)
+{
+    *connectionStats = stats;
+}
\ No newline at end of file
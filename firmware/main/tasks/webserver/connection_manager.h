@@ -0,0 +1,69 @@
+#ifndef CONNECTION_MANAGER_H
+#define CONNECTION_MANAGER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mongoose.h>
+
+typedef struct connection_stats_s
+{
+    uint32_t connections;
+    uint32_t peak_connections;
+    uint32_t max_connections;
+    uint32_t evictions;
+    uint32_t refused;
+    uint32_t idle_closed;
+    uint32_t dropped_frames;
+} connection_stats_t;
+
+/**
+ * @brief Starts managing the connections accepted by the given manager.
+ * 
+ * @param[in] manager The manager whose connections are managed.
+ */
+void connection_manager_start(struct mg_mgr* manager);
+
+/**
+ * @brief Stops managing connections. Must be called after the manager has been freed.
+ */
+void connection_manager_stop(void);
+
+/**
+ * @brief Keeps track of accepted and closed connections, and enforces the connection budget on every accept.
+ * When the budget is exceeded the least recently used idle http connection is evicted,
+ * or the new connection is refused if no connection is idle.
+ * Must be called for every event of connections that are accepted by the manager.
+ * 
+ * @param[in] nc The connection the event occured on.
+ * @param[in] ev The mongoose event.
+ */
+void connection_manager_handle_event(struct mg_connection* nc, int ev);
+
+/**
+ * @brief Closes http connections that have been idle for longer than the idle timeout.
+ * Websockets are never closed for being idle. Must be called regularly from the webserver thread.
+ */
+void connection_manager_poll(void);
+
+/**
+ * @brief Checks if data can be queued on a connection without exceeding its send buffer limit.
+ * Data that does not fit is counted as a dropped frame.
+ * 
+ * @param[in] nc The connection to send on.
+ * @param[in] length The number of bytes to send.
+ * 
+ * @return true if the data fits and can be sent, or
+ * false if the data must be dropped.
+ */
+bool connection_manager_can_send(const struct mg_connection* nc, size_t length);
+
+/**
+ * @brief Gets the current connection statistics.
+ * 
+ * @param[out] stats The connection statistics.
+ */
+void connection_manager_get_stats(connection_stats_t* stats);
+
+#endif // CONNECTION_MANAGER_H
\ No newline at end of file
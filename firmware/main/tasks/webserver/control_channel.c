@@ -0,0 +1,163 @@
+#include "control_channel.h"
+
+#include <assert.h>
+
+#include <logger.h>
+#include <lift/lift.h>
+#include <services/lift_service.h>
+
+// Marks connections that are on the control channel
+#define MG_F_CONTROL_CHANNEL MG_F_USER_2
+
+// Upper bound on the frames in a single websocket message, so one message can not stall the webserver
+#define MAX_FRAMES_PER_MESSAGE 16
+
+static_assert(sizeof(control_frame_t) == CONTROL_FRAME_SIZE, "control_frame_t does not match the control protocol");
+
+static const char TAG[] = "Control Channel";
+
+static control_result_t lift_err_to_control_result(lift_err_t liftErr)
+{
+    switch (liftErr)
+    {
+    case LIFT_OK:
+        return CONTROL_RESULT_OK;
+
+    case LIFT_AT_ENDSTOP:
+        return CONTROL_RESULT_AT_ENDSTOP;
+
+    case LIFT_SPEED_TOO_HIGH:
+        return CONTROL_RESULT_SPEED_TOO_HIGH;
+
+    case LIFT_SPEED_TOO_LOW:
+        return CONTROL_RESULT_SPEED_TOO_LOW;
+
+    default:
+        return CONTROL_RESULT_FAIL;
+    }
+}
+
+static lift_err_t set_speed_if_given(lift_device_handle_t liftHandle, uint32_t speed)
+{
+    return speed == 0 ? LIFT_OK : lift_set_speed(liftHandle, speed);
+}
+
+static control_result_t execute_command(const control_frame_t* command)
+{
+    if (command->opcode == CONTROL_OPCODE_PING)
+    {
+        return CONTROL_RESULT_OK;
+    }
+
+    lift_device_handle_t liftHandle = lift_service_get_lift_device_handle();
+    if (liftHandle == NULL)
+    {
+        return CONTROL_RESULT_LIFT_OFFLINE;
+    }
+
+    lift_err_t liftErr;
+    switch (command->opcode)
+    {
+    case CONTROL_OPCODE_UP:
+        liftErr = set_speed_if_given(liftHandle, command->payload);
+        if (liftErr == LIFT_OK)
+        {
+            liftErr = lift_up(liftHandle);
+        }
+        break;
+
+    case CONTROL_OPCODE_DOWN:
+        liftErr = set_speed_if_given(liftHandle, command->payload);
+        if (liftErr == LIFT_OK)
+        {
+            liftErr = lift_down(liftHandle);
+        }
+        break;
+
+    case CONTROL_OPCODE_STOP:
+        liftErr = lift_stop(liftHandle);
+        break;
+
+    case CONTROL_OPCODE_SET_SPEED:
+        liftErr = lift_set_speed(liftHandle, command->payload);
+        break;
+
+    case CONTROL_OPCODE_MOVE_TO:
+        liftErr = lift_move_to(liftHandle, (int32_t)command->payload);
+        break;
+
+    default:
+        return CONTROL_RESULT_UNKNOWN_OPCODE;
+    }
+
+    return lift_err_to_control_result(liftErr);
+}
+
+static void handle_message(struct mg_connection* nc, const struct websocket_message* wm)
+{
+    size_t nrOfFrames = wm->size / CONTROL_FRAME_SIZE;
+    if ((wm->flags & 0x0F) != WEBSOCKET_OP_BINARY || wm->size % CONTROL_FRAME_SIZE != 0 || nrOfFrames > MAX_FRAMES_PER_MESSAGE)
+    {
+        LOG_W(TAG, "Invalid control message of %u bytes, closing connection", wm->size);
+        mg_send_websocket_frame(nc, WEBSOCKET_OP_CLOSE, NULL, 0);
+        nc->flags |= MG_F_SEND_AND_CLOSE;
+        return;
+    }
+
+    // Ack all frames of a message with a single websocket message
+    control_frame_t acks[MAX_FRAMES_PER_MESSAGE];
+    const control_frame_t* commands = (const control_frame_t*) wm->data;
+    for (size_t i = 0; i < nrOfFrames; ++i)
+    {
+        acks[i].opcode = commands[i].opcode | CONTROL_OPCODE_ACK;
+        acks[i].result = execute_command(&commands[i]);
+        acks[i].sequence = commands[i].sequence;
+
+        lift_device_handle_t liftHandle = lift_service_get_lift_device_handle();
+        acks[i].payload = liftHandle == NULL ? 0 : lift_get_speed(liftHandle);
+
+        LOG_D(TAG, "Command %u, sequence %u: result %u", commands[i].opcode, commands[i].sequence, acks[i].result);
+    }
+
+    mg_send_websocket_frame(nc, WEBSOCKET_OP_BINARY, acks, nrOfFrames * CONTROL_FRAME_SIZE);
+}
+
+bool control_channel_handle_event(struct mg_connection* nc, int ev, void* ev_data)
+{
+    switch (ev)
+    {
+    case MG_EV_WEBSOCKET_HANDSHAKE_REQUEST:
+    {
+        // Remember which websockets are for the control channel, the uri is only known during the handshake
+        struct http_message* message = (struct http_message*) ev_data;
+        if (mg_vcmp(&message->uri, CONTROL_CHANNEL_URI) == 0)
+        {
+            nc->flags |= MG_F_CONTROL_CHANNEL;
+            return true;
+        }
+        return false;
+    }
+
+    case MG_EV_WEBSOCKET_HANDSHAKE_DONE:
+        if (nc->flags & MG_F_CONTROL_CHANNEL)
+        {
+            LOG_I(TAG, "Control channel connect");
+            return true;
+        }
+        return false;
+
+    case MG_EV_WEBSOCKET_FRAME:
+        if (nc->flags & MG_F_CONTROL_CHANNEL)
+        {
+            handle_message(nc, (struct websocket_message*) ev_data);
+            return true;
+        }
+        return false;
+
+    case MG_EV_CLOSE:
+        return (nc->flags & MG_F_CONTROL_CHANNEL) != 0;
+
+    default:
+        return false;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,66 @@
+#ifndef CONTROL_CHANNEL_H
+#define CONTROL_CHANNEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <mongoose.h>
+
+#define CONTROL_CHANNEL_URI "/api/control"
+
+// Binary control protocol, spoken over binary websocket frames on CONTROL_CHANNEL_URI.
+// Every command and every ack is a fixed size frame of CONTROL_FRAME_SIZE bytes, all values little endian.
+// A websocket message can carry several frames back to back, each one is acked in order.
+//
+// Command: opcode (1), reserved (1), sequence (2), payload (4)
+// Ack:     opcode | CONTROL_OPCODE_ACK (1), result (1), sequence (2), payload (4)
+//
+// The sequence number is chosen by the client and echoed in the ack.
+// The payload of an ack is the speed of the lift after executing the command.
+#define CONTROL_FRAME_SIZE 8
+
+typedef enum control_opcode_e
+{
+    CONTROL_OPCODE_PING = 0x00,         // Payload ignored, acks without touching the lift
+    CONTROL_OPCODE_UP = 0x01,           // Payload is the speed, 0 keeps the current speed
+    CONTROL_OPCODE_DOWN = 0x02,         // Payload is the speed, 0 keeps the current speed
+    CONTROL_OPCODE_STOP = 0x03,         // Payload ignored
+    CONTROL_OPCODE_SET_SPEED = 0x04,    // Payload is the speed
+    CONTROL_OPCODE_MOVE_TO = 0x05,      // Payload is the position, signed
+
+    CONTROL_OPCODE_ACK = 0x80
+} control_opcode_t;
+
+typedef enum control_result_e
+{
+    CONTROL_RESULT_OK = 0,
+    CONTROL_RESULT_FAIL,
+    CONTROL_RESULT_UNKNOWN_OPCODE,
+    CONTROL_RESULT_LIFT_OFFLINE,
+    CONTROL_RESULT_AT_ENDSTOP,
+    CONTROL_RESULT_SPEED_TOO_HIGH,
+    CONTROL_RESULT_SPEED_TOO_LOW
+} control_result_t;
+
+typedef struct __attribute__((packed)) control_frame_s
+{
+    uint8_t  opcode;
+    uint8_t  result;
+    uint16_t sequence;
+    uint32_t payload;
+} control_frame_t;
+
+/**
+ * @brief Handles websocket events of connections to CONTROL_CHANNEL_URI.
+ * Executes the commands in every binary frame and sends back an ack per command.
+ * 
+ * @param[in] nc The connection the event occured on.
+ * @param[in] ev The mongoose event.
+ * @param[in] ev_data The mongoose event data.
+ * 
+ * @return true if the event belonged to the control channel and was handled, or
+ * false if the event should be handled by someone else.
+ */
+bool control_channel_handle_event(struct mg_connection* nc, int ev, void* ev_data);
+
+#endif // CONTROL_CHANNEL_H
\ No newline at end of file
@@ -0,0 +1,454 @@
+#include "batch_controller.h"
+#include "controller_base.h"
+#include "controller_json.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <logger.h>
+#include <lift/lift.h>
+#include <services/lift_service.h>
+#include <services/settings_service.h>
+
+#define controllerUri "/batch"
+
+#define MAX_OPERATIONS 8
+
+// Large enough for the results of MAX_OPERATIONS operations
+#define BATCH_RESPONSE_BUFFER_SIZE 512
+
+typedef enum batch_op_e
+{
+    BATCH_OP_UNKNOWN,
+    BATCH_OP_UP,
+    BATCH_OP_DOWN,
+    BATCH_OP_STOP,
+    BATCH_OP_SPEED,
+    BATCH_OP_MOVE_TO,
+    BATCH_OP_SETTINGS
+} batch_op_t;
+
+typedef enum batch_result_e
+{
+    BATCH_RESULT_OK,
+    BATCH_RESULT_INVALID,
+    BATCH_RESULT_SPEED_OUT_OF_RANGE,
+    BATCH_RESULT_FAILED,
+    BATCH_RESULT_NOT_APPLIED
+} batch_result_t;
+
+// Fields are the union of the fields of all operations, which ones are used depends on the op
+typedef struct batch_operation_s
+{
+    json_string_t op;
+    uint32_t      speed;
+    int32_t       position;
+    uint32_t      lift_min_speed;
+    uint32_t      lift_max_speed;
+    uint32_t      lift_default_speed;
+} batch_operation_t;
+
+typedef struct batch_s
+{
+    batch_op_t        ops[MAX_OPERATIONS];
+    batch_operation_t operations[MAX_OPERATIONS];
+    uint32_t          fieldsRead[MAX_OPERATIONS];
+    batch_result_t    results[MAX_OPERATIONS];
+    size_t            nrOfOperations;
+} batch_t;
+
+// Bits in fieldsRead, in the order of operation_fields
+#define FIELD_SPEED              (1u << 1)
+#define FIELD_POSITION           (1u << 2)
+#define FIELD_LIFT_MIN_SPEED     (1u << 3)
+#define FIELD_LIFT_MAX_SPEED     (1u << 4)
+#define FIELD_LIFT_DEFAULT_SPEED (1u << 5)
+
+static const json_field_t operation_fields[] = {
+    JSON_FIELD(batch_operation_t, op, "op", JSON_FIELD_TYPE_STRING),
+    JSON_FIELD(batch_operation_t, speed, "speed", JSON_FIELD_TYPE_UINT32),
+    JSON_FIELD(batch_operation_t, position, "position", JSON_FIELD_TYPE_INT32),
+    JSON_FIELD(batch_operation_t, lift_min_speed, "liftMinSpeed", JSON_FIELD_TYPE_UINT32),
+    JSON_FIELD(batch_operation_t, lift_max_speed, "liftMaxSpeed", JSON_FIELD_TYPE_UINT32),
+    JSON_FIELD(batch_operation_t, lift_default_speed, "liftDefaultSpeed", JSON_FIELD_TYPE_UINT32)
+};
+
+static const char* const op_names[] = {
+    [BATCH_OP_UNKNOWN] = "",
+    [BATCH_OP_UP] = "up",
+    [BATCH_OP_DOWN] = "down",
+    [BATCH_OP_STOP] = "stop",
+    [BATCH_OP_SPEED] = "speed",
+    [BATCH_OP_MOVE_TO] = "moveTo",
+    [BATCH_OP_SETTINGS] = "settings"
+};
+
+static const char* const result_names[] = {
+    [BATCH_RESULT_OK] = "ok",
+    [BATCH_RESULT_INVALID] = "invalid",
+    [BATCH_RESULT_SPEED_OUT_OF_RANGE] = "speedOutOfRange",
+    [BATCH_RESULT_FAILED] = "failed",
+    [BATCH_RESULT_NOT_APPLIED] = "notApplied"
+};
+
+static char TAG[] = __FILE__;
+
+static batch_op_t op_str_to_batch_op(const json_string_t* op)
+{
+    for (size_t i = BATCH_OP_UNKNOWN + 1; i < sizeof(op_names) / sizeof(op_names[0]); ++i)
+    {
+        if (strlen(op_names[i]) == op->len && memcmp(op_names[i], op->p, op->len) == 0)
+        {
+            return (batch_op_t)i;
+        }
+    }
+
+    return BATCH_OP_UNKNOWN;
+}
+
+static controller_json_err_t read_operation(size_t index, const char* element, size_t length, void* userData)
+{
+    batch_t* batch = (batch_t*)userData;
+    batch_operation_t* operation = &batch->operations[index];
+
+    controller_json_err_t err = json_read_object(
+        element,
+        length,
+        operation_fields,
+        sizeof(operation_fields) / sizeof(operation_fields[0]),
+        operation,
+        &batch->fieldsRead[index]);
+    if (err != CONTROLLER_JSON_OK)
+    {
+        return err;
+    }
+
+    batch->ops[index] = op_str_to_batch_op(&operation->op);
+    return CONTROLLER_JSON_OK;
+}
+
+static bool is_speed_in_range(uint32_t speed, const settings_t* settings)
+{
+    return speed >= settings->lift_min_speed && speed <= settings->lift_max_speed;
+}
+
+// Checks every operation against the settings as they will be when the operation is applied,
+// so nothing is applied unless the whole batch can be applied
+static bool validate_batch(batch_t* batch, bool isLiftOnline, settings_t* settings)
+{
+    bool isValid = true;
+    for (size_t i = 0; i < batch->nrOfOperations; ++i)
+    {
+        const batch_operation_t* operation = &batch->operations[i];
+        uint32_t fieldsRead = batch->fieldsRead[i];
+        batch_result_t result = BATCH_RESULT_OK;
+
+        switch (batch->ops[i])
+        {
+        case BATCH_OP_UP:
+        case BATCH_OP_DOWN:
+            if (!isLiftOnline)
+            {
+                result = BATCH_RESULT_FAILED;
+            }
+            else if ((fieldsRead & FIELD_SPEED) && !is_speed_in_range(operation->speed, settings))
+            {
+                result = BATCH_RESULT_SPEED_OUT_OF_RANGE;
+            }
+            break;
+
+        case BATCH_OP_STOP:
+            result = isLiftOnline ? BATCH_RESULT_OK : BATCH_RESULT_FAILED;
+            break;
+
+        case BATCH_OP_SPEED:
+            if (!isLiftOnline)
+            {
+                result = BATCH_RESULT_FAILED;
+            }
+            else if (!(fieldsRead & FIELD_SPEED))
+            {
+                result = BATCH_RESULT_INVALID;
+            }
+            else if (!is_speed_in_range(operation->speed, settings))
+            {
+                result = BATCH_RESULT_SPEED_OUT_OF_RANGE;
+            }
+            break;
+
+        case BATCH_OP_MOVE_TO:
+            if (!isLiftOnline)
+            {
+                result = BATCH_RESULT_FAILED;
+            }
+            else if (!(fieldsRead & FIELD_POSITION))
+            {
+                result = BATCH_RESULT_INVALID;
+            }
+            break;
+
+        case BATCH_OP_SETTINGS:
+            // Later operations are validated against the new settings
+            if (fieldsRead & FIELD_LIFT_MIN_SPEED)
+            {
+                settings->lift_min_speed = operation->lift_min_speed;
+            }
+            if (fieldsRead & FIELD_LIFT_MAX_SPEED)
+            {
+                settings->lift_max_speed = operation->lift_max_speed;
+            }
+            if (fieldsRead & FIELD_LIFT_DEFAULT_SPEED)
+            {
+                settings->lift_default_speed = operation->lift_default_speed;
+            }
+
+            if (settings->lift_min_speed > settings->lift_max_speed || !is_speed_in_range(settings->lift_default_speed, settings))
+            {
+                result = BATCH_RESULT_INVALID;
+            }
+            break;
+
+        case BATCH_OP_UNKNOWN:
+        default:
+            result = BATCH_RESULT_INVALID;
+            break;
+        }
+
+        batch->results[i] = result;
+        isValid = isValid && result == BATCH_RESULT_OK;
+    }
+
+    return isValid;
+}
+
+static batch_result_t apply_operation(batch_op_t op, const batch_operation_t* operation, uint32_t fieldsRead, lift_device_handle_t liftHandle)
+{
+    lift_err_t liftErr = LIFT_OK;
+
+    switch (op)
+    {
+    case BATCH_OP_UP:
+    case BATCH_OP_DOWN:
+        if (fieldsRead & FIELD_SPEED)
+        {
+            liftErr = lift_set_speed(liftHandle, operation->speed);
+        }
+        if (liftErr == LIFT_OK)
+        {
+            liftErr = op == BATCH_OP_UP ? lift_up(liftHandle) : lift_down(liftHandle);
+        }
+        break;
+
+    case BATCH_OP_STOP:
+        liftErr = lift_stop(liftHandle);
+        break;
+
+    case BATCH_OP_SPEED:
+        liftErr = lift_set_speed(liftHandle, operation->speed);
+        break;
+
+    case BATCH_OP_MOVE_TO:
+        liftErr = lift_move_to(liftHandle, operation->position);
+        break;
+
+    case BATCH_OP_SETTINGS:
+    {
+        const settings_t* currentSettings;
+        if (settings_service_load(&currentSettings) == SETTINGS_SERVICE_FAIL)
+        {
+            return BATCH_RESULT_FAILED;
+        }
+
+        settings_t settings = *currentSettings;
+        if (fieldsRead & FIELD_LIFT_MIN_SPEED)
+        {
+            settings.lift_min_speed = operation->lift_min_speed;
+        }
+        if (fieldsRead & FIELD_LIFT_MAX_SPEED)
+        {
+            settings.lift_max_speed = operation->lift_max_speed;
+        }
+        if (fieldsRead & FIELD_LIFT_DEFAULT_SPEED)
+        {
+            settings.lift_default_speed = operation->lift_default_speed;
+        }
+
+        return settings_service_save(&settings) == SETTINGS_SERVICE_OK ? BATCH_RESULT_OK : BATCH_RESULT_FAILED;
+    }
+
+    default:
+        return BATCH_RESULT_INVALID;
+    }
+
+    return liftErr == LIFT_OK ? BATCH_RESULT_OK : BATCH_RESULT_FAILED;
+}
+
+// Undoes the first nrOfOperations operations of a batch that failed part way, including the one that failed,
+// which may have had part of its effect. A lift the batch moved is stopped, a stop is not undone.
+static bool roll_back_batch(const batch_t* batch, size_t nrOfOperations, const settings_t* previousSettings, uint32_t previousSpeed, lift_device_handle_t liftHandle)
+{
+    bool isMoved = false;
+    bool isSpeedChanged = false;
+    bool isSettingsChanged = false;
+
+    for (size_t i = 0; i < nrOfOperations; ++i)
+    {
+        switch (batch->ops[i])
+        {
+        case BATCH_OP_UP:
+        case BATCH_OP_DOWN:
+            isMoved = true;
+            isSpeedChanged = isSpeedChanged || (batch->fieldsRead[i] & FIELD_SPEED);
+            break;
+
+        case BATCH_OP_MOVE_TO:
+            isMoved = true;
+            break;
+
+        case BATCH_OP_SPEED:
+            isSpeedChanged = true;
+            break;
+
+        case BATCH_OP_SETTINGS:
+            isSettingsChanged = true;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    bool isRolledBack = true;
+    if (isMoved && lift_stop(liftHandle) != LIFT_OK)
+    {
+        LOG_E(TAG, "Can not stop the lift after a failed batch");
+        isRolledBack = false;
+    }
+
+    // The settings go first, they set the speed limits the previous speed is within
+    if (isSettingsChanged && settings_service_save(previousSettings) != SETTINGS_SERVICE_OK)
+    {
+        LOG_E(TAG, "Can not restore the settings after a failed batch");
+        isRolledBack = false;
+    }
+
+    if (isSpeedChanged && lift_set_speed(liftHandle, previousSpeed) != LIFT_OK)
+    {
+        LOG_E(TAG, "Can not restore the lift speed after a failed batch");
+        isRolledBack = false;
+    }
+
+    return isRolledBack;
+}
+
+static void batch_post_handler(struct mg_connection* nc, struct http_message* message, request_arena_t* arena, void* userData)
+{
+    batch_t* batch = (batch_t*)request_arena_calloc(arena, 1, sizeof(batch_t));
+    if (batch == NULL)
+    {
+        mg_http_send_error(nc, 500, NULL);
+        return;
+    }
+
+    controller_json_err_t err = json_read_array(
+        message->body.p,
+        message->body.len,
+        MAX_OPERATIONS,
+        read_operation,
+        batch,
+        &batch->nrOfOperations);
+    if (err != CONTROLLER_JSON_OK)
+    {
+        mg_http_send_error(nc, 400, err == CONTROLLER_JSON_ERR_OVERFLOW ? "Too many operations." : "Invalid operations.");
+        return;
+    }
+
+    const settings_t* settings;
+    if (settings_service_load(&settings) == SETTINGS_SERVICE_FAIL)
+    {
+        mg_http_send_error(nc, 500, "Can not read settings.");
+        return;
+    }
+
+    // Requests are handled one at a time on the webserver thread, so no other client can
+    // change the lift or the settings between validating and applying the operations
+    lift_device_handle_t liftHandle = lift_service_get_lift_device_handle();
+    settings_t validationSettings = *settings;
+    bool isApplied = validate_batch(batch, liftHandle != NULL, &validationSettings);
+
+    if (isApplied)
+    {
+        // Saving settings and setting the speed can still fail after validation, what was applied before is undone then
+        const settings_t previousSettings = *settings;
+        const uint32_t previousSpeed = liftHandle != NULL ? lift_get_speed(liftHandle) : 0;
+
+        for (size_t i = 0; i < batch->nrOfOperations; ++i)
+        {
+            batch->results[i] = apply_operation(batch->ops[i], &batch->operations[i], batch->fieldsRead[i], liftHandle);
+            if (batch->results[i] != BATCH_RESULT_OK)
+            {
+                LOG_W(TAG, "Batch operation %u failed, undoing the operations before it", i);
+                isApplied = false;
+
+                if (!roll_back_batch(batch, i + 1, &previousSettings, previousSpeed, liftHandle))
+                {
+                    mg_http_send_error(nc, 500, "Batch failed and could not be undone.");
+                    return;
+                }
+
+                for (size_t j = 0; j < batch->nrOfOperations; ++j)
+                {
+                    if (j != i)
+                    {
+                        batch->results[j] = BATCH_RESULT_NOT_APPLIED;
+                    }
+                }
+                break;
+            }
+        }
+    }
+    else
+    {
+        // Valid operations are not applied when another operation in the batch is invalid
+        for (size_t i = 0; i < batch->nrOfOperations; ++i)
+        {
+            if (batch->results[i] == BATCH_RESULT_OK)
+            {
+                batch->results[i] = BATCH_RESULT_NOT_APPLIED;
+            }
+        }
+    }
+
+    json_writer_t writer;
+    json_writer_init(&writer, request_arena_alloc(arena, BATCH_RESPONSE_BUFFER_SIZE), BATCH_RESPONSE_BUFFER_SIZE);
+    json_writer_begin_object(&writer, NULL);
+    json_writer_add_bool(&writer, "applied", isApplied);
+    json_writer_begin_array(&writer, "results");
+    for (size_t i = 0; i < batch->nrOfOperations; ++i)
+    {
+        json_writer_begin_object(&writer, NULL);
+        json_writer_add_string(&writer, "op", op_names[batch->ops[i]]);
+        json_writer_add_string(&writer, "result", result_names[batch->results[i]]);
+        json_writer_end_object(&writer);
+    }
+    json_writer_end_array(&writer);
+    json_writer_end_object(&writer);
+    json_writer_send(nc, isApplied ? 200 : 422, &writer);
+}
+
+static uri_handler_info_t batch_handler_info = {
+    .uri = controllerUri,
+    .methodHandlers = {
+        {
+            .method = HTTP_REQUEST_METHOD_POST,
+            .handler = batch_post_handler,
+            .user_data = NULL
+        }
+    }
+    };
+
+void batch_controller_register_uri_handlers(const char* rootUri)
+{   
+    // Register uri's
+    register_uri_handler(rootUri, &batch_handler_info);
+}
\ No newline at end of file
@@ -0,0 +1,8 @@
+#ifndef BATCH_CONTROLLER_H
+#define BATCH_CONTROLLER_H
+
+#include <mongoose.h>
+
+void batch_controller_register_uri_handlers(const char* rootUri);
+
+#endif // BATCH_CONTROLLER_H
\ No newline at end of file
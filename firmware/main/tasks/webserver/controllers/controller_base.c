@@ -1,153 +1,281 @@
 #include "controller_base.h"
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 
+#include <esp_timer.h>
+
 #include <logger.h>
+#include <sdkconfig.h>
+#include <services/metrics_service.h>
+#include <tasks/webserver/webserver_task.h>
+
+#define REQUEST_ARENA_SIZE CONFIG_WEBSERVER_REQUEST_ARENA_SIZE
+
+// Large enough for route="<rootUri><uri>" of every route
+#define MAX_ROUTE_LABEL_LENGTH 48
+
+typedef enum http_status_class_e
+{
+    HTTP_STATUS_CLASS_2XX,
+    HTTP_STATUS_CLASS_3XX,
+    HTTP_STATUS_CLASS_4XX,
+    HTTP_STATUS_CLASS_5XX,
+
+    HTTP_STATUS_CLASS_MAX
+} http_status_class_t;
+
+typedef struct route_s
+{
+    const char* rootUri;
+    const char* uri;
+
+    // Handlers indexed by method so dispatching needs no search
+    request_handler_t handlers[HTTP_REQUEST_METHOD_MAX];
+    void*             handlersUserData[HTTP_REQUEST_METHOD_MAX];
+
+    const multipart_request_uri_handler_info_t* multipartHandlerInfo;
+    http_request_method_t                       multipartMethod;
+
+    const stream_request_uri_handler_info_t* streamHandlerInfos[HTTP_REQUEST_METHOD_MAX];
+
+    size_t arenaHighWaterMark;
+
+    char               metricLabel[MAX_ROUTE_LABEL_LENGTH];
+    metric_counter_t   requestsMetrics[HTTP_STATUS_CLASS_MAX];
+    metric_histogram_t durationMetric;
+} route_t;
 
 static char TAG[] = "Controller Base";
 
-static const char* http_request_method_to_str(const http_request_method_t method)
-{
-    switch(method)
-    {
-        case HTTP_REQUEST_METHOD_GET:
-            return "GET";
-        case HTTP_REQUEST_METHOD_HEAD:
-            return "HEAD";
-        case HTTP_REQUEST_METHOD_POST:
-            return "POST";
-        case HTTP_REQUEST_METHOD_PUT:
-            return "PUT";
-        case HTTP_REQUEST_METHOD_DELETE:
-            return "DELETE";
-        case HTTP_REQUEST_METHOD_CONNECT:
-            return "CONNECT";
-        case HTTP_REQUEST_METHOD_OPTIONS:
-            return "OPTIONS";
-        case HTTP_REQUEST_METHOD_TRACE:
-            return "TRACE";
-        case HTTP_REQUEST_METHOD_PATCH:
-            return "PATCH";
-        case HTTP_REQUEST_METHOD_UNKNOWN:
-        default:
-            return "Unknown";
-    }
-}
+static const char* const status_class_labels[HTTP_STATUS_CLASS_MAX] = {
+    [HTTP_STATUS_CLASS_2XX] = "code=\"2xx\"",
+    [HTTP_STATUS_CLASS_3XX] = "code=\"3xx\"",
+    [HTTP_STATUS_CLASS_4XX] = "code=\"4xx\"",
+    [HTTP_STATUS_CLASS_5XX] = "code=\"5xx\""
+};
+
+// Request durations in microseconds, handlers are expected to take well under a millisecond
+static const uint32_t request_duration_bounds[] = { 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 100000 };
+
+static route_t       routes[ROUTE_TABLE_MAX_ROUTES];
+static route_table_t routeTable;
+
+// Requests are handled one at a time on the webserver thread, so a single arena serves every request.
+// Multipart and stream requests span many events with other requests in between, they get their own arena
+// which is owned by one connection at a time.
+static uint8_t               requestArenaBuffer[REQUEST_ARENA_SIZE] __attribute__((aligned(8)));
+static request_arena_t       requestArena = { .buffer = requestArenaBuffer, .size = REQUEST_ARENA_SIZE };
+static uint8_t               uploadArenaBuffer[REQUEST_ARENA_SIZE] __attribute__((aligned(8)));
+static request_arena_t       uploadArena = { .buffer = uploadArenaBuffer, .size = REQUEST_ARENA_SIZE };
+static struct mg_connection* uploadArenaOwner = NULL;
+
+// The stream request that owns the upload arena, if any
+static const stream_request_uri_handler_info_t* streamHandlerInfo = NULL;
+static size_t                                   streamRemaining = 0;
+// Bytes of the current DATA message the handler consumed, and whether it asked to wait before the next message
+static size_t                                   streamConsumed = 0;
+static bool                                     streamPaused = false;
+static size_t                                   streamRecvLimit = 0;
+// The part of the body that arrived with the header, held until the request is started outside of mongoose's event
+static struct mbuf                              streamPendingData;
+static bool                                     streamStarting = false;
 
 static http_request_method_t method_str_to_http_request_method(const struct mg_str* method)
 {
-    if(mg_vcmp(method, "GET") == 0)
-    {
-        return HTTP_REQUEST_METHOD_GET;
-    }
-    else if(mg_vcmp(method, "HEAD") == 0)
-    {
-        return HTTP_REQUEST_METHOD_HEAD;
-    }
-    else if(mg_vcmp(method, "POST") == 0)
-    {
-        return HTTP_REQUEST_METHOD_POST;
-    }
-    else if(mg_vcmp(method, "PUT") == 0)
+    return http_request_method_from_str(method->p, method->len);
+}
+
+static http_request_method_t method_cstr_to_http_request_method(const char* method)
+{
+    return http_request_method_from_str(method, strlen(method));
+}
+
+static void route_register_metrics(route_t* route)
+{
+    snprintf(route->metricLabel, sizeof(route->metricLabel), "route=\"%s%s\"", route->rootUri, route->uri);
+
+    for(size_t i = 0; i < HTTP_STATUS_CLASS_MAX; ++i)
     {
-        return HTTP_REQUEST_METHOD_PUT;
+        route->requestsMetrics[i] = (metric_counter_t)METRIC_COUNTER("tvlift_http_requests_total", "Number of api requests by route and status code.", route->metricLabel);
+        route->requestsMetrics[i].metric.extra_labels = status_class_labels[i];
+        metrics_service_register(&route->requestsMetrics[i].metric);
     }
-    else if(mg_vcmp(method, "DELETE") == 0)
+
+    route->durationMetric = (metric_histogram_t)METRIC_HISTOGRAM(
+        "tvlift_http_request_duration_seconds",
+        "Time spent in the request handlers of a route.",
+        route->metricLabel,
+        request_duration_bounds,
+        1000000);
+    metrics_service_register(&route->durationMetric.metric);
+}
+
+static void route_unregister_metrics(route_t* route)
+{
+    for(size_t i = 0; i < HTTP_STATUS_CLASS_MAX; ++i)
     {
-        return HTTP_REQUEST_METHOD_DELETE;
+        metrics_service_unregister(&route->requestsMetrics[i].metric);
     }
-    else if(mg_vcmp(method, "CONNECT") == 0)
+    metrics_service_unregister(&route->durationMetric.metric);
+}
+
+// Reads the status code of the response the handler appended to the send buffer, or returns 0 if there is none
+static int get_response_status(const struct mg_connection* nc, size_t sendBufferLength)
+{
+    // Responses start with a status line like "HTTP/1.1 200 OK"
+    const struct mbuf* sendBuffer = &nc->send_mbuf;
+    const char* status = sendBuffer->buf + sendBufferLength + sizeof("HTTP/1.1 ") - 1;
+    if(sendBuffer->len < sendBufferLength + sizeof("HTTP/1.1 200") - 1 ||
+        memcmp(sendBuffer->buf + sendBufferLength, "HTTP/", 5) != 0)
     {
-        return HTTP_REQUEST_METHOD_CONNECT;
+        return 0;
     }
-    else if(mg_vcmp(method, "OPTIONS") == 0)
+
+    return (status[0] - '0') * 100 + (status[1] - '0') * 10 + (status[2] - '0');
+}
+
+static route_t* route_get_or_add(const char* rootUri, const char* uri)
+{
+    const size_t nrOfRoutes = routeTable.nr_of_routes;
+    const int index = route_table_add(&routeTable, rootUri, uri);
+    if(index == ROUTE_TABLE_NO_ROUTE)
     {
-        return HTTP_REQUEST_METHOD_OPTIONS;
+        LOG_E(TAG, "Route table full, can not register uri: %s%s", rootUri, uri);
+        return NULL;
     }
-    else if(mg_vcmp(method, "TRACE") == 0)
+
+    route_t* route = &routes[index];
+    if((size_t)index < nrOfRoutes)
     {
-        return HTTP_REQUEST_METHOD_TRACE;
+        return route;
     }
-    else if(mg_vcmp(method, "PATCH") == 0)
+
+    memset(route, 0, sizeof(*route));
+    route->rootUri = rootUri;
+    route->uri = uri;
+    route->multipartMethod = HTTP_REQUEST_METHOD_UNKNOWN;
+    route_register_metrics(route);
+
+    return route;
+}
+
+static route_t* route_find(const struct mg_str* uri)
+{
+    const int index = route_table_find(&routeTable, uri->p, uri->len);
+    return index == ROUTE_TABLE_NO_ROUTE ? NULL : &routes[index];
+}
+
+static void release_arena(request_arena_t* arena, route_t* route)
+{
+    if(arena->peak > route->arenaHighWaterMark)
     {
-        return HTTP_REQUEST_METHOD_PATCH;
+        route->arenaHighWaterMark = arena->peak;
     }
-    else
+
+    if(arena->overflow)
     {
-        return HTTP_REQUEST_METHOD_UNKNOWN;
+        LOG_W(TAG, "Request arena of %u bytes too small for %s%s, %u bytes needed", arena->size, route->rootUri, route->uri, arena->peak);
     }
+
+    request_arena_reset(arena);
 }
 
-static void http_request_handler(struct mg_connection* nc, int ev, void* ev_data, void* user_data)
+static void release_upload_arena(void)
 {
-    uri_handler_info_t* uriHandlerInfo = (uri_handler_info_t*) user_data;
-    struct http_message* message = (struct http_message*) ev_data;
-
-    switch (ev) 
+    if(uploadArenaOwner == NULL)
     {
-    case MG_EV_HTTP_REQUEST:
+        return;
+    }
 
-        LOG_D(
-            TAG,
-            "HTTP Request recieved: %.*s: %.*s",
-            message->method.len, message->method.p,
-            message->uri.len, message->uri.p);
-        
-        http_request_method_t method = method_str_to_http_request_method(&message->method);
+    release_arena(&uploadArena, (route_t*)uploadArenaOwner->user_data);
+    uploadArenaOwner->user_data = NULL;
+    uploadArenaOwner = NULL;
+    streamHandlerInfo = NULL;
+    streamPaused = false;
+    streamStarting = false;
+    mbuf_free(&streamPendingData);
+}
 
-        for(int i = 0; i < HTTP_REQUEST_METHOD_MAX; ++i)
-        {
-            const method_handler_info_t* methodHandlerInfo = &(uriHandlerInfo->methodHandlers[i]);
-            if(methodHandlerInfo->method == method && methodHandlerInfo->handler != NULL)
-            {
-                // Call the handler
-                LOG_D(TAG, "HTTP Request handler found, calling handler");
-                methodHandlerInfo->handler(nc, message, methodHandlerInfo->user_data);
-                return;
-            }
-        }
+static void http_request_handler(struct mg_connection* nc, route_t* route, struct http_message* message)
+{
+    LOG_D(
+        TAG,
+        "HTTP Request recieved: %.*s: %.*s",
+        message->method.len, message->method.p,
+        message->uri.len, message->uri.p);
 
+    http_request_method_t method = method_str_to_http_request_method(&message->method);
+    if(method == HTTP_REQUEST_METHOD_UNKNOWN || route->handlers[method] == NULL)
+    {
         // Method has no endpoint
         LOG_D(TAG, "HTTP Request handler not found");
         mg_http_send_error(nc, 404, NULL);
         return;
+    }
 
-    default:
-        // Unsupported
-        nc->flags |= MG_F_CLOSE_IMMEDIATELY;
-        return;
+    // Call the handler
+    LOG_D(TAG, "HTTP Request handler found, calling handler");
+    int64_t started = esp_timer_get_time();
+    size_t sendBufferLength = nc->send_mbuf.len;
+
+    route->handlers[method](nc, message, &requestArena, route->handlersUserData[method]);
+
+    int64_t duration = esp_timer_get_time() - started;
+    int status = get_response_status(nc, sendBufferLength);
+    if(status >= 200 && status < 600)
+    {
+        metrics_counter_inc(&route->requestsMetrics[status / 100 - 2]);
     }
+    metrics_histogram_observe(&route->durationMetric, (uint32_t)duration);
+
+    // The response is in the send buffer now, nothing can refer to the arena anymore
+    release_arena(&requestArena, route);
 }
 
-static void http_multipart_request_handler(struct mg_connection* nc, int ev, void* ev_data, void* user_data)
+static void http_multipart_request_handler(struct mg_connection* nc, int ev, void* ev_data)
 {
-    multipart_request_uri_handler_info_t* handlerInfo = (multipart_request_uri_handler_info_t*) user_data;
-    struct http_message* message = (struct http_message*) ev_data;
-
-    switch (ev) 
+    switch (ev)
     {
     case MG_EV_HTTP_MULTIPART_REQUEST:
     {
+        struct http_message* message = (struct http_message*) ev_data;
+
         LOG_D(
             TAG,
             "HTTP Multipart Request recieved: %.*s: %.*s",
             message->method.len, message->method.p,
             message->uri.len, message->uri.p);
 
-        if(mg_vcmp(&message->method, handlerInfo->method) == 0)
+        route_t* route = route_find(&message->uri);
+        if(route != NULL &&
+           route->multipartHandlerInfo != NULL &&
+           route->multipartMethod == method_str_to_http_request_method(&message->method))
         {
+            if(uploadArenaOwner != NULL)
+            {
+                LOG_W(TAG, "HTTP Multipart Request refused, another multipart request is in progress");
+                nc->user_data = NULL;
+                mg_http_send_error(nc, 503, "Another upload is in progress.");
+                break;
+            }
+
             LOG_D(TAG, "HTTP Request handler found, calling handler");
 
-            // Need to set user_data to handlerInfo so it is availabe to subsequent calls
-            nc->user_data = handlerInfo;
+            // Need to set user_data to the route so it is availabe to subsequent calls
+            nc->user_data = (void*) route;
+            uploadArenaOwner = nc;
 
             // Call the handler
-            handlerInfo->handler(nc, message, NULL, MULTIPART_REQUEST_MESSAGE_TYPE_BEGIN, handlerInfo->user_data);
+            route->multipartHandlerInfo->handler(nc, message, NULL, MULTIPART_REQUEST_MESSAGE_TYPE_BEGIN, &uploadArena, route->multipartHandlerInfo->user_data);
         }
         else
         {
             // Method has no endpoint
             LOG_D(TAG, "HTTP Request handler not found");
+            nc->user_data = NULL;
             mg_http_send_error(nc, 404, NULL);
         }
         break;
@@ -158,78 +286,491 @@ static void http_multipart_request_handler(struct mg_connection* nc, int ev, voi
     case MG_EV_HTTP_PART_END:
     case MG_EV_HTTP_MULTIPART_REQUEST_END:
     {
+        const route_t* route = (const route_t*) nc->user_data;
         struct mg_http_multipart_part* part = (struct mg_http_multipart_part*) ev_data;
 
+        if(route == NULL || uploadArenaOwner != nc)
+        {
+            // Request was not accepted
+            break;
+        }
+
         multipart_request_message_type_t type;
         switch (ev)
         {
-        case MG_EV_HTTP_PART_BEGIN:  
-            LOG_D(TAG, "HTTP Multipart part '%s' begin recieved: %s: %s", part->file_name, message->method.p, message->uri.p);
+        case MG_EV_HTTP_PART_BEGIN:
+            LOG_D(TAG, "HTTP Multipart part '%s' begin recieved", part->file_name);
             type = MULTIPART_REQUEST_MESSAGE_TYPE_PART_BEGIN;
             break;
         case MG_EV_HTTP_PART_DATA:
-            LOG_D(TAG, "HTTP Multipart part '%s' data recieved: %s: %s", part->file_name, message->method.p, message->uri.p);
+            // Not logged, data arrives in small pieces and logging each of them costs more then handling it
             type = MULTIPART_REQUEST_MESSAGE_TYPE_PART_DATA;
             break;
         case MG_EV_HTTP_PART_END:
-            LOG_D(TAG, "HTTP Multipart part '%s' end recieved: %s: %s", part->file_name, message->method.p, message->uri.p);
+            LOG_D(TAG, "HTTP Multipart part '%s' end recieved", part->file_name);
             type = MULTIPART_REQUEST_MESSAGE_TYPE_PART_END;
             break;
         case MG_EV_HTTP_MULTIPART_REQUEST_END:
         default:
-            LOG_D(TAG, "HTTP Multipart end recieved: %s: %s", message->method.p, message->uri.p);
+            LOG_D(TAG, "HTTP Multipart end recieved");
             type = MULTIPART_REQUEST_MESSAGE_TYPE_END;
             break;
         }
-          
+
         // Call the handler
-        handlerInfo->handler(nc, NULL, part, type, handlerInfo->user_data);
+        route->multipartHandlerInfo->handler(nc, NULL, part, type, &uploadArena, route->multipartHandlerInfo->user_data);
+
+        if(type == MULTIPART_REQUEST_MESSAGE_TYPE_END)
+        {
+            release_upload_arena();
+        }
         break;
     }
     }
 }
 
-void register_uri_handler(struct mg_connection* nc, const char* rootUri, uri_handler_info_t* uriHandlerInfo)
+static bool is_content_type(const struct mg_str* contentType, const char* expected)
+{
+    // Ignore parameters like "; charset=utf-8"
+    size_t length = 0;
+    while(length < contentType->len && contentType->p[length] != ';' && contentType->p[length] != ' ')
+    {
+        length++;
+    }
+
+    const struct mg_str mediaType = mg_mk_str_n(contentType->p, length);
+    return mg_vcasecmp(&mediaType, expected) == 0;
+}
+
+static void stop_stream_request(struct mg_connection* nc)
+{
+    // Whatever is left of the body can not be parsed as the next request, so the connection is closed after the response
+    nc->flags |= MG_F_SEND_AND_CLOSE;
+    release_upload_arena();
+}
+
+static void wait_stream_request(struct mg_connection* nc)
+{
+    // Mongoose only reads from a connection while its recieve buffer is below the limit,
+    // so the client is held back by TCP flow control until the request is resumed
+    nc->recv_mbuf_limit = 0;
+}
+
+static void http_stream_request_continue(struct mg_connection* nc)
+{
+    struct mbuf* io = &nc->recv_mbuf;
+    size_t length = io->len < streamRemaining ? io->len : streamRemaining;
+
+    streamPaused = false;
+
+    if(length > 0)
+    {
+        const struct mg_str data = mg_mk_str_n(io->buf, length);
+        streamConsumed = length;
+
+        if(!streamHandlerInfo->handler(nc, NULL, &data, STREAM_REQUEST_MESSAGE_TYPE_DATA, &uploadArena, streamHandlerInfo->user_data))
+        {
+            mbuf_remove(io, io->len);
+            stop_stream_request(nc);
+            return;
+        }
+
+        // The bytes the handler did not consume stay in the recieve buffer until the request is resumed
+        streamRemaining -= streamConsumed;
+        mbuf_remove(io, streamConsumed);
+        if(streamPaused)
+        {
+            wait_stream_request(nc);
+            return;
+        }
+    }
+
+    // Anything past the body is dropped
+    mbuf_remove(io, io->len);
+
+    if(streamRemaining == 0)
+    {
+        streamHandlerInfo->handler(nc, NULL, NULL, STREAM_REQUEST_MESSAGE_TYPE_END, &uploadArena, streamHandlerInfo->user_data);
+        if(streamPaused)
+        {
+            wait_stream_request(nc);
+            return;
+        }
+
+        stop_stream_request(nc);
+    }
+}
+
+void stream_request_pause(struct mg_connection* nc, size_t nrOfBytesConsumed)
+{
+    if(uploadArenaOwner != nc || streamHandlerInfo == NULL)
+    {
+        return;
+    }
+
+    streamConsumed = nrOfBytesConsumed < streamConsumed ? nrOfBytesConsumed : streamConsumed;
+    streamPaused = true;
+}
+
+void stream_request_resume(struct mg_connection* nc)
+{
+    // The connection may have closed since the resume was posted
+    if(uploadArenaOwner != nc || streamHandlerInfo == NULL || !streamPaused)
+    {
+        return;
+    }
+
+    nc->recv_mbuf_limit = streamRecvLimit;
+    http_stream_request_continue(nc);
+}
+
+bool stream_request_is_paused(const struct mg_connection* nc)
+{
+    return uploadArenaOwner == nc && streamHandlerInfo != NULL && streamPaused;
+}
+
+static void start_stream_request(void* arg)
+{
+    struct mg_connection* nc = (struct mg_connection*) arg;
+    struct mbuf* io = &nc->recv_mbuf;
+
+    // The connection may have closed since the start was posted
+    if(uploadArenaOwner != nc || streamHandlerInfo == NULL || !streamStarting)
+    {
+        return;
+    }
+
+    // Data that arrived in the meantime goes after the part of the body that came with the header
+    if(io->len > 0 && mbuf_append(&streamPendingData, io->buf, io->len) != io->len)
+    {
+        // The handler gets its ABORT message when the connection closes
+        LOG_E(TAG, "HTTP Stream Request out of memory");
+        nc->flags |= MG_F_CLOSE_IMMEDIATELY;
+        return;
+    }
+
+    mbuf_free(io);
+    *io = streamPendingData;
+    mbuf_init(&streamPendingData, 0);
+    streamStarting = false;
+
+    nc->recv_mbuf_limit = streamRecvLimit;
+    http_stream_request_continue(nc);
+}
+
+// The handler lets go of the request, its connection is closed without a response
+static void abort_stream_request(struct mg_connection* nc)
+{
+    LOG_W(TAG, "HTTP Stream Request aborted with %u bytes remaining", streamRemaining);
+    streamHandlerInfo->handler(nc, NULL, NULL, STREAM_REQUEST_MESSAGE_TYPE_ABORT, &uploadArena, streamHandlerInfo->user_data);
+    release_upload_arena();
+}
+
+// A client that reconnects may find its old connection still holding the upload, until that one times out
+static bool take_over_stream_request(struct http_message* message, const stream_request_uri_handler_info_t* handlerInfo)
+{
+    struct mg_connection* owner = uploadArenaOwner;
+
+    if(streamHandlerInfo == NULL ||
+       streamHandlerInfo->handler != handlerInfo->handler ||
+       handlerInfo->takeover == NULL ||
+       !handlerInfo->takeover(message, handlerInfo->user_data))
+    {
+        return false;
+    }
+
+    LOG_W(TAG, "HTTP Stream Request taken over from another connection");
+    abort_stream_request(owner);
+    owner->flags |= MG_F_CLOSE_IMMEDIATELY;
+    return true;
+}
+
+static bool http_stream_request_begin(struct mg_connection* nc)
+{
+    struct mbuf* io = &nc->recv_mbuf;
+
+    // Only requests with a body are streamed, checking the method first saves parsing every other request twice
+    if(nc->listener == NULL ||
+        (nc->flags & MG_F_IS_WEBSOCKET) ||
+        io->len < 4 ||
+        (memcmp(io->buf, "PUT ", 4) != 0 && memcmp(io->buf, "POST", 4) != 0))
+    {
+        return false;
+    }
+
+    struct http_message message;
+    int headerLength = mg_parse_http(io->buf, io->len, &message, 1);
+    if(headerLength <= 0)
+    {
+        // Not a complete request header yet
+        return false;
+    }
+
+    http_request_method_t method = method_str_to_http_request_method(&message.method);
+    route_t* route = route_find(&message.uri);
+    if(method == HTTP_REQUEST_METHOD_UNKNOWN || route == NULL || route->streamHandlerInfos[method] == NULL)
+    {
+        return false;
+    }
+
+    const stream_request_uri_handler_info_t* handlerInfo = route->streamHandlerInfos[method];
+    struct mg_str* contentType = mg_get_http_header(&message, "Content-Type");
+    if(contentType == NULL || !is_content_type(contentType, handlerInfo->content_type))
+    {
+        return false;
+    }
+
+    LOG_D(
+        TAG,
+        "HTTP Stream Request recieved: %.*s: %.*s",
+        message.method.len, message.method.p,
+        message.uri.len, message.uri.p);
+
+    // From here on mongoose is bypassed for this connection, every event goes straight to the handler of the connection.
+    // Mongoose would otherwise buffer the whole body before passing on the request.
+    nc->proto_handler = NULL;
+
+    // Without a Content-Length mongoose reports an unknown body length
+    if(message.body.len == (size_t)~0)
+    {
+        mg_http_send_error(nc, 411, NULL);
+        mbuf_remove(io, io->len);
+        nc->flags |= MG_F_SEND_AND_CLOSE;
+        return true;
+    }
+
+    if(uploadArenaOwner != NULL && !take_over_stream_request(&message, handlerInfo))
+    {
+        LOG_W(TAG, "HTTP Stream Request refused, another upload is in progress");
+        mg_http_send_error(nc, 503, "Another upload is in progress.");
+        mbuf_remove(io, io->len);
+        nc->flags |= MG_F_SEND_AND_CLOSE;
+        return true;
+    }
+
+    nc->user_data = (void*) route;
+    uploadArenaOwner = nc;
+    streamHandlerInfo = handlerInfo;
+    streamRemaining = message.body.len;
+    streamPaused = false;
+    streamRecvLimit = nc->recv_mbuf_limit;
+
+    // The message points into the recieve buffer, so the header is only removed after the handler is done with it
+    bool accepted = handlerInfo->handler(nc, &message, NULL, STREAM_REQUEST_MESSAGE_TYPE_BEGIN, &uploadArena, handlerInfo->user_data);
+    mbuf_remove(io, headerLength);
+
+    if(!accepted)
+    {
+        mbuf_remove(io, io->len);
+        stop_stream_request(nc);
+        return true;
+    }
+
+    // Mongoose parses what is left in the recieve buffer once this event returns, and refuses a request whose buffer is
+    // at its limit, so the body is neither passed to the handler nor left in the buffer here. The part of it that came
+    // with the header is moved aside, and the request is started from the webserver thread after the event.
+    streamPendingData = *io;
+    mbuf_init(io, 0);
+    streamStarting = true;
+
+    if(!webserver_task_post(start_stream_request, nc))
+    {
+        LOG_W(TAG, "HTTP Stream Request refused, the webserver does not take work");
+        mg_http_send_error(nc, 503, "The server is busy.");
+        nc->flags |= MG_F_SEND_AND_CLOSE;
+    }
+    return true;
+}
+
+static void http_stream_request_handler(struct mg_connection* nc, int ev)
+{
+    switch (ev)
+    {
+    case MG_EV_RECV:
+        if(uploadArenaOwner == nc && streamHandlerInfo != NULL && streamStarting)
+        {
+            // Kept until the request is started
+            wait_stream_request(nc);
+        }
+        else if(uploadArenaOwner == nc && streamHandlerInfo != NULL)
+        {
+            http_stream_request_continue(nc);
+        }
+        else
+        {
+            // The request was refused or stopped early, the rest of it is dropped until the connection closes
+            mbuf_remove(&nc->recv_mbuf, nc->recv_mbuf.len);
+        }
+        break;
+
+    case MG_EV_CLOSE:
+        if(uploadArenaOwner == nc && streamHandlerInfo != NULL)
+        {
+            abort_stream_request(nc);
+        }
+        break;
+    }
+}
+
+void register_uri_handler(const char* rootUri, const uri_handler_info_t* uriHandlerInfo)
 {
-    char* uri = (char*)calloc(strlen(rootUri) + strlen(uriHandlerInfo->uri) + 1, sizeof(char));
-    strcat(strcat(uri, rootUri), uriHandlerInfo->uri);
-    
+    route_t* route = route_get_or_add(rootUri, uriHandlerInfo->uri);
+    if(route == NULL)
+    {
+        return;
+    }
+
     // Check which methods are being registered and if this is allowed
-    bool registeredMethods[HTTP_REQUEST_METHOD_MAX] = {false};
     for(int i = 0; i < HTTP_REQUEST_METHOD_MAX; ++i)
     {
-        if(uriHandlerInfo->methodHandlers[i].handler != NULL)
+        const method_handler_info_t* methodHandlerInfo = &uriHandlerInfo->methodHandlers[i];
+        if(methodHandlerInfo->handler == NULL)
         {
-            if(registeredMethods[uriHandlerInfo->methodHandlers[i].method])
-            {
-                LOG_E(
-                    TAG,
-                    "Registering more then 1 handler for the same method:uri pair is not allowed. Uri: %s Method: %s",
-                    uri,
-                    http_request_method_to_str(uriHandlerInfo->methodHandlers[i].method));
-
-                free(uri);
-                return;
-            }
-            else
-            {             
-                LOG_D(TAG, "Registering handler for: %s:%s", http_request_method_to_str(uriHandlerInfo->methodHandlers[i].method), uri);
-                registeredMethods[uriHandlerInfo->methodHandlers[i].method] = true;
-            }       
+            continue;
+        }
+
+        if(route->handlers[methodHandlerInfo->method] != NULL)
+        {
+            LOG_E(
+                TAG,
+                "Registering more then 1 handler for the same method:uri pair is not allowed. Uri: %s%s Method: %s",
+                rootUri,
+                uriHandlerInfo->uri,
+                http_request_method_to_str(methodHandlerInfo->method));
+        }
+        else
+        {
+            LOG_D(TAG, "Registering handler for: %s:%s%s", http_request_method_to_str(methodHandlerInfo->method), rootUri, uriHandlerInfo->uri);
+            route->handlers[methodHandlerInfo->method] = methodHandlerInfo->handler;
+            route->handlersUserData[methodHandlerInfo->method] = methodHandlerInfo->user_data;
         }
     }
+}
+
+void register_multipart_request_uri_handler(const char* rootUri, const multipart_request_uri_handler_info_t* uriHandlerInfo)
+{
+    route_t* route = route_get_or_add(rootUri, uriHandlerInfo->uri);
+    if(route == NULL)
+    {
+        return;
+    }
+
+    if(route->multipartHandlerInfo != NULL)
+    {
+        LOG_E(TAG, "Registering more then 1 multipart handler for the same uri is not allowed. Uri: %s%s", rootUri, uriHandlerInfo->uri);
+        return;
+    }
+
+    LOG_D(TAG, "Registered multipart handler for: %s:%s%s", uriHandlerInfo->method, rootUri, uriHandlerInfo->uri);
+
+    route->multipartHandlerInfo = uriHandlerInfo;
+    route->multipartMethod = method_cstr_to_http_request_method(uriHandlerInfo->method);
+}
+
+void register_stream_request_uri_handler(const char* rootUri, const stream_request_uri_handler_info_t* uriHandlerInfo)
+{
+    route_t* route = route_get_or_add(rootUri, uriHandlerInfo->uri);
+    if(route == NULL)
+    {
+        return;
+    }
+
+    http_request_method_t method = method_cstr_to_http_request_method(uriHandlerInfo->method);
+    if(method == HTTP_REQUEST_METHOD_UNKNOWN || route->streamHandlerInfos[method] != NULL)
+    {
+        LOG_E(TAG, "Registering more then 1 stream handler for the same method:uri pair is not allowed. Uri: %s%s Method: %s", rootUri, uriHandlerInfo->uri, uriHandlerInfo->method);
+        return;
+    }
 
-    mg_register_http_endpoint(nc, uri, http_request_handler, uriHandlerInfo);
-    free(uri);
+    LOG_D(TAG, "Registered stream handler for: %s:%s%s", uriHandlerInfo->method, rootUri, uriHandlerInfo->uri);
+
+    route->streamHandlerInfos[method] = uriHandlerInfo;
 }
 
-void register_multipart_request_uri_handler(struct mg_connection* nc, const char* rootUri, multipart_request_uri_handler_info_t* uriHandlerInfo)
+void clear_uri_handlers(void)
 {
-    char* uri = (char*)calloc(strlen(rootUri) + strlen(uriHandlerInfo->uri) + 1, sizeof(char));
-    strcat(strcat(uri, rootUri), uriHandlerInfo->uri);
+    // Connections are closed before the route table is cleared, no request can still refer to a route
+    uploadArenaOwner = NULL;
+    streamHandlerInfo = NULL;
+    streamStarting = false;
+    mbuf_free(&streamPendingData);
+    request_arena_reset(&uploadArena);
 
-    LOG_D(TAG, "Registered multipart handler for: %s:%s", uriHandlerInfo->method, uri);
+    for(size_t i = 0; i < routeTable.nr_of_routes; ++i)
+    {
+        route_unregister_metrics(&routes[i]);
+    }
+    route_table_clear(&routeTable);
+}
 
-    mg_register_http_endpoint(nc, uri, http_multipart_request_handler, uriHandlerInfo);
-    free(uri);
+bool get_route_stats(size_t index, route_stats_t* stats)
+{
+    if(index >= routeTable.nr_of_routes)
+    {
+        return false;
+    }
+
+    stats->root_uri = routes[index].rootUri;
+    stats->uri = routes[index].uri;
+    stats->arena_high_water_mark = routes[index].arenaHighWaterMark;
+    return true;
+}
+
+size_t get_request_arena_size(void)
+{
+    return REQUEST_ARENA_SIZE;
+}
+
+bool dispatch_uri_handler(struct mg_connection* nc, int ev, void* ev_data)
+{
+    // Connections that were taken over from mongoose for a stream request only ever carry that request
+    if(nc->listener != NULL && nc->proto_handler == NULL)
+    {
+        http_stream_request_handler(nc, ev);
+        return ev != MG_EV_CLOSE;
+    }
+
+    switch (ev)
+    {
+    case MG_EV_RECV:
+        // Called before mongoose parses the recieved data, so stream requests can be taken over before their body is buffered
+        return http_stream_request_begin(nc);
+
+    case MG_EV_HTTP_REQUEST:
+    {
+        struct http_message* message = (struct http_message*) ev_data;
+
+        route_t* route = route_find(&message->uri);
+        if(route == NULL)
+        {
+            return false;
+        }
+
+        http_request_handler(nc, route, message);
+        return true;
+    }
+
+    case MG_EV_HTTP_MULTIPART_REQUEST:
+    case MG_EV_HTTP_PART_BEGIN:
+    case MG_EV_HTTP_PART_DATA:
+    case MG_EV_HTTP_PART_END:
+    case MG_EV_HTTP_MULTIPART_REQUEST_END:
+        http_multipart_request_handler(nc, ev, ev_data);
+        return true;
+
+    case MG_EV_CLOSE:
+        // A multipart request that never finished still owns the arena, its handler has to let go of the request too
+        if(uploadArenaOwner == nc)
+        {
+            const route_t* route = (const route_t*) nc->user_data;
+
+            LOG_W(TAG, "HTTP Multipart Request aborted");
+            route->multipartHandlerInfo->handler(nc, NULL, NULL, MULTIPART_REQUEST_MESSAGE_TYPE_ABORT, &uploadArena, route->multipartHandlerInfo->user_data);
+            release_upload_arena();
+        }
+        return false;
+
+    default:
+        return false;
+    }
 }
\ No newline at end of file
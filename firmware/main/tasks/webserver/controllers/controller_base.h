@@ -1,24 +1,12 @@
 #ifndef CONTROLLER_BASE_H
 #define CONTROLLER_BASE_H
 
+#include <stdbool.h>
+
 #include <mongoose.h>
 
-typedef enum http_request_method_e
-{
-    HTTP_REQUEST_METHOD_UNKNOWN = -1,
-    
-    HTTP_REQUEST_METHOD_GET = 0,
-    HTTP_REQUEST_METHOD_HEAD,
-    HTTP_REQUEST_METHOD_POST,
-    HTTP_REQUEST_METHOD_PUT,
-    HTTP_REQUEST_METHOD_DELETE,
-    HTTP_REQUEST_METHOD_CONNECT,
-    HTTP_REQUEST_METHOD_OPTIONS,
-    HTTP_REQUEST_METHOD_TRACE,
-    HTTP_REQUEST_METHOD_PATCH,
-
-    HTTP_REQUEST_METHOD_MAX
-} http_request_method_t;
+#include "request_arena.h"
+#include "route_table.h"
 
 typedef enum multipart_request_message_type_e
 {
@@ -26,19 +14,72 @@ typedef enum multipart_request_message_type_e
     MULTIPART_REQUEST_MESSAGE_TYPE_PART_BEGIN,
     MULTIPART_REQUEST_MESSAGE_TYPE_PART_DATA,
     MULTIPART_REQUEST_MESSAGE_TYPE_PART_END,
-    MULTIPART_REQUEST_MESSAGE_TYPE_END
+    MULTIPART_REQUEST_MESSAGE_TYPE_END,
+    // The connection closed before the END message
+    MULTIPART_REQUEST_MESSAGE_TYPE_ABORT
 } multipart_request_message_type_t;
 
+typedef enum stream_request_message_type_e
+{
+    STREAM_REQUEST_MESSAGE_TYPE_BEGIN,
+    STREAM_REQUEST_MESSAGE_TYPE_DATA,
+    STREAM_REQUEST_MESSAGE_TYPE_END,
+    // The connection closed, or another request took over, before the whole body was recieved
+    STREAM_REQUEST_MESSAGE_TYPE_ABORT
+} stream_request_message_type_t;
+
+/**
+ * @brief Handles a request.
+ * The arena is reset as soon as the handler returns, the response must be complete by then.
+ */
 typedef void (*request_handler_t)(
     struct mg_connection* nc,
     struct http_message* const message,
+    request_arena_t* arena,
     void* userData);
 
+/**
+ * @brief Handles the messages of a multipart request.
+ * The arena is the same for every message of the request and is reset after the END or ABORT message.
+ * The message and part are only passed with the messages they belong to, the ABORT message has neither.
+ */
 typedef void (*multipart_request_handler_t)(
     struct mg_connection* const nc,
     struct http_message* const message,
     struct mg_http_multipart_part* const part,
     const multipart_request_message_type_t type,
+    request_arena_t* arena,
+    void* userData);
+
+/**
+ * @brief Handles the messages of a request whose body is passed to the handler as it is recieved, without buffering or parsing it.
+ * The message is only passed with the BEGIN message, the data only with DATA messages.
+ * The arena is the same for every message of the request and is reset after the END or ABORT message.
+ * The connection is closed after the response.
+ * A handler that can not take all data right now, or that can not respond to END yet, calls stream_request_pause
+ * and later stream_request_resume, the data it did not consume is passed again then.
+ *
+ * @return true to continue recieving the request, or
+ * false to stop after the handler sent an error response, no END or ABORT message follows.
+ */
+typedef bool (*stream_request_handler_t)(
+    struct mg_connection* const nc,
+    struct http_message* const message,
+    const struct mg_str* const data,
+    const stream_request_message_type_t type,
+    request_arena_t* arena,
+    void* userData);
+
+/**
+ * @brief Decides if a stream request may take over from the stream request of the same handler that is in progress,
+ * for a client that reconnected before the server noticed its old connection is gone.
+ * The request in progress gets its ABORT message and its connection is closed, then the new request gets its BEGIN message.
+ *
+ * @return true to take over, or
+ * false to refuse the new request with 503.
+ */
+typedef bool (*stream_request_takeover_handler_t)(
+    struct http_message* const message,
     void* userData);
 
 typedef struct method_handler_info_s
@@ -64,7 +105,113 @@ typedef struct multipart_request_uri_handler_info_t
     void* user_data;
 } multipart_request_uri_handler_info_t;
 
-void register_uri_handler(struct mg_connection* nc, const char* rootUri, uri_handler_info_t* uriHandlerInfo);
-void register_multipart_request_uri_handler(struct mg_connection* nc, const char* rootUri, multipart_request_uri_handler_info_t* uriHandlerInfo);
+typedef struct stream_request_uri_handler_info_s
+{
+    const char* uri;
+    stream_request_handler_t handler;
+    const char* method;
+    // Only requests with this content type are streamed, other requests of the uri are handled as usual
+    const char* content_type;
+    // Optional, without it a request is refused while another one is in progress
+    stream_request_takeover_handler_t takeover;
+
+    void* user_data;
+} stream_request_uri_handler_info_t;
+
+typedef struct route_stats_s
+{
+    const char* root_uri;
+    const char* uri;
+    // The most arena memory any request of the route needed, can be larger then the arena
+    size_t      arena_high_water_mark;
+} route_stats_t;
+
+/**
+ * @brief Adds the handlers of a uri to the route table.
+ * 
+ * @param[in] rootUri Uri prefix of the controller, must outlive the route table.
+ * @param[in] uriHandlerInfo Handlers to register, must outlive the route table.
+ */
+void register_uri_handler(const char* rootUri, const uri_handler_info_t* uriHandlerInfo);
+
+/**
+ * @brief Adds a multipart request handler of a uri to the route table.
+ * A uri can have both a multipart request handler and regular request handlers.
+ * 
+ * @param[in] rootUri Uri prefix of the controller, must outlive the route table.
+ * @param[in] uriHandlerInfo Handler to register, must outlive the route table.
+ */
+void register_multipart_request_uri_handler(const char* rootUri, const multipart_request_uri_handler_info_t* uriHandlerInfo);
+
+/**
+ * @brief Adds a stream request handler of a uri and method to the route table.
+ * Requests must have a Content-Length, only one stream or multipart request can be in progress at a time.
+ * 
+ * @param[in] rootUri Uri prefix of the controller, must outlive the route table.
+ * @param[in] uriHandlerInfo Handler to register, must outlive the route table.
+ */
+void register_stream_request_uri_handler(const char* rootUri, const stream_request_uri_handler_info_t* uriHandlerInfo);
+
+/**
+ * @brief Makes a stream request wait before its next message.
+ * Must be called by the stream request handler during a DATA or END message. The data the handler did not consume
+ * stays in the recieve buffer and mongoose stops reading from the connection, so the client waits until the request is resumed.
+ * 
+ * @param[in] nc The connection of the stream request.
+ * @param[in] nrOfBytesConsumed How many bytes of the data of the DATA message the handler consumed.
+ */
+void stream_request_pause(struct mg_connection* nc, size_t nrOfBytesConsumed);
+
+/**
+ * @brief Continues a paused stream request, the data that was not consumed is passed to the handler again.
+ * Must be called from the webserver thread. Does nothing if the connection has no paused stream request,
+ * so it is safe to call for a connection that closed in the mean time.
+ * 
+ * @param[in] nc The connection of the stream request.
+ */
+void stream_request_resume(struct mg_connection* nc);
+
+/**
+ * @brief Checks if a stream request on a connection is paused, such a connection is waiting for the server, not for the client.
+ * 
+ * @param[in] nc The connection to check.
+ * 
+ * @return true if the connection has a paused stream request.
+ */
+bool stream_request_is_paused(const struct mg_connection* nc);
+
+/**
+ * @brief Removes all registered handlers from the route table.
+ */
+void clear_uri_handlers(void);
+
+/**
+ * @brief Gets the statistics of a route in the route table.
+ * 
+ * @param[in] index Index of the route, routes are numbered in the order they were registered.
+ * @param[out] stats The statistics of the route.
+ * 
+ * @return true if the route exists, or
+ * false if index is past the last route.
+ */
+bool get_route_stats(size_t index, route_stats_t* stats);
+
+/**
+ * @brief Gets the size of the arena that is passed to request handlers.
+ */
+size_t get_request_arena_size(void);
+
+/**
+ * @brief Dispatches a webserver event to the handler registered for its uri.
+ * Lookup walks the uri once and does not allocate.
+ * 
+ * @param[in] nc The connection the event occured on.
+ * @param[in] ev The mongoose event.
+ * @param[in] ev_data The mongoose event data.
+ * 
+ * @return true if the event was handled, or
+ * false if no handler is registered for the uri of the request.
+ */
+bool dispatch_uri_handler(struct mg_connection* nc, int ev, void* ev_data);
 
 #endif // CONTROLLER_BASE_H
\ No newline at end of file
@@ -0,0 +1,541 @@
+#include "controller_json.h"
+
+#include <string.h>
+
+#include <logger.h>
+
+// Guards against deeply nested values in skipped fields
+#define MAX_SKIP_DEPTH 8
+
+typedef struct json_reader_s
+{
+    const char* p;
+    const char* end;
+} json_reader_t;
+
+static const char TAG[] = "Controller Json";
+
+static void write_raw(json_writer_t* writer, const char* data, size_t length)
+{
+    if (writer->overflow || writer->length + length > writer->size)
+    {
+        writer->overflow = true;
+        return;
+    }
+
+    memcpy(writer->buffer + writer->length, data, length);
+    writer->length += length;
+}
+
+static void write_char(json_writer_t* writer, char c)
+{
+    write_raw(writer, &c, 1);
+}
+
+static void write_key(json_writer_t* writer, const char* key)
+{
+    if (writer->needs_separator)
+    {
+        write_char(writer, ',');
+    }
+    writer->needs_separator = true;
+
+    // Keys are literals in the controllers, they never need escaping
+    if (key != NULL)
+    {
+        write_char(writer, '"');
+        write_raw(writer, key, strlen(key));
+        write_raw(writer, "\":", 2);
+    }
+}
+
+static void write_uint(json_writer_t* writer, uint32_t value)
+{
+    char digits[10];
+    size_t nrOfDigits = 0;
+    do
+    {
+        digits[sizeof(digits) - 1 - nrOfDigits++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+
+    write_raw(writer, digits + sizeof(digits) - nrOfDigits, nrOfDigits);
+}
+
+void json_writer_init(json_writer_t* writer, char* buffer, size_t size)
+{
+    writer->buffer = buffer;
+    writer->size = size;
+    writer->length = 0;
+    writer->needs_separator = false;
+    // Without a buffer nothing fits, the response becomes an error when it is sent
+    writer->overflow = buffer == NULL;
+}
+
+void json_writer_begin_object(json_writer_t* writer, const char* key)
+{
+    write_key(writer, key);
+    write_char(writer, '{');
+    writer->needs_separator = false;
+}
+
+void json_writer_end_object(json_writer_t* writer)
+{
+    write_char(writer, '}');
+    writer->needs_separator = true;
+}
+
+void json_writer_begin_array(json_writer_t* writer, const char* key)
+{
+    write_key(writer, key);
+    write_char(writer, '[');
+    writer->needs_separator = false;
+}
+
+void json_writer_end_array(json_writer_t* writer)
+{
+    write_char(writer, ']');
+    writer->needs_separator = true;
+}
+
+void json_writer_add_uint(json_writer_t* writer, const char* key, uint32_t value)
+{
+    write_key(writer, key);
+    write_uint(writer, value);
+}
+
+void json_writer_add_int(json_writer_t* writer, const char* key, int32_t value)
+{
+    write_key(writer, key);
+    if (value < 0)
+    {
+        write_char(writer, '-');
+        write_uint(writer, -(uint32_t)value);
+    }
+    else
+    {
+        write_uint(writer, value);
+    }
+}
+
+void json_writer_add_bool(json_writer_t* writer, const char* key, bool value)
+{
+    write_key(writer, key);
+    if (value)
+    {
+        write_raw(writer, "true", 4);
+    }
+    else
+    {
+        write_raw(writer, "false", 5);
+    }
+}
+
+void json_writer_add_string(json_writer_t* writer, const char* key, const char* value)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    write_key(writer, key);
+    write_char(writer, '"');
+    for (const char* c = value; *c != '\0'; ++c)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            write_char(writer, '\\');
+            write_char(writer, *c);
+        }
+        else if ((unsigned char)*c < 0x20)
+        {
+            char escaped[] = { '\\', 'u', '0', '0', hex[(*c >> 4) & 0x0F], hex[*c & 0x0F] };
+            write_raw(writer, escaped, sizeof(escaped));
+        }
+        else
+        {
+            write_char(writer, *c);
+        }
+    }
+    write_char(writer, '"');
+}
+
+void json_writer_send(struct mg_connection* nc, int status, const json_writer_t* writer)
+{
+    if (writer->overflow)
+    {
+        LOG_E(TAG, "Response does not fit in %u bytes", writer->size);
+        mg_http_send_error(nc, 500, NULL);
+        return;
+    }
+
+    mg_send_head(nc, status, writer->length, "Content-Type: application/json");
+    mg_send(nc, writer->buffer, writer->length);
+}
+
+static void skip_whitespace(json_reader_t* reader)
+{
+    while (reader->p < reader->end && (*reader->p == ' ' || *reader->p == '\t' || *reader->p == '\n' || *reader->p == '\r'))
+    {
+        reader->p++;
+    }
+}
+
+static bool consume(json_reader_t* reader, char c)
+{
+    skip_whitespace(reader);
+    if (reader->p < reader->end && *reader->p == c)
+    {
+        reader->p++;
+        return true;
+    }
+
+    return false;
+}
+
+static bool consume_literal(json_reader_t* reader, const char* literal, size_t length)
+{
+    if ((size_t)(reader->end - reader->p) < length || memcmp(reader->p, literal, length) != 0)
+    {
+        return false;
+    }
+
+    reader->p += length;
+    return true;
+}
+
+static controller_json_err_t read_string(json_reader_t* reader, const char** string, size_t* length)
+{
+    if (!consume(reader, '"'))
+    {
+        return CONTROLLER_JSON_ERR_SYNTAX;
+    }
+
+    // Escapes are skipped, not decoded, field names never contain them
+    const char* start = reader->p;
+    while (reader->p < reader->end && *reader->p != '"')
+    {
+        reader->p += *reader->p == '\\' ? 2 : 1;
+    }
+
+    if (reader->p >= reader->end)
+    {
+        return CONTROLLER_JSON_ERR_SYNTAX;
+    }
+
+    *string = start;
+    *length = reader->p - start;
+    reader->p++;
+    return CONTROLLER_JSON_OK;
+}
+
+static controller_json_err_t read_number(json_reader_t* reader, bool allowNegative, uint32_t limit, bool* isNegative, uint32_t* value)
+{
+    skip_whitespace(reader);
+
+    *isNegative = reader->p < reader->end && *reader->p == '-';
+    if (*isNegative)
+    {
+        if (!allowNegative)
+        {
+            return CONTROLLER_JSON_ERR_RANGE;
+        }
+        reader->p++;
+    }
+
+    if (reader->p >= reader->end || *reader->p < '0' || *reader->p > '9')
+    {
+        return CONTROLLER_JSON_ERR_TYPE;
+    }
+
+    uint32_t result = 0;
+    while (reader->p < reader->end && *reader->p >= '0' && *reader->p <= '9')
+    {
+        uint32_t digit = *reader->p++ - '0';
+        if (result > (limit - digit) / 10)
+        {
+            return CONTROLLER_JSON_ERR_RANGE;
+        }
+        result = result * 10 + digit;
+    }
+
+    // Fractions are truncated, like json_scanf did with %u
+    if (reader->p < reader->end && *reader->p == '.')
+    {
+        do
+        {
+            reader->p++;
+        } while (reader->p < reader->end && *reader->p >= '0' && *reader->p <= '9');
+    }
+
+    if (reader->p < reader->end && (*reader->p == 'e' || *reader->p == 'E'))
+    {
+        return CONTROLLER_JSON_ERR_RANGE;
+    }
+
+    *value = result;
+    return CONTROLLER_JSON_OK;
+}
+
+static controller_json_err_t skip_value(json_reader_t* reader)
+{
+    skip_whitespace(reader);
+    if (reader->p >= reader->end)
+    {
+        return CONTROLLER_JSON_ERR_SYNTAX;
+    }
+
+    const char* string;
+    size_t length;
+    switch (*reader->p)
+    {
+    case '"':
+        return read_string(reader, &string, &length);
+
+    case '{':
+    case '[':
+    {
+        // Skip nested values by counting brackets, strings are skipped as a whole so brackets in them do not count
+        size_t depth = 0;
+        do
+        {
+            if (*reader->p == '"')
+            {
+                if (read_string(reader, &string, &length) != CONTROLLER_JSON_OK)
+                {
+                    return CONTROLLER_JSON_ERR_SYNTAX;
+                }
+                continue;
+            }
+
+            if (*reader->p == '{' || *reader->p == '[')
+            {
+                if (++depth > MAX_SKIP_DEPTH)
+                {
+                    return CONTROLLER_JSON_ERR_SYNTAX;
+                }
+            }
+            else if (*reader->p == '}' || *reader->p == ']')
+            {
+                depth--;
+            }
+            reader->p++;
+        } while (depth > 0 && reader->p < reader->end);
+
+        return depth == 0 ? CONTROLLER_JSON_OK : CONTROLLER_JSON_ERR_SYNTAX;
+    }
+
+    default:
+        // Numbers and literals
+        while (reader->p < reader->end && *reader->p != ',' && *reader->p != '}' && *reader->p != ']' &&
+            *reader->p != ' ' && *reader->p != '\t' && *reader->p != '\n' && *reader->p != '\r')
+        {
+            reader->p++;
+        }
+        return CONTROLLER_JSON_OK;
+    }
+}
+
+static controller_json_err_t read_field(json_reader_t* reader, const json_field_t* field, void* target)
+{
+    controller_json_err_t err;
+    bool isNegative;
+    uint32_t value;
+
+    switch (field->type)
+    {
+    case JSON_FIELD_TYPE_UINT32:
+        err = read_number(reader, false, UINT32_MAX, &isNegative, &value);
+        if (err == CONTROLLER_JSON_OK)
+        {
+            *(uint32_t*)((char*)target + field->offset) = value;
+        }
+        return err;
+
+    case JSON_FIELD_TYPE_INT32:
+        err = read_number(reader, true, INT32_MAX, &isNegative, &value);
+        if (err == CONTROLLER_JSON_OK)
+        {
+            *(int32_t*)((char*)target + field->offset) = isNegative ? -(int32_t)value : (int32_t)value;
+        }
+        return err;
+
+    case JSON_FIELD_TYPE_STRING:
+    {
+        json_string_t* string = (json_string_t*)((char*)target + field->offset);
+        skip_whitespace(reader);
+        if (reader->p >= reader->end || *reader->p != '"')
+        {
+            return CONTROLLER_JSON_ERR_TYPE;
+        }
+        return read_string(reader, &string->p, &string->len);
+    }
+
+    case JSON_FIELD_TYPE_RAW:
+    {
+        json_string_t* raw = (json_string_t*)((char*)target + field->offset);
+        skip_whitespace(reader);
+        raw->p = reader->p;
+        controller_json_err_t err = skip_value(reader);
+        raw->len = reader->p - raw->p;
+        return err;
+    }
+
+    case JSON_FIELD_TYPE_BOOL:
+        skip_whitespace(reader);
+        if (consume_literal(reader, "true", 4))
+        {
+            *(bool*)((char*)target + field->offset) = true;
+        }
+        else if (consume_literal(reader, "false", 5))
+        {
+            *(bool*)((char*)target + field->offset) = false;
+        }
+        else
+        {
+            return CONTROLLER_JSON_ERR_TYPE;
+        }
+        return CONTROLLER_JSON_OK;
+
+    default:
+        return CONTROLLER_JSON_FAIL;
+    }
+}
+
+controller_json_err_t json_read_object(
+    const char* json,
+    size_t length,
+    const json_field_t* fields,
+    size_t nrOfFields,
+    void* target,
+    uint32_t* fieldsRead)
+{
+    json_reader_t reader = {
+        .p = json,
+        .end = json + length
+    };
+    uint32_t read = 0;
+
+    if (!consume(&reader, '{'))
+    {
+        return CONTROLLER_JSON_ERR_SYNTAX;
+    }
+
+    if (!consume(&reader, '}'))
+    {
+        do
+        {
+            const char* name;
+            size_t nameLength;
+            controller_json_err_t err = read_string(&reader, &name, &nameLength);
+            if (err != CONTROLLER_JSON_OK || !consume(&reader, ':'))
+            {
+                return CONTROLLER_JSON_ERR_SYNTAX;
+            }
+
+            size_t i = 0;
+            while (i < nrOfFields && (fields[i].name_length != nameLength || memcmp(fields[i].name, name, nameLength) != 0))
+            {
+                i++;
+            }
+
+            if (i < nrOfFields)
+            {
+                err = read_field(&reader, &fields[i], target);
+                read |= 1u << i;
+            }
+            else
+            {
+                err = skip_value(&reader);
+            }
+
+            if (err != CONTROLLER_JSON_OK)
+            {
+                return err;
+            }
+        } while (consume(&reader, ','));
+
+        if (!consume(&reader, '}'))
+        {
+            return CONTROLLER_JSON_ERR_SYNTAX;
+        }
+    }
+
+    if (fieldsRead != NULL)
+    {
+        *fieldsRead = read;
+    }
+
+    return CONTROLLER_JSON_OK;
+}
+
+controller_json_err_t json_read_array(
+    const char* json,
+    size_t length,
+    size_t maxElements,
+    json_array_element_handler_t handler,
+    void* userData,
+    size_t* nrOfElements)
+{
+    json_reader_t reader = {
+        .p = json,
+        .end = json + length
+    };
+    size_t index = 0;
+
+    if (!consume(&reader, '['))
+    {
+        return CONTROLLER_JSON_ERR_SYNTAX;
+    }
+
+    if (!consume(&reader, ']'))
+    {
+        do
+        {
+            if (index >= maxElements)
+            {
+                return CONTROLLER_JSON_ERR_OVERFLOW;
+            }
+
+            skip_whitespace(&reader);
+            const char* element = reader.p;
+            controller_json_err_t err = skip_value(&reader);
+            if (err != CONTROLLER_JSON_OK)
+            {
+                return err;
+            }
+
+            err = handler(index++, element, reader.p - element, userData);
+            if (err != CONTROLLER_JSON_OK)
+            {
+                return err;
+            }
+        } while (consume(&reader, ','));
+
+        if (!consume(&reader, ']'))
+        {
+            return CONTROLLER_JSON_ERR_SYNTAX;
+        }
+    }
+
+    if (nrOfElements != NULL)
+    {
+        *nrOfElements = index;
+    }
+
+    return CONTROLLER_JSON_OK;
+}
+
+controller_json_err_t json_read_string(const char* json, size_t length, json_string_t* string)
+{
+    json_reader_t reader = {
+        .p = json,
+        .end = json + length
+    };
+
+    skip_whitespace(&reader);
+    if (reader.p >= reader.end || *reader.p != '"' || read_string(&reader, &string->p, &string->len) != CONTROLLER_JSON_OK)
+    {
+        return CONTROLLER_JSON_ERR_TYPE;
+    }
+
+    skip_whitespace(&reader);
+    return reader.p == reader.end ? CONTROLLER_JSON_OK : CONTROLLER_JSON_ERR_TYPE;
+}
\ No newline at end of file
@@ -0,0 +1,173 @@
+#ifndef CONTROLLER_JSON_H
+#define CONTROLLER_JSON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mongoose.h>
+
+// Large enough for every response of the api controllers
+#define CONTROLLER_JSON_BUFFER_SIZE 256
+
+typedef enum 
+{
+    CONTROLLER_JSON_OK = 0,
+    CONTROLLER_JSON_FAIL = -1,
+
+    CONTROLLER_JSON_ERR_SYNTAX = 1,
+    CONTROLLER_JSON_ERR_TYPE,
+    CONTROLLER_JSON_ERR_RANGE,
+    CONTROLLER_JSON_ERR_OVERFLOW
+
+} controller_json_err_t;
+
+typedef enum json_field_type_e
+{
+    JSON_FIELD_TYPE_UINT32,
+    JSON_FIELD_TYPE_INT32,
+    JSON_FIELD_TYPE_BOOL,
+    JSON_FIELD_TYPE_STRING,
+    // Any value, stored as a json_string_t holding the json text of the value
+    JSON_FIELD_TYPE_RAW
+} json_field_type_t;
+
+/**
+ * @brief A string inside the json text, fields of type JSON_FIELD_TYPE_STRING and JSON_FIELD_TYPE_RAW are read into this.
+ * Points into the json text, escapes are not decoded and it is not null terminated.
+ */
+typedef struct json_string_s
+{
+    const char* p;
+    size_t      len;
+} json_string_t;
+
+/**
+ * @brief Called for every element of a json array.
+ * 
+ * @param[in] index The index of the element.
+ * @param[in] element The json text of the element.
+ * @param[in] length The length of the json text of the element.
+ * @param[in] userData The user data passed to json_read_array.
+ * 
+ * @return controller_json_err_t CONTROLLER_JSON_OK to continue with the next element,
+ * any other value stops reading the array and is returned by json_read_array.
+ */
+typedef controller_json_err_t (*json_array_element_handler_t)(size_t index, const char* element, size_t length, void* userData);
+
+/**
+ * @brief Describes where the value of a json field is stored in a struct.
+ * Tables of fields are meant to be static const, see JSON_FIELD.
+ */
+typedef struct json_field_s
+{
+    const char*       name;
+    uint8_t           name_length;
+    json_field_type_t type;
+    size_t            offset;
+} json_field_t;
+
+#define JSON_FIELD(structType, member, jsonName, fieldType) \
+    { .name = jsonName, .name_length = sizeof(jsonName) - 1, .type = fieldType, .offset = offsetof(structType, member) }
+
+/**
+ * @brief Writes json into a fixed buffer supplied by the caller, usually allocated from the request arena.
+ * Writing past the end of the buffer sets overflow instead of allocating.
+ */
+typedef struct json_writer_s
+{
+    char*  buffer;
+    size_t size;
+    size_t length;
+    bool   needs_separator;
+    bool   overflow;
+} json_writer_t;
+
+/**
+ * @brief Prepares a writer to write into a buffer.
+ * 
+ * @param[in] writer The writer to initialize.
+ * @param[in] buffer The buffer to write into, usually allocated from the request arena. NULL is treated as a buffer that is too small.
+ * @param[in] size The size of the buffer.
+ */
+void json_writer_init(json_writer_t* writer, char* buffer, size_t size);
+void json_writer_begin_object(json_writer_t* writer, const char* key);
+void json_writer_end_object(json_writer_t* writer);
+void json_writer_begin_array(json_writer_t* writer, const char* key);
+void json_writer_end_array(json_writer_t* writer);
+void json_writer_add_uint(json_writer_t* writer, const char* key, uint32_t value);
+void json_writer_add_int(json_writer_t* writer, const char* key, int32_t value);
+void json_writer_add_bool(json_writer_t* writer, const char* key, bool value);
+void json_writer_add_string(json_writer_t* writer, const char* key, const char* value);
+
+/**
+ * @brief Sends the json in the writer as the complete response to a request.
+ * Sends a 500 response instead if the json did not fit in the buffer of the writer.
+ * 
+ * @param[in] nc The connection to send the response on.
+ * @param[in] status The http status code of the response.
+ * @param[in] writer The writer holding a complete json document.
+ */
+void json_writer_send(struct mg_connection* nc, int status, const json_writer_t* writer);
+
+/**
+ * @brief Reads the fields of a json object into a struct in a single pass, without allocating.
+ * Fields that are not in the table are skipped, fields that are not in the json are left untouched.
+ * 
+ * @param[in] json The json text, does not need to be null terminated.
+ * @param[in] length The length of the json text.
+ * @param[in] fields Table of the fields to read.
+ * @param[in] nrOfFields The number of fields in the table, at most 32.
+ * @param[out] target The struct the fields are stored in.
+ * @param[out] fieldsRead Optional, bit i is set if fields[i] was read.
+ * 
+ * @return controller_json_err_t CONTROLLER_JSON_OK if the json was read, or
+ * CONTROLLER_JSON_ERR_SYNTAX if the json is not a valid object,
+ * CONTROLLER_JSON_ERR_TYPE if a field has a value of the wrong type,
+ * CONTROLLER_JSON_ERR_RANGE if a number does not fit its field.
+ * The target may be partially updated when an error is returned.
+ */
+controller_json_err_t json_read_object(
+    const char* json,
+    size_t length,
+    const json_field_t* fields,
+    size_t nrOfFields,
+    void* target,
+    uint32_t* fieldsRead);
+
+/**
+ * @brief Walks the elements of a json array in a single pass, without allocating.
+ * 
+ * @param[in] json The json text, does not need to be null terminated.
+ * @param[in] length The length of the json text.
+ * @param[in] maxElements The maximum number of elements the array may have.
+ * @param[in] handler Called for every element, in order.
+ * @param[in] userData Passed to the handler.
+ * @param[out] nrOfElements Optional, the number of elements in the array.
+ * 
+ * @return controller_json_err_t CONTROLLER_JSON_OK if every element was handled, or
+ * CONTROLLER_JSON_ERR_SYNTAX if the json is not a valid array,
+ * CONTROLLER_JSON_ERR_OVERFLOW if the array has more than maxElements elements,
+ * or the error returned by the handler.
+ */
+controller_json_err_t json_read_array(
+    const char* json,
+    size_t length,
+    size_t maxElements,
+    json_array_element_handler_t handler,
+    void* userData,
+    size_t* nrOfElements);
+
+/**
+ * @brief Reads a json text that is a single string, like the elements of an array of strings.
+ * 
+ * @param[in] json The json text, does not need to be null terminated.
+ * @param[in] length The length of the json text.
+ * @param[out] string The string, points into the json text.
+ * 
+ * @return controller_json_err_t CONTROLLER_JSON_OK if the json was read, or
+ * CONTROLLER_JSON_ERR_TYPE if the json is not a string.
+ */
+controller_json_err_t json_read_string(const char* json, size_t length, json_string_t* string);
+
+#endif // CONTROLLER_JSON_H
\ No newline at end of file
@@ -1,10 +1,9 @@
 #include "lift_controller.h"
 #include "controller_base.h"
+#include "controller_json.h"
 
 #include <stdio.h>
 
-#include <frozen.h>
-
 #include <pins.h>
 #include <logger.h>
 #include <lift/lift.h>
@@ -15,45 +14,59 @@
 
 static char TAG[] = __FILE__;
 
-static uint32_t getSpeed(struct http_message* message)
+typedef struct speed_request_s
+{
+    uint32_t speed;
+} speed_request_t;
+
+static const json_field_t speed_request_fields[] = {
+    JSON_FIELD(speed_request_t, speed, "speed", JSON_FIELD_TYPE_UINT32)
+};
+
+static bool getSpeed(struct http_message* message, uint32_t* speed)
 {
     const settings_t* settings;
     settings_service_load(&settings);
 
-    uint32_t speed = settings->lift_default_speed;   
-
-    json_scanf(
-        message->body.p,
-        message->body.len,
-        "{"
-            "speed: %u" 
-        "}",
-        &speed);
-    
-    return speed;
+    speed_request_t request = {
+        .speed = settings->lift_default_speed
+    };
+
+    // Requests without a body use the default speed
+    if (message->body.len > 0 &&
+        json_read_object(message->body.p, message->body.len, speed_request_fields, 1, &request, NULL) != CONTROLLER_JSON_OK)
+    {
+        return false;
+    }
+
+    *speed = request.speed;
+    return true;
 }
 
-static void status_get_handler(struct mg_connection* nc, struct http_message* message, void* userData)
+static void status_get_handler(struct mg_connection* nc, struct http_message* message, request_arena_t* arena, void* userData)
 {
     lift_device_handle_t liftHandle = lift_service_get_lift_device_handle();
 
-    char* str = json_asprintf(
-        "{"
-            "status: %Q"
-        "}",
-        liftHandle == NULL ? "offline" : "online"
-    );
-    mg_send_head(nc, 200, strlen(str), NULL);
-    mg_printf(nc, "%s", str);
-    free(str);
+    json_writer_t writer;
+    json_writer_init(&writer, request_arena_alloc(arena, CONTROLLER_JSON_BUFFER_SIZE), CONTROLLER_JSON_BUFFER_SIZE);
+    json_writer_begin_object(&writer, NULL);
+    json_writer_add_string(&writer, "status", liftHandle == NULL ? "offline" : "online");
+    json_writer_end_object(&writer);
+    json_writer_send(nc, 200, &writer);
 }
 
-static void up_post_handler(struct mg_connection* nc, struct http_message* message, void* userData)
+static void up_post_handler(struct mg_connection* nc, struct http_message* message, request_arena_t* arena, void* userData)
 {
     lift_err_t liftErr;
     lift_device_handle_t liftHandle = lift_service_get_lift_device_handle();
 
-    uint32_t speed = getSpeed(message);
+    uint32_t speed;
+    if(!getSpeed(message, &speed))
+    {
+        mg_http_send_error(nc, 400, "Invalid speed.");
+        return;
+    }
+
     liftErr = lift_set_speed(liftHandle, speed);
     if(liftErr != LIFT_OK)
     {
@@ -71,12 +84,18 @@ static void up_post_handler(struct mg_connection* nc, struct http_message* messa
     mg_send_head(nc, 200, 0, NULL);
 }
 
-static void down_post_handler(struct mg_connection* nc, struct http_message* message, void* userData)
+static void down_post_handler(struct mg_connection* nc, struct http_message* message, request_arena_t* arena, void* userData)
 {
     lift_err_t liftErr;
     lift_device_handle_t liftHandle = lift_service_get_lift_device_handle();
 
-    uint32_t speed = getSpeed(message);
+    uint32_t speed;
+    if(!getSpeed(message, &speed))
+    {
+        mg_http_send_error(nc, 400, "Invalid speed.");
+        return;
+    }
+
     liftErr = lift_set_speed(liftHandle, speed);
     if(liftErr != LIFT_OK)
     {
@@ -94,7 +113,7 @@ static void down_post_handler(struct mg_connection* nc, struct http_message* mes
     mg_send_head(nc, 200, 0, NULL);
 }
 
-static void stop_post_handler(struct mg_connection* nc, struct http_message* message, void* userData)
+static void stop_post_handler(struct mg_connection* nc, struct http_message* message, request_arena_t* arena, void* userData)
 {
     lift_device_handle_t liftHandle = lift_service_get_lift_device_handle();
     lift_err_t liftErr = lift_stop(liftHandle);
@@ -107,27 +126,30 @@ static void stop_post_handler(struct mg_connection* nc, struct http_message* mes
     mg_send_head(nc, 200, 0, NULL);
 }
 
-static void speed_get_handler(struct mg_connection* nc, struct http_message* message, void* userData)
+static void speed_get_handler(struct mg_connection* nc, struct http_message* message, request_arena_t* arena, void* userData)
 {
     lift_device_handle_t liftHandle = lift_service_get_lift_device_handle();
 
-    char* str = json_asprintf(
-        "{"
-            "speed: %u"
-        "}",
-        lift_get_speed(liftHandle)
-    );
-    mg_send_head(nc, 200, strlen(str), NULL);
-    mg_printf(nc, "%s", str);
-    free(str);
+    json_writer_t writer;
+    json_writer_init(&writer, request_arena_alloc(arena, CONTROLLER_JSON_BUFFER_SIZE), CONTROLLER_JSON_BUFFER_SIZE);
+    json_writer_begin_object(&writer, NULL);
+    json_writer_add_uint(&writer, "speed", lift_get_speed(liftHandle));
+    json_writer_end_object(&writer);
+    json_writer_send(nc, 200, &writer);
 }
 
-static void speed_post_handler(struct mg_connection* nc, struct http_message* message, void* userData)
+static void speed_post_handler(struct mg_connection* nc, struct http_message* message, request_arena_t* arena, void* userData)
 {
     lift_err_t liftErr;
     lift_device_handle_t liftHandle = lift_service_get_lift_device_handle();
 
-    uint32_t speed = getSpeed(message);
+    uint32_t speed;
+    if(!getSpeed(message, &speed))
+    {
+        mg_http_send_error(nc, 400, "Invalid speed.");
+        return;
+    }
+
     liftErr = lift_set_speed(liftHandle, speed);
     if(liftErr != LIFT_OK)
     {
@@ -198,17 +220,17 @@ static uri_handler_info_t speed_handler_info = {
     }
     };
 
-void lift_controller_register_uri_handlers(struct mg_connection* nc, const char* rootUri)
+void lift_controller_register_uri_handlers(const char* rootUri)
 {   
     // Register status uri
-    register_uri_handler(nc, rootUri, &status_handler_info);
+    register_uri_handler(rootUri, &status_handler_info);
 
     if(lift_service_get_lift_device_handle() != NULL)
     {
         // Register other uri's
-        register_uri_handler(nc, rootUri, &up_handler_info);
-        register_uri_handler(nc, rootUri, &down_handler_info);
-        register_uri_handler(nc, rootUri, &stop_handler_info);
-        register_uri_handler(nc, rootUri, &speed_handler_info);
+        register_uri_handler(rootUri, &up_handler_info);
+        register_uri_handler(rootUri, &down_handler_info);
+        register_uri_handler(rootUri, &stop_handler_info);
+        register_uri_handler(rootUri, &speed_handler_info);
     }
 }
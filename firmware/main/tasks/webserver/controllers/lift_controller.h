@@ -3,6 +3,6 @@
 
 #include <mongoose.h>
 
-void lift_controller_register_uri_handlers(struct mg_connection* nc, const char* rootUri);
+void lift_controller_register_uri_handlers(const char* rootUri);
 
 #endif // LIFT_CONTROLLER_H
\ No newline at end of file
@@ -0,0 +1,79 @@
+#include "metrics_controller.h"
+#include "controller_base.h"
+
+#include <string.h>
+
+#include <services/metrics_service.h>
+
+#define controllerUri "/metrics"
+
+// The metrics are sent in chunks of this size, so the whole text never has to be in memory at once
+#define METRICS_CHUNK_SIZE 1024
+
+typedef struct metrics_response_s
+{
+    struct mg_connection* nc;
+    char*                 chunk;
+    size_t                length;
+} metrics_response_t;
+
+static void flush_chunk(metrics_response_t* response)
+{
+    if (response->length > 0)
+    {
+        mg_send_http_chunk(response->nc, response->chunk, response->length);
+        response->length = 0;
+    }
+}
+
+static void print_metrics(const char* text, size_t length, void* userData)
+{
+    metrics_response_t* response = (metrics_response_t*)userData;
+
+    if (response->length + length > METRICS_CHUNK_SIZE)
+    {
+        flush_chunk(response);
+    }
+
+    memcpy(response->chunk + response->length, text, length);
+    response->length += length;
+}
+
+static void metrics_get_handler(struct mg_connection* nc, struct http_message* message, request_arena_t* arena, void* userData)
+{
+    metrics_response_t response = {
+        .nc = nc,
+        .chunk = request_arena_alloc(arena, METRICS_CHUNK_SIZE),
+        .length = 0
+    };
+
+    if (response.chunk == NULL)
+    {
+        mg_http_send_error(nc, 500, NULL);
+        return;
+    }
+
+    mg_send_response_line(nc, 200, "Content-Type: text/plain; version=0.0.4\r\nTransfer-Encoding: chunked");
+    metrics_service_print(print_metrics, &response);
+    flush_chunk(&response);
+
+    // An empty chunk ends the response
+    mg_send_http_chunk(nc, "", 0);
+}
+
+static uri_handler_info_t metrics_handler_info = {
+    .uri = controllerUri,
+    .methodHandlers = {
+        {
+            .method = HTTP_REQUEST_METHOD_GET,
+            .handler = metrics_get_handler,
+            .user_data = NULL
+        }
+    }
+    };
+
+void metrics_controller_register_uri_handlers(const char* rootUri)
+{   
+    // Register uri's
+    register_uri_handler(rootUri, &metrics_handler_info);
+}
\ No newline at end of file
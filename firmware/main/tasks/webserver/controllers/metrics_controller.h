@@ -0,0 +1,8 @@
+#ifndef METRICS_CONTROLLER_H
+#define METRICS_CONTROLLER_H
+
+#include <mongoose.h>
+
+void metrics_controller_register_uri_handlers(const char* rootUri);
+
+#endif // METRICS_CONTROLLER_H
\ No newline at end of file
@@ -0,0 +1,80 @@
+#include "request_arena.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#define ARENA_ALIGNMENT 8
+
+static size_t align_size(size_t size)
+{
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+void request_arena_reset(request_arena_t* arena)
+{
+    arena->used = 0;
+    arena->peak = 0;
+    arena->overflow = false;
+}
+
+void* request_arena_alloc(request_arena_t* arena, size_t size)
+{
+    size_t required = arena->used + align_size(size);
+    if (required > arena->peak)
+    {
+        arena->peak = required;
+    }
+
+    if (required > arena->size)
+    {
+        arena->overflow = true;
+        return NULL;
+    }
+
+    void* memory = arena->buffer + arena->used;
+    arena->used = required;
+    return memory;
+}
+
+void* request_arena_calloc(request_arena_t* arena, size_t count, size_t size)
+{
+    if (size != 0 && count > SIZE_MAX / size)
+    {
+        arena->overflow = true;
+        return NULL;
+    }
+
+    void* memory = request_arena_alloc(arena, count * size);
+    if (memory != NULL)
+    {
+        memset(memory, 0, count * size);
+    }
+
+    return memory;
+}
+
+char* request_arena_printf(request_arena_t* arena, const char* format, ...)
+{
+    va_list args;
+
+    // Format straight into the free part of the arena, only claim what was used
+    char* str = (char*)(arena->buffer + arena->used);
+    size_t available = request_arena_available(arena);
+
+    va_start(args, format);
+    int length = vsnprintf(available > 0 ? str : NULL, available, format, args);
+    va_end(args);
+
+    if (length < 0)
+    {
+        return NULL;
+    }
+
+    return request_arena_alloc(arena, (size_t)length + 1) != NULL ? str : NULL;
+}
+
+size_t request_arena_available(const request_arena_t* arena)
+{
+    return arena->size - arena->used;
+}
\ No newline at end of file
@@ -0,0 +1,60 @@
+#ifndef REQUEST_ARENA_H
+#define REQUEST_ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Bump allocator for memory that lives as long as a single request.
+ * Allocations are never freed one by one, the whole arena is reset when the response is complete,
+ * so request handlers never fragment the heap.
+ */
+typedef struct request_arena_s
+{
+    uint8_t* buffer;
+    size_t   size;
+    size_t   used;
+    // The most memory that was requested since the arena was reset, can be larger then size
+    size_t   peak;
+    bool     overflow;
+} request_arena_t;
+
+/**
+ * @brief Releases all allocations of the arena.
+ * 
+ * @param[in] arena The arena to reset.
+ */
+void request_arena_reset(request_arena_t* arena);
+
+/**
+ * @brief Allocates memory from the arena, aligned for any type.
+ * 
+ * @param[in] arena The arena to allocate from.
+ * @param[in] size The number of bytes to allocate.
+ * 
+ * @return Pointer to the memory, or NULL if the arena has no room left.
+ */
+void* request_arena_alloc(request_arena_t* arena, size_t size);
+
+/**
+ * @brief Allocates zero initialized memory from the arena, see request_arena_alloc.
+ */
+void* request_arena_calloc(request_arena_t* arena, size_t count, size_t size);
+
+/**
+ * @brief Formats a string into memory allocated from the arena.
+ * 
+ * @param[in] arena The arena to allocate from.
+ * @param[in] format printf style format string.
+ * 
+ * @return The null terminated string, or NULL if it does not fit in the arena.
+ */
+char* request_arena_printf(request_arena_t* arena, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Gets the number of bytes left in the arena.
+ */
+size_t request_arena_available(const request_arena_t* arena);
+
+#endif // REQUEST_ARENA_H
\ No newline at end of file
@@ -0,0 +1,165 @@
+#include "route_table.h"
+
+#include <string.h>
+
+#define NO_NODE 0
+
+static size_t route_node_find_child(const route_table_t* table, size_t node, char c)
+{
+    for(size_t child = table->nodes[node].firstChild; child != NO_NODE; child = table->nodes[child].nextSibling)
+    {
+        if(table->nodes[child].c == c)
+        {
+            return child;
+        }
+    }
+
+    return NO_NODE;
+}
+
+static size_t route_node_add_child(route_table_t* table, size_t node, char c)
+{
+    size_t child = route_node_find_child(table, node, c);
+    if(child != NO_NODE)
+    {
+        return child;
+    }
+
+    if(table->nr_of_nodes == ROUTE_TABLE_MAX_NODES)
+    {
+        return NO_NODE;
+    }
+
+    child = table->nr_of_nodes++;
+    table->nodes[child].c = c;
+    table->nodes[child].firstChild = NO_NODE;
+    table->nodes[child].nextSibling = table->nodes[node].firstChild;
+    table->nodes[child].route = ROUTE_TABLE_NO_ROUTE;
+    table->nodes[node].firstChild = child;
+
+    return child;
+}
+
+void route_table_clear(route_table_t* table)
+{
+    table->nr_of_routes = 0;
+    table->nr_of_nodes = 1;
+    table->nodes[0].c = '\0';
+    table->nodes[0].firstChild = NO_NODE;
+    table->nodes[0].nextSibling = NO_NODE;
+    table->nodes[0].route = ROUTE_TABLE_NO_ROUTE;
+}
+
+int route_table_add(route_table_t* table, const char* rootUri, const char* uri)
+{
+    size_t node = 0;
+    const char* parts[] = { rootUri, uri };
+    for(size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); ++i)
+    {
+        for(const char* c = parts[i]; *c != '\0'; ++c)
+        {
+            node = route_node_add_child(table, node, *c);
+            if(node == NO_NODE)
+            {
+                return ROUTE_TABLE_NO_ROUTE;
+            }
+        }
+    }
+
+    if(table->nodes[node].route != ROUTE_TABLE_NO_ROUTE)
+    {
+        return table->nodes[node].route;
+    }
+
+    if(table->nr_of_routes == ROUTE_TABLE_MAX_ROUTES)
+    {
+        return ROUTE_TABLE_NO_ROUTE;
+    }
+
+    table->nodes[node].route = table->nr_of_routes++;
+
+    return table->nodes[node].route;
+}
+
+int route_table_find(const route_table_t* table, const char* uri, size_t length)
+{
+    size_t node = 0;
+    for(size_t i = 0; i < length; ++i)
+    {
+        // Tolerate a single trailing slash
+        if(uri[i] == '/' && i == length - 1)
+        {
+            break;
+        }
+
+        node = route_node_find_child(table, node, uri[i]);
+        if(node == NO_NODE)
+        {
+            return ROUTE_TABLE_NO_ROUTE;
+        }
+    }
+
+    return table->nodes[node].route;
+}
+
+const char* http_request_method_to_str(const http_request_method_t method)
+{
+    switch(method)
+    {
+        case HTTP_REQUEST_METHOD_GET:
+            return "GET";
+        case HTTP_REQUEST_METHOD_HEAD:
+            return "HEAD";
+        case HTTP_REQUEST_METHOD_POST:
+            return "POST";
+        case HTTP_REQUEST_METHOD_PUT:
+            return "PUT";
+        case HTTP_REQUEST_METHOD_DELETE:
+            return "DELETE";
+        case HTTP_REQUEST_METHOD_CONNECT:
+            return "CONNECT";
+        case HTTP_REQUEST_METHOD_OPTIONS:
+            return "OPTIONS";
+        case HTTP_REQUEST_METHOD_TRACE:
+            return "TRACE";
+        case HTTP_REQUEST_METHOD_PATCH:
+            return "PATCH";
+        case HTTP_REQUEST_METHOD_UNKNOWN:
+        default:
+            return "Unknown";
+    }
+}
+
+http_request_method_t http_request_method_from_str(const char* method, size_t length)
+{
+    // Every method is uniquely identified by its length and first character,
+    // so only a single comparison against the candidate is needed
+    http_request_method_t candidate;
+    switch(length)
+    {
+        case 3:
+            candidate = method[0] == 'G' ? HTTP_REQUEST_METHOD_GET : HTTP_REQUEST_METHOD_PUT;
+            break;
+        case 4:
+            candidate = method[0] == 'H' ? HTTP_REQUEST_METHOD_HEAD : HTTP_REQUEST_METHOD_POST;
+            break;
+        case 5:
+            candidate = method[0] == 'T' ? HTTP_REQUEST_METHOD_TRACE : HTTP_REQUEST_METHOD_PATCH;
+            break;
+        case 6:
+            candidate = HTTP_REQUEST_METHOD_DELETE;
+            break;
+        case 7:
+            candidate = method[0] == 'C' ? HTTP_REQUEST_METHOD_CONNECT : HTTP_REQUEST_METHOD_OPTIONS;
+            break;
+        default:
+            return HTTP_REQUEST_METHOD_UNKNOWN;
+    }
+
+    if(memcmp(method, http_request_method_to_str(candidate), length) != 0)
+    {
+        return HTTP_REQUEST_METHOD_UNKNOWN;
+    }
+
+    return candidate;
+}
\ No newline at end of file
@@ -0,0 +1,99 @@
+#ifndef ROUTE_TABLE_H
+#define ROUTE_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Route indices are stored in an int8_t and node indices in an uint8_t
+#define ROUTE_TABLE_MAX_ROUTES 16
+#define ROUTE_TABLE_MAX_NODES  192
+
+#define ROUTE_TABLE_NO_ROUTE -1
+
+typedef enum http_request_method_e
+{
+    HTTP_REQUEST_METHOD_UNKNOWN = -1,
+    
+    HTTP_REQUEST_METHOD_GET = 0,
+    HTTP_REQUEST_METHOD_HEAD,
+    HTTP_REQUEST_METHOD_POST,
+    HTTP_REQUEST_METHOD_PUT,
+    HTTP_REQUEST_METHOD_DELETE,
+    HTTP_REQUEST_METHOD_CONNECT,
+    HTTP_REQUEST_METHOD_OPTIONS,
+    HTTP_REQUEST_METHOD_TRACE,
+    HTTP_REQUEST_METHOD_PATCH,
+
+    HTTP_REQUEST_METHOD_MAX
+} http_request_method_t;
+
+// Prefix trie over the full uri of every route, one character per node.
+// Nodes refer to each other by index, the root node is always at index 0 so
+// index 0 doubles as the "no node" marker for children and siblings.
+typedef struct route_node_s
+{
+    char    c;
+    uint8_t firstChild;
+    uint8_t nextSibling;
+    int8_t  route;
+} route_node_t;
+
+/**
+ * @brief Maps uris to route indices. Only knows about uris, what a route does is up to the user of the table.
+ * Must be cleared before it is used.
+ */
+typedef struct route_table_s
+{
+    route_node_t nodes[ROUTE_TABLE_MAX_NODES];
+    size_t       nr_of_nodes;
+    size_t       nr_of_routes;
+} route_table_t;
+
+/**
+ * @brief Removes every route from the table.
+ */
+void route_table_clear(route_table_t* table);
+
+/**
+ * @brief Adds the route of a uri to the table, or finds it if it was added before.
+ * Routes are numbered in the order they were added, starting at 0.
+ * 
+ * @param[in] table The route table.
+ * @param[in] rootUri Uri prefix of the route.
+ * @param[in] uri Rest of the uri of the route, walked after the root uri so the two need not be concatenated.
+ * 
+ * @return int The index of the route, or
+ * ROUTE_TABLE_NO_ROUTE if the table is full.
+ */
+int route_table_add(route_table_t* table, const char* rootUri, const char* uri);
+
+/**
+ * @brief Finds the route of a uri, a single trailing slash is ignored.
+ * Walks the uri once and does not allocate.
+ * 
+ * @param[in] table The route table.
+ * @param[in] uri The uri to look up, need not be null terminated.
+ * @param[in] length Length of the uri.
+ * 
+ * @return int The index of the route, or
+ * ROUTE_TABLE_NO_ROUTE if no route has this uri.
+ */
+int route_table_find(const route_table_t* table, const char* uri, size_t length);
+
+/**
+ * @brief Gets the name of a method as it appears in a request.
+ */
+const char* http_request_method_to_str(const http_request_method_t method);
+
+/**
+ * @brief Resolves the method of a request from its name, with a single comparison.
+ * 
+ * @param[in] method The name of the method, need not be null terminated.
+ * @param[in] length Length of the name.
+ * 
+ * @return http_request_method_t The method, or
+ * HTTP_REQUEST_METHOD_UNKNOWN if the name is not a method.
+ */
+http_request_method_t http_request_method_from_str(const char* method, size_t length);
+
+#endif // ROUTE_TABLE_H
\ No newline at end of file
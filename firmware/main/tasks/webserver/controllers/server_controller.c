@@ -0,0 +1,92 @@
+#include "server_controller.h"
+#include "controller_base.h"
+#include "controller_json.h"
+
+#include <tasks/webserver/connection_manager.h>
+#include <tasks/webserver/log_stream.h>
+
+#define controllerUri "/server"
+
+// Large enough for the statistics of every route
+#define ROUTES_RESPONSE_BUFFER_SIZE 1024
+
+static void connections_get_handler(struct mg_connection* nc, struct http_message* message, request_arena_t* arena, void* userData)
+{
+    connection_stats_t stats;
+    connection_manager_get_stats(&stats);
+
+    log_stream_stats_t logStats;
+    log_stream_get_stats(&logStats);
+
+    json_writer_t writer;
+    json_writer_init(&writer, request_arena_alloc(arena, CONTROLLER_JSON_BUFFER_SIZE), CONTROLLER_JSON_BUFFER_SIZE);
+    json_writer_begin_object(&writer, NULL);
+    json_writer_add_uint(&writer, "connections", stats.connections);
+    json_writer_add_uint(&writer, "peakConnections", stats.peak_connections);
+    json_writer_add_uint(&writer, "maxConnections", stats.max_connections);
+    json_writer_add_uint(&writer, "evictions", stats.evictions);
+    json_writer_add_uint(&writer, "refused", stats.refused);
+    json_writer_add_uint(&writer, "idleClosed", stats.idle_closed);
+    json_writer_add_uint(&writer, "droppedFrames", stats.dropped_frames);
+    json_writer_begin_object(&writer, "logStream");
+    json_writer_add_uint(&writer, "clients", logStats.clients);
+    json_writer_add_uint(&writer, "frames", logStats.frames);
+    json_writer_add_uint(&writer, "ringDroppedLines", logStats.ring_dropped_lines);
+    json_writer_add_uint(&writer, "clientDroppedLines", logStats.client_dropped_lines);
+    json_writer_end_object(&writer);
+    json_writer_end_object(&writer);
+    json_writer_send(nc, 200, &writer);
+}
+
+static void routes_get_handler(struct mg_connection* nc, struct http_message* message, request_arena_t* arena, void* userData)
+{
+    json_writer_t writer;
+    json_writer_init(&writer, request_arena_alloc(arena, ROUTES_RESPONSE_BUFFER_SIZE), ROUTES_RESPONSE_BUFFER_SIZE);
+    json_writer_begin_object(&writer, NULL);
+    json_writer_add_uint(&writer, "arenaSize", get_request_arena_size());
+    json_writer_begin_array(&writer, "routes");
+
+    route_stats_t stats;
+    for (size_t i = 0; get_route_stats(i, &stats); ++i)
+    {
+        const char* uri = request_arena_printf(arena, "%s%s", stats.root_uri, stats.uri);
+
+        json_writer_begin_object(&writer, NULL);
+        json_writer_add_string(&writer, "uri", uri != NULL ? uri : stats.uri);
+        json_writer_add_uint(&writer, "arenaHighWaterMark", stats.arena_high_water_mark);
+        json_writer_end_object(&writer);
+    }
+
+    json_writer_end_array(&writer);
+    json_writer_end_object(&writer);
+    json_writer_send(nc, 200, &writer);
+}
+
+static uri_handler_info_t connections_handler_info = {
+    .uri = controllerUri "/connections",
+    .methodHandlers = {
+        {
+            .method = HTTP_REQUEST_METHOD_GET,
+            .handler = connections_get_handler,
+            .user_data = NULL
+        }
+    }
+    };
+
+static uri_handler_info_t routes_handler_info = {
+    .uri = controllerUri "/routes",
+    .methodHandlers = {
+        {
+            .method = HTTP_REQUEST_METHOD_GET,
+            .handler = routes_get_handler,
+            .user_data = NULL
+        }
+    }
+    };
+
+void server_controller_register_uri_handlers(const char* rootUri)
+{   
+    // Register uri's
+    register_uri_handler(rootUri, &connections_handler_info);
+    register_uri_handler(rootUri, &routes_handler_info);
+}
\ No newline at end of file
@@ -0,0 +1,8 @@
+#ifndef SERVER_CONTROLLER_H
+#define SERVER_CONTROLLER_H
+
+#include <mongoose.h>
+
+void server_controller_register_uri_handlers(const char* rootUri);
+
+#endif // SERVER_CONTROLLER_H
\ No newline at end of file
@@ -1,10 +1,9 @@
 #include "settings_controller.h"
 #include "controller_base.h"
+#include "controller_json.h"
 
 #include <stdio.h>
 
-#include <frozen.h>
-
 #include <logger.h>
 #include <services/settings_service.h>
 
@@ -12,26 +11,34 @@
 
 static char TAG[] = __FILE__;
 
-static settings_t getSettings(struct http_message* message)
+static const json_field_t settings_fields[] = {
+    JSON_FIELD(settings_t, lift_min_speed, "liftMinSpeed", JSON_FIELD_TYPE_UINT32),
+    JSON_FIELD(settings_t, lift_max_speed, "liftMaxSpeed", JSON_FIELD_TYPE_UINT32),
+    JSON_FIELD(settings_t, lift_default_speed, "liftDefaultSpeed", JSON_FIELD_TYPE_UINT32)
+};
+
+static bool getSettings(struct http_message* message, settings_t* settings)
 {
-    settings_t settings;
+    // Start from the current settings, so the version is kept and fields that are left out do not change
+    const settings_t* currentSettings;
+    if(settings_service_load(&currentSettings) == SETTINGS_SERVICE_FAIL)
+    {
+        return false;
+    }
+    *settings = *currentSettings;
 
-    json_scanf(
+    controller_json_err_t err = json_read_object(
         message->body.p,
         message->body.len,
-        "{"
-            "liftMinSpeed: %u",
-            "liftMaxSpeed: %u",
-            "liftDefaultSpeed: %u"
-        "}",
-        &settings.lift_min_speed,
-        &settings.lift_max_speed,
-        &settings.lift_default_speed);
-    
-    return settings;
+        settings_fields,
+        sizeof(settings_fields) / sizeof(settings_fields[0]),
+        settings,
+        NULL);
+
+    return err == CONTROLLER_JSON_OK;
 }
 
-static void settings_get_handler(struct mg_connection* nc, struct http_message* message, void* userData)
+static void settings_get_handler(struct mg_connection* nc, struct http_message* message, request_arena_t* arena, void* userData)
 {
     const settings_t* settings;
     settings_service_err_t err = settings_service_load(&settings);
@@ -42,27 +49,25 @@ static void settings_get_handler(struct mg_connection* nc, struct http_message*
         return;
     }
 
-    char* str = json_asprintf(
-        "{"
-            "version: %u,"
-            "liftMinSpeed: %u,"
-            "liftMaxSpeed: %u,"
-            "liftDefaultSpeed: %u"
-        "}",
-        settings->version,
-        settings->lift_min_speed,
-        settings->lift_max_speed,
-        settings->lift_default_speed
-    );
-
-    mg_send_head(nc, 200, strlen(str), NULL);
-    mg_printf(nc, "%s", str);
-    free(str);
+    json_writer_t writer;
+    json_writer_init(&writer, request_arena_alloc(arena, CONTROLLER_JSON_BUFFER_SIZE), CONTROLLER_JSON_BUFFER_SIZE);
+    json_writer_begin_object(&writer, NULL);
+    json_writer_add_uint(&writer, "version", settings->version);
+    json_writer_add_uint(&writer, "liftMinSpeed", settings->lift_min_speed);
+    json_writer_add_uint(&writer, "liftMaxSpeed", settings->lift_max_speed);
+    json_writer_add_uint(&writer, "liftDefaultSpeed", settings->lift_default_speed);
+    json_writer_end_object(&writer);
+    json_writer_send(nc, 200, &writer);
 }
 
-static void settings_post_handler(struct mg_connection* nc, struct http_message* message, void* userData)
+static void settings_post_handler(struct mg_connection* nc, struct http_message* message, request_arena_t* arena, void* userData)
 {
-    settings_t settings = getSettings(message);
+    settings_t settings;
+    if(!getSettings(message, &settings))
+    {
+        mg_http_send_error(nc, 400, "Invalid settings.");
+        return;
+    }
 
     if(settings_service_save(&settings) != SETTINGS_SERVICE_OK)
     {
@@ -89,8 +94,8 @@ static uri_handler_info_t settings_handler_info = {
     }
     };
 
-void settings_controller_register_uri_handlers(struct mg_connection* nc, const char* rootUri)
+void settings_controller_register_uri_handlers(const char* rootUri)
 {   
     // Register uri's
-    register_uri_handler(nc, rootUri, &settings_handler_info);
+    register_uri_handler(rootUri, &settings_handler_info);
 }
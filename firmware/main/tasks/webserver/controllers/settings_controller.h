@@ -3,6 +3,6 @@
 
 #include <mongoose.h>
 
-void settings_controller_register_uri_handlers(struct mg_connection* nc, const char* rootUri);
+void settings_controller_register_uri_handlers(const char* rootUri);
 
 #endif // SETTINGS_CONTROLLER_H
\ No newline at end of file
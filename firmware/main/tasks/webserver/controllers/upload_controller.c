@@ -1,138 +1,689 @@
 #include "upload_controller.h"
 #include "controller_base.h"
+#include "controller_json.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <esp_ota_ops.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <sdkconfig.h>
 
 #include <services/ota_service.h>
+#include <tasks/update/update_task.h>
+#include <tasks/webserver/webserver_task.h>
 #include <logger.h>
 
 #define controllerUri "/upload"
 
+// Time the response gets to reach the client before the system restarts into the new firmware
+#define RESTART_DELAY_US 1000000
+
+// How long the writer task of an update tries to get its notification onto a full webserver work queue
+#define NOTIFY_RETRIES      100
+#define NOTIFY_RETRY_DELAY  pdMS_TO_TICKS(10)
+
+// A session whose connection dropped is kept this long for the client to continue it
+#define SESSION_TIMEOUT_US  ((int64_t)CONFIG_WEBSERVER_UPLOAD_SESSION_TIMEOUT_S * 1000000)
+// The expiry of a session is retried after this long when the webserver can not take it right away
+#define SESSION_EXPIRY_RETRY_US 1000000
+
+// An update that is streamed to the ota service over one or more requests.
+// It only lives in memory, the decompression and delta state of an update can not be continued after a restart.
+typedef struct upload_session_s
+{
+    ota_state_handle_t ota;
+    // 0 for an upload without a session, which is abandoned when its connection drops
+    uint32_t id;
+    // Bytes of the update file the ota service accepted, a continued upload starts here
+    size_t offset;
+    size_t length;
+    // The connection that feeds the update, it is paused while the update has no free buffer
+    struct mg_connection* nc;
+    int64_t detach_time;
+} upload_session_t;
+
+typedef struct session_request_s
+{
+    uint32_t length;
+} session_request_t;
+
+static const json_field_t session_fields[] = {
+    JSON_FIELD(session_request_t, length, "length", JSON_FIELD_TYPE_UINT32)
+};
+
+typedef struct pull_request_s
+{
+    json_string_t url;
+} pull_request_t;
+
+static const json_field_t pull_fields[] = {
+    JSON_FIELD(pull_request_t, url, "url", JSON_FIELD_TYPE_STRING)
+};
+
+// The status of a pull has its url on top of the usual fields
+#define PULL_RESPONSE_BUFFER_SIZE (CONTROLLER_JSON_BUFFER_SIZE + UPDATE_TASK_MAX_URL_LENGTH)
+
 static char TAG[] = "Upload Controller";
 
-static void firmware_post_handler(
-    struct mg_connection* nc,
-    struct http_message* const message,
-    struct mg_http_multipart_part* part,
-    multipart_request_message_type_t type,
-    void* userData)
+static esp_timer_handle_t restartTimer = NULL;
+
+// Only touched on the webserver thread
+static upload_session_t uploadSession = { 0 };
+static esp_timer_handle_t sessionTimer = NULL;
+
+static void restart(void* arg)
+{
+    LOG_I(TAG, "Restarting system!");
+    esp_restart();
+}
+
+static void restart_after_response(void)
 {
-    ota_service_err_t otaErr = OTA_SERVICE_OK;
-    ota_state_handle_t* otaState = NULL;
+    LOG_I(TAG, "Prepare to restart system!");
 
-    switch (type)
+    if (restartTimer == NULL)
     {
-    case MULTIPART_REQUEST_MESSAGE_TYPE_BEGIN:
+        const esp_timer_create_args_t timerArgs = {
+            .callback = restart,
+            .name = "restart"
+        };
+
+        if (esp_timer_create(&timerArgs, &restartTimer) != ESP_OK)
+        {
+            restart(NULL);
+            return;
+        }
+    }
+
+    esp_timer_start_once(restartTimer, RESTART_DELAY_US);
+}
+
+static bool send_ota_error(struct mg_connection* nc, ota_service_err_t otaErr)
+{
+    switch (otaErr)
     {
-        // Nothing to do
+    case OTA_SERVICE_ERR_OTA_END_FAILED:
+        mg_http_send_error(nc, 400, "Could not finalize OTA update: Failed to end OTA.");
+        break;
+    case OTA_SERVICE_ERR_SET_BOOT_PARTITON_FAILED:
+        mg_http_send_error(nc, 400, "Could not finalize OTA update: Failed to set new boot partition.");
+        break;
+    case OTA_SERVICE_ERR_INCOMPLETE:
+        mg_http_send_error(nc, 400, "Could not finalize OTA update: Update file is incomplete.");
+        break;
+    case OTA_SERVICE_ERR_INVALID_PACKAGE:
+        mg_http_send_error(nc, 400, "Update file is not a valid firmware package.");
+        break;
+    case OTA_SERVICE_ERR_BASE_MISMATCH:
+        mg_http_send_error(nc, 409, "Update file is a delta for another firmware version, use the full update file.");
+        break;
+    case OTA_SERVICE_ERR_CORRUPT:
+        mg_http_send_error(nc, 400, "Update file is corrupt, upload it again.");
+        break;
+    case OTA_SERVICE_ERR_BAD_SIGNATURE:
+        mg_http_send_error(nc, 403, "Update file is not signed by a trusted key.");
+        break;
+    case OTA_SERVICE_ERR_IN_PROGRESS:
+        mg_http_send_error(nc, 503, "Another firmware update is in progress.");
+        break;
+    default:
+        mg_http_send_error(nc, 500, "OTA update failed.");
         break;
     }
 
-    case MULTIPART_REQUEST_MESSAGE_TYPE_PART_BEGIN:
+    return false;
+}
+
+static void resume_upload(void* arg)
+{
+    if (uploadSession.nc != NULL)
     {
-        otaState = (ota_state_handle_t*)userData;
-        if(strcmp(part->var_name, "firmware") == 0)
+        stream_request_resume(uploadSession.nc);
+    }
+}
+
+// Called by the writer task of the update when it freed a buffer or finished
+static void notify_upload(void* userData)
+{
+    for (int i = 0; !webserver_task_post(resume_upload, NULL); ++i)
+    {
+        if (i == NOTIFY_RETRIES)
         {
-            otaErr = ota_service_firmware_update_begin(otaState);
+            LOG_W(TAG, "Can not resume the firmware upload, the webserver does not take work");
+            return;
         }
-        else
+
+        vTaskDelay(NOTIFY_RETRY_DELAY);
+    }
+}
+
+static bool parse_header_number(const struct mg_str* value, int base, uint32_t* number)
+{
+    char text[11];
+    if (value->len == 0 || value->len >= sizeof(text))
+    {
+        return false;
+    }
+
+    memcpy(text, value->p, value->len);
+    text[value->len] = '\0';
+
+    char* end;
+    *number = strtoul(text, &end, base);
+    return *end == '\0';
+}
+
+static void send_session(struct mg_connection* nc, int status, request_arena_t* arena)
+{
+    char id[9];
+    snprintf(id, sizeof(id), "%08x", uploadSession.id);
+
+    json_writer_t writer;
+    json_writer_init(&writer, request_arena_alloc(arena, CONTROLLER_JSON_BUFFER_SIZE), CONTROLLER_JSON_BUFFER_SIZE);
+    json_writer_begin_object(&writer, NULL);
+    json_writer_add_string(&writer, "id", id);
+    json_writer_add_uint(&writer, "offset", uploadSession.offset);
+    json_writer_add_uint(&writer, "length", uploadSession.length);
+    json_writer_add_uint(&writer, "timeout", CONFIG_WEBSERVER_UPLOAD_SESSION_TIMEOUT_S);
+    json_writer_end_object(&writer);
+    json_writer_send(nc, status, &writer);
+}
+
+// Abandons the update of the session, if there is one
+static void close_session(void)
+{
+    if (uploadSession.ota != NULL)
+    {
+        ota_service_firmware_update_abort(uploadSession.ota);
+    }
+
+    if (sessionTimer != NULL)
+    {
+        esp_timer_stop(sessionTimer);
+    }
+
+    memset(&uploadSession, 0, sizeof(uploadSession));
+}
+
+static void expire_session(void* arg)
+{
+    // The session may have continued, or a new one may have started, since the timer fired
+    if (uploadSession.ota != NULL &&
+        uploadSession.nc == NULL &&
+        esp_timer_get_time() - uploadSession.detach_time >= SESSION_TIMEOUT_US)
+    {
+        LOG_W(TAG, "Upload session %08x timed out at %u of %u bytes", uploadSession.id, uploadSession.offset, uploadSession.length);
+        close_session();
+    }
+}
+
+static void on_session_timeout(void* arg)
+{
+    if (!webserver_task_post(expire_session, NULL))
+    {
+        esp_timer_start_once(sessionTimer, SESSION_EXPIRY_RETRY_US);
+    }
+}
+
+// Keeps the update of the session for the client to continue, until the session times out
+static void detach_session(void)
+{
+    uploadSession.nc = NULL;
+    uploadSession.detach_time = esp_timer_get_time();
+
+    if (sessionTimer == NULL)
+    {
+        const esp_timer_create_args_t timerArgs = {
+            .callback = on_session_timeout,
+            .name = "upload session"
+        };
+
+        if (esp_timer_create(&timerArgs, &sessionTimer) != ESP_OK)
         {
-            mg_http_send_error(nc, 400, "Multipart variable name not recognized.");
+            LOG_E(TAG, "Can not keep upload session %08x without a timer", uploadSession.id);
+            close_session();
             return;
         }
+    }
 
-        break;
+    esp_timer_stop(sessionTimer);
+    esp_timer_start_once(sessionTimer, SESSION_TIMEOUT_US);
+}
+
+static bool continue_session(struct mg_connection* nc, struct http_message* message, const struct mg_str* sessionId, request_arena_t* arena)
+{
+    uint32_t id;
+    uint32_t offset;
+    const struct mg_str* offsetHeader = mg_get_http_header(message, "Upload-Offset");
+    if (!parse_header_number(sessionId, 16, &id) || offsetHeader == NULL || !parse_header_number(offsetHeader, 10, &offset))
+    {
+        mg_http_send_error(nc, 400, "Expected the Upload-Session and Upload-Offset headers.");
+        return false;
     }
-    
-    case MULTIPART_REQUEST_MESSAGE_TYPE_PART_DATA:
+
+    if (uploadSession.ota == NULL || uploadSession.id == 0 || uploadSession.id != id)
     {
-        otaState = (ota_state_handle_t*)userData;
+        mg_http_send_error(nc, 404, "Upload session not found.");
+        return false;
+    }
+
+    // Only the offset the session is at can be continued, the response tells the client which one that is
+    if (offset != uploadSession.offset || offset + message->body.len > uploadSession.length)
+    {
+        send_session(nc, 409, arena);
+        return false;
+    }
+
+    esp_timer_stop(sessionTimer);
+    uploadSession.nc = nc;
 
-        if(strcmp(part->var_name, "firmware") == 0)
+    LOG_I(TAG, "Upload session %08x continued at %u of %u bytes", uploadSession.id, uploadSession.offset, uploadSession.length);
+    return true;
+}
+
+static bool firmware_stream_handler(
+    struct mg_connection* const nc,
+    struct http_message* const message,
+    const struct mg_str* const data,
+    const stream_request_message_type_t type,
+    request_arena_t* arena,
+    void* userData)
+{
+    upload_session_t* session = (upload_session_t*)userData;
+    ota_service_err_t otaErr;
+
+    switch (type)
+    {
+    case STREAM_REQUEST_MESSAGE_TYPE_BEGIN:
+    {
+        const struct mg_str* sessionId = mg_get_http_header(message, "Upload-Session");
+        if (sessionId != NULL)
         {
-            otaErr = ota_service_firmware_update_write(*otaState, part->data.p, part->data.len);
+            return continue_session(nc, message, sessionId, arena);
         }
-        else
+
+        // An upload without a session starts over, a session that was left behind is abandoned for it
+        close_session();
+        LOG_I(TAG, "Firmware upload of %u bytes started", message->body.len);
+
+        otaErr = ota_service_firmware_update_begin(&session->ota, notify_upload, NULL);
+        if (otaErr != OTA_SERVICE_OK)
         {
-            mg_http_send_error(nc, 400, "Multipart variable name not recognized.");
-            return;
+            return send_ota_error(nc, otaErr);
         }
+        session->length = message->body.len;
+        session->nc = nc;
+        return true;
+    }
 
-        if(otaErr != OTA_SERVICE_OK)
+    case STREAM_REQUEST_MESSAGE_TYPE_DATA:
+    {
+        size_t nrOfBytesAccepted;
+        otaErr = ota_service_firmware_update_write(session->ota, data->p, data->len, &nrOfBytesAccepted);
+        if (otaErr != OTA_SERVICE_OK)
         {
-            mg_http_send_error(nc, 500, "Writing update file failed.");
-            return;
+            close_session();
+            return send_ota_error(nc, otaErr);
         }
+        session->offset += nrOfBytesAccepted;
 
-        break;
+        // Both buffers are full, the rest of the data waits until the writer task frees one
+        if (nrOfBytesAccepted < data->len)
+        {
+            stream_request_pause(nc, nrOfBytesAccepted);
+        }
+        return true;
     }
 
-    case MULTIPART_REQUEST_MESSAGE_TYPE_PART_END:
+    case STREAM_REQUEST_MESSAGE_TYPE_END:
     {
-        otaState = (ota_state_handle_t*)userData;
+        // A request that did not complete the update of its session is answered with the offset to continue from
+        if (session->offset < session->length)
+        {
+            send_session(nc, 200, arena);
+            detach_session();
+            return true;
+        }
 
-        // Check if the upload was completed succesfully
-        if(part->status < 0)
+        // The writer task may still be writing the last buffers, the response waits until it is done
+        otaErr = ota_service_firmware_update_finish(session->ota);
+        if (otaErr == OTA_SERVICE_ERR_BUSY)
         {
-            // Multipart message was not completed
-            mg_http_send_error(nc, 400, "Multipart message part not properly terminated.");
-            return;
+            stream_request_pause(nc, 0);
+            return true;
         }
-        else
+
+        // The state is freed once the update finished, whether that succeeded or not
+        session->ota = NULL;
+        close_session();
+        if (otaErr != OTA_SERVICE_OK)
         {
-            if(strcmp(part->var_name, "firmware") == 0)
-            {
-                otaErr = ota_service_firmware_update_end(*otaState);
-            }
-            else
-            {
-                mg_http_send_error(nc, 400, "Multipart variable name not recognized.");
-                return;
-            }
+            return send_ota_error(nc, otaErr);
         }
 
-        break;
+        json_writer_t writer;
+        json_writer_init(&writer, request_arena_alloc(arena, CONTROLLER_JSON_BUFFER_SIZE), CONTROLLER_JSON_BUFFER_SIZE);
+        json_writer_begin_object(&writer, NULL);
+        json_writer_add_string(&writer, "result", "ok");
+        json_writer_end_object(&writer);
+        json_writer_send(nc, 200, &writer);
+
+        restart_after_response();
+        return true;
+    }
+
+    case STREAM_REQUEST_MESSAGE_TYPE_ABORT:
+    default:
+        if (session->id == 0)
+        {
+            close_session();
+            return false;
+        }
+
+        // The update waits for the client to continue the session
+        LOG_W(TAG, "Upload session %08x stopped at %u of %u bytes", session->id, session->offset, session->length);
+        detach_session();
+        return false;
     }
+}
+
+// A client that continues its session takes it over from its old connection, which may not have noticed yet that the
+// client is gone. That connection is detached from the session before the new request begins.
+static bool firmware_stream_takeover(struct http_message* const message, void* userData)
+{
+    const upload_session_t* session = (const upload_session_t*)userData;
+    const struct mg_str* sessionId = mg_get_http_header(message, "Upload-Session");
+    uint32_t id;
+
+    return sessionId != NULL && parse_header_number(sessionId, 16, &id) && session->id != 0 && id == session->id;
+}
 
-    case MULTIPART_REQUEST_MESSAGE_TYPE_END:
+static void session_post_handler(struct mg_connection* nc, struct http_message* message, request_arena_t* arena, void* userData)
+{
+    if (uploadSession.nc != NULL)
     {
-        // Redirect client to reset page
-        mg_http_send_redirect(nc, 301, mg_mk_str("/"), mg_mk_str(NULL));
-        nc->flags |= MG_F_SEND_AND_CLOSE;
+        mg_http_send_error(nc, 503, "Another upload is in progress.");
+        return;
+    }
 
-        // Restart the system
-        LOG_I(TAG, "Prepare to restart system!");
-        esp_restart();
+    session_request_t request = { 0 };
+    uint32_t fieldsRead = 0;
+    if (json_read_object(message->body.p, message->body.len, session_fields, sizeof(session_fields) / sizeof(session_fields[0]), &request, &fieldsRead) != CONTROLLER_JSON_OK
+        || (fieldsRead & 1) == 0
+        || request.length == 0)
+    {
+        mg_http_send_error(nc, 400, "Expected the length of the update file.");
         return;
     }
 
+    // A new session replaces one that was left behind
+    close_session();
+
+    ota_service_err_t otaErr = ota_service_firmware_update_begin(&uploadSession.ota, notify_upload, NULL);
+    if (otaErr != OTA_SERVICE_OK)
+    {
+        send_ota_error(nc, otaErr);
+        return;
     }
 
-    switch (otaErr)
+    // Id 0 marks uploads without a session
+    do
+    {
+        uploadSession.id = esp_random();
+    } while (uploadSession.id == 0);
+    uploadSession.length = request.length;
+
+    LOG_I(TAG, "Upload session %08x of %u bytes started", uploadSession.id, uploadSession.length);
+
+    send_session(nc, 201, arena);
+    detach_session();
+}
+
+static void session_get_handler(struct mg_connection* nc, struct http_message* message, request_arena_t* arena, void* userData)
+{
+    if (uploadSession.ota == NULL || uploadSession.id == 0)
+    {
+        mg_http_send_error(nc, 404, "No upload session.");
+        return;
+    }
+
+    send_session(nc, 200, arena);
+}
+
+static void session_delete_handler(struct mg_connection* nc, struct http_message* message, request_arena_t* arena, void* userData)
+{
+    if (uploadSession.nc != NULL)
+    {
+        mg_http_send_error(nc, 503, "The upload is in progress.");
+        return;
+    }
+
+    close_session();
+    mg_send_head(nc, 200, 0, NULL);
+}
+
+static const char* update_state_name(update_state_t state)
+{
+    switch (state)
+    {
+    case UPDATE_STATE_DOWNLOADING:
+        return "downloading";
+    case UPDATE_STATE_UP_TO_DATE:
+        return "upToDate";
+    case UPDATE_STATE_DONE:
+        return "done";
+    case UPDATE_STATE_FAILED:
+        return "failed";
+    default:
+        return "idle";
+    }
+}
+
+static void send_pull_status(struct mg_connection* nc, int status, request_arena_t* arena)
+{
+    update_status_t updateStatus;
+    update_task_get_status(&updateStatus);
+
+    json_writer_t writer;
+    json_writer_init(&writer, request_arena_alloc(arena, PULL_RESPONSE_BUFFER_SIZE), PULL_RESPONSE_BUFFER_SIZE);
+    json_writer_begin_object(&writer, NULL);
+    json_writer_add_string(&writer, "state", update_state_name(updateStatus.state));
+    json_writer_add_string(&writer, "url", updateStatus.url);
+    json_writer_add_uint(&writer, "offset", updateStatus.offset);
+    json_writer_add_uint(&writer, "length", updateStatus.length);
+    json_writer_add_uint(&writer, "retries", updateStatus.retries);
+    json_writer_add_int(&writer, "httpStatus", updateStatus.http_status);
+    json_writer_add_int(&writer, "otaResult", updateStatus.ota_result);
+    json_writer_end_object(&writer);
+    json_writer_send(nc, status, &writer);
+}
+
+static void pull_get_handler(struct mg_connection* nc, struct http_message* message, request_arena_t* arena, void* userData)
+{
+    send_pull_status(nc, 200, arena);
+}
+
+static void pull_post_handler(struct mg_connection* nc, struct http_message* message, request_arena_t* arena, void* userData)
+{
+    pull_request_t request = { 0 };
+    uint32_t fieldsRead = 0;
+
+    // Without a body or url the update is pulled from the configured url
+    if (message->body.len > 0
+        && json_read_object(message->body.p, message->body.len, pull_fields, sizeof(pull_fields) / sizeof(pull_fields[0]), &request, &fieldsRead) != CONTROLLER_JSON_OK)
+    {
+        mg_http_send_error(nc, 400, "Invalid pull request.");
+        return;
+    }
+
+    char* url = NULL;
+    if (fieldsRead & 1)
+    {
+        if (request.url.len >= UPDATE_TASK_MAX_URL_LENGTH)
+        {
+            mg_http_send_error(nc, 400, "Url is too long.");
+            return;
+        }
+
+        url = (char*)request_arena_alloc(arena, request.url.len + 1);
+        if (url == NULL)
+        {
+            mg_http_send_error(nc, 500, "Can not pull a firmware update.");
+            return;
+        }
+
+        memcpy(url, request.url.p, request.url.len);
+        url[request.url.len] = '\0';
+    }
+
+    switch (update_task_pull(url))
     {
-    case OTA_SERVICE_OK:
-        // Everyting went well
+    case UPDATE_TASK_OK:
+        send_pull_status(nc, 202, arena);
         break;
-    case OTA_SERVICE_ERR_OTA_END_FAILED:
-        mg_http_send_error(nc, 400, "Could not finalize OTA update: Failed to end OTA.");
+    case UPDATE_TASK_ERR_BUSY:
+        mg_http_send_error(nc, 503, "A firmware update is already being pulled.");
         break;
-    case OTA_SERVICE_ERR_SET_BOOT_PARTITON_FAILED:
-        mg_http_send_error(nc, 400, "Could not finalize OTA update: Failed to set new boot partition.");
+    case UPDATE_TASK_ERR_NO_URL:
+        mg_http_send_error(nc, 400, "No url given and none is configured.");
         break;
     default:
-        // Something unknown went wrong
-        mg_http_send_error(nc, 500, "OTA update failed.");
+        mg_http_send_error(nc, 500, "Can not pull a firmware update.");
         break;
     }
 }
 
-static ota_state_handle_t ota_state;
-static multipart_request_uri_handler_info_t firmware_post_handler_info = {
+static void status_get_handler(struct mg_connection* nc, struct http_message* message, request_arena_t* arena, void* userData)
+{
+    ota_service_progress_t progress;
+    ota_service_get_progress(&progress);
+
+    json_writer_t writer;
+    json_writer_init(&writer, request_arena_alloc(arena, CONTROLLER_JSON_BUFFER_SIZE), CONTROLLER_JSON_BUFFER_SIZE);
+    json_writer_begin_object(&writer, NULL);
+    json_writer_add_bool(&writer, "running", progress.running);
+    json_writer_add_string(&writer, "state", ota_service_progress_state_name(progress.state));
+    json_writer_add_int(&writer, "result", progress.result);
+    json_writer_add_uint(&writer, "done", progress.nr_of_bytes_processed);
+    json_writer_add_uint(&writer, "total", progress.nr_of_bytes_total);
+    json_writer_add_uint(&writer, "received", progress.nr_of_bytes_received);
+    json_writer_add_uint(&writer, "throughput", progress.throughput);
+    json_writer_add_uint(&writer, "elapsedMs", progress.elapsed_ms);
+    json_writer_add_uint(&writer, "eraseMs", progress.erase_ms);
+    json_writer_add_uint(&writer, "writeMs", progress.write_ms);
+    json_writer_end_object(&writer);
+    json_writer_send(nc, 200, &writer);
+}
+
+static void firmware_get_handler(struct mg_connection* nc, struct http_message* message, request_arena_t* arena, void* userData)
+{
+    // Tells clients which firmware is running, so they can pick an update that has a delta for it
+    const esp_app_desc_t* app = esp_ota_get_app_description();
+
+    char elfSha256[2 * sizeof(app->app_elf_sha256) + 1];
+    for (size_t i = 0; i < sizeof(app->app_elf_sha256); ++i)
+    {
+        snprintf(&elfSha256[2 * i], 3, "%02x", app->app_elf_sha256[i]);
+    }
+
+    json_writer_t writer;
+    json_writer_init(&writer, request_arena_alloc(arena, CONTROLLER_JSON_BUFFER_SIZE), CONTROLLER_JSON_BUFFER_SIZE);
+    json_writer_begin_object(&writer, NULL);
+    json_writer_add_string(&writer, "version", app->version);
+    json_writer_add_string(&writer, "elfSha256", elfSha256);
+    json_writer_end_object(&writer);
+    json_writer_send(nc, 200, &writer);
+}
+
+static uri_handler_info_t firmware_handler_info = {
+    .uri = controllerUri "/firmware",
+    .methodHandlers = {
+        {
+            .method = HTTP_REQUEST_METHOD_GET,
+            .handler = firmware_get_handler,
+            .user_data = NULL
+        }
+    }
+    };
+
+static uri_handler_info_t session_handler_info = {
+    .uri = controllerUri "/firmware/session",
+    .methodHandlers = {
+        {
+            .method = HTTP_REQUEST_METHOD_GET,
+            .handler = session_get_handler,
+            .user_data = NULL
+        },
+        {
+            .method = HTTP_REQUEST_METHOD_POST,
+            .handler = session_post_handler,
+            .user_data = NULL
+        },
+        {
+            .method = HTTP_REQUEST_METHOD_DELETE,
+            .handler = session_delete_handler,
+            .user_data = NULL
+        }
+    }
+    };
+
+static uri_handler_info_t status_handler_info = {
+    .uri = controllerUri "/status",
+    .methodHandlers = {
+        {
+            .method = HTTP_REQUEST_METHOD_GET,
+            .handler = status_get_handler,
+            .user_data = NULL
+        }
+    }
+    };
+
+static uri_handler_info_t pull_handler_info = {
+    .uri = controllerUri "/firmware/pull",
+    .methodHandlers = {
+        {
+            .method = HTTP_REQUEST_METHOD_GET,
+            .handler = pull_get_handler,
+            .user_data = NULL
+        },
+        {
+            .method = HTTP_REQUEST_METHOD_POST,
+            .handler = pull_post_handler,
+            .user_data = NULL
+        }
+    }
+    };
+
+// The firmware image is the request body, POST and PUT are the same upload
+static stream_request_uri_handler_info_t firmware_stream_post_handler_info = {
     .uri = controllerUri "/firmware",
     .method = "POST",
-    .handler = firmware_post_handler,
-    .user_data = &ota_state
+    .content_type = "application/octet-stream",
+    .handler = firmware_stream_handler,
+    .takeover = firmware_stream_takeover,
+    .user_data = &uploadSession
+    };
+
+static stream_request_uri_handler_info_t firmware_stream_put_handler_info = {
+    .uri = controllerUri "/firmware",
+    .method = "PUT",
+    .content_type = "application/octet-stream",
+    .handler = firmware_stream_handler,
+    .takeover = firmware_stream_takeover,
+    .user_data = &uploadSession
     };
 
-void upload_controller_register_uri_handlers(struct mg_connection* nc, const char* rootUri)
+void upload_controller_register_uri_handlers(const char* rootUri)
 {
-    register_multipart_request_uri_handler(nc, rootUri, &firmware_post_handler_info);
+    register_uri_handler(rootUri, &firmware_handler_info);
+    register_uri_handler(rootUri, &session_handler_info);
+    register_uri_handler(rootUri, &pull_handler_info);
+    register_uri_handler(rootUri, &status_handler_info);
+    register_stream_request_uri_handler(rootUri, &firmware_stream_post_handler_info);
+    register_stream_request_uri_handler(rootUri, &firmware_stream_put_handler_info);
 }
@@ -3,6 +3,6 @@
 
 #include <mongoose.h>
 
-void upload_controller_register_uri_handlers(struct mg_connection* nc, const char* rootUri);
+void upload_controller_register_uri_handlers(const char* rootUri);
 
 #endif // UPLOAD_CONTROLLER_H
\ No newline at end of file
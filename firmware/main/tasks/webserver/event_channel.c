@@ -0,0 +1,272 @@
+#include "event_channel.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <logger.h>
+#include <services/lift_service.h>
+#include <services/ota_service.h>
+
+#include "connection_manager.h"
+#include "controllers/controller_json.h"
+#include "webserver_task.h"
+
+#define MAX_EVENT_LENGTH 192
+#define MAX_OTA_EVENT_LENGTH 256
+
+// Marks connections that are subscribed to the event channel
+#define MG_F_EVENT_CHANNEL MG_F_USER_1
+
+typedef struct event_message_s
+{
+    size_t len;
+    char   message[];
+} event_message_t;
+
+static const char TAG[] = "Event Channel";
+
+static struct mg_mgr* eventChannelManager = NULL;
+
+static const char* lift_state_to_str(lift_state_t state)
+{
+    switch (state)
+    {
+    case LIFT_STATE_STOPPED_DOWN:
+    case LIFT_STATE_REACHED_DOWN:
+    case LIFT_STATE_SETTLING_DOWN:
+        return "down";
+
+    case LIFT_STATE_STOPPED_UP:
+    case LIFT_STATE_REACHED_UP:
+    case LIFT_STATE_SETTLING_UP:
+        return "up";
+
+    case LIFT_STATE_MOVING_UP:
+        return "moving_up";
+
+    case LIFT_STATE_MOVING_DOWN:
+        return "moving_down";
+
+    case LIFT_STATE_STOPPED_MID:
+    default:
+        return "stopped";
+    }
+}
+
+static const char* lift_event_type_to_str(lift_event_type_t type)
+{
+    switch (type)
+    {
+    case LIFT_EVENT_STATE_CHANGED:
+        return "state";
+
+    case LIFT_EVENT_SPEED_CHANGED:
+        return "speed";
+
+    case LIFT_EVENT_POSITION_CHANGED:
+        return "position";
+
+    case LIFT_EVENT_ENDSTOP_CHANGED:
+    default:
+        return "endstop";
+    }
+}
+
+static size_t format_event(char* buffer, size_t size, const char* type, const lift_status_t* status)
+{
+    json_writer_t writer;
+    json_writer_init(&writer, buffer, size);
+    json_writer_begin_object(&writer, NULL);
+    json_writer_add_string(&writer, "type", type);
+    json_writer_add_string(&writer, "status", status == NULL ? "offline" : "online");
+
+    // Every event carries the complete status, so clients never have to combine events
+    if (status != NULL)
+    {
+        json_writer_add_string(&writer, "state", lift_state_to_str(status->state));
+        json_writer_add_uint(&writer, "speed", status->speed);
+        json_writer_add_int(&writer, "position", status->position);
+        json_writer_begin_object(&writer, "endstops");
+        json_writer_add_bool(&writer, "down", status->endstop_down);
+        json_writer_add_bool(&writer, "up", status->endstop_up);
+        json_writer_end_object(&writer);
+    }
+
+    json_writer_end_object(&writer);
+    return writer.overflow ? 0 : writer.length;
+}
+
+static size_t format_ota_event(char* buffer, size_t size, const ota_service_progress_t* progress)
+{
+    json_writer_t writer;
+    json_writer_init(&writer, buffer, size);
+    json_writer_begin_object(&writer, NULL);
+    json_writer_add_string(&writer, "type", "ota");
+    json_writer_add_bool(&writer, "running", progress->running);
+    json_writer_add_string(&writer, "state", ota_service_progress_state_name(progress->state));
+    json_writer_add_int(&writer, "result", progress->result);
+    json_writer_add_uint(&writer, "done", progress->nr_of_bytes_processed);
+    json_writer_add_uint(&writer, "total", progress->nr_of_bytes_total);
+    json_writer_add_uint(&writer, "received", progress->nr_of_bytes_received);
+    json_writer_add_uint(&writer, "throughput", progress->throughput);
+    json_writer_add_uint(&writer, "elapsedMs", progress->elapsed_ms);
+    json_writer_add_uint(&writer, "eraseMs", progress->erase_ms);
+    json_writer_add_uint(&writer, "writeMs", progress->write_ms);
+    json_writer_end_object(&writer);
+    return writer.overflow ? 0 : writer.length;
+}
+
+static void broadcast_event(void* arg)
+{
+    event_message_t* eventMessage = (event_message_t*) arg;
+
+    if (eventChannelManager != NULL)
+    {
+        for (struct mg_connection* nc = mg_next(eventChannelManager, NULL); nc != NULL; nc = mg_next(eventChannelManager, nc))
+        {
+            if ((nc->flags & MG_F_IS_WEBSOCKET) && (nc->flags & MG_F_EVENT_CHANNEL) &&
+                connection_manager_can_send(nc, eventMessage->len))
+            {
+                mg_send_websocket_frame(nc, WEBSOCKET_OP_TEXT, eventMessage->message, eventMessage->len);
+            }
+        }
+    }
+
+    free(eventMessage);
+}
+
+static void post_event(const char* buffer, size_t len)
+{
+    event_message_t* eventMessage = (event_message_t*) malloc(sizeof(event_message_t) + len);
+    if (eventMessage == NULL)
+    {
+        return;
+    }
+
+    eventMessage->len = len;
+    memcpy(eventMessage->message, buffer, len);
+
+    if (!webserver_task_post(broadcast_event, eventMessage))
+    {
+        free(eventMessage);
+    }
+}
+
+static void on_lift_event(lift_event_type_t type, const lift_status_t* status)
+{
+    // Lift events are raised from the lift monitor task, hand them over to the webserver thread
+    if (eventChannelManager == NULL)
+    {
+        return;
+    }
+
+    char buffer[MAX_EVENT_LENGTH];
+    size_t len = format_event(buffer, sizeof(buffer), lift_event_type_to_str(type), status);
+    if (len == 0)
+    {
+        LOG_W(TAG, "Can not format lift event");
+        return;
+    }
+
+    post_event(buffer, len);
+}
+
+static void on_ota_progress(const ota_service_progress_t* progress)
+{
+    // Progress is reported from the writer task of the update, a report that does not fit the queue is dropped
+    if (eventChannelManager == NULL)
+    {
+        return;
+    }
+
+    char buffer[MAX_OTA_EVENT_LENGTH];
+    size_t len = format_ota_event(buffer, sizeof(buffer), progress);
+    if (len == 0)
+    {
+        LOG_W(TAG, "Can not format ota event");
+        return;
+    }
+
+    post_event(buffer, len);
+}
+
+static void send_snapshot(struct mg_connection* nc)
+{
+    lift_device_handle_t liftHandle = lift_service_get_lift_device_handle();
+
+    lift_status_t status;
+    if (liftHandle != NULL)
+    {
+        lift_get_status(liftHandle, &status);
+    }
+
+    char buffer[MAX_OTA_EVENT_LENGTH];
+    size_t len = format_event(buffer, sizeof(buffer), "snapshot", liftHandle != NULL ? &status : NULL);
+    if (len > 0)
+    {
+        mg_send_websocket_frame(nc, WEBSOCKET_OP_TEXT, buffer, len);
+    }
+
+    // A client that connects during an update sees where it is right away
+    ota_service_progress_t progress;
+    ota_service_get_progress(&progress);
+    if (progress.running)
+    {
+        len = format_ota_event(buffer, sizeof(buffer), &progress);
+        if (len > 0)
+        {
+            mg_send_websocket_frame(nc, WEBSOCKET_OP_TEXT, buffer, len);
+        }
+    }
+}
+
+void event_channel_init(void)
+{
+    lift_service_register(on_lift_event);
+    ota_service_set_progress_listener(on_ota_progress);
+}
+
+void event_channel_start(struct mg_mgr* manager)
+{
+    eventChannelManager = manager;
+}
+
+void event_channel_stop(void)
+{
+    eventChannelManager = NULL;
+}
+
+bool event_channel_handle_event(struct mg_connection* nc, int ev, void* ev_data)
+{
+    switch (ev)
+    {
+    case MG_EV_WEBSOCKET_HANDSHAKE_REQUEST:
+    {
+        // Remember which websockets are for the event channel, the uri is only known during the handshake
+        struct http_message* message = (struct http_message*) ev_data;
+        if (mg_vcmp(&message->uri, EVENT_CHANNEL_URI) == 0)
+        {
+            nc->flags |= MG_F_EVENT_CHANNEL;
+            return true;
+        }
+        return false;
+    }
+
+    case MG_EV_WEBSOCKET_HANDSHAKE_DONE:
+        if (nc->flags & MG_F_EVENT_CHANNEL)
+        {
+            LOG_I(TAG, "Event channel connect");
+            send_snapshot(nc);
+            return true;
+        }
+        return false;
+
+    case MG_EV_WEBSOCKET_FRAME:
+    case MG_EV_CLOSE:
+        // Clients do not send anything over the event channel
+        return (nc->flags & MG_F_EVENT_CHANNEL) != 0;
+
+    default:
+        return false;
+    }
+}
\ No newline at end of file
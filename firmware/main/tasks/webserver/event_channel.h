@@ -0,0 +1,40 @@
+#ifndef EVENT_CHANNEL_H
+#define EVENT_CHANNEL_H
+
+#include <stdbool.h>
+
+#include <mongoose.h>
+
+#define EVENT_CHANNEL_URI "/api/events"
+
+/**
+ * @brief Subscribes the event channel to lift events and firmware update progress. Must be called once, before the webserver starts.
+ */
+void event_channel_init(void);
+
+/**
+ * @brief Starts pushing events to websocket clients of the given manager.
+ * 
+ * @param[in] manager The manager whose websocket connections receive the events.
+ */
+void event_channel_start(struct mg_mgr* manager);
+
+/**
+ * @brief Stops pushing events. Must be called after the manager has been freed.
+ */
+void event_channel_stop(void);
+
+/**
+ * @brief Handles websocket events of connections to EVENT_CHANNEL_URI,
+ * and sends a snapshot of the current lift status when a client connects.
+ * 
+ * @param[in] nc The connection the event occured on.
+ * @param[in] ev The mongoose event.
+ * @param[in] ev_data The mongoose event data.
+ * 
+ * @return true if the event belonged to the event channel and was handled, or
+ * false if the event should be handled by someone else.
+ */
+bool event_channel_handle_event(struct mg_connection* nc, int ev, void* ev_data);
+
+#endif // EVENT_CHANNEL_H
\ No newline at end of file
@@ -0,0 +1,622 @@
+#include "log_stream.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <logger.h>
+#include <sdkconfig.h>
+
+#include "connection_manager.h"
+#include "controllers/controller_json.h"
+#include "webserver_task.h"
+
+// Must be a power of two, positions in the ring are free running counters
+#define LOG_RING_SIZE 4096
+#define LOG_RING_MASK (LOG_RING_SIZE - 1)
+
+// Records are aligned so their header never wraps around the end of the ring
+#define LOG_RECORD_ALIGNMENT 4
+#define MAX_LINE_LENGTH 256
+
+#define MAX_CLIENTS CONFIG_WEBSERVER_MAX_CONNECTIONS
+#define MAX_SUMMARY_LENGTH 48
+#define MAX_FILTER_TAGS 8
+
+// Only the start of a line is searched for its level and tag
+#define MAX_PREFIX_LENGTH 64
+
+// Marks connections that receive the log stream
+#define MG_F_LOG_STREAM MG_F_USER_3
+
+_Static_assert((LOG_RING_SIZE & LOG_RING_MASK) == 0, "LOG_RING_SIZE must be a power of two");
+
+typedef enum log_record_state_e
+{
+    // Reserved by a producer that is still writing it, or not reserved at all
+    LOG_RECORD_STATE_FREE = 0,
+    LOG_RECORD_STATE_LINE,
+    // Fills the end of the ring when a line does not fit before the end
+    LOG_RECORD_STATE_PADDING
+} log_record_state_t;
+
+typedef enum log_filter_mode_e
+{
+    LOG_FILTER_MODE_ALL_TAGS,
+    LOG_FILTER_MODE_ALLOW_TAGS,
+    LOG_FILTER_MODE_DENY_TAGS
+} log_filter_mode_t;
+
+typedef struct log_record_s
+{
+    uint16_t length;
+    uint16_t state;
+    uint8_t  level;
+    uint8_t  reserved[3];
+    uint32_t tagHash;
+    char     line[];
+} log_record_t;
+
+typedef struct log_filter_s
+{
+    // The most verbose level that passes, a logger_service_loglevel_t
+    uint8_t  level;
+    uint8_t  mode;
+    uint8_t  nrOfTags;
+    uint32_t tagHashes[MAX_FILTER_TAGS];
+} log_filter_t;
+
+typedef struct log_client_s
+{
+    struct mg_connection* nc;
+    uint32_t              droppedLines;
+    log_filter_t          filter;
+} log_client_t;
+
+typedef struct log_subscription_s
+{
+    json_string_t level;
+    json_string_t allowTags;
+    json_string_t denyTags;
+} log_subscription_t;
+
+static const json_field_t log_subscription_fields[] = {
+    JSON_FIELD(log_subscription_t, level, "level", JSON_FIELD_TYPE_STRING),
+    JSON_FIELD(log_subscription_t, allowTags, "allowTags", JSON_FIELD_TYPE_RAW),
+    JSON_FIELD(log_subscription_t, denyTags, "denyTags", JSON_FIELD_TYPE_RAW)
+};
+
+// Indexed by logger_service_loglevel_t
+static const char* const log_level_names[] = {
+    "none",
+    "error",
+    "warn",
+    "info",
+    "debug",
+    "verbose"
+};
+
+static const char TAG[] = "Log Stream";
+
+// Producers reserve space by advancing the head, only the webserver thread advances the tail.
+// The consumed part of the ring is zeroed, so a record reads as free until its producer has committed it.
+static uint8_t  logRing[LOG_RING_SIZE] __attribute__((aligned(LOG_RECORD_ALIGNMENT)));
+static uint32_t logRingHead = 0;
+static uint32_t logRingTail = 0;
+static uint32_t logRingDroppedLines = 0;
+static bool     logStreamDrainPending = false;
+
+// Only touched by the webserver thread, apart from the number of clients which the sink reads
+static log_client_t logClients[MAX_CLIENTS];
+static uint32_t     nrOfLogClients = 0;
+static char         logFrame[LOG_RING_SIZE];
+static log_stream_stats_t logStreamStats;
+
+// Copy of the filters of all clients for the sink, which runs on other tasks.
+// The webserver thread makes the sequence odd while it updates the copy, a sink that sees
+// an odd or changed sequence keeps the line and leaves the filtering to the drain.
+static log_filter_t sinkFilters[MAX_CLIENTS];
+static uint32_t     sinkFiltersSequence = 0;
+
+static size_t align_record_size(size_t size)
+{
+    return (size + LOG_RECORD_ALIGNMENT - 1) & ~(size_t)(LOG_RECORD_ALIGNMENT - 1);
+}
+
+static log_record_t* record_at(uint32_t position)
+{
+    return (log_record_t*)&logRing[position & LOG_RING_MASK];
+}
+
+static void log_stream_drain_work(void* arg)
+{
+    log_stream_drain();
+}
+
+static uint32_t hash_tag(const char* tag, size_t length)
+{
+    // FNV-1a, filters compare tags by their hash so a line never has to be compared against tag strings
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i)
+    {
+        hash = (hash ^ (uint8_t)tag[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+// Lines are formatted like "I (1234) Tag: message", optionally preceded by a color escape sequence.
+// Lines that are not formatted like that are treated as info lines without a tag.
+static void parse_line(const char* line, size_t length, uint8_t* level, uint32_t* tagHash)
+{
+    *level = LOGGER_SERVICE_LOGLEVEL_INFO;
+    *tagHash = 0;
+
+    const char* p = line;
+    const char* end = line + (length < MAX_PREFIX_LENGTH ? length : MAX_PREFIX_LENGTH);
+    if (p < end && *p == '\033')
+    {
+        while (p < end && *p != 'm')
+        {
+            p++;
+        }
+        p++;
+    }
+
+    if (p >= end)
+    {
+        return;
+    }
+
+    switch (*p)
+    {
+    case 'E':
+        *level = LOGGER_SERVICE_LOGLEVEL_ERROR;
+        break;
+    case 'W':
+        *level = LOGGER_SERVICE_LOGLEVEL_WARN;
+        break;
+    case 'I':
+        *level = LOGGER_SERVICE_LOGLEVEL_INFO;
+        break;
+    case 'D':
+        *level = LOGGER_SERVICE_LOGLEVEL_DEBUG;
+        break;
+    case 'V':
+        *level = LOGGER_SERVICE_LOGLEVEL_VERBOSE;
+        break;
+    default:
+        return;
+    }
+
+    const char* tag = memchr(p, ')', end - p);
+    if (tag == NULL || tag + 2 >= end)
+    {
+        return;
+    }
+    tag += 2;
+
+    for (const char* c = tag; c + 1 < end; ++c)
+    {
+        if (c[0] == ':' && c[1] == ' ')
+        {
+            *tagHash = hash_tag(tag, c - tag);
+            return;
+        }
+    }
+}
+
+static bool filter_passes(const log_filter_t* filter, uint8_t level, uint32_t tagHash)
+{
+    if (level > filter->level)
+    {
+        return false;
+    }
+
+    if (filter->mode == LOG_FILTER_MODE_ALL_TAGS)
+    {
+        return true;
+    }
+
+    bool isListed = false;
+    for (size_t i = 0; i < filter->nrOfTags && !isListed; ++i)
+    {
+        isListed = filter->tagHashes[i] == tagHash;
+    }
+
+    return filter->mode == LOG_FILTER_MODE_ALLOW_TAGS ? isListed : !isListed;
+}
+
+static bool is_wanted_by_any_client(uint8_t level, uint32_t tagHash)
+{
+    uint32_t sequence = __atomic_load_n(&sinkFiltersSequence, __ATOMIC_ACQUIRE);
+    if (sequence & 1)
+    {
+        return true;
+    }
+
+    bool isWanted = false;
+    uint32_t nrOfClients = __atomic_load_n(&nrOfLogClients, __ATOMIC_RELAXED);
+    for (size_t i = 0; i < nrOfClients && !isWanted; ++i)
+    {
+        isWanted = filter_passes(&sinkFilters[i], level, tagHash);
+    }
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return isWanted || __atomic_load_n(&sinkFiltersSequence, __ATOMIC_RELAXED) != sequence;
+}
+
+static void publish_filters(void)
+{
+    __atomic_store_n(&sinkFiltersSequence, sinkFiltersSequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for (size_t i = 0; i < nrOfLogClients; ++i)
+    {
+        sinkFilters[i] = logClients[i].filter;
+    }
+
+    __atomic_store_n(&sinkFiltersSequence, sinkFiltersSequence + 1, __ATOMIC_RELEASE);
+}
+
+static void log_stream_sink(const char* message, const size_t len, void* user_data)
+{
+    // Nobody is listening, do not even copy the line
+    if (__atomic_load_n(&nrOfLogClients, __ATOMIC_RELAXED) == 0)
+    {
+        return;
+    }
+
+    // Drop lines nobody wants before they are copied
+    uint8_t level;
+    uint32_t tagHash;
+    parse_line(message, len, &level, &tagHash);
+    if (!is_wanted_by_any_client(level, tagHash))
+    {
+        return;
+    }
+
+    size_t length = len < MAX_LINE_LENGTH ? len : MAX_LINE_LENGTH;
+    uint32_t recordSize = align_record_size(sizeof(log_record_t) + length);
+
+    // Reserve room for the record, preceded by padding if it would not fit before the end of the ring
+    uint32_t head = __atomic_load_n(&logRingHead, __ATOMIC_RELAXED);
+    uint32_t padding;
+    do
+    {
+        uint32_t tail = __atomic_load_n(&logRingTail, __ATOMIC_ACQUIRE);
+        uint32_t contiguous = LOG_RING_SIZE - (head & LOG_RING_MASK);
+        padding = recordSize > contiguous ? contiguous : 0;
+
+        if (head + padding + recordSize - tail > LOG_RING_SIZE)
+        {
+            __atomic_fetch_add(&logRingDroppedLines, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&logRingHead, &head, head + padding + recordSize, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    if (padding > 0)
+    {
+        log_record_t* paddingRecord = record_at(head);
+        paddingRecord->length = padding;
+        __atomic_store_n(&paddingRecord->state, LOG_RECORD_STATE_PADDING, __ATOMIC_RELEASE);
+    }
+
+    log_record_t* record = record_at(head + padding);
+    record->length = length;
+    record->level = level;
+    record->tagHash = tagHash;
+    memcpy(record->line, message, length);
+    __atomic_store_n(&record->state, LOG_RECORD_STATE_LINE, __ATOMIC_RELEASE);
+
+    // Only one drain needs to be posted, it takes everything that is in the ring when it runs
+    if (!__atomic_exchange_n(&logStreamDrainPending, true, __ATOMIC_ACQ_REL))
+    {
+        if (!webserver_task_post(log_stream_drain_work, NULL))
+        {
+            // The webserver thread drains the ring on every poll anyway
+            __atomic_store_n(&logStreamDrainPending, false, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+static log_client_t* find_client(const struct mg_connection* nc)
+{
+    for (size_t i = 0; i < nrOfLogClients; ++i)
+    {
+        if (logClients[i].nc == nc)
+        {
+            return &logClients[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Finds the end of the committed records, lines are delivered in the order they were reserved
+static uint32_t find_committed_end(void)
+{
+    uint32_t position = logRingTail;
+    uint32_t head = __atomic_load_n(&logRingHead, __ATOMIC_ACQUIRE);
+
+    while (position != head)
+    {
+        log_record_t* record = record_at(position);
+        uint16_t state = __atomic_load_n(&record->state, __ATOMIC_ACQUIRE);
+        if (state == LOG_RECORD_STATE_FREE)
+        {
+            // Still being written
+            break;
+        }
+
+        position += state == LOG_RECORD_STATE_PADDING ? record->length : align_record_size(sizeof(log_record_t) + record->length);
+    }
+
+    return position;
+}
+
+// Copies the lines that pass the filter into the frame, returns the number of lines that passed
+static uint32_t collect_lines(uint32_t end, const log_filter_t* filter, size_t* frameLength)
+{
+    uint32_t nrOfLines = 0;
+    for (uint32_t position = logRingTail; position != end;)
+    {
+        log_record_t* record = record_at(position);
+        if (record->state == LOG_RECORD_STATE_PADDING)
+        {
+            position += record->length;
+            continue;
+        }
+
+        if (filter_passes(filter, record->level, record->tagHash))
+        {
+            memcpy(logFrame + *frameLength, record->line, record->length);
+            *frameLength += record->length;
+            ++nrOfLines;
+        }
+
+        position += align_record_size(sizeof(log_record_t) + record->length);
+    }
+
+    return nrOfLines;
+}
+
+static void release_lines(uint32_t end)
+{
+    // Zero the records so they read as free until a producer commits a new record in their place
+    for (uint32_t position = logRingTail; position != end;)
+    {
+        size_t contiguous = LOG_RING_SIZE - (position & LOG_RING_MASK);
+        size_t length = end - position < contiguous ? end - position : contiguous;
+        memset(&logRing[position & LOG_RING_MASK], 0, length);
+        position += length;
+    }
+
+    __atomic_store_n(&logRingTail, end, __ATOMIC_RELEASE);
+}
+
+static controller_json_err_t read_tag(size_t index, const char* element, size_t length, void* userData)
+{
+    log_filter_t* filter = (log_filter_t*)userData;
+
+    json_string_t tag;
+    controller_json_err_t err = json_read_string(element, length, &tag);
+    if (err != CONTROLLER_JSON_OK)
+    {
+        return err;
+    }
+
+    filter->tagHashes[index] = hash_tag(tag.p, tag.len);
+    return CONTROLLER_JSON_OK;
+}
+
+static bool read_tag_hashes(const json_string_t* tags, log_filter_t* filter)
+{
+    size_t nrOfTags;
+    if (json_read_array(tags->p, tags->len, MAX_FILTER_TAGS, read_tag, filter, &nrOfTags) != CONTROLLER_JSON_OK)
+    {
+        return false;
+    }
+
+    filter->nrOfTags = nrOfTags;
+    return true;
+}
+
+static const char* read_subscription(const char* json, size_t length, log_filter_t* filter)
+{
+    log_subscription_t subscription;
+    uint32_t fieldsRead;
+    if (json_read_object(json, length, log_subscription_fields, sizeof(log_subscription_fields) / sizeof(log_subscription_fields[0]), &subscription, &fieldsRead) != CONTROLLER_JSON_OK)
+    {
+        return "invalid subscription";
+    }
+
+    log_filter_t newFilter = {
+        .level = LOGGER_SERVICE_LOGLEVEL_VERBOSE,
+        .mode = LOG_FILTER_MODE_ALL_TAGS,
+        .nrOfTags = 0
+    };
+
+    if (fieldsRead & (1u << 0))
+    {
+        size_t level = 0;
+        while (level < sizeof(log_level_names) / sizeof(log_level_names[0]) &&
+               (strlen(log_level_names[level]) != subscription.level.len || memcmp(log_level_names[level], subscription.level.p, subscription.level.len) != 0))
+        {
+            level++;
+        }
+
+        if (level == sizeof(log_level_names) / sizeof(log_level_names[0]))
+        {
+            return "unknown level";
+        }
+        newFilter.level = level;
+    }
+
+    if ((fieldsRead & (1u << 1)) && (fieldsRead & (1u << 2)))
+    {
+        return "allowTags and denyTags can not be combined";
+    }
+    else if (fieldsRead & (1u << 1))
+    {
+        newFilter.mode = LOG_FILTER_MODE_ALLOW_TAGS;
+        if (!read_tag_hashes(&subscription.allowTags, &newFilter))
+        {
+            return "invalid allowTags";
+        }
+    }
+    else if (fieldsRead & (1u << 2))
+    {
+        newFilter.mode = LOG_FILTER_MODE_DENY_TAGS;
+        if (!read_tag_hashes(&subscription.denyTags, &newFilter))
+        {
+            return "invalid denyTags";
+        }
+    }
+
+    *filter = newFilter;
+    return NULL;
+}
+
+void log_stream_init(void)
+{
+    logger_service_register_sink(log_stream_sink, NULL);
+}
+
+void log_stream_start(void)
+{
+    memset(&logStreamStats, 0, sizeof(logStreamStats));
+}
+
+void log_stream_stop(void)
+{
+    __atomic_store_n(&nrOfLogClients, 0, __ATOMIC_RELAXED);
+    publish_filters();
+}
+
+bool log_stream_handle_event(struct mg_connection* nc, int ev, void* ev_data)
+{
+    switch (ev)
+    {
+    case MG_EV_WEBSOCKET_HANDSHAKE_DONE:
+        if (nrOfLogClients == MAX_CLIENTS)
+        {
+            LOG_W(TAG, "Too many log stream clients");
+            return true;
+        }
+
+        LOG_I(TAG, "Websocket Connect");
+        nc->flags |= MG_F_LOG_STREAM;
+        logClients[nrOfLogClients].nc = nc;
+        logClients[nrOfLogClients].droppedLines = 0;
+
+        // New clients get every line until they subscribe to less
+        logClients[nrOfLogClients].filter.level = LOGGER_SERVICE_LOGLEVEL_VERBOSE;
+        logClients[nrOfLogClients].filter.mode = LOG_FILTER_MODE_ALL_TAGS;
+        logClients[nrOfLogClients].filter.nrOfTags = 0;
+
+        __atomic_store_n(&nrOfLogClients, nrOfLogClients + 1, __ATOMIC_RELAXED);
+        publish_filters();
+        return true;
+
+    case MG_EV_WEBSOCKET_FRAME:
+    {
+        log_client_t* client = find_client(nc);
+        if (!(nc->flags & MG_F_LOG_STREAM) || client == NULL)
+        {
+            return false;
+        }
+
+        struct websocket_message* message = (struct websocket_message*) ev_data;
+        const char* error = read_subscription((const char*)message->data, message->size, &client->filter);
+        if (error != NULL)
+        {
+            LOG_W(TAG, "Log subscription rejected: %s", error);
+            mg_printf_websocket_frame(nc, WEBSOCKET_OP_TEXT, "[log subscription rejected: %s]\n", error);
+            return true;
+        }
+
+        publish_filters();
+        return true;
+    }
+
+    case MG_EV_CLOSE:
+    {
+        log_client_t* client = find_client(nc);
+        if (!(nc->flags & MG_F_LOG_STREAM) || client == NULL)
+        {
+            return false;
+        }
+
+        LOG_I(TAG, "Websocket Disconnect");
+        *client = logClients[nrOfLogClients - 1];
+        __atomic_store_n(&nrOfLogClients, nrOfLogClients - 1, __ATOMIC_RELAXED);
+        publish_filters();
+        return true;
+    }
+
+    default:
+        return (nc->flags & MG_F_LOG_STREAM) != 0;
+    }
+}
+
+void log_stream_drain(void)
+{
+    // Clear the pending flag first so lines logged while draining post a new drain
+    __atomic_store_n(&logStreamDrainPending, false, __ATOMIC_RELEASE);
+
+    uint32_t end = find_committed_end();
+    uint32_t ringDroppedLines = __atomic_exchange_n(&logRingDroppedLines, 0, __ATOMIC_RELAXED);
+
+    logStreamStats.ring_dropped_lines += ringDroppedLines;
+    if (end == logRingTail && ringDroppedLines == 0)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < nrOfLogClients; ++i)
+    {
+        log_client_t* client = &logClients[i];
+        client->droppedLines += ringDroppedLines;
+
+        // Every client gets its own frame with only the lines that pass its filter
+        size_t frameLength = 0;
+        uint32_t nrOfLines = collect_lines(end, &client->filter, &frameLength);
+        if (frameLength == 0)
+        {
+            continue;
+        }
+
+        // Lines the client missed are summarized in front of the new lines
+        char summary[MAX_SUMMARY_LENGTH];
+        int summaryLength = 0;
+        if (client->droppedLines > 0)
+        {
+            summaryLength = snprintf(summary, sizeof(summary), "[%u log lines dropped]\n", client->droppedLines);
+        }
+
+        const struct mg_str parts[] = {
+            { .p = summary, .len = summaryLength },
+            { .p = logFrame, .len = frameLength }
+        };
+
+        if (connection_manager_can_send(client->nc, summaryLength + frameLength))
+        {
+            mg_send_websocket_framev(client->nc, WEBSOCKET_OP_TEXT, parts, sizeof(parts) / sizeof(parts[0]));
+            client->droppedLines = 0;
+            ++logStreamStats.frames;
+        }
+        else
+        {
+            client->droppedLines += nrOfLines;
+            logStreamStats.client_dropped_lines += nrOfLines;
+        }
+    }
+
+    release_lines(end);
+}
+
+void log_stream_get_stats(log_stream_stats_t* stats)
+{
+    *stats = logStreamStats;
+    stats->clients = nrOfLogClients;
+}
\ No newline at end of file
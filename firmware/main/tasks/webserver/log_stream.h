@@ -0,0 +1,67 @@
+#ifndef LOG_STREAM_H
+#define LOG_STREAM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <mongoose.h>
+
+typedef struct log_stream_stats_s
+{
+    uint32_t clients;
+    uint32_t frames;
+    // Lines that did not fit in the ring because the webserver thread did not keep up
+    uint32_t ring_dropped_lines;
+    // Lines that were not sent to a client because its send buffer was full
+    uint32_t client_dropped_lines;
+} log_stream_stats_t;
+
+/**
+ * @brief Registers the log stream as a logger sink. Must be called once, before the webserver starts.
+ * The sink only copies log lines into a lock-free ring, it can be called from any task.
+ * Lines that do not pass the filter of any client are dropped before they are copied.
+ */
+void log_stream_init(void);
+
+/**
+ * @brief Starts streaming log lines to websocket clients.
+ */
+void log_stream_start(void);
+
+/**
+ * @brief Stops streaming log lines and forgets all clients. Must be called after the manager has been freed.
+ */
+void log_stream_stop(void);
+
+/**
+ * @brief Handles websocket events of connections that receive the log stream.
+ * Every websocket that is not claimed by another channel receives the log stream,
+ * so this must be called after the other channels had a chance to handle the event.
+ * Clients receive every line until they send a subscription message, which replaces their filter:
+ * {"level": "warn", "allowTags": ["Lift"]} or {"level": "debug", "denyTags": ["Webserver"]}.
+ * Levels are none, error, warn, info, debug and verbose, both tag lists are optional.
+ * 
+ * @param[in] nc The connection the event occured on.
+ * @param[in] ev The mongoose event.
+ * @param[in] ev_data The mongoose event data.
+ * 
+ * @return true if the event belonged to the log stream and was handled, or
+ * false if the event should be handled by someone else.
+ */
+bool log_stream_handle_event(struct mg_connection* nc, int ev, void* ev_data);
+
+/**
+ * @brief Sends all log lines in the ring to every client, as a single websocket frame per client.
+ * Clients whose send buffer is full skip the frame and are told how many lines they missed in the next frame.
+ * Must be called from the webserver thread.
+ */
+void log_stream_drain(void);
+
+/**
+ * @brief Gets the current log stream statistics.
+ * 
+ * @param[out] stats The log stream statistics.
+ */
+void log_stream_get_stats(log_stream_stats_t* stats);
+
+#endif // LOG_STREAM_H
\ No newline at end of file
@@ -0,0 +1,626 @@
+#include "static_file_server.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <esp32/rom/crc.h>
+#include <esp_timer.h>
+
+#include <logger.h>
+
+#include <services/asset_service.h>
+#include <services/metrics_service.h>
+
+#define WEBROOT "/data/www"
+#define INDEX_FILE "/index.html"
+#define GZIP_EXTENSION ".gz"
+
+#define MAX_PATH_LENGTH     64
+#define MAX_TRANSFERS       8
+#define MAX_ETAGS           32
+#define TRANSFER_CHUNK_SIZE 1024
+#define MAX_IF_NONE_MATCH   32
+
+// Time one poll may spend on transfers before the event loop gets to handle requests again.
+// Every transfer that is ready gets at most one chunk per poll, and at least one chunk is always processed.
+#define TRANSFER_POLL_BUDGET_US 2000
+
+// Length of the content hash webpack puts in filenames, e.g. app.1a2b3c4d.js
+#define FILENAME_HASH_LENGTH 8
+
+#define CACHE_CONTROL_IMMUTABLE "public, max-age=31536000, immutable"
+#define CACHE_CONTROL_REVALIDATE "no-cache"
+
+typedef struct mime_type_s
+{
+    const char* extension;
+    const char* mime_type;
+} mime_type_t;
+
+typedef struct etag_s
+{
+    uint32_t path_crc;
+    uint32_t content_crc;
+} etag_t;
+
+typedef struct response_s
+{
+    const char* content_type;
+    const char* cache_control;
+    size_t      size;
+    bool        is_gzipped;
+    bool        is_head;
+} response_t;
+
+typedef enum transfer_state_e
+{
+    TRANSFER_STATE_FREE = 0,
+    // Reading the file to calculate its etag, the response is sent once it is known
+    TRANSFER_STATE_HASHING,
+    TRANSFER_STATE_SENDING
+} transfer_state_t;
+
+// A transfer sends either from a file on SPIFFS, or straight from the mapped asset pack.
+// Transfers are only advanced from static_file_server_poll, never from the event handler,
+// so file reads can not delay requests that are handled by the event loop.
+typedef struct transfer_s
+{
+    struct mg_connection* nc;
+    transfer_state_t      state;
+    FILE*                 file;
+    const char*           data;
+    size_t                remaining;
+    size_t                size;
+    int64_t               started;
+
+    // Kept while hashing, the request is gone by the time the etag is known
+    response_t            response;
+    uint32_t              path_crc;
+    uint32_t              content_crc;
+    char                  if_none_match[MAX_IF_NONE_MATCH];
+} transfer_t;
+
+static const char TAG[] = "Static File Server";
+
+static const mime_type_t mime_types[] = {
+    { ".html", "text/html" },
+    { ".js",   "application/javascript" },
+    { ".css",  "text/css" },
+    { ".json", "application/json" },
+    { ".map",  "application/json" },
+    { ".ico",  "image/x-icon" },
+    { ".png",  "image/png" },
+    { ".svg",  "image/svg+xml" },
+    { ".txt",  "text/plain" },
+    { ".woff", "font/woff" },
+    { ".woff2","font/woff2" },
+};
+
+static etag_t     etags[MAX_ETAGS];
+static size_t     nrOfEtags = 0;
+static transfer_t transfers[MAX_TRANSFERS];
+static size_t     nextTransfer = 0;
+
+// Poll durations in microseconds
+static const uint32_t pollDurationBounds[] = { 100, 250, 500, 1000, 2000, 3000, 5000, 10000 };
+static metric_histogram_t pollDurationMetric = METRIC_HISTOGRAM(
+    "tvlift_static_file_poll_duration_seconds",
+    "Time the event loop spent on static file transfers per poll.",
+    NULL,
+    pollDurationBounds,
+    1000000);
+
+static const char* get_mime_type(const char* path)
+{
+    const char* extension = strrchr(path, '.');
+    if (extension != NULL)
+    {
+        for (size_t i = 0; i < sizeof(mime_types) / sizeof(mime_types[0]); ++i)
+        {
+            if (strcmp(extension, mime_types[i].extension) == 0)
+            {
+                return mime_types[i].mime_type;
+            }
+        }
+    }
+
+    return "application/octet-stream";
+}
+
+static bool is_hashed_filename(const char* path)
+{
+    // Look for a dot separated part of the filename that consists of exactly FILENAME_HASH_LENGTH hex digits
+    const char* filename = strrchr(path, '/');
+    filename = filename == NULL ? path : filename + 1;
+
+    for (const char* part = strchr(filename, '.'); part != NULL; part = strchr(part + 1, '.'))
+    {
+        size_t length = 0;
+        while (isxdigit((unsigned char)part[1 + length]))
+        {
+            length++;
+        }
+
+        if (length == FILENAME_HASH_LENGTH && part[1 + length] == '.')
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool find_etag(uint32_t pathCrc, uint32_t* etag)
+{
+    // Files only change through a firmware update, which is followed by a restart,
+    // so the checksum of a file only needs to be calculated once
+    for (size_t i = 0; i < nrOfEtags; ++i)
+    {
+        if (etags[i].path_crc == pathCrc)
+        {
+            *etag = etags[i].content_crc;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void add_etag(uint32_t pathCrc, uint32_t contentCrc)
+{
+    if (nrOfEtags < MAX_ETAGS)
+    {
+        etags[nrOfEtags].path_crc = pathCrc;
+        etags[nrOfEtags].content_crc = contentCrc;
+        nrOfEtags++;
+    }
+}
+
+static void format_etag(char* etag, size_t size, uint32_t contentCrc, bool isGzipped)
+{
+    // The gzipped and plain variants are different representations so they get different etags
+    snprintf(etag, size, "\"%08" PRIx32 "%s\"", contentCrc, isGzipped ? "-gz" : "");
+}
+
+static transfer_t* find_transfer(const struct mg_connection* nc)
+{
+    for (size_t i = 0; i < MAX_TRANSFERS; ++i)
+    {
+        if (transfers[i].nc == nc)
+        {
+            return &transfers[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void free_transfer(transfer_t* transfer)
+{
+    if (transfer->file != NULL)
+    {
+        fclose(transfer->file);
+    }
+
+    transfer->file = NULL;
+    transfer->data = NULL;
+    transfer->nc = NULL;
+    transfer->state = TRANSFER_STATE_FREE;
+}
+
+static void end_transfer(transfer_t* transfer, bool completed)
+{
+    LOG_D(TAG, "%s transfer of %u bytes from %s after %lld us",
+        completed ? "Completed" : "Aborted",
+        transfer->size,
+        transfer->file != NULL ? "SPIFFS" : "asset pack",
+        esp_timer_get_time() - transfer->started);
+
+    free_transfer(transfer);
+}
+
+static bool is_ready(const transfer_t* transfer)
+{
+    // Only keep a single chunk in the send buffer, so a transfer never needs more memory than that
+    return transfer->state == TRANSFER_STATE_HASHING ||
+        (transfer->state == TRANSFER_STATE_SENDING && transfer->nc->send_mbuf.len < TRANSFER_CHUNK_SIZE);
+}
+
+static void continue_sending(transfer_t* transfer)
+{
+    if (transfer->file == NULL)
+    {
+        // Mapped flash can be sent as is, without copying it into a buffer first
+        size_t length = transfer->remaining < TRANSFER_CHUNK_SIZE ? transfer->remaining : TRANSFER_CHUNK_SIZE;
+        mg_send(transfer->nc, transfer->data, length);
+        transfer->data += length;
+        transfer->remaining -= length;
+
+        if (transfer->remaining == 0)
+        {
+            end_transfer(transfer, true);
+        }
+        return;
+    }
+
+    char buffer[TRANSFER_CHUNK_SIZE];
+    size_t length = fread(buffer, 1, sizeof(buffer), transfer->file);
+    if (length > 0)
+    {
+        mg_send(transfer->nc, buffer, length);
+    }
+
+    if (length < sizeof(buffer))
+    {
+        end_transfer(transfer, true);
+    }
+}
+
+static bool accepts_gzip(struct http_message* message)
+{
+    struct mg_str* acceptEncoding = mg_get_http_header(message, "Accept-Encoding");
+    return acceptEncoding != NULL && mg_strstr(*acceptEncoding, mg_mk_str("gzip")) != NULL;
+}
+
+static void send_response(
+    struct mg_connection* nc,
+    transfer_t* transfer,
+    const response_t* response,
+    const char* etag,
+    struct mg_str ifNoneMatch,
+    FILE* file,
+    const char* data)
+{
+    bool hasBody = !response->is_head && response->size > 0;
+
+    if (mg_strstr(ifNoneMatch, mg_mk_str(etag)) != NULL)
+    {
+        if (transfer != NULL)
+        {
+            free_transfer(transfer);
+        }
+        else if (file != NULL)
+        {
+            fclose(file);
+        }
+
+        mg_send_response_line(nc, 304, "Access-Control-Allow-Origin: *");
+        mg_printf(nc,
+            "ETag: %s\r\n"
+            "Cache-Control: %s\r\n"
+            "Vary: Accept-Encoding\r\n"
+            "Content-Length: 0\r\n"
+            "\r\n",
+            etag,
+            response->cache_control);
+        return;
+    }
+
+    if (hasBody && transfer == NULL)
+    {
+        transfer = find_transfer(NULL);
+        if (transfer == NULL)
+        {
+            LOG_W(TAG, "Too many file transfers in progress, refusing request");
+            if (file != NULL)
+            {
+                fclose(file);
+            }
+            mg_http_send_error(nc, 503, NULL);
+            return;
+        }
+    }
+
+    mg_send_response_line(nc, 200, "Access-Control-Allow-Origin: *");
+    mg_printf(nc,
+        "Content-Type: %s\r\n"
+        "Content-Length: %u\r\n"
+        "%s"
+        "ETag: %s\r\n"
+        "Cache-Control: %s\r\n"
+        "Vary: Accept-Encoding\r\n"
+        "\r\n",
+        response->content_type,
+        response->size,
+        response->is_gzipped ? "Content-Encoding: gzip\r\n" : "",
+        etag,
+        response->cache_control);
+
+    if (!hasBody)
+    {
+        if (transfer != NULL)
+        {
+            free_transfer(transfer);
+        }
+        else if (file != NULL)
+        {
+            fclose(file);
+        }
+        return;
+    }
+
+    // The body is sent by static_file_server_poll
+    if (transfer->state == TRANSFER_STATE_FREE)
+    {
+        transfer->started = esp_timer_get_time();
+    }
+    transfer->nc = nc;
+    transfer->state = TRANSFER_STATE_SENDING;
+    transfer->file = file;
+    transfer->data = data;
+    transfer->remaining = response->size;
+    transfer->size = response->size;
+}
+
+static void continue_hashing(transfer_t* transfer)
+{
+    uint8_t buffer[TRANSFER_CHUNK_SIZE];
+    size_t length = fread(buffer, 1, sizeof(buffer), transfer->file);
+    transfer->content_crc = crc32_le(transfer->content_crc, buffer, length);
+
+    if (length == sizeof(buffer))
+    {
+        return;
+    }
+
+    if (ferror(transfer->file) || fseek(transfer->file, 0, SEEK_SET) != 0)
+    {
+        LOG_W(TAG, "Can not read file for etag");
+        mg_http_send_error(transfer->nc, 500, NULL);
+        end_transfer(transfer, false);
+        return;
+    }
+
+    add_etag(transfer->path_crc, transfer->content_crc);
+
+    char etag[24];
+    format_etag(etag, sizeof(etag), transfer->content_crc, transfer->response.is_gzipped);
+
+    send_response(
+        transfer->nc,
+        transfer,
+        &transfer->response,
+        etag,
+        mg_mk_str(transfer->if_none_match),
+        transfer->file,
+        NULL);
+}
+
+static struct mg_str get_if_none_match(struct http_message* message)
+{
+    struct mg_str* ifNoneMatch = mg_get_http_header(message, "If-None-Match");
+    return ifNoneMatch != NULL ? *ifNoneMatch : mg_mk_str(NULL);
+}
+
+static bool is_head(struct http_message* message)
+{
+    return mg_vcmp(&message->method, "HEAD") == 0;
+}
+
+static void serve_asset(struct mg_connection* nc, struct http_message* message, struct mg_str uri)
+{
+    asset_t asset;
+    if (asset_service_find(uri.p, uri.len, &asset) != ASSET_SERVICE_OK)
+    {
+        mg_http_send_error(nc, 404, NULL);
+        return;
+    }
+
+    response_t response = {
+        .content_type = asset.content_type,
+        .cache_control = is_hashed_filename(asset.path) ? CACHE_CONTROL_IMMUTABLE : CACHE_CONTROL_REVALIDATE,
+        .size = asset.length,
+        .is_gzipped = false,
+        .is_head = is_head(message)
+    };
+
+    // The gzipped and plain variants are different representations so they get different etags
+    if (asset.gzip_data != NULL && accepts_gzip(message))
+    {
+        char etag[24];
+        snprintf(etag, sizeof(etag), "%.*s-gz\"", (int)strlen(asset.etag) - 1, asset.etag);
+
+        response.size = asset.gzip_length;
+        response.is_gzipped = true;
+        send_response(nc, NULL, &response, etag, get_if_none_match(message), NULL, asset.gzip_data);
+    }
+    else
+    {
+        send_response(nc, NULL, &response, asset.etag, get_if_none_match(message), NULL, asset.data);
+    }
+}
+
+static void serve_file(struct mg_connection* nc, struct http_message* message, struct mg_str uri)
+{
+    // Refuse paths that do not fit
+    if (sizeof(WEBROOT) + uri.len + sizeof(GZIP_EXTENSION) > MAX_PATH_LENGTH)
+    {
+        mg_http_send_error(nc, 404, NULL);
+        return;
+    }
+
+    char path[MAX_PATH_LENGTH];
+    int pathLength = snprintf(path, sizeof(path), WEBROOT "%.*s", (int)uri.len, uri.p);
+
+    // Prefer the precompressed variant of the file
+    FILE* file = NULL;
+    bool isGzipped = false;
+    if (accepts_gzip(message))
+    {
+        strcpy(path + pathLength, GZIP_EXTENSION);
+        file = fopen(path, "rb");
+        isGzipped = file != NULL;
+    }
+
+    if (file == NULL)
+    {
+        path[pathLength] = '\0';
+        file = fopen(path, "rb");
+    }
+
+    if (file == NULL)
+    {
+        mg_http_send_error(nc, 404, NULL);
+        return;
+    }
+
+    long size = -1;
+    if (fseek(file, 0, SEEK_END) == 0)
+    {
+        size = ftell(file);
+    }
+
+    if (size < 0 || fseek(file, 0, SEEK_SET) != 0)
+    {
+        LOG_W(TAG, "Can not read file: %s", path);
+        fclose(file);
+        mg_http_send_error(nc, 500, NULL);
+        return;
+    }
+
+    uint32_t pathCrc = crc32_le(0, (const uint8_t*)path, strlen(path));
+
+    path[pathLength] = '\0';
+    response_t response = {
+        .content_type = get_mime_type(path),
+        .cache_control = is_hashed_filename(path) ? CACHE_CONTROL_IMMUTABLE : CACHE_CONTROL_REVALIDATE,
+        .size = size,
+        .is_gzipped = isGzipped,
+        .is_head = is_head(message)
+    };
+
+    uint32_t etagCrc;
+    if (find_etag(pathCrc, &etagCrc))
+    {
+        char etag[24];
+        format_etag(etag, sizeof(etag), etagCrc, isGzipped);
+
+        send_response(nc, NULL, &response, etag, get_if_none_match(message), file, NULL);
+        return;
+    }
+
+    // The etag is needed for the headers, so the whole file is read first.
+    // That is done a chunk at a time by static_file_server_poll, like sending the file.
+    transfer_t* transfer = find_transfer(NULL);
+    if (transfer == NULL)
+    {
+        LOG_W(TAG, "Too many file transfers in progress, refusing request for: %s", path);
+        fclose(file);
+        mg_http_send_error(nc, 503, NULL);
+        return;
+    }
+
+    struct mg_str ifNoneMatch = get_if_none_match(message);
+    size_t ifNoneMatchLength = ifNoneMatch.len < sizeof(transfer->if_none_match) ? ifNoneMatch.len : sizeof(transfer->if_none_match) - 1;
+    memcpy(transfer->if_none_match, ifNoneMatch.p, ifNoneMatchLength);
+    transfer->if_none_match[ifNoneMatchLength] = '\0';
+
+    transfer->nc = nc;
+    transfer->state = TRANSFER_STATE_HASHING;
+    transfer->file = file;
+    transfer->data = NULL;
+    transfer->size = size;
+    transfer->started = esp_timer_get_time();
+    transfer->response = response;
+    transfer->path_crc = pathCrc;
+    transfer->content_crc = 0;
+}
+
+void static_file_server_init(void)
+{
+    metrics_service_register(&pollDurationMetric.metric);
+}
+
+void static_file_server_serve(struct mg_connection* nc, struct http_message* message)
+{
+    const struct mg_str uri = mg_vcmp(&message->uri, "/") == 0 ? mg_mk_str(INDEX_FILE) : message->uri;
+
+    // Refuse paths that would escape the webroot
+    if (mg_strstr(uri, mg_mk_str("..")) != NULL)
+    {
+        mg_http_send_error(nc, 404, NULL);
+        return;
+    }
+
+    if (asset_service_is_mapped())
+    {
+        serve_asset(nc, message, uri);
+    }
+    else
+    {
+        serve_file(nc, message, uri);
+    }
+}
+
+void static_file_server_handle_event(struct mg_connection* nc, int ev)
+{
+    if (ev != MG_EV_CLOSE)
+    {
+        return;
+    }
+
+    transfer_t* transfer = find_transfer(nc);
+    if (transfer != NULL)
+    {
+        end_transfer(transfer, false);
+    }
+}
+
+void static_file_server_poll(void)
+{
+    const int64_t start = esp_timer_get_time();
+    bool isIdle = true;
+
+    // Round robin, so every transfer gets its turn even when the budget runs out early
+    for (size_t i = 0; i < MAX_TRANSFERS; ++i)
+    {
+        transfer_t* transfer = &transfers[(nextTransfer + i) % MAX_TRANSFERS];
+        if (!is_ready(transfer))
+        {
+            continue;
+        }
+
+        if (!isIdle && esp_timer_get_time() - start >= TRANSFER_POLL_BUDGET_US)
+        {
+            nextTransfer = (nextTransfer + i) % MAX_TRANSFERS;
+            break;
+        }
+
+        isIdle = false;
+        if (transfer->state == TRANSFER_STATE_HASHING)
+        {
+            continue_hashing(transfer);
+        }
+        else
+        {
+            continue_sending(transfer);
+        }
+    }
+
+    if (!isIdle)
+    {
+        metrics_histogram_observe(&pollDurationMetric, (uint32_t)(esp_timer_get_time() - start));
+    }
+}
+
+bool static_file_server_has_pending_work(void)
+{
+    for (size_t i = 0; i < MAX_TRANSFERS; ++i)
+    {
+        if (is_ready(&transfers[i]))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool static_file_server_is_transferring(const struct mg_connection* nc)
+{
+    return find_transfer(nc) != NULL;
+}
\ No newline at end of file
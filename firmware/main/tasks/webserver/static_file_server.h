@@ -0,0 +1,55 @@
+#ifndef STATIC_FILE_SERVER_H
+#define STATIC_FILE_SERVER_H
+
+#include <stdbool.h>
+
+#include <mongoose.h>
+
+/**
+ * @brief Registers the metrics of the file server, called once when the webserver is initialized.
+ */
+void static_file_server_init(void);
+
+/**
+ * @brief Serves a file from the asset pack if one is mapped, or from the webroot otherwise, in response to a request.
+ * Picks the precompressed .gz variant of the file if the client accepts gzip,
+ * and answers with 304 if the client already has the current version of the file.
+ * Only the headers are sent right away, the body is sent by static_file_server_poll.
+ *
+ * @param[in] nc The connection the request was recieved on.
+ * @param[in] message The request.
+ */
+void static_file_server_serve(struct mg_connection* nc, struct http_message* message);
+
+/**
+ * @brief Cleans up file transfers of a connection.
+ * Must be called for every event of connections that files can be served on.
+ *
+ * @param[in] nc The connection the event occured on.
+ * @param[in] ev The mongoose event.
+ */
+void static_file_server_handle_event(struct mg_connection* nc, int ev);
+
+/**
+ * @brief Continues file transfers, one chunk per transfer at most, until the time budget of a poll is used up.
+ * Must be called from the webserver thread after every mg_mgr_poll, so requests never wait for more than one poll budget of file reads.
+ */
+void static_file_server_poll(void);
+
+/**
+ * @brief Checks if a transfer can continue right away, in which case mg_mgr_poll should not wait for events.
+ *
+ * @return true if static_file_server_poll has work to do.
+ */
+bool static_file_server_has_pending_work(void);
+
+/**
+ * @brief Checks if a file is being sent on a connection.
+ *
+ * @param[in] nc The connection to check.
+ *
+ * @return true if a file transfer is in progress on the connection.
+ */
+bool static_file_server_is_transferring(const struct mg_connection* nc);
+
+#endif // STATIC_FILE_SERVER_H
\ No newline at end of file
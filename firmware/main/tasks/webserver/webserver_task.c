@@ -6,42 +6,155 @@
 #include <soc/soc.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
 #include <esp_event.h>
+#include <lwip/sockets.h>
 
 #include <mongoose.h>
 
 #include <shared.h>
 #include <logger.h>
+#include <services/metrics_service.h>
 #include <services/status_service.h>
 
+#include "controllers/batch_controller.h"
+#include "controllers/controller_base.h"
 #include "controllers/lift_controller.h"
+#include "controllers/metrics_controller.h"
+#include "controllers/server_controller.h"
 #include "controllers/settings_controller.h"
 #include "controllers/upload_controller.h"
+#include "connection_manager.h"
+#include "control_channel.h"
+#include "event_channel.h"
+#include "log_stream.h"
+#include "static_file_server.h"
 
-#define WEBROOT "/data/www/"
 #define WEBSERVER_THREAD_TAG "WebserverThread"
 #define WEBSERVER_THREAD_STACK_SIZE_KB 8
 
+// The poll timeout only bounds how often mongoose timers are serviced,
+// other tasks wake the thread up immediately through the wakeup socket
+#define WEBSERVER_POLL_TIMEOUT_MS 1000
+#define WEBSERVER_WORK_QUEUE_LENGTH 32
+
+typedef struct webserver_work_item_s
+{
+    webserver_work_t work;
+    void*            arg;
+} webserver_work_item_t;
+
 static service_handle_t serviceHandle;
 static TaskHandle_t webserverTaskHandle = NULL;
 static TaskHandle_t webserverThreadHandle = NULL;
 static SemaphoreHandle_t webserverControlSemaphore = NULL;
 
+static QueueHandle_t webserverWorkQueue = NULL;
+static SemaphoreHandle_t webserverWakeupSemaphore = NULL;
+static volatile bool webserverWakeupPending = false;
+static int webserverWakeupSockets[2] = { INVALID_SOCKET, INVALID_SOCKET };
+
 static struct mg_mgr manager;
 static struct mg_connection* webserverConnection;
-static struct mg_serve_http_opts http_server_opts = {
-    .document_root = WEBROOT,
-    .enable_directory_listing = "no",
-    .index_files =  WEBROOT "index.html",
-    .extra_headers = "Access-Control-Allow-Origin: *"
-};
 
 static const char* TAG = WEBSERVER_TASK_TAG;
 
-static void websocket_sink(const char* message, const size_t len, void* user_data)
+static int32_t read_stack_free_bytes(void* userData)
 {
-    struct mg_connection* websocketLoggerConnection = (struct mg_connection*) user_data;
-    mg_send_websocket_frame(websocketLoggerConnection, WEBSOCKET_OP_TEXT, message, len);
+    TaskHandle_t handle = *(TaskHandle_t*)userData;
+    return handle != NULL ? uxTaskGetStackHighWaterMark(handle) : 0;
+}
+
+static metric_gauge_t webserverThreadStackMetric = METRIC_GAUGE(
+    "tvlift_task_stack_free_bytes",
+    "Least amount of free stack space a task ever had.",
+    "task=\"" WEBSERVER_THREAD_TAG "\"",
+    read_stack_free_bytes,
+    &webserverThreadHandle);
+
+static bool create_wakeup_sockets(int sockets[2])
+{
+    struct sockaddr_in address = {
+        .sin_family = AF_INET,
+        .sin_port = 0,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+    };
+    socklen_t addressLength = sizeof(address);
+
+    // Receiving side, bound to an ephemeral loopback port and polled by mongoose
+    sockets[1] = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockets[1] < 0 ||
+        bind(sockets[1], (struct sockaddr*) &address, addressLength) != 0 ||
+        getsockname(sockets[1], (struct sockaddr*) &address, &addressLength) != 0)
+    {
+        goto error;
+    }
+
+    // Sending side, connected to the receiving side so waking up is a single send
+    sockets[0] = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockets[0] < 0 ||
+        connect(sockets[0], (struct sockaddr*) &address, addressLength) != 0 ||
+        fcntl(sockets[0], F_SETFL, O_NONBLOCK) != 0)
+    {
+        goto error;
+    }
+
+    return true;
+
+error:
+    for (int i = 0; i < 2; ++i)
+    {
+        if (sockets[i] >= 0)
+        {
+            closesocket(sockets[i]);
+        }
+        sockets[i] = INVALID_SOCKET;
+    }
+
+    return false;
+}
+
+static void wakeup_ev_handler(struct mg_connection* c, int ev, void* ev_data, void* user_data)
+{
+    if (ev == MG_EV_RECV)
+    {
+        // The datagrams carry no data, they only interrupt mg_mgr_poll
+        mbuf_remove(&c->recv_mbuf, c->recv_mbuf.len);
+    }
+}
+
+static void webserver_wakeup(void)
+{
+    // Only one wakeup needs to be in flight, the thread handles all queued work when it wakes
+    if (webserverWakeupPending)
+    {
+        return;
+    }
+
+    xSemaphoreTake(webserverWakeupSemaphore, portMAX_DELAY);
+
+    if (!webserverWakeupPending && webserverWakeupSockets[0] != INVALID_SOCKET)
+    {
+        webserverWakeupPending = true;
+
+        const char wakeup = 0;
+        send(webserverWakeupSockets[0], &wakeup, sizeof(wakeup), 0);
+    }
+
+    xSemaphoreGive(webserverWakeupSemaphore);
+}
+
+static void webserver_run_posted_work(void)
+{
+    // Clear the pending flag first so work posted while draining wakes the thread up again
+    webserverWakeupPending = false;
+
+    webserver_work_item_t item;
+    while (xQueueReceive(webserverWorkQueue, &item, 0) == pdTRUE)
+    {
+        item.work(item.arg);
+    }
 }
 
 static void webserver_ev_handler(struct mg_connection* c, int ev, void* ev_data, void* user_data)
@@ -49,41 +162,33 @@ static void webserver_ev_handler(struct mg_connection* c, int ev, void* ev_data,
     struct http_message* message = (struct http_message*) ev_data;
     // struct websocket_message* wm = (struct websocket_message *) ev_data;
 
-    switch (ev)
+    // Keep track of connections before anything else, every accept and close must be seen
+    connection_manager_handle_event(c, ev);
+
+    // Let the route table handle api requests first
+    if (dispatch_uri_handler(c, ev, ev_data))
     {
-    case MG_EV_HTTP_REQUEST:
-        if (mg_vcmp(&message->uri, "/") == 0) 
-        {
-            mg_http_serve_file(c, message, WEBROOT "index.html", mg_mk_str("text/html"), mg_mk_str(NULL));
-        }
-        else
-        {
-            mg_serve_http(c, message, http_server_opts);
-        }
-        break;
+        return;
+    }
 
-    case MG_EV_WEBSOCKET_HANDSHAKE_DONE:
-        // New websocket connection
-        LOG_I(TAG, "Websocket Connect");
-        sink_handle_t handle = logger_service_register_sink(websocket_sink, (void*)c);
+    // Websockets on the event and control channels do not carry log messages,
+    // every other websocket receives the log stream
+    if (event_channel_handle_event(c, ev, ev_data) ||
+        control_channel_handle_event(c, ev, ev_data) ||
+        log_stream_handle_event(c, ev, ev_data))
+    {
+        return;
+    }
 
-        // Save the handle
-        c->user_data = handle;
+    // Clean up file transfers of closed connections
+    static_file_server_handle_event(c, ev);
 
+    switch (ev)
+    {
+    case MG_EV_HTTP_REQUEST:
+        static_file_server_serve(c, message);
         break;
-        
-    case MG_EV_CLOSE: 
-        // Disconnect
-        if (c->flags & MG_F_IS_WEBSOCKET)
-        {
-            logger_service_unregister_sink((sink_handle_t)c->user_data);
-            LOG_I(TAG, "Websocket Disconnect");
 
-            // Remove the handle
-            free(c->user_data);
-            c->user_data = NULL;
-        }
-        break;
     }
     
 }
@@ -95,8 +200,21 @@ static void webserver_thread(void* pvParameters)
 
     for (;;)
     {
-        // Webserver event loop
-        mg_mgr_poll(&manager, 100);
+        // Webserver event loop, requests are handled here.
+        // Do not wait for events while file transfers can continue.
+        mg_mgr_poll(&manager, static_file_server_has_pending_work() ? 0 : WEBSERVER_POLL_TIMEOUT_MS);
+
+        // Continue file transfers for at most one poll budget, so the next requests are handled without delay
+        static_file_server_poll();
+
+        // Handle work posted by other tasks
+        webserver_run_posted_work();
+
+        // Send log lines that were logged since the last drain, in case posting the drain failed
+        log_stream_drain();
+
+        // Close connections that have been idle for too long
+        connection_manager_poll();
 
         // Check to see if we need to stop
         uint32_t stop = ulTaskNotifyTake(pdTRUE, 0);
@@ -105,6 +223,7 @@ static void webserver_thread(void* pvParameters)
             break;
         }
     }
+
     LOG_I(TAG, "Webserver polling loop stopped");
 
     // Notify the webserver task we have stopped
@@ -114,24 +233,57 @@ static void webserver_thread(void* pvParameters)
     vTaskDelete(NULL);
 }
 
+static void close_wakeup_sockets(void)
+{
+    // The receiving side is owned by the manager and closed by mg_mgr_free
+    xSemaphoreTake(webserverWakeupSemaphore, portMAX_DELAY);
+    if (webserverWakeupSockets[0] != INVALID_SOCKET)
+    {
+        closesocket(webserverWakeupSockets[0]);
+    }
+    webserverWakeupSockets[0] = INVALID_SOCKET;
+    webserverWakeupSockets[1] = INVALID_SOCKET;
+    xSemaphoreGive(webserverWakeupSemaphore);
+}
+
 static void start_webserver()
 {
     LOG_I(TAG, "Starting webserver");
 
     // Initialise the webserver manager
     mg_mgr_init(&manager, NULL);
+    connection_manager_start(&manager);
+    event_channel_start(&manager);
+    log_stream_start();
 
     // Set up webserver connection
     LOG_I(TAG, "Starting webserver on port: '%d'", 80);
     webserverConnection = mg_bind(&manager, "80", webserver_ev_handler, NULL);
     mg_set_protocol_http_websocket(webserverConnection);
+
+    // Set up the wakeup sockets so other tasks can interrupt mg_mgr_poll
+    xSemaphoreTake(webserverWakeupSemaphore, portMAX_DELAY);
+    if (create_wakeup_sockets(webserverWakeupSockets))
+    {
+        mg_add_sock(&manager, webserverWakeupSockets[1], wakeup_ev_handler, NULL);
+    }
+    else
+    {
+        LOG_W(TAG, "Could not create wakeup sockets, posted work is delayed up to %d ms", WEBSERVER_POLL_TIMEOUT_MS);
+    }
+    webserverWakeupPending = false;
+    xSemaphoreGive(webserverWakeupSemaphore);
     
     // Set URI handlers
     LOG_I(TAG, "Registering URI handlers");
     const char* rootUri = "/api";
-    lift_controller_register_uri_handlers(webserverConnection, rootUri);
-    settings_controller_register_uri_handlers(webserverConnection, rootUri);
-    upload_controller_register_uri_handlers(webserverConnection, rootUri);
+    clear_uri_handlers();
+    lift_controller_register_uri_handlers(rootUri);
+    settings_controller_register_uri_handlers(rootUri);
+    upload_controller_register_uri_handlers(rootUri);
+    server_controller_register_uri_handlers(rootUri);
+    batch_controller_register_uri_handlers(rootUri);
+    metrics_controller_register_uri_handlers(rootUri);
 
     // Start the webserver thread
     BaseType_t taskCreateResult = xTaskCreatePinnedToCore(
@@ -153,6 +305,10 @@ static void start_webserver()
         
         // Free webserver resources
         mg_mgr_free(&manager);
+        event_channel_stop();
+        log_stream_stop();
+        connection_manager_stop();
+        close_wakeup_sockets();
     }
 }
 
@@ -160,14 +316,22 @@ static void stop_webserver()
 {
     LOG_I(TAG, "Stopping webserver");
 
-    // Notify webserver thread to stop
+    // Notify webserver thread to stop and interrupt its poll
     xTaskNotifyGive(webserverThreadHandle);
+    webserver_wakeup();
 
     // Wait for websever thread to be stopped
     ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
 
+    // Run work that was posted right before stopping, it may own resources that need to be freed
+    webserver_run_posted_work();
+
     // Free webserver resources
     mg_mgr_free(&manager);
+    event_channel_stop();
+    log_stream_stop();
+    connection_manager_stop();
+    close_wakeup_sockets();
 
     LOG_I(TAG, "Webserver stopped");
 }
@@ -210,11 +374,43 @@ static void webserver_init()
     // Create the semaphore for webserver start/stop control
     webserverControlSemaphore = xSemaphoreCreateMutex();
 
+    // Create the queue and semaphore for work posted to the webserver thread
+    webserverWorkQueue = xQueueCreate(WEBSERVER_WORK_QUEUE_LENGTH, sizeof(webserver_work_item_t));
+    webserverWakeupSemaphore = xSemaphoreCreateMutex();
+
+    // Push lift events and log lines to websocket clients
+    event_channel_init();
+    log_stream_init();
+    static_file_server_init();
+
+    metrics_service_register(&webserverThreadStackMetric.metric);
+
     // Register events
     esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, wifi_event_sta_disconnected, NULL);
     esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, ip_event_sta_got_ip, NULL);
 }
 
+bool webserver_task_post(webserver_work_t work, void* arg)
+{
+    if (webserverWorkQueue == NULL || webserverThreadHandle == NULL)
+    {
+        return false;
+    }
+
+    webserver_work_item_t item = {
+        .work = work,
+        .arg = arg
+    };
+
+    if (xQueueSendToBack(webserverWorkQueue, &item, 0) != pdTRUE)
+    {
+        return false;
+    }
+
+    webserver_wakeup();
+    return true;
+}
+
 void webserver_task_main(void* pvParameters)
 {
     LOG_I(TAG, "Starting task");
@@ -2,10 +2,26 @@
 #define WEBSERVER_TASK_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #define WEBSERVER_TASK_TAG "Webserver"
 #define WEBSERVER_TASK_STACK_SIZE_KB 2
 
+typedef void (*webserver_work_t)(void* arg);
+
 void webserver_task_main(void* pvParameters);
 
+/**
+ * @brief Queues work to be executed on the webserver thread and wakes the thread up immediately.
+ * Safe to call from any task, including the webserver thread itself. Never blocks.
+ * 
+ * @param[in] work Function to call on the webserver thread.
+ * @param[in] arg Argument passed to work. Ownership is passed along with the work, the work is
+ * responsible for freeing it. Work that was posted is always executed, also when the webserver stops.
+ * 
+ * @return true if the work was queued, or
+ * false if the webserver is not running or the queue is full, in which case work is not called.
+ */
+bool webserver_task_post(webserver_work_t work, void* arg);
+
 #endif // WEBSERVER_TASK_H
\ No newline at end of file
@@ -0,0 +1,111 @@
+import argparse
+import gzip
+import hashlib
+import mimetypes
+import os
+import struct
+
+# Must match services/asset_service.c
+MAGIC = 0x4B415754  # "TWAK"
+VERSION = 1
+HEADER_FORMAT = "<IHHI"
+ENTRY_FORMAT = "<48s32s20sIIII"
+PATH_SIZE = 48
+CONTENT_TYPE_SIZE = 32
+ALIGNMENT = 4
+
+CONTENT_TYPES = {
+    ".html": "text/html",
+    ".js": "application/javascript",
+    ".css": "text/css",
+    ".json": "application/json",
+    ".map": "application/json",
+    ".ico": "image/x-icon",
+    ".png": "image/png",
+    ".svg": "image/svg+xml",
+    ".txt": "text/plain",
+    ".woff": "font/woff",
+    ".woff2": "font/woff2",
+}
+
+COMPRESSIBLE = (".html", ".js", ".css", ".json", ".map", ".svg", ".ico", ".txt")
+
+parser = argparse.ArgumentParser(description="Packs the web assets into a read-only asset pack that is served directly from flash.")
+parser.add_argument("root", help="Directory with the web assets")
+parser.add_argument("out", help="Output file")
+parser.add_argument("--size", help="Size of the partition the pack is flashed to, packing fails if the pack does not fit", type=lambda x: int(x, 0))
+args = parser.parse_args()
+
+
+def content_type(path):
+    extension = os.path.splitext(path)[1]
+    return CONTENT_TYPES.get(extension) or mimetypes.guess_type(path)[0] or "application/octet-stream"
+
+
+def align(data):
+    return data + b"\xff" * (-len(data) % ALIGNMENT)
+
+
+# Collect all assets, precompressed .gz files are stored as the gzip variant of their original
+assets = []
+for directory, _, files in os.walk(args.root):
+    for name in files:
+        if name.endswith(".gz"):
+            continue
+
+        fullPath = os.path.join(directory, name)
+        path = "/" + os.path.relpath(fullPath, args.root).replace(os.sep, "/")
+
+        with open(fullPath, "rb") as f:
+            data = f.read()
+
+        gzipped = b""
+        if os.path.exists(fullPath + ".gz"):
+            with open(fullPath + ".gz", "rb") as f:
+                gzipped = f.read()
+        elif name.endswith(COMPRESSIBLE) and len(data) >= 1024:
+            gzipped = gzip.compress(data, 9, mtime=0)
+
+        # Only keep the gzip variant if it actually saves space
+        if len(gzipped) >= len(data):
+            gzipped = b""
+
+        if len(path.encode()) >= PATH_SIZE:
+            raise SystemExit("Path too long for asset pack: " + path)
+
+        assets.append((path, data, gzipped))
+
+# The device looks up assets with a binary search
+assets.sort(key=lambda asset: asset[0].encode())
+
+headerSize = struct.calcsize(HEADER_FORMAT) + len(assets) * struct.calcsize(ENTRY_FORMAT)
+entries = b""
+blobs = b""
+for path, data, gzipped in assets:
+    etag = '"' + hashlib.sha256(data).hexdigest()[:16] + '"'
+
+    offset = headerSize + len(blobs)
+    blobs += align(data)
+
+    gzipOffset = headerSize + len(blobs) if gzipped else 0
+    blobs += align(gzipped)
+
+    entries += struct.pack(
+        ENTRY_FORMAT,
+        path.encode(),
+        content_type(path).encode()[:CONTENT_TYPE_SIZE - 1],
+        etag.encode(),
+        offset,
+        len(data),
+        gzipOffset,
+        len(gzipped))
+
+pack = struct.pack(HEADER_FORMAT, MAGIC, VERSION, len(assets), headerSize + len(blobs)) + entries + blobs
+
+if args.size is not None and len(pack) > args.size:
+    raise SystemExit("Asset pack of {} bytes does not fit in {} bytes".format(len(pack), args.size))
+
+with open(args.out, "wb") as out:
+    out.write(pack)
+
+print("Packed {} assets into {} bytes".format(len(assets), headerSize + len(blobs)))
\ No newline at end of file
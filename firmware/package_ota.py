@@ -0,0 +1,218 @@
+import argparse
+import hashlib
+import struct
+import zlib
+
+# Must match services/ota_service.c
+PACKAGE_MAGIC = 0x504F5754  # "TWOP"
+PACKAGE_VERSION = 1
+PACKAGE_HEADER_FORMAT = "<IHHI"
+SECTION_FORMAT = "<BBHI32s"
+SECTION_TYPE_SPIFFS = 1
+SECTION_TYPE_APP = 2
+SECTION_TYPE_APP_DELTA = 3
+SECTION_TYPE_SIGNATURE = 4
+SECTION_FLAG_BLANK_REST = 0x01
+SECTION_FLAG_SECTOR_HASHES = 0x02
+SECTOR_SIZE = 4096
+SECTOR_HASH_LENGTH = 16
+DELTA_INFO_FORMAT = "<32sII"
+DELTA_COMMAND_FORMAT = "<IIi"
+# A DER encoded ECDSA P-256 signature is at most this long, signatures are made until one has this length
+SIGNATURE_LENGTH = 72
+
+COMPRESSED_MAGIC = 0x5A4F5754  # "TWOZ"
+COMPRESSED_HEADER_FORMAT = "<IIB3x"
+
+# Must match services/asset_service.c
+ASSET_PACK_MAGIC = 0x4B415754  # "TWAK"
+
+# Offsets in an app image: the image header and the first segment header are followed by the app description
+APP_DESC_OFFSET = 24 + 8
+APP_DESC_MAGIC = 0xABCD5432
+APP_DESC_ELF_SHA256_OFFSET = APP_DESC_OFFSET + 144
+
+# Matches are looked up by this many bytes, base positions are indexed every DELTA_INDEX_STEP bytes
+DELTA_SEED_LENGTH = 16
+DELTA_INDEX_STEP = 4
+
+parser = argparse.ArgumentParser(description="Packages a spiffs image and an app image into a firmware update package.")
+parser.add_argument("spiffs", help="Spiffs partition image, or asset pack")
+parser.add_argument("app", help="App image")
+parser.add_argument("out", help="Output file")
+parser.add_argument("--compress", help="Deflate the output, the device decompresses it while it writes the update", action="store_true")
+parser.add_argument("--window-bits", help="Size of the compression window as a power of 2, the device needs this much memory to decompress", type=int, default=13, choices=range(9, 16))
+parser.add_argument("--base", help="App image the device is running, the app is sent as a delta against it if that is smaller")
+parser.add_argument("--sign-key", help="PEM encoded ECDSA P-256 private key to sign the manifest with")
+args = parser.parse_args()
+
+with open(args.spiffs, "rb") as f:
+    spiffs = f.read()
+
+with open(args.app, "rb") as f:
+    app = f.read()
+
+# A spiffs image is padded with erased flash up to the partition size. Only the bytes before the padding are sent,
+# the device makes sure the rest of the partition is erased. An asset pack knows its own length and needs neither.
+spiffsFlags = 0
+if len(spiffs) < 4 or struct.unpack_from("<I", spiffs)[0] != ASSET_PACK_MAGIC:
+    spiffsLength = len(spiffs.rstrip(b"\xff"))
+    spiffs = spiffs[:spiffsLength + (-spiffsLength % 4)]
+    spiffsFlags |= SECTION_FLAG_BLANK_REST
+else:
+    spiffs = spiffs[:struct.unpack_from("<IHHI", spiffs)[3]]
+
+# The device skips the sectors it already has, sectors are hashed as they end up in flash: padded with erased flash
+spiffsFlags |= SECTION_FLAG_SECTOR_HASHES
+
+
+def sector_hashes(data):
+    hashes = b""
+    for offset in range(0, len(data), SECTOR_SIZE):
+        sector = data[offset:offset + SECTOR_SIZE].ljust(SECTOR_SIZE, b"\xff")
+        hashes += hashlib.sha256(sector).digest()[:SECTOR_HASH_LENGTH]
+    return hashes
+
+
+def extend_match(base, target, basePosition, targetPosition):
+    # Extends the match as long as it has more equal then different bytes since its best end,
+    # so code that moved along with a few changed addresses stays one match, like bsdiff does
+    score = 0
+    bestScore = 0
+    bestLength = 0
+    length = 0
+    limit = min(len(base) - basePosition, len(target) - targetPosition)
+
+    while length < limit and score > bestScore - 32:
+        chunk = min(64, limit - length)
+        if base[basePosition + length:basePosition + length + chunk] == target[targetPosition + length:targetPosition + length + chunk]:
+            score += chunk
+            length += chunk
+        else:
+            score += 1 if base[basePosition + length] == target[targetPosition + length] else -1
+            length += 1
+
+        if score > bestScore:
+            bestScore = score
+            bestLength = length
+
+    return bestLength
+
+
+def make_delta(base, target):
+    index = {}
+    for position in range(0, len(base) - DELTA_SEED_LENGTH + 1, DELTA_INDEX_STEP):
+        index.setdefault(base[position:position + DELTA_SEED_LENGTH], position)
+
+    # Matches as (target position, base position, length), the bytes between matches are sent as they are
+    matches = []
+    targetPosition = 0
+    extraStart = 0
+    alignment = 0
+    while targetPosition + DELTA_SEED_LENGTH <= len(target):
+        seed = target[targetPosition:targetPosition + DELTA_SEED_LENGTH]
+
+        # Prefer the alignment of the previous match, the code after a change usually moved by the same amount
+        basePosition = targetPosition + alignment
+        if basePosition < 0 or base[basePosition:basePosition + DELTA_SEED_LENGTH] != seed:
+            basePosition = index.get(seed)
+        if basePosition is None:
+            targetPosition += 1
+            continue
+
+        # The index only has every few positions, the match may start a bit earlier
+        while targetPosition > extraStart and basePosition > 0 and target[targetPosition - 1] == base[basePosition - 1]:
+            targetPosition -= 1
+            basePosition -= 1
+
+        length = extend_match(base, target, basePosition, targetPosition)
+        matches.append((targetPosition, basePosition, length))
+        alignment = basePosition - targetPosition
+        targetPosition += length
+        extraStart = targetPosition
+
+    # Every command is a diff against the base followed by extra bytes, the first command only has extra bytes
+    patch = b""
+    previous = (0, 0, 0)
+    for targetPosition, basePosition, length in matches + [(len(target), None, 0)]:
+        diffStart, diffBase, diffLength = previous
+        extraStart = diffStart + diffLength
+        diff = bytes((target[diffStart + i] - base[diffBase + i]) & 0xFF for i in range(diffLength))
+        seek = basePosition - (diffBase + diffLength) if basePosition is not None else 0
+        patch += struct.pack(DELTA_COMMAND_FORMAT, diffLength, targetPosition - extraStart, seek) + diff + target[extraStart:targetPosition]
+        previous = (targetPosition, basePosition, length)
+
+    return patch
+
+
+def deflate(data):
+    # Raw deflate without zlib header, the window bits bound how far back references can reach
+    compressor = zlib.compressobj(9, zlib.DEFLATED, -args.window_bits, 9)
+    return compressor.compress(data) + compressor.flush()
+
+
+sections = [(SECTION_TYPE_SPIFFS, spiffsFlags, sector_hashes(spiffs), spiffs), (SECTION_TYPE_APP, 0, b"", app)]
+
+# The device refuses a delta that was not made against the image it runs, the full image is the fallback for that
+if args.base:
+    with open(args.base, "rb") as f:
+        base = f.read()
+
+    if struct.unpack_from("<I", base, APP_DESC_OFFSET)[0] != APP_DESC_MAGIC:
+        raise SystemExit("Base is not an app image: " + args.base)
+
+    patch = make_delta(base, app)
+    info = struct.pack(DELTA_INFO_FORMAT, base[APP_DESC_ELF_SHA256_OFFSET:APP_DESC_ELF_SHA256_OFFSET + 32], len(base), len(app))
+
+    # A patch is mostly zeros and only small once compressed, so compressed sizes are compared
+    print("App delta of {} bytes, {} bytes compressed against {} bytes for the full image".format(len(patch), len(deflate(patch)), len(deflate(app))))
+    if len(deflate(patch)) < len(deflate(app)):
+        sections[1] = (SECTION_TYPE_APP_DELTA, 0, info, patch)
+    else:
+        print("App delta is not smaller then the full image, using the full image")
+
+# The signature is over the manifest, which only has the length of the signature, so the signature section comes first
+# and the device checks it before anything is written
+if args.sign_key:
+    sections.insert(0, (SECTION_TYPE_SIGNATURE, 0, b"", b"\x00" * SIGNATURE_LENGTH))
+
+# The section info follows the section entries, the manifest is everything up to the first section
+entries = b""
+infos = b""
+infosOffset = struct.calcsize(PACKAGE_HEADER_FORMAT) + len(sections) * struct.calcsize(SECTION_FORMAT)
+for sectionType, flags, info, data in sections:
+    infoOffset = infosOffset + len(infos) if info else 0
+    infos += info
+    # The signature is not known yet, the device does not check its hash
+    sectionHash = hashlib.sha256(data).digest() if sectionType != SECTION_TYPE_SIGNATURE else b""
+    entries += struct.pack(SECTION_FORMAT, sectionType, flags, infoOffset, len(data), sectionHash)
+
+manifestLength = infosOffset + len(infos)
+manifest = struct.pack(PACKAGE_HEADER_FORMAT, PACKAGE_MAGIC, PACKAGE_VERSION, len(sections), manifestLength) + entries + infos
+
+if args.sign_key:
+    # Comes with the python environment of esp-idf
+    import ecdsa
+
+    with open(args.sign_key, "r") as f:
+        key = ecdsa.SigningKey.from_pem(f.read())
+
+    signature = b""
+    while len(signature) != SIGNATURE_LENGTH:
+        signature = key.sign(manifest, hashfunc=hashlib.sha256, sigencode=ecdsa.util.sigencode_der)
+    sections[0] = (SECTION_TYPE_SIGNATURE, 0, b"", signature)
+
+package = manifest + b"".join(data for _, _, _, data in sections)
+
+print("Packaged spiffs section of {} bytes and app section of {} bytes into {} bytes".format(len(spiffs), len(sections[-1][3]), len(package)))
+
+with open(args.out, "wb") as out:
+    if args.compress:
+        compressed = deflate(package)
+
+        out.write(struct.pack(COMPRESSED_HEADER_FORMAT, COMPRESSED_MAGIC, len(package), args.window_bits))
+        out.write(compressed)
+
+        print("Compressed update file from {} to {} bytes ({:.1f}%)".format(len(package), len(compressed), 100 * len(compressed) / len(package)))
+    else:
+        out.write(package)
\ No newline at end of file
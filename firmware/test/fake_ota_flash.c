@@ -0,0 +1,294 @@
+#include "fake_ota_flash.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_timer.h>
+
+#define NR_OF_PARTITIONS 4
+#define APP_HANDLE       1
+
+typedef struct fake_partition_s
+{
+    esp_partition_t partition;
+    uint8_t*        data;
+    bool            hidden;
+} fake_partition_t;
+
+static fake_partition_t partitions[NR_OF_PARTITIONS] = {
+    { .partition = { .type = ESP_PARTITION_TYPE_APP, .subtype = ESP_PARTITION_SUBTYPE_APP_OTA_0, .address = 0x10000, .size = 0x100000, .label = "ota_0" } },
+    { .partition = { .type = ESP_PARTITION_TYPE_DATA, .subtype = ESP_PARTITION_SUBTYPE_DATA_SPIFFS, .address = 0x110000, .size = 0xF0000, .label = "spiffs_0" } },
+    { .partition = { .type = ESP_PARTITION_TYPE_APP, .subtype = ESP_PARTITION_SUBTYPE_APP_OTA_1, .address = 0x200000, .size = 0x100000, .label = "ota_1" } },
+    { .partition = { .type = ESP_PARTITION_TYPE_DATA, .subtype = ESP_PARTITION_SUBTYPE_DATA_SPIFFS, .address = 0x300000, .size = 0xF0000, .label = "spiffs_1" } }
+};
+
+#define RUNNING_PARTITION (&partitions[0].partition)
+#define UPDATE_PARTITION  (&partitions[2].partition)
+
+static const esp_partition_t* bootPartition = RUNNING_PARTITION;
+static fake_ota_flash_stats_t stats;
+
+// The one app image that is being written
+static struct
+{
+    bool                   open;
+    const esp_partition_t* partition;
+    size_t                 length;
+} app;
+
+static void add_time(int64_t* time, int64_t start)
+{
+    *time += esp_timer_get_time() - start;
+}
+
+static fake_partition_t* find(const esp_partition_t* partition)
+{
+    for (size_t i = 0; i < NR_OF_PARTITIONS; ++i)
+    {
+        if (&partitions[i].partition == partition)
+        {
+            return &partitions[i];
+        }
+    }
+
+    abort();
+}
+
+static fake_partition_t* find_by_label(const char* label)
+{
+    for (size_t i = 0; i < NR_OF_PARTITIONS; ++i)
+    {
+        if (strcmp(partitions[i].partition.label, label) == 0)
+        {
+            return &partitions[i];
+        }
+    }
+
+    abort();
+}
+
+void fake_ota_flash_init(void)
+{
+    for (size_t i = 0; i < NR_OF_PARTITIONS; ++i)
+    {
+        if (partitions[i].data == NULL)
+        {
+            partitions[i].data = malloc(partitions[i].partition.size);
+        }
+        memset(partitions[i].data, 0xFF, partitions[i].partition.size);
+        partitions[i].hidden = false;
+    }
+
+    bootPartition = RUNNING_PARTITION;
+    app.open = false;
+    fake_ota_flash_clear_stats();
+}
+
+void fake_ota_flash_set(const char* label, const uint8_t* data, size_t length)
+{
+    fake_partition_t* fake = find_by_label(label);
+
+    if (length > fake->partition.size)
+    {
+        abort();
+    }
+
+    memset(fake->data, 0xFF, fake->partition.size);
+    if (data != NULL)
+    {
+        memcpy(fake->data, data, length);
+    }
+}
+
+const uint8_t* fake_ota_flash_get(const char* label)
+{
+    return find_by_label(label)->data;
+}
+
+fake_ota_flash_stats_t fake_ota_flash_get_stats(void)
+{
+    return stats;
+}
+
+void fake_ota_flash_hide(const char* label)
+{
+    find_by_label(label)->hidden = true;
+}
+
+void fake_ota_flash_clear_stats(void)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+const esp_partition_t* ota_flash_get_boot_partition(void)
+{
+    return bootPartition;
+}
+
+const esp_partition_t* ota_flash_get_running_partition(void)
+{
+    return RUNNING_PARTITION;
+}
+
+const esp_partition_t* ota_flash_get_next_update_partition(void)
+{
+    return find(UPDATE_PARTITION)->hidden ? NULL : UPDATE_PARTITION;
+}
+
+const esp_partition_t* ota_flash_find_spiffs_partition(const char* label)
+{
+    for (size_t i = 0; i < NR_OF_PARTITIONS; ++i)
+    {
+        if (!partitions[i].hidden && partitions[i].partition.subtype == ESP_PARTITION_SUBTYPE_DATA_SPIFFS && strcmp(partitions[i].partition.label, label) == 0)
+        {
+            return &partitions[i].partition;
+        }
+    }
+
+    return NULL;
+}
+
+const esp_app_desc_t* ota_flash_get_app_description(void)
+{
+    // Like esp-idf, the description of the image in the running partition
+    return (const esp_app_desc_t*)(find(RUNNING_PARTITION)->data + sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t));
+}
+
+esp_err_t ota_flash_erase(const esp_partition_t* partition, size_t offset, size_t length, ota_flash_timing_t* timing)
+{
+    const int64_t start = esp_timer_get_time();
+    fake_partition_t* fake = find(partition);
+
+    if (offset % SPI_FLASH_SEC_SIZE != 0 || length % SPI_FLASH_SEC_SIZE != 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (offset + length > partition->size)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    memset(fake->data + offset, 0xFF, length);
+    stats.nr_of_erased_sectors += length / SPI_FLASH_SEC_SIZE;
+
+    if (timing)
+    {
+        add_time(&timing->erase_time, start);
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t ota_flash_write(const esp_partition_t* partition, size_t offset, const void* data, size_t length, ota_flash_timing_t* timing)
+{
+    const int64_t start = esp_timer_get_time();
+    fake_partition_t* fake = find(partition);
+    const uint8_t* bytes = data;
+
+    if (offset + length > partition->size)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    bool bad = false;
+    for (size_t i = 0; i < length; ++i)
+    {
+        // Writing can only clear bits
+        bad |= (fake->data[offset + i] & bytes[i]) != bytes[i];
+        fake->data[offset + i] &= bytes[i];
+    }
+
+    stats.nr_of_written_bytes += length;
+    stats.nr_of_bad_writes += bad;
+
+    if (timing)
+    {
+        add_time(&timing->write_time, start);
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t ota_flash_read(const esp_partition_t* partition, size_t offset, void* data, size_t length)
+{
+    fake_partition_t* fake = find(partition);
+
+    if (offset + length > partition->size)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    memcpy(data, fake->data + offset, length);
+    return ESP_OK;
+}
+
+esp_err_t ota_flash_app_begin(const esp_partition_t* partition, size_t imageLength, esp_ota_handle_t* appHandle, ota_flash_timing_t* timing)
+{
+    if (app.open || partition == RUNNING_PARTITION || partition->type != ESP_PARTITION_TYPE_APP)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (imageLength > partition->size)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Like esp_ota_begin with a known image size, only the sectors of the image are erased
+    const size_t eraseLength = (imageLength + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
+    esp_err_t err = ota_flash_erase(partition, 0, eraseLength, timing);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    app.open = true;
+    app.partition = partition;
+    app.length = 0;
+    *appHandle = APP_HANDLE;
+    return ESP_OK;
+}
+
+esp_err_t ota_flash_app_write(esp_ota_handle_t appHandle, const void* data, size_t length, ota_flash_timing_t* timing)
+{
+    if (!app.open || appHandle != APP_HANDLE)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = ota_flash_write(app.partition, app.length, data, length, timing);
+    if (err == ESP_OK)
+    {
+        app.length += length;
+    }
+
+    return err;
+}
+
+esp_err_t ota_flash_app_end(esp_ota_handle_t appHandle)
+{
+    if (!app.open || appHandle != APP_HANDLE)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    app.open = false;
+
+    // esp_ota_end verifies the whole image, the fake only checks it has a header
+    if (app.length < sizeof(esp_image_header_t) || find(app.partition)->data[0] != ESP_IMAGE_HEADER_MAGIC)
+    {
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t ota_flash_set_boot_partition(const esp_partition_t* partition)
+{
+    if (partition->type != ESP_PARTITION_TYPE_APP)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    bootPartition = partition;
+    return ESP_OK;
+}
\ No newline at end of file
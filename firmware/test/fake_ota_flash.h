@@ -0,0 +1,51 @@
+#ifndef FAKE_OTA_FLASH_H
+#define FAKE_OTA_FLASH_H
+
+// ota_flash over partitions in memory, with the partition table of partitions.csv. The app in ota_0 is running
+// and the next update goes to ota_1. Flash behaves like NOR flash: writing only clears bits, so writing
+// to a range that was not erased is counted as a bad write instead of silently giving the right bytes.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <services/ota_flash.h>
+
+typedef struct fake_ota_flash_stats_s
+{
+    size_t nr_of_erased_sectors;
+    size_t nr_of_written_bytes;
+    size_t nr_of_bad_writes;
+} fake_ota_flash_stats_t;
+
+/**
+ * @brief Erases all partitions, makes ota_0 the boot partition and clears the stats.
+ */
+void fake_ota_flash_init(void);
+
+/**
+ * @brief Sets the contents of a partition, the rest of it is erased. Does not count in the stats.
+ *
+ * @param[in] label The label of the partition, like "spiffs_1".
+ * @param[in] data The contents, may be NULL to only erase the partition.
+ * @param[in] length The length of data, at most the size of the partition.
+ */
+void fake_ota_flash_set(const char* label, const uint8_t* data, size_t length);
+
+/**
+ * @brief Gets the contents of a partition, the length is the size of the partition.
+ */
+const uint8_t* fake_ota_flash_get(const char* label);
+
+/**
+ * @brief Gets the erases and writes since the flash was initialized or the stats were cleared.
+ */
+fake_ota_flash_stats_t fake_ota_flash_get_stats(void);
+
+/**
+ * @brief Hides a partition from the partition lookups, like a partition table without it. Undone by fake_ota_flash_init.
+ */
+void fake_ota_flash_hide(const char* label);
+
+void fake_ota_flash_clear_stats(void);
+
+#endif // FAKE_OTA_FLASH_H
\ No newline at end of file
@@ -0,0 +1,216 @@
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct host_queue_s
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t  changed;
+    UBaseType_t     length;
+    UBaseType_t     item_size;
+    UBaseType_t     count;
+    UBaseType_t     head;
+    uint8_t         items[];
+};
+
+typedef struct host_task_start_s
+{
+    TaskFunction_t function;
+    void*          parameters;
+} host_task_start_t;
+
+static void* host_task_main(void* arg)
+{
+    host_task_start_t start = *(host_task_start_t*)arg;
+    free(arg);
+
+    start.function(start.parameters);
+
+    // FreeRTOS tasks never return, they delete themselves
+    abort();
+}
+
+BaseType_t xTaskCreatePinnedToCore(
+    TaskFunction_t function,
+    const char* name,
+    uint32_t stackDepth,
+    void* parameters,
+    UBaseType_t priority,
+    TaskHandle_t* createdTask,
+    BaseType_t coreId)
+{
+    host_task_start_t* start = malloc(sizeof(*start));
+    if (start == NULL)
+    {
+        return pdFAIL;
+    }
+    start->function = function;
+    start->parameters = parameters;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, host_task_main, start) != 0)
+    {
+        free(start);
+        return pdFAIL;
+    }
+    pthread_detach(thread);
+
+    if (createdTask != NULL)
+    {
+        *createdTask = (TaskHandle_t)start;
+    }
+
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task != NULL)
+    {
+        // Deleting another task is not supported
+        abort();
+    }
+
+    pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    usleep((useconds_t)ticks * 1000);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (TickType_t)(now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+    QueueHandle_t queue = malloc(sizeof(*queue) + length * itemSize);
+    if (queue == NULL)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+    queue->length = length;
+    queue->item_size = itemSize;
+    queue->count = 0;
+    queue->head = 0;
+
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    pthread_cond_destroy(&queue->changed);
+    pthread_mutex_destroy(&queue->mutex);
+    free(queue);
+}
+
+// Waits until the condition holds, the queue mutex must be held. Returns false on a timeout.
+static bool host_queue_wait(QueueHandle_t queue, bool (*condition)(QueueHandle_t queue), TickType_t ticksToWait)
+{
+    struct timespec deadline;
+    if (ticksToWait != portMAX_DELAY)
+    {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += ticksToWait / 1000;
+        deadline.tv_nsec += (long)(ticksToWait % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    while (!condition(queue))
+    {
+        if (ticksToWait == 0)
+        {
+            return false;
+        }
+
+        if (ticksToWait == portMAX_DELAY)
+        {
+            pthread_cond_wait(&queue->changed, &queue->mutex);
+        }
+        else if (pthread_cond_timedwait(&queue->changed, &queue->mutex, &deadline) == ETIMEDOUT)
+        {
+            return condition(queue);
+        }
+    }
+
+    return true;
+}
+
+static bool host_queue_has_room(QueueHandle_t queue)
+{
+    return queue->count < queue->length;
+}
+
+static bool host_queue_has_items(QueueHandle_t queue)
+{
+    return queue->count > 0;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticksToWait)
+{
+    pthread_mutex_lock(&queue->mutex);
+
+    if (!host_queue_wait(queue, host_queue_has_room, ticksToWait))
+    {
+        pthread_mutex_unlock(&queue->mutex);
+        return pdFALSE;
+    }
+
+    const UBaseType_t tail = (queue->head + queue->count) % queue->length;
+    if (queue->item_size > 0)
+    {
+        memcpy(queue->items + tail * queue->item_size, item, queue->item_size);
+    }
+    queue->count++;
+
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticksToWait)
+{
+    pthread_mutex_lock(&queue->mutex);
+
+    if (!host_queue_wait(queue, host_queue_has_items, ticksToWait))
+    {
+        pthread_mutex_unlock(&queue->mutex);
+        return pdFALSE;
+    }
+
+    if (queue->item_size > 0)
+    {
+        memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+    }
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    const UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->mutex);
+    return count;
+}
\ No newline at end of file
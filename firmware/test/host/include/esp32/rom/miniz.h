@@ -0,0 +1,56 @@
+#ifndef HOST_MINIZ_H
+#define HOST_MINIZ_H
+
+// The tinfl part of the miniz in the esp32 rom, on top of zlib. zlib keeps its own window, so unlike tinfl
+// the output buffer is only written to and not read back, which gives the same output for the same calls.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zlib.h>
+
+typedef uint8_t mz_uint8;
+typedef uint32_t mz_uint32;
+
+enum
+{
+    TINFL_FLAG_PARSE_ZLIB_HEADER = 1,
+    TINFL_FLAG_HAS_MORE_INPUT = 2,
+    TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF = 4,
+    TINFL_FLAG_COMPUTE_ADLER32 = 8
+};
+
+typedef enum
+{
+    TINFL_STATUS_BAD_PARAM = -3,
+    TINFL_STATUS_ADLER32_MISMATCH = -2,
+    TINFL_STATUS_FAILED = -1,
+    TINFL_STATUS_DONE = 0,
+    TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+    TINFL_STATUS_HAS_MORE_OUTPUT = 2
+} tinfl_status;
+
+// zlib allocates its state and window from the decompressor, so freeing the decompressor frees everything like with tinfl
+#define HOST_TINFL_ARENA_SIZE (48 * 1024)
+
+typedef struct
+{
+    z_stream stream;
+    int      initialized;
+    size_t   arena_used;
+    uint8_t  arena[HOST_TINFL_ARENA_SIZE] __attribute__((aligned(16)));
+} tinfl_decompressor;
+
+// The stream is set up by the first tinfl_decompress call
+#define tinfl_init(r) do { (r)->initialized = 0; (r)->arena_used = 0; } while (0)
+
+tinfl_status tinfl_decompress(
+    tinfl_decompressor* r,
+    const mz_uint8* pIn_buf_next,
+    size_t* pIn_buf_size,
+    mz_uint8* pOut_buf_start,
+    mz_uint8* pOut_buf_next,
+    size_t* pOut_buf_size,
+    const mz_uint32 decomp_flags);
+
+#endif // HOST_MINIZ_H
\ No newline at end of file
@@ -0,0 +1,54 @@
+#ifndef HOST_ESP_OTA_OPS_H
+#define HOST_ESP_OTA_OPS_H
+
+// The app image types of esp-idf 4, with the same layout so app images made for the chip can be used.
+
+#include <stdint.h>
+
+#include <esp_err.h>
+#include <esp_partition.h>
+
+#define ESP_IMAGE_HEADER_MAGIC 0xE9
+
+typedef uint32_t esp_ota_handle_t;
+
+typedef struct
+{
+    uint8_t  magic;
+    uint8_t  segment_count;
+    uint8_t  spi_mode;
+    uint8_t  spi_speed: 4;
+    uint8_t  spi_size: 4;
+    uint32_t entry_addr;
+    uint8_t  wp_pin;
+    uint8_t  spi_pin_drv[3];
+    uint16_t chip_id;
+    uint8_t  min_chip_rev;
+    uint8_t  reserved[8];
+    uint8_t  hash_appended;
+} __attribute__((packed)) esp_image_header_t;
+
+typedef struct
+{
+    uint32_t load_addr;
+    uint32_t data_len;
+} esp_image_segment_header_t;
+
+typedef struct
+{
+    uint32_t magic_word;
+    uint32_t secure_version;
+    uint32_t reserv1[2];
+    char     version[32];
+    char     project_name[32];
+    char     time[16];
+    char     date[16];
+    char     idf_ver[32];
+    uint8_t  app_elf_sha256[32];
+    uint32_t reserv2[20];
+} esp_app_desc_t;
+
+_Static_assert(sizeof(esp_image_header_t) == 24, "esp_image_header_t does not match esp-idf");
+_Static_assert(sizeof(esp_app_desc_t) == 256, "esp_app_desc_t does not match esp-idf");
+
+#endif // HOST_ESP_OTA_OPS_H
\ No newline at end of file
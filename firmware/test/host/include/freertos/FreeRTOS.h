@@ -0,0 +1,38 @@
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+// Just enough FreeRTOS on top of pthreads to run the firmware services that use tasks, queues and semaphores on the host.
+// A tick is a millisecond.
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <pthread.h>
+
+#include <sdkconfig.h>
+
+typedef int          BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t     TickType_t;
+typedef uint8_t      portSTACK_TYPE;
+
+#define pdFALSE 0
+#define pdTRUE  1
+#define pdPASS  pdTRUE
+#define pdFAIL  pdFALSE
+
+#define portMAX_DELAY      ((TickType_t)0xFFFFFFFF)
+#define configTICK_RATE_HZ 1000
+#define pdMS_TO_TICKS(ms)  ((TickType_t)(ms))
+
+#define portNUM_PROCESSORS 2
+#define PRO_CPU_NUM        0
+#define APP_CPU_NUM        1
+#define tskIDLE_PRIORITY   0
+
+typedef pthread_mutex_t portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED PTHREAD_MUTEX_INITIALIZER
+#define portENTER_CRITICAL(mux)      pthread_mutex_lock(mux)
+#define portEXIT_CRITICAL(mux)       pthread_mutex_unlock(mux)
+
+#endif // HOST_FREERTOS_H
\ No newline at end of file
@@ -0,0 +1,16 @@
+#ifndef HOST_FREERTOS_QUEUE_H
+#define HOST_FREERTOS_QUEUE_H
+
+#include "FreeRTOS.h"
+
+typedef struct host_queue_s* QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize);
+void          vQueueDelete(QueueHandle_t queue);
+BaseType_t    xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticksToWait);
+BaseType_t    xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticksToWait);
+UBaseType_t   uxQueueMessagesWaiting(QueueHandle_t queue);
+
+#define xQueueSendToBack xQueueSend
+
+#endif // HOST_FREERTOS_QUEUE_H
\ No newline at end of file
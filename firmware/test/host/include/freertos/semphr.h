@@ -0,0 +1,14 @@
+#ifndef HOST_FREERTOS_SEMPHR_H
+#define HOST_FREERTOS_SEMPHR_H
+
+#include "queue.h"
+
+// A binary semaphore is a queue of one item without data, like it is in FreeRTOS
+typedef QueueHandle_t SemaphoreHandle_t;
+
+#define xSemaphoreCreateBinary()               xQueueCreate(1, 0)
+#define vSemaphoreDelete(semaphore)            vQueueDelete(semaphore)
+#define xSemaphoreTake(semaphore, ticksToWait) xQueueReceive(semaphore, NULL, ticksToWait)
+#define xSemaphoreGive(semaphore)              xQueueSend(semaphore, NULL, 0)
+
+#endif // HOST_FREERTOS_SEMPHR_H
\ No newline at end of file
@@ -0,0 +1,26 @@
+#ifndef HOST_FREERTOS_TASK_H
+#define HOST_FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void* parameters);
+typedef struct host_task_s* TaskHandle_t;
+
+// Every task is a detached thread, the priority, stack size and core are ignored
+BaseType_t xTaskCreatePinnedToCore(
+    TaskFunction_t function,
+    const char* name,
+    uint32_t stackDepth,
+    void* parameters,
+    UBaseType_t priority,
+    TaskHandle_t* createdTask,
+    BaseType_t coreId);
+
+// Only a task deleting itself is supported
+void vTaskDelete(TaskHandle_t task);
+
+void vTaskDelay(TickType_t ticks);
+
+TickType_t xTaskGetTickCount(void);
+
+#endif // HOST_FREERTOS_TASK_H
\ No newline at end of file
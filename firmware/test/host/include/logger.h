@@ -0,0 +1,26 @@
+#ifndef HOST_LOGGER_H
+#define HOST_LOGGER_H
+
+// Log lines go to stderr, only the ones at or above host_log_level
+
+typedef enum
+{
+    HOST_LOG_LEVEL_NONE,
+    HOST_LOG_LEVEL_ERROR,
+    HOST_LOG_LEVEL_WARN,
+    HOST_LOG_LEVEL_INFO,
+    HOST_LOG_LEVEL_DEBUG,
+    HOST_LOG_LEVEL_VERBOSE
+} host_log_level_t;
+
+extern host_log_level_t host_log_level;
+
+void host_log(host_log_level_t level, const char* tag, const char* format, ...) __attribute__((format(printf, 3, 4)));
+
+#define LOG_E(tag, ...) host_log(HOST_LOG_LEVEL_ERROR, tag, __VA_ARGS__)
+#define LOG_W(tag, ...) host_log(HOST_LOG_LEVEL_WARN, tag, __VA_ARGS__)
+#define LOG_I(tag, ...) host_log(HOST_LOG_LEVEL_INFO, tag, __VA_ARGS__)
+#define LOG_D(tag, ...) host_log(HOST_LOG_LEVEL_DEBUG, tag, __VA_ARGS__)
+#define LOG_V(tag, ...) host_log(HOST_LOG_LEVEL_VERBOSE, tag, __VA_ARGS__)
+
+#endif // HOST_LOGGER_H
\ No newline at end of file
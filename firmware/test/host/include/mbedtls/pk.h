@@ -0,0 +1,32 @@
+#ifndef HOST_MBEDTLS_PK_H
+#define HOST_MBEDTLS_PK_H
+
+// The public key functions of mbedtls 2 the signature check uses, with OpenSSL behind them. Only the builds that
+// define CONFIG_OTA_SIGNATURE_VERIFY link them.
+
+#include <stddef.h>
+
+#define MBEDTLS_ERR_PK_BAD_INPUT_DATA      -0x3E80
+#define MBEDTLS_ERR_PK_KEY_INVALID_FORMAT  -0x3D00
+#define MBEDTLS_ERR_ECP_VERIFY_FAILED      -0x4E00
+
+typedef enum
+{
+    MBEDTLS_MD_NONE = 0,
+    MBEDTLS_MD_SHA256 = 6
+} mbedtls_md_type_t;
+
+typedef struct
+{
+    // The EVP_PKEY, kept opaque so the firmware does not see the OpenSSL headers
+    void* key;
+} mbedtls_pk_context;
+
+void mbedtls_pk_init(mbedtls_pk_context* context);
+void mbedtls_pk_free(mbedtls_pk_context* context);
+// A PEM key must be null terminated, with the terminator counted in length
+int  mbedtls_pk_parse_public_key(mbedtls_pk_context* context, const unsigned char* key, size_t length);
+// Only sha256 hashes are supported
+int  mbedtls_pk_verify(mbedtls_pk_context* context, mbedtls_md_type_t mdAlg, const unsigned char* hash, size_t hashLength, const unsigned char* signature, size_t signatureLength);
+
+#endif // HOST_MBEDTLS_PK_H
\ No newline at end of file
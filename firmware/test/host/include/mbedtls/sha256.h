@@ -0,0 +1,25 @@
+#ifndef HOST_MBEDTLS_SHA256_H
+#define HOST_MBEDTLS_SHA256_H
+
+// The sha256 functions of mbedtls 2 the firmware uses, with a plain C implementation behind them
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct
+{
+    uint32_t      state[8];
+    uint64_t      length;
+    unsigned char buffer[64];
+    size_t        buffer_length;
+} mbedtls_sha256_context;
+
+void mbedtls_sha256_init(mbedtls_sha256_context* context);
+void mbedtls_sha256_free(mbedtls_sha256_context* context);
+// Only sha256 is supported, is224 must be 0
+int  mbedtls_sha256_starts_ret(mbedtls_sha256_context* context, int is224);
+int  mbedtls_sha256_update_ret(mbedtls_sha256_context* context, const unsigned char* input, size_t length);
+int  mbedtls_sha256_finish_ret(mbedtls_sha256_context* context, unsigned char output[32]);
+int  mbedtls_sha256_ret(const unsigned char* input, size_t length, unsigned char output[32], int is224);
+
+#endif // HOST_MBEDTLS_SHA256_H
\ No newline at end of file
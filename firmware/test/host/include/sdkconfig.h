@@ -0,0 +1,7 @@
+#ifndef HOST_SDKCONFIG_H
+#define HOST_SDKCONFIG_H
+
+// The configuration the host builds use. CONFIG_OTA_SIGNATURE_VERIFY is set by the builds that check signatures,
+// see CMakeLists.txt.
+
+#endif // HOST_SDKCONFIG_H
\ No newline at end of file
@@ -0,0 +1,84 @@
+#include <esp32/rom/miniz.h>
+
+#include <string.h>
+
+static voidpf arena_alloc(voidpf opaque, uInt items, uInt size)
+{
+    tinfl_decompressor* r = opaque;
+    const size_t length = ((size_t)items * size + 15) & ~(size_t)15;
+
+    if (r->arena_used + length > sizeof(r->arena))
+    {
+        return Z_NULL;
+    }
+
+    voidpf memory = r->arena + r->arena_used;
+    r->arena_used += length;
+    return memory;
+}
+
+static void arena_free(voidpf opaque, voidpf address)
+{
+    // Everything is freed along with the decompressor
+}
+
+tinfl_status tinfl_decompress(
+    tinfl_decompressor* r,
+    const mz_uint8* pIn_buf_next,
+    size_t* pIn_buf_size,
+    mz_uint8* pOut_buf_start,
+    mz_uint8* pOut_buf_next,
+    size_t* pOut_buf_size,
+    const mz_uint32 decomp_flags)
+{
+    if (decomp_flags & (TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_COMPUTE_ADLER32))
+    {
+        // The firmware only inflates raw deflate streams
+        *pIn_buf_size = 0;
+        *pOut_buf_size = 0;
+        return TINFL_STATUS_BAD_PARAM;
+    }
+
+    if (!r->initialized)
+    {
+        memset(&r->stream, 0, sizeof(r->stream));
+        r->stream.zalloc = arena_alloc;
+        r->stream.zfree = arena_free;
+        r->stream.opaque = r;
+        r->arena_used = 0;
+        if (inflateInit2(&r->stream, -MAX_WBITS) != Z_OK)
+        {
+            *pIn_buf_size = 0;
+            *pOut_buf_size = 0;
+            return TINFL_STATUS_FAILED;
+        }
+        r->initialized = 1;
+    }
+
+    r->stream.next_in = (Bytef*)pIn_buf_next;
+    r->stream.avail_in = (uInt)*pIn_buf_size;
+    r->stream.next_out = pOut_buf_next;
+    r->stream.avail_out = (uInt)*pOut_buf_size;
+
+    const int result = inflate(&r->stream, Z_NO_FLUSH);
+
+    *pIn_buf_size -= r->stream.avail_in;
+    *pOut_buf_size -= r->stream.avail_out;
+
+    if (result == Z_STREAM_END)
+    {
+        return TINFL_STATUS_DONE;
+    }
+
+    if (result != Z_OK && result != Z_BUF_ERROR)
+    {
+        return TINFL_STATUS_FAILED;
+    }
+
+    if (r->stream.avail_out == 0)
+    {
+        return TINFL_STATUS_HAS_MORE_OUTPUT;
+    }
+
+    return (decomp_flags & TINFL_FLAG_HAS_MORE_INPUT) ? TINFL_STATUS_NEEDS_MORE_INPUT : TINFL_STATUS_FAILED;
+}
\ No newline at end of file
@@ -0,0 +1,16 @@
+// The public key the signature check verifies with. The firmware build embeds it with target_add_binary_data, which
+// adds a null terminator and names the symbols after the file, this does the same with the test key.
+
+#ifndef OTA_PUBLIC_KEY_PEM
+#error OTA_PUBLIC_KEY_PEM must be the path of the PEM encoded public key
+#endif
+
+__asm__(
+    ".section .rodata\n"
+    ".global _binary_ota_public_key_pem_start\n"
+    ".global _binary_ota_public_key_pem_end\n"
+    "_binary_ota_public_key_pem_start:\n"
+    ".incbin \"" OTA_PUBLIC_KEY_PEM "\"\n"
+    ".byte 0\n"
+    "_binary_ota_public_key_pem_end:\n"
+    ".previous\n");
\ No newline at end of file
@@ -0,0 +1,57 @@
+#include <mbedtls/pk.h>
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+
+void mbedtls_pk_init(mbedtls_pk_context* context)
+{
+    context->key = NULL;
+}
+
+void mbedtls_pk_free(mbedtls_pk_context* context)
+{
+    EVP_PKEY_free(context->key);
+    context->key = NULL;
+}
+
+int mbedtls_pk_parse_public_key(mbedtls_pk_context* context, const unsigned char* key, size_t length)
+{
+    if (length == 0 || key[length - 1] != '\0')
+    {
+        return MBEDTLS_ERR_PK_KEY_INVALID_FORMAT;
+    }
+
+    BIO* bio = BIO_new_mem_buf(key, (int)(length - 1));
+    if (bio == NULL)
+    {
+        return MBEDTLS_ERR_PK_BAD_INPUT_DATA;
+    }
+
+    context->key = PEM_read_bio_PUBKEY(bio, NULL, NULL, NULL);
+    BIO_free(bio);
+
+    return context->key != NULL ? 0 : MBEDTLS_ERR_PK_KEY_INVALID_FORMAT;
+}
+
+int mbedtls_pk_verify(mbedtls_pk_context* context, mbedtls_md_type_t mdAlg, const unsigned char* hash, size_t hashLength, const unsigned char* signature, size_t signatureLength)
+{
+    if (context->key == NULL || mdAlg != MBEDTLS_MD_SHA256 || hashLength != 32)
+    {
+        return MBEDTLS_ERR_PK_BAD_INPUT_DATA;
+    }
+
+    EVP_PKEY_CTX* verifyContext = EVP_PKEY_CTX_new(context->key, NULL);
+    if (verifyContext == NULL)
+    {
+        return MBEDTLS_ERR_PK_BAD_INPUT_DATA;
+    }
+
+    int result = MBEDTLS_ERR_PK_BAD_INPUT_DATA;
+    if (EVP_PKEY_verify_init(verifyContext) == 1 && EVP_PKEY_CTX_set_signature_md(verifyContext, EVP_sha256()) == 1)
+    {
+        result = EVP_PKEY_verify(verifyContext, signature, signatureLength, hash, hashLength) == 1 ? 0 : MBEDTLS_ERR_ECP_VERIFY_FAILED;
+    }
+
+    EVP_PKEY_CTX_free(verifyContext);
+    return result;
+}
\ No newline at end of file
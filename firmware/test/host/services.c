@@ -0,0 +1,32 @@
+// The services the ota service uses besides flash. Metrics are not collected on the host,
+// and the spiffs partition of an app partition follows from the partition table the fake flash has.
+
+#include <services/metrics_service.h>
+#include <services/spiffs_service.h>
+
+#include <string.h>
+
+void metrics_service_register(metric_t* metric)
+{
+}
+
+void metrics_service_unregister(metric_t* metric)
+{
+}
+
+void metrics_counter_add(metric_counter_t* counter, uint32_t value)
+{
+}
+
+void metrics_gauge_set(metric_gauge_t* gauge, int32_t value)
+{
+}
+
+void metrics_histogram_observe(metric_histogram_t* histogram, uint32_t value)
+{
+}
+
+const char* spiffs_service_get_spiffs_partition_label_for_app_partition(const char* appPartitionLabel)
+{
+    return strcmp(appPartitionLabel, "ota_0") == 0 ? "spiffs_0" : "spiffs_1";
+}
\ No newline at end of file
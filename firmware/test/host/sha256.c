@@ -0,0 +1,160 @@
+#include <mbedtls/sha256.h>
+
+#include <string.h>
+
+static const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t rotr(uint32_t x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+static void sha256_block(mbedtls_sha256_context* context, const unsigned char block[64])
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i)
+    {
+        w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 | (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; ++i)
+    {
+        const uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        const uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = context->state[0], b = context->state[1], c = context->state[2], d = context->state[3];
+    uint32_t e = context->state[4], f = context->state[5], g = context->state[6], h = context->state[7];
+
+    for (int i = 0; i < 64; ++i)
+    {
+        const uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+        const uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    context->state[0] += a;
+    context->state[1] += b;
+    context->state[2] += c;
+    context->state[3] += d;
+    context->state[4] += e;
+    context->state[5] += f;
+    context->state[6] += g;
+    context->state[7] += h;
+}
+
+void mbedtls_sha256_init(mbedtls_sha256_context* context)
+{
+    memset(context, 0, sizeof(*context));
+}
+
+void mbedtls_sha256_free(mbedtls_sha256_context* context)
+{
+    memset(context, 0, sizeof(*context));
+}
+
+int mbedtls_sha256_starts_ret(mbedtls_sha256_context* context, int is224)
+{
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    if (is224)
+    {
+        return -1;
+    }
+
+    memcpy(context->state, initial, sizeof(initial));
+    context->length = 0;
+    context->buffer_length = 0;
+    return 0;
+}
+
+int mbedtls_sha256_update_ret(mbedtls_sha256_context* context, const unsigned char* input, size_t length)
+{
+    context->length += length;
+
+    while (length > 0)
+    {
+        if (context->buffer_length == 0 && length >= 64)
+        {
+            sha256_block(context, input);
+            input += 64;
+            length -= 64;
+            continue;
+        }
+
+        size_t n = 64 - context->buffer_length;
+        n = n < length ? n : length;
+        memcpy(context->buffer + context->buffer_length, input, n);
+        context->buffer_length += n;
+        input += n;
+        length -= n;
+
+        if (context->buffer_length == 64)
+        {
+            sha256_block(context, context->buffer);
+            context->buffer_length = 0;
+        }
+    }
+
+    return 0;
+}
+
+int mbedtls_sha256_finish_ret(mbedtls_sha256_context* context, unsigned char output[32])
+{
+    const uint64_t bits = context->length * 8;
+    static const unsigned char padding[64] = { 0x80 };
+
+    const size_t padLength = context->buffer_length < 56 ? 56 - context->buffer_length : 120 - context->buffer_length;
+    mbedtls_sha256_update_ret(context, padding, padLength);
+
+    unsigned char lengthBytes[8];
+    for (int i = 0; i < 8; ++i)
+    {
+        lengthBytes[i] = (unsigned char)(bits >> (56 - i * 8));
+    }
+    mbedtls_sha256_update_ret(context, lengthBytes, sizeof(lengthBytes));
+
+    for (int i = 0; i < 8; ++i)
+    {
+        output[i * 4] = (unsigned char)(context->state[i] >> 24);
+        output[i * 4 + 1] = (unsigned char)(context->state[i] >> 16);
+        output[i * 4 + 2] = (unsigned char)(context->state[i] >> 8);
+        output[i * 4 + 3] = (unsigned char)context->state[i];
+    }
+
+    return 0;
+}
+
+int mbedtls_sha256_ret(const unsigned char* input, size_t length, unsigned char output[32], int is224)
+{
+    mbedtls_sha256_context context;
+    mbedtls_sha256_init(&context);
+
+    int err = mbedtls_sha256_starts_ret(&context, is224);
+    if (err == 0)
+    {
+        mbedtls_sha256_update_ret(&context, input, length);
+        mbedtls_sha256_finish_ret(&context, output);
+    }
+
+    mbedtls_sha256_free(&context);
+    return err;
+}
\ No newline at end of file
@@ -0,0 +1,155 @@
+import argparse
+import os
+import random
+import struct
+import subprocess
+import sys
+
+# Makes the app and spiffs images for the host tests of the ota service, and packages them with package_ota.py
+# like a release would. The images only need the parts the ota service and package_ota.py look at.
+
+SPIFFS_PARTITION_SIZE = 0xF0000
+SECTOR_SIZE = 4096
+APP_DESC_MAGIC = 0xABCD5432
+ASSET_PACK_MAGIC = 0x4B415754  # "TWAK"
+
+parser = argparse.ArgumentParser(description="Makes the update packages for the host tests of the ota service.")
+parser.add_argument("out", help="Output directory")
+parser.add_argument("--sign", action="store_true", help="Also make a test key, signed packages and signed_cases.txt, needs the ecdsa module")
+args = parser.parse_args()
+
+packager = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "package_ota.py")
+rng = random.Random(20)
+
+# Code repeats itself a lot, but not exactly, so it compresses about like a real image
+WORDS = [rng.randbytes(rng.randint(2, 12)) for _ in range(300)]
+
+
+def code(length):
+    data = bytearray()
+    while len(data) < length:
+        data += rng.choice(WORDS) if rng.random() < 0.8 else rng.randbytes(rng.randint(1, 8))
+    return bytes(data[:length])
+
+
+def app_image(version, elfSha256, body):
+    header = struct.pack("<BBBBIB3sHB8sB", 0xE9, 1, 2, 0x20, 0x40080000, 0xEE, b"\x00" * 3, 0, 0, b"\x00" * 8, 1)
+    segment = struct.pack("<II", 0x3F400020, 256 + len(body))
+    desc = struct.pack("<II8x32s32s16s16s32s32s80x", APP_DESC_MAGIC, 0, version, b"tv-lift", b"12:00:00", b"Oct 19 2026", b"v4.4", elfSha256)
+    return header + segment + desc + body
+
+
+def edit(data):
+    # What a small change of the firmware does to the image: some code changes, some moves and everything after it shifts
+    data = bytearray(data)
+    for _ in range(20):
+        position = rng.randrange(len(data))
+        data[position:position + rng.randint(1, 64)] = code(rng.randint(0, 96))
+    for _ in range(5):
+        position = rng.randrange(len(data))
+        data[position] ^= 0x5A
+    return bytes(data)
+
+
+def spiffs_image(contentLength):
+    # Files with some erased flash between them, padded with erased flash to the partition size
+    data = bytearray()
+    while len(data) < contentLength:
+        data += code(rng.randint(100, 20000))
+        data += b"\xff" * rng.choice([0, 0, 3, 100, SECTOR_SIZE])
+    data = data[:contentLength].rstrip(b"\xff")
+    return bytes(data).ljust(SPIFFS_PARTITION_SIZE, b"\xff")
+
+
+def change_sectors(image, nrOfSectors):
+    data = bytearray(image)
+    for _ in range(nrOfSectors):
+        position = rng.randrange(len(image.rstrip(b"\xff")))
+        data[position:position + 50] = code(50)
+    return bytes(data)
+
+
+def write(name, data):
+    with open(os.path.join(args.out, name), "wb") as f:
+        f.write(data)
+
+
+def package(name, spiffs, app, *options):
+    subprocess.run([sys.executable, packager, os.path.join(args.out, spiffs), os.path.join(args.out, app), os.path.join(args.out, name)] + list(options),
+                   check=True, stdout=subprocess.DEVNULL)
+
+
+os.makedirs(args.out, exist_ok=True)
+
+baseBody = code(300000)
+write("base.bin", app_image(b"1.0.0", rng.randbytes(32), baseBody))
+write("target.bin", app_image(b"1.1.0", rng.randbytes(32), edit(baseBody)))
+# Built from the same code as the base, but a delta against it does not apply to the base
+write("other_base.bin", app_image(b"1.0.1", rng.randbytes(32), baseBody))
+
+# The lengths put the end of the spiffs section, and so the start of the app section, at different places in the buffers
+spiffs = spiffs_image(400000 + 1)
+write("spiffs.bin", spiffs)
+write("spiffs_old.bin", change_sectors(spiffs, 10))
+write("spiffs_small.bin", spiffs_image(70000 + 2))
+
+# An asset pack knows its own length, what follows it in the image is not sent
+assets = code(150000 + 3)
+assetPack = struct.pack("<IHHI", ASSET_PACK_MAGIC, 1, 0, 12 + len(assets)) + assets
+write("assets.bin", assetPack + b"\xff" * 1000)
+
+package("plain.bin", "spiffs.bin", "target.bin")
+package("compressed.bin", "spiffs.bin", "target.bin", "--compress")
+package("delta.bin", "spiffs_small.bin", "target.bin", "--base", os.path.join(args.out, "base.bin"))
+package("delta_compressed.bin", "spiffs.bin", "target.bin", "--base", os.path.join(args.out, "base.bin"), "--compress", "--window-bits", "15")
+package("assets_compressed.bin", "assets.bin", "target.bin", "--compress", "--window-bits", "9")
+package("delta_other_base.bin", "spiffs.bin", "target.bin", "--base", os.path.join(args.out, "other_base.bin"))
+
+# name, package, spiffs image, how much of the spiffs partition is the image, app image, expected result
+cases = [
+    ("plain", "plain.bin", "spiffs.bin", "all", "target.bin", "ok"),
+    ("compressed", "compressed.bin", "spiffs.bin", "all", "target.bin", "ok"),
+    ("delta", "delta.bin", "spiffs_small.bin", "all", "target.bin", "ok"),
+    ("delta_compressed", "delta_compressed.bin", "spiffs.bin", "all", "target.bin", "ok"),
+    ("assets_compressed", "assets_compressed.bin", "assets.bin", str(len(assetPack)), "target.bin", "ok"),
+    ("delta_other_base", "delta_other_base.bin", "spiffs.bin", "all", "target.bin", "base_mismatch"),
+]
+
+
+def write_cases(name, cases):
+    with open(os.path.join(args.out, name), "w") as f:
+        for case in cases:
+            f.write(" ".join(case) + "\n")
+
+
+if args.sign:
+    import ecdsa
+
+    # Made from the seeded generator, so the packages are the same every build
+    def signing_key(name):
+        key = ecdsa.SigningKey.from_secret_exponent(rng.randrange(1, ecdsa.NIST256p.order), curve=ecdsa.NIST256p)
+        write(name, key.to_pem())
+        return key
+
+    testKey = signing_key("test_key.pem")
+    signing_key("other_key.pem")
+    # The key the builds with CONFIG_OTA_SIGNATURE_VERIFY embed
+    write("ota_public_key.pem", testKey.get_verifying_key().to_pem())
+
+    package("signed.bin", "spiffs.bin", "target.bin", "--sign-key", os.path.join(args.out, "test_key.pem"))
+    package("signed_delta_compressed.bin", "spiffs.bin", "target.bin", "--base", os.path.join(args.out, "base.bin"), "--compress",
+            "--sign-key", os.path.join(args.out, "test_key.pem"))
+    package("signed_other_key.bin", "spiffs.bin", "target.bin", "--sign-key", os.path.join(args.out, "other_key.pem"))
+
+    # Without signature verification a signature is only logged
+    cases.append(("signed_unverified", "signed.bin", "spiffs.bin", "all", "target.bin", "ok"))
+
+    # For the builds that verify signatures, unsigned packages and packages signed with another key are refused
+    write_cases("signed_cases.txt", [
+        ("signed", "signed.bin", "spiffs.bin", "all", "target.bin", "ok"),
+        ("signed_delta_comp", "signed_delta_compressed.bin", "spiffs.bin", "all", "target.bin", "ok"),
+        ("signed_other_key", "signed_other_key.bin", "spiffs.bin", "all", "target.bin", "bad_signature"),
+        ("unsigned", "plain.bin", "spiffs.bin", "all", "target.bin", "bad_signature"),
+    ])
+
+write_cases("cases.txt", cases)
\ No newline at end of file
@@ -0,0 +1,71 @@
+// Measures how fast the ota service takes packages in chunks of different sizes, like the network hands them over.
+// The fake flash erases and writes at memory speed, so this is the cost of the service itself:
+// copying into the buffers, handing them to the writer task, decompressing, applying deltas and hashing.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_timer.h>
+
+#include "fake_ota_flash.h"
+#include "ota_service_common.h"
+
+static size_t fixed_chunk_length(void* state)
+{
+    return *(size_t*)state;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <package directory> [rounds]\n", argv[0]);
+        return 2;
+    }
+
+    static const char* packages[] = { "plain.bin", "compressed.bin", "delta_compressed.bin" };
+    static const size_t chunkLengths[] = { 64, 256, 536, 1460, 4096, 16384 };
+    const int nrOfRounds = argc > 2 ? atoi(argv[2]) : 20;
+
+    ota_service_init();
+
+    const file_t base = read_package_file(argv[1], "base.bin");
+
+    printf("%-22s %8s %10s %10s\n", "package", "chunk", "bytes", "MB/s");
+    for (size_t p = 0; p < sizeof(packages) / sizeof(packages[0]); ++p)
+    {
+        const file_t package = read_package_file(argv[1], packages[p]);
+
+        for (size_t c = 0; c < sizeof(chunkLengths) / sizeof(chunkLengths[0]); ++c)
+        {
+            int64_t bestTime = INT64_MAX;
+
+            for (int round = 0; round < nrOfRounds; ++round)
+            {
+                fake_ota_flash_init();
+                fake_ota_flash_set("ota_0", base.data, base.length);
+
+                size_t chunkLength = chunkLengths[c];
+                const int64_t start = esp_timer_get_time();
+                const ota_service_err_t err = run_update(package, fixed_chunk_length, &chunkLength, true);
+                const int64_t time = esp_timer_get_time() - start;
+
+                if (err != OTA_SERVICE_OK)
+                {
+                    fprintf(stderr, "Update with %s failed with %d\n", packages[p], err);
+                    return 1;
+                }
+                bestTime = time < bestTime ? time : bestTime;
+            }
+
+            // Update file bytes per second, what the network has to deliver
+            printf("%-22s %8zu %10zu %10.1f\n", packages[p], chunkLengths[c], package.length, (double)package.length / (double)bestTime);
+        }
+
+        free(package.data);
+    }
+
+    free(base.data);
+    return 0;
+}
\ No newline at end of file
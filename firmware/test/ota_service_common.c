@@ -0,0 +1,125 @@
+#include "ota_service_common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+file_t read_package_file(const char* directory, const char* name)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", directory, name);
+
+    FILE* f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Can not open %s\n", path);
+        exit(1);
+    }
+
+    fseek(f, 0, SEEK_END);
+    file_t file = { .length = (size_t)ftell(f) };
+    fseek(f, 0, SEEK_SET);
+
+    file.data = malloc(file.length);
+    if (file.data == NULL || fread(file.data, 1, file.length, f) != file.length)
+    {
+        fprintf(stderr, "Can not read %s\n", path);
+        exit(1);
+    }
+
+    fclose(f);
+    return file;
+}
+
+uint32_t next_random(uint32_t* state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+void wait_for_closed_update(void)
+{
+    ota_service_progress_t progress;
+    for (ota_service_get_progress(&progress); progress.running; ota_service_get_progress(&progress))
+    {
+        // Only yields, the benchmark times this as well
+        vTaskDelay(0);
+    }
+}
+
+static void notify(void* userData)
+{
+    xSemaphoreGive((SemaphoreHandle_t)userData);
+}
+
+ota_service_err_t run_update(file_t package, size_t (*chunkLength)(void* state), void* state, bool blocking)
+{
+    SemaphoreHandle_t notified = xSemaphoreCreateBinary();
+    ota_state_handle_t handle;
+    ota_service_err_t err;
+
+    wait_for_closed_update();
+
+    // The previous update frees its state just after it reported it closed
+    while ((err = ota_service_firmware_update_begin(&handle, blocking ? NULL : notify, notified)) == OTA_SERVICE_ERR_IN_PROGRESS)
+    {
+        vTaskDelay(0);
+    }
+    if (err != OTA_SERVICE_OK)
+    {
+        vSemaphoreDelete(notified);
+        return err;
+    }
+
+    size_t offset = 0;
+    while (offset < package.length && err == OTA_SERVICE_OK)
+    {
+        size_t length = chunkLength(state);
+        length = length < package.length - offset ? length : package.length - offset;
+
+        if (blocking)
+        {
+            err = ota_service_firmware_update_write(handle, (const char*)package.data + offset, length, NULL);
+            offset += length;
+            continue;
+        }
+
+        // Like the upload controller, what was not accepted is written again once a buffer is free
+        size_t accepted;
+        err = ota_service_firmware_update_write(handle, (const char*)package.data + offset, length, &accepted);
+        offset += accepted;
+        if (err == OTA_SERVICE_OK && accepted < length)
+        {
+            xSemaphoreTake(notified, portMAX_DELAY);
+        }
+    }
+
+    if (err != OTA_SERVICE_OK)
+    {
+        // The update already failed, ending it returns that error and frees it
+        ota_service_firmware_update_end(handle);
+    }
+    else if (blocking)
+    {
+        err = ota_service_firmware_update_end(handle);
+    }
+    else
+    {
+        while ((err = ota_service_firmware_update_finish(handle)) == OTA_SERVICE_ERR_BUSY)
+        {
+            xSemaphoreTake(notified, portMAX_DELAY);
+        }
+    }
+
+    // The writer task may still notify until it closed the update
+    wait_for_closed_update();
+    vSemaphoreDelete(notified);
+    return err;
+}
\ No newline at end of file
@@ -0,0 +1,46 @@
+#ifndef OTA_SERVICE_COMMON_H
+#define OTA_SERVICE_COMMON_H
+
+// What the ota service test and benchmark share: reading the packages made by make_ota_test_packages.py
+// and feeding them to the ota service like the upload controller does.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <services/ota_service.h>
+
+typedef struct file_s
+{
+    uint8_t* data;
+    size_t   length;
+} file_t;
+
+/**
+ * @brief Reads a file of the package directory, exits when it can not be read.
+ */
+file_t read_package_file(const char* directory, const char* name);
+
+/**
+ * @brief Gets the next number of a xorshift generator, so a seed always gives the same chunks.
+ */
+uint32_t next_random(uint32_t* state);
+
+/**
+ * @brief Waits until the last update closed, so it no longer touches the flash.
+ */
+void wait_for_closed_update(void);
+
+/**
+ * @brief Runs an update with the package, written in chunks of the given sizes.
+ *
+ * @param[in] package The update package.
+ * @param[in] chunkLength Gets the length of the next chunk.
+ * @param[in] state Passed to chunkLength.
+ * @param[in] blocking Whether the writes wait for the writer task, or return what was accepted and wait for notify.
+ *
+ * @return The first error of the writes, or the result of ending the update.
+ */
+ota_service_err_t run_update(file_t package, size_t (*chunkLength)(void* state), void* state, bool blocking);
+
+#endif // OTA_SERVICE_COMMON_H
\ No newline at end of file
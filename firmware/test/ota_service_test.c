@@ -0,0 +1,319 @@
+// Runs the ota service on the host against the fake flash. Every package made by make_ota_test_packages.py is written
+// with many random chunkings, on top of different partition contents, and the partitions are compared byte for byte
+// with the images that were packaged. Broken packages must fail without switching the boot partition.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <services/ota_service.h>
+
+#include "fake_ota_flash.h"
+#include "ota_service_common.h"
+
+#define DEFAULT_NR_OF_SEEDS 24
+#define MAX_CASES   16
+
+#ifndef OTA_BUFFER_SIZE
+#define OTA_BUFFER_SIZE SPI_FLASH_SEC_SIZE
+#endif
+
+// A build that verifies signatures runs the signed packages, and refuses the others
+#ifdef CONFIG_OTA_SIGNATURE_VERIFY
+#define CASES_FILE "signed_cases.txt"
+#else
+#define CASES_FILE "cases.txt"
+#endif
+
+typedef struct test_case_s
+{
+    char              name[64];
+    file_t            package;
+    file_t            spiffs;
+    // How much of the spiffs partition must equal the image, all of it unless the image is an asset pack
+    size_t            spiffs_length;
+    file_t            app;
+    ota_service_err_t expected;
+} test_case_t;
+
+typedef struct chunker_s
+{
+    uint32_t random;
+    size_t   max_length;
+} chunker_t;
+
+static file_t base;
+static file_t otherBase;
+static file_t spiffsOld;
+static int nrOfFailures = 0;
+static uint32_t nrOfSeeds = DEFAULT_NR_OF_SEEDS;
+
+#define CHECK(condition, ...) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__); \
+            fputc('\n', stderr); \
+            nrOfFailures++; \
+        } \
+    } while (0)
+
+static size_t random_chunk_length(void* state)
+{
+    chunker_t* chunker = state;
+    return 1 + next_random(&chunker->random) % chunker->max_length;
+}
+
+static ota_service_err_t parse_result(const char* name)
+{
+    if (strcmp(name, "ok") == 0)
+    {
+        return OTA_SERVICE_OK;
+    }
+    if (strcmp(name, "base_mismatch") == 0)
+    {
+        return OTA_SERVICE_ERR_BASE_MISMATCH;
+    }
+    if (strcmp(name, "bad_signature") == 0)
+    {
+        return OTA_SERVICE_ERR_BAD_SIGNATURE;
+    }
+
+    fprintf(stderr, "Unknown result %s\n", name);
+    exit(1);
+}
+
+static size_t read_cases(const char* directory, test_case_t* cases)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/" CASES_FILE, directory);
+
+    FILE* f = fopen(path, "r");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Can not open %s\n", path);
+        exit(1);
+    }
+
+    size_t nrOfCases = 0;
+    char package[64], spiffs[64], spiffsLength[64], app[64], expected[64];
+    while (nrOfCases < MAX_CASES && fscanf(f, "%63s %63s %63s %63s %63s %63s", cases[nrOfCases].name, package, spiffs, spiffsLength, app, expected) == 6)
+    {
+        test_case_t* testCase = &cases[nrOfCases++];
+        testCase->package = read_package_file(directory, package);
+        testCase->spiffs = read_package_file(directory, spiffs);
+        testCase->spiffs_length = strcmp(spiffsLength, "all") == 0 ? testCase->spiffs.length : strtoul(spiffsLength, NULL, 10);
+        testCase->app = read_package_file(directory, app);
+        testCase->expected = parse_result(expected);
+    }
+
+    fclose(f);
+    return nrOfCases;
+}
+
+// What the partitions of the update held before, which decides what has to be erased and which spiffs sectors can be skipped
+typedef enum previous_contents_e
+{
+    PREVIOUS_CONTENTS_GARBAGE,
+    PREVIOUS_CONTENTS_OLD,
+    PREVIOUS_CONTENTS_SAME,
+    NR_OF_PREVIOUS_CONTENTS
+} previous_contents_t;
+
+static void prepare_flash(const test_case_t* testCase, previous_contents_t previous, uint32_t seed)
+{
+    fake_ota_flash_init();
+    fake_ota_flash_set("ota_0", base.data, base.length);
+
+    switch (previous)
+    {
+    case PREVIOUS_CONTENTS_GARBAGE:
+    {
+        static uint8_t garbage[0x100000];
+        uint32_t random = seed * 2654435761u + 1;
+        for (size_t i = 0; i < sizeof(garbage); i += 4)
+        {
+            const uint32_t value = next_random(&random);
+            memcpy(garbage + i, &value, sizeof(value));
+        }
+        fake_ota_flash_set("ota_1", garbage, sizeof(garbage));
+        fake_ota_flash_set("spiffs_1", garbage, 0xF0000);
+        break;
+    }
+
+    case PREVIOUS_CONTENTS_OLD:
+        fake_ota_flash_set("ota_1", otherBase.data, otherBase.length);
+        fake_ota_flash_set("spiffs_1", spiffsOld.data, spiffsOld.length);
+        break;
+
+    case PREVIOUS_CONTENTS_SAME:
+        fake_ota_flash_set("ota_1", testCase->app.data, testCase->app.length);
+        fake_ota_flash_set("spiffs_1", testCase->spiffs.data, testCase->spiffs.length);
+        break;
+
+    default:
+        break;
+    }
+
+    fake_ota_flash_clear_stats();
+}
+
+static void check_updated_flash(const test_case_t* testCase, previous_contents_t previous, uint32_t seed)
+{
+    const uint8_t* app = fake_ota_flash_get("ota_1");
+    const uint8_t* spiffs = fake_ota_flash_get("spiffs_1");
+    const fake_ota_flash_stats_t stats = fake_ota_flash_get_stats();
+
+    CHECK(ota_flash_get_boot_partition() == ota_flash_get_next_update_partition(), "%s seed %u: boot partition is not ota_1", testCase->name, seed);
+    CHECK(memcmp(app, testCase->app.data, testCase->app.length) == 0, "%s seed %u: ota_1 does not hold the app", testCase->name, seed);
+    CHECK(memcmp(spiffs, testCase->spiffs.data, testCase->spiffs_length) == 0, "%s seed %u: spiffs_1 does not hold the spiffs image", testCase->name, seed);
+    CHECK(stats.nr_of_bad_writes == 0, "%s seed %u: %zu writes to flash that was not erased", testCase->name, seed, stats.nr_of_bad_writes);
+
+    // esp_ota_begin only erases the sectors of the image, the rest of the app partition is left as it was
+    const size_t appSectors = (testCase->app.length + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE;
+    for (size_t i = testCase->app.length; i < appSectors * SPI_FLASH_SEC_SIZE; ++i)
+    {
+        if (app[i] != 0xFF)
+        {
+            CHECK(false, "%s seed %u: ota_1 is not erased after the image at %zu", testCase->name, seed, i);
+            break;
+        }
+    }
+
+    // With the same spiffs image already in place, none of its sectors are erased again
+    if (previous == PREVIOUS_CONTENTS_SAME)
+    {
+        CHECK(stats.nr_of_erased_sectors == appSectors, "%s seed %u: %zu sectors erased, the app only has %zu", testCase->name, seed, stats.nr_of_erased_sectors, appSectors);
+    }
+}
+
+static void check_unchanged_boot_partition(const char* name, uint32_t seed)
+{
+    CHECK(ota_flash_get_boot_partition() == ota_flash_get_running_partition(), "%s seed %u: boot partition changed after a failed update", name, seed);
+    CHECK(fake_ota_flash_get_stats().nr_of_bad_writes == 0, "%s seed %u: writes to flash that was not erased", name, seed);
+}
+
+static void test_case(const test_case_t* testCase)
+{
+    for (uint32_t seed = 1; seed <= nrOfSeeds; ++seed)
+    {
+        // From single bytes to several buffers at once, the writer gets its data cut in other places every time
+        static const size_t maxLengths[] = { 16, 700, OTA_BUFFER_SIZE, 3 * OTA_BUFFER_SIZE + 5, 64 * 1024 };
+        chunker_t chunker = { .random = seed, .max_length = maxLengths[seed % 5] };
+        const previous_contents_t previous = (previous_contents_t)(seed % NR_OF_PREVIOUS_CONTENTS);
+        const bool blocking = seed % 2 == 0;
+
+        prepare_flash(testCase, previous, seed);
+        const ota_service_err_t err = run_update(testCase->package, random_chunk_length, &chunker, blocking);
+
+        CHECK(err == testCase->expected, "%s seed %u: result %d, expected %d", testCase->name, seed, err, testCase->expected);
+        if (err == OTA_SERVICE_OK)
+        {
+            check_updated_flash(testCase, previous, seed);
+        }
+        else
+        {
+            check_unchanged_boot_partition(testCase->name, seed);
+        }
+    }
+}
+
+static void test_broken_package(const test_case_t* testCase)
+{
+    if (testCase->expected != OTA_SERVICE_OK)
+    {
+        return;
+    }
+
+    file_t broken = { .data = malloc(testCase->package.length), .length = testCase->package.length };
+
+    for (uint32_t seed = 1; seed <= (nrOfSeeds + 3) / 4; ++seed)
+    {
+        chunker_t chunker = { .random = seed, .max_length = 2000 };
+        uint32_t random = seed;
+
+        // A changed byte anywhere after the manifest must be caught by a section hash, or by the decompressor
+        memcpy(broken.data, testCase->package.data, broken.length);
+        const size_t position = broken.length / 4 + next_random(&random) % (broken.length * 3 / 4);
+        broken.data[position] ^= 1 << (next_random(&random) % 8);
+
+        prepare_flash(testCase, PREVIOUS_CONTENTS_GARBAGE, seed);
+        ota_service_err_t err = run_update(broken, random_chunk_length, &chunker, seed % 2 == 0);
+        CHECK(err != OTA_SERVICE_OK, "%s seed %u: package with a changed byte at %zu was accepted", testCase->name, seed, position);
+        check_unchanged_boot_partition(testCase->name, seed);
+
+        // A package that ends early
+        memcpy(broken.data, testCase->package.data, broken.length);
+        file_t truncated = { .data = broken.data, .length = next_random(&random) % broken.length };
+
+        chunker.random = seed;
+        prepare_flash(testCase, PREVIOUS_CONTENTS_GARBAGE, seed);
+        err = run_update(truncated, random_chunk_length, &chunker, seed % 2 == 0);
+        CHECK(err != OTA_SERVICE_OK, "%s seed %u: package cut at %zu was accepted", testCase->name, seed, truncated.length);
+        check_unchanged_boot_partition(testCase->name, seed);
+    }
+
+    free(broken.data);
+}
+
+// Without a partition to write to, an update is refused at its begin and leaves nothing behind
+static void test_missing_partition(const char* label)
+{
+    ota_state_handle_t handle;
+
+    wait_for_closed_update();
+    fake_ota_flash_init();
+    fake_ota_flash_hide(label);
+
+    ota_service_err_t err = ota_service_firmware_update_begin(&handle, NULL, NULL);
+    CHECK(err == OTA_SERVICE_FAIL, "without %s: begin returned %d", label, err);
+
+    // Refusing the update freed it, so the next one is not blocked
+    fake_ota_flash_init();
+    err = ota_service_firmware_update_begin(&handle, NULL, NULL);
+    CHECK(err == OTA_SERVICE_OK, "after a refused update: begin returned %d", err);
+    if (err == OTA_SERVICE_OK)
+    {
+        ota_service_firmware_update_abort(handle);
+    }
+    wait_for_closed_update();
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <package directory> [seeds]\n", argv[0]);
+        return 2;
+    }
+    if (argc > 2)
+    {
+        nrOfSeeds = (uint32_t)strtoul(argv[2], NULL, 10);
+    }
+
+    ota_service_init();
+
+    static test_case_t cases[MAX_CASES];
+    const size_t nrOfCases = read_cases(argv[1], cases);
+    base = read_package_file(argv[1], "base.bin");
+    otherBase = read_package_file(argv[1], "other_base.bin");
+    spiffsOld = read_package_file(argv[1], "spiffs_old.bin");
+
+    printf("Buffers of %u bytes, %u seeds\n", (unsigned int)OTA_BUFFER_SIZE, nrOfSeeds);
+    for (size_t i = 0; i < nrOfCases; ++i)
+    {
+        const int nrOfFailuresBefore = nrOfFailures;
+        test_case(&cases[i]);
+        test_broken_package(&cases[i]);
+        printf("%-20s %s\n", cases[i].name, nrOfFailures == nrOfFailuresBefore ? "ok" : "FAILED");
+    }
+
+    const int nrOfFailuresBefore = nrOfFailures;
+    test_missing_partition("ota_1");
+    test_missing_partition("spiffs_1");
+    printf("%-20s %s\n", "missing_partition", nrOfFailures == nrOfFailuresBefore ? "ok" : "FAILED");
+
+    return nrOfFailures == 0 && nrOfCases > 0 ? 0 : 1;
+}
\ No newline at end of file
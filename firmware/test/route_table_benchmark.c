@@ -0,0 +1,173 @@
+// Measures what dispatching a request through the route table costs: finding the route of the uri and resolving the method.
+// The linear search is what dispatching cost before the route table, every uri compared against every route in turn.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "route_table.h"
+
+#define ITERATIONS 200000
+
+typedef struct request_s
+{
+    const char* method;
+    const char* uri;
+    // Index of the route the uri belongs to, or ROUTE_TABLE_NO_ROUTE for requests that go to the static file server
+    int route;
+} request_t;
+
+// The routes in the order webserver_task registers them, with the lift device present
+static const char* const routeUris[] = {
+    "/lift/status",
+    "/lift/up",
+    "/lift/down",
+    "/lift/stop",
+    "/lift/speed",
+    "/settings",
+    "/upload/firmware",
+    "/upload/firmware/session",
+    "/upload/firmware/pull",
+    "/upload/status",
+    "/server/connections",
+    "/server/routes",
+    "/batch",
+    "/metrics"
+};
+
+#define NR_OF_ROUTES (sizeof(routeUris) / sizeof(routeUris[0]))
+
+// A mix of api calls the web ui and the load generator make, and static files
+static const request_t requests[] = {
+    { "GET",    "/api/lift/status",            0 },
+    { "POST",   "/api/lift/up",                1 },
+    { "POST",   "/api/lift/down",              2 },
+    { "POST",   "/api/lift/stop",              3 },
+    { "GET",    "/api/lift/speed",             4 },
+    { "POST",   "/api/lift/speed/",            4 },
+    { "GET",    "/api/settings",               5 },
+    { "POST",   "/api/settings",               5 },
+    { "GET",    "/api/upload/firmware",        6 },
+    { "DELETE", "/api/upload/firmware/session", 7 },
+    { "GET",    "/api/upload/firmware/pull",   8 },
+    { "GET",    "/api/upload/status",          9 },
+    { "GET",    "/api/server/connections",     10 },
+    { "GET",    "/api/server/routes",          11 },
+    { "POST",   "/api/batch",                  12 },
+    { "GET",    "/api/metrics",                13 },
+    { "GET",    "/",                           ROUTE_TABLE_NO_ROUTE },
+    { "GET",    "/index.html",                 ROUTE_TABLE_NO_ROUTE },
+    { "GET",    "/js/app.js",                  ROUTE_TABLE_NO_ROUTE },
+    { "GET",    "/api/lift/position",          ROUTE_TABLE_NO_ROUTE },
+};
+
+#define NR_OF_REQUESTS (sizeof(requests) / sizeof(requests[0]))
+
+static char fullUris[NR_OF_ROUTES][48];
+
+static double now_ns(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+static int linear_find(const char* uri, size_t length)
+{
+    if(length > 1 && uri[length - 1] == '/')
+    {
+        length--;
+    }
+
+    for(size_t i = 0; i < NR_OF_ROUTES; ++i)
+    {
+        if(strlen(fullUris[i]) == length && memcmp(fullUris[i], uri, length) == 0)
+        {
+            return i;
+        }
+    }
+
+    return ROUTE_TABLE_NO_ROUTE;
+}
+
+static http_request_method_t linear_method(const char* method, size_t length)
+{
+    for(int i = 0; i < HTTP_REQUEST_METHOD_MAX; ++i)
+    {
+        const char* name = http_request_method_to_str(i);
+        if(strlen(name) == length && memcmp(name, method, length) == 0)
+        {
+            return i;
+        }
+    }
+
+    return HTTP_REQUEST_METHOD_UNKNOWN;
+}
+
+int main(void)
+{
+    static route_table_t table;
+    route_table_clear(&table);
+
+    for(size_t i = 0; i < NR_OF_ROUTES; ++i)
+    {
+        snprintf(fullUris[i], sizeof(fullUris[i]), "/api%s", routeUris[i]);
+        if(route_table_add(&table, "/api", routeUris[i]) != (int)i)
+        {
+            printf("FAIL: route %s got the wrong index\n", routeUris[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("%zu routes in %zu of %d nodes\n", table.nr_of_routes, table.nr_of_nodes, ROUTE_TABLE_MAX_NODES);
+
+    // Lengths are known up front, like they are for the uri and method of a parsed request
+    size_t uriLengths[NR_OF_REQUESTS];
+    size_t methodLengths[NR_OF_REQUESTS];
+    for(size_t i = 0; i < NR_OF_REQUESTS; ++i)
+    {
+        uriLengths[i] = strlen(requests[i].uri);
+        methodLengths[i] = strlen(requests[i].method);
+
+        const int route = route_table_find(&table, requests[i].uri, uriLengths[i]);
+        const http_request_method_t method = http_request_method_from_str(requests[i].method, methodLengths[i]);
+        if(route != requests[i].route || route != linear_find(requests[i].uri, uriLengths[i]) ||
+            method != linear_method(requests[i].method, methodLengths[i]) || method == HTTP_REQUEST_METHOD_UNKNOWN)
+        {
+            printf("FAIL: %s %s resolved to route %d method %d\n", requests[i].method, requests[i].uri, route, method);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // The sum keeps the compiler from dropping the lookups
+    volatile int sink = 0;
+
+    double start = now_ns();
+    for(int iteration = 0; iteration < ITERATIONS; ++iteration)
+    {
+        for(size_t i = 0; i < NR_OF_REQUESTS; ++i)
+        {
+            sink += route_table_find(&table, requests[i].uri, uriLengths[i]);
+            sink += http_request_method_from_str(requests[i].method, methodLengths[i]);
+        }
+    }
+    const double tableTime = (now_ns() - start) / ((double)ITERATIONS * NR_OF_REQUESTS);
+
+    start = now_ns();
+    for(int iteration = 0; iteration < ITERATIONS; ++iteration)
+    {
+        for(size_t i = 0; i < NR_OF_REQUESTS; ++i)
+        {
+            sink += linear_find(requests[i].uri, uriLengths[i]);
+            sink += linear_method(requests[i].method, methodLengths[i]);
+        }
+    }
+    const double linearTime = (now_ns() - start) / ((double)ITERATIONS * NR_OF_REQUESTS);
+
+    printf("Route table:    %6.1f ns per request\n", tableTime);
+    printf("Linear search:  %6.1f ns per request\n", linearTime);
+
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
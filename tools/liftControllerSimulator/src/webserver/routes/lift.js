@@ -18,12 +18,12 @@ router.route("/speed")
 
         if(!speed)
         {
-            res.status(500);
+            res.status(500).send();
             return;
         }
 
         liftService.speed = speed;
-        res.status(200);
+        res.status(200).send();
     });
 
 router.post("/up", (req, res) => 
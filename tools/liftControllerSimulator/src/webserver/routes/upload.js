@@ -1,9 +1,135 @@
 const express = require("express");
 const router = express.Router();
 
+// The firmware that is running, clients use it to pick a delta update
+router.get("/firmware", (req, res) =>
+{
+    res.status(200).json({ version: "simulator", elfSha256: "0".repeat(64) });
+});
+
 router.post("/firmware", (req, res) => 
 {
     res.status(200).send();
 });
 
+// Upload session, an upload continues from its offset after the connection dropped
+let session = null;
+// Like the device, only one request feeds an upload at a time
+let uploadRequest = null;
+
+router.post("/firmware/session", (req, res) =>
+{
+    session = { id: Math.floor(Math.random() * 0xFFFFFFFF).toString(16).padStart(8, "0"), offset: 0, length: req.body.length, timeout: 300 };
+    res.status(201).json(session);
+});
+
+router.get("/firmware/session", (req, res) =>
+{
+    if (session == null)
+    {
+        res.status(404).send("No upload session.");
+        return;
+    }
+    res.status(200).json(session);
+});
+
+router.delete("/firmware/session", (req, res) =>
+{
+    if (uploadRequest != null)
+    {
+        res.status(503).send("The upload is in progress.");
+        return;
+    }
+    session = null;
+    res.status(200).send();
+});
+
+// Progress of the last firmware update, the simulator never writes one
+router.get("/status", (req, res) =>
+{
+    res.status(200).json({ running: false, state: "manifest", result: 0, done: 0, total: 0, received: 0, throughput: 0, elapsedMs: 0, eraseMs: 0, writeMs: 0 });
+});
+
+// Pulled updates, the simulator has nothing to install so every pull finds the firmware up to date
+let pull = { state: "idle", url: "", offset: 0, length: 0, retries: 0, httpStatus: 0, otaResult: 0 };
+
+router.get("/firmware/pull", (req, res) =>
+{
+    res.status(200).json(pull);
+});
+
+router.post("/firmware/pull", (req, res) =>
+{
+    const url = req.body != null && req.body.url != null ? req.body.url : "";
+    if (url === "")
+    {
+        res.status(400).send("No url given and none is configured.");
+        return;
+    }
+    pull = { state: "upToDate", url: url, offset: 0, length: 0, retries: 0, httpStatus: 304, otaResult: 0 };
+    res.status(202).json(pull);
+});
+
+// Raw firmware image as the request body
+router.put("/firmware", (req, res) =>
+{
+    const sessionId = req.get("Upload-Session");
+    if (uploadRequest != null)
+    {
+        // A client that reconnects to continue its session takes it over from its old connection,
+        // which may not have noticed yet that the client is gone
+        if (sessionId == null || session == null || session.id !== sessionId)
+        {
+            res.status(503).send("Another upload is in progress.");
+            return;
+        }
+        uploadRequest.socket.destroy();
+        uploadRequest = null;
+    }
+
+    if (sessionId != null && (session == null || session.id !== sessionId))
+    {
+        res.status(404).send("Upload session not found.");
+        return;
+    }
+
+    // Only the offset the session is at can be continued
+    if (sessionId != null && Number(req.get("Upload-Offset")) !== session.offset)
+    {
+        res.status(409).json(session);
+        return;
+    }
+
+    const current = sessionId != null ? session : null;
+    uploadRequest = req;
+    req.on("close", () =>
+    {
+        if (uploadRequest === req)
+        {
+            uploadRequest = null;
+        }
+    });
+    req.on("data", (chunk) =>
+    {
+        if (current != null)
+        {
+            current.offset += chunk.length;
+        }
+    });
+    req.on("end", () =>
+    {
+        if (uploadRequest === req)
+        {
+            uploadRequest = null;
+        }
+        if (current != null && current.offset < current.length)
+        {
+            res.status(200).json(current);
+            return;
+        }
+        session = null;
+        res.status(200).json({ result: "ok" });
+    });
+});
+
 module.exports = router;
\ No newline at end of file
@@ -1,6 +1,8 @@
 const WebSocket = require("ws");
 const uuid = require("uuid");
 const Ansicolor = require("ansicolor");
+const liftService = require("../services/liftService");
+const { Opcode, Result, encodeFrame, decodeFrames } = require("../../../loadGenerator/src/controlProtocol");
 
 function sleep(ms)
 {
@@ -22,8 +24,40 @@ async function send(ws)
     send(ws);
 }
 
-function connection(ws)
+function controlConnection(ws)
 {
+    console.log("Control channel connected");
+
+    // Ack every command frame, like the firmware does
+    ws.on("message", data =>
+    {
+        const acks = decodeFrames(data).map(command =>
+        {
+            let result = liftService.status === "online" || command.opcode === Opcode.PING ? Result.OK : Result.LIFT_OFFLINE;
+            if (result === Result.OK && command.opcode === Opcode.SET_SPEED)
+            {
+                liftService.speed = command.payload;
+            }
+            else if (command.opcode > Opcode.MOVE_TO)
+            {
+                result = Result.UNKNOWN_OPCODE;
+            }
+
+            return encodeFrame(command.opcode | Opcode.ACK, command.sequence, liftService.speed, result);
+        });
+
+        ws.send(Buffer.concat(acks));
+    });
+}
+
+function connection(ws, request)
+{
+    if (request.url === "/api/control")
+    {
+        controlConnection(ws);
+        return;
+    }
+
     const id = uuid.v1();
 
     console.log("Connected", id);
@@ -0,0 +1,50 @@
+// Must match tasks/webserver/control_channel.h in the firmware
+const FRAME_SIZE = 8;
+
+const Opcode = {
+    PING: 0x00,
+    UP: 0x01,
+    DOWN: 0x02,
+    STOP: 0x03,
+    SET_SPEED: 0x04,
+    MOVE_TO: 0x05,
+
+    ACK: 0x80
+};
+
+const Result = {
+    OK: 0,
+    FAIL: 1,
+    UNKNOWN_OPCODE: 2,
+    LIFT_OFFLINE: 3,
+    AT_ENDSTOP: 4,
+    SPEED_TOO_HIGH: 5,
+    SPEED_TOO_LOW: 6
+};
+
+function encodeFrame(opcode, sequence, payload, result = 0)
+{
+    const frame = Buffer.alloc(FRAME_SIZE);
+    frame.writeUInt8(opcode, 0);
+    frame.writeUInt8(result, 1);
+    frame.writeUInt16LE(sequence & 0xFFFF, 2);
+    frame.writeUInt32LE(payload >>> 0, 4);
+    return frame;
+}
+
+function decodeFrames(buffer)
+{
+    const frames = [];
+    for (let offset = 0; offset + FRAME_SIZE <= buffer.length; offset += FRAME_SIZE)
+    {
+        frames.push({
+            opcode: buffer.readUInt8(offset),
+            result: buffer.readUInt8(offset + 1),
+            sequence: buffer.readUInt16LE(offset + 2),
+            payload: buffer.readUInt32LE(offset + 4)
+        });
+    }
+    return frames;
+}
+
+module.exports = { FRAME_SIZE, Opcode, Result, encodeFrame, decodeFrames };
\ No newline at end of file
@@ -0,0 +1,102 @@
+const zlib = require("zlib");
+const { download, findAssets } = require("./downloader");
+
+// Usage: node src/downloadBenchmark.js [--host tvlift.local] [--port 80] [--rounds 20] [--clients 1,4] [--label <backend>]
+// Downloads the web interface like a browser with an empty cache, and reports the throughput of the static file server.
+// Run it once against firmware built with CONFIG_WEBSERVER_ASSET_PACK and once against firmware without it to compare
+// the asset pack with spiffs, the label is printed with every result to tell the runs apart.
+function parseArguments(argv)
+{
+    const options = {
+        host: "tvlift.local",
+        port: 80,
+        rounds: 20,
+        clients: "1,4",
+        label: ""
+    };
+
+    for (let i = 0; i < argv.length; i += 2)
+    {
+        const name = argv[i].replace(/^--/, "");
+        if (!(name in options) || argv[i + 1] === undefined)
+        {
+            console.error("Unknown or incomplete argument:", argv[i]);
+            process.exit(1);
+        }
+
+        options[name] = name === "port" || name === "rounds" ? Number(argv[i + 1]) : argv[i + 1];
+    }
+
+    return options;
+}
+
+async function downloadRounds(options, paths, rounds, result)
+{
+    for (let round = 0; round < rounds; ++round)
+    {
+        for (const path of paths)
+        {
+            const start = process.hrtime.bigint();
+            const response = await download(options, path);
+            result.latencies.push(Number(process.hrtime.bigint() - start) / 1e6);
+            result.bytes += response.body.length;
+            result.errors += response.status === 200 ? 0 : 1;
+        }
+    }
+}
+
+async function measure(options, paths, clients)
+{
+    // Every client downloads the whole interface the same number of times, so the work does not depend on the number of clients
+    const result = { bytes: 0, errors: 0, latencies: [] };
+    const rounds = Math.max(1, Math.round(options.rounds / clients));
+
+    const start = process.hrtime.bigint();
+    const loops = [];
+    for (let i = 0; i < clients; ++i)
+    {
+        loops.push(downloadRounds(options, paths, rounds, result));
+    }
+    await Promise.all(loops);
+    const seconds = Number(process.hrtime.bigint() - start) / 1e9;
+
+    const sorted = result.latencies.sort((a, b) => a - b);
+    const percentile = (p) => sorted[Math.min(sorted.length - 1, Math.floor(p / 100 * sorted.length))];
+
+    console.log(
+        (options.label + " x" + clients).padEnd(12),
+        "files=" + sorted.length,
+        "bytes=" + (result.bytes / 1024).toFixed(0) + "KiB",
+        "throughput=" + (result.bytes / 1024 / seconds).toFixed(1) + "KiB/s",
+        "p50=" + percentile(50).toFixed(1) + "ms",
+        "p90=" + percentile(90).toFixed(1) + "ms",
+        "max=" + sorted[sorted.length - 1].toFixed(1) + "ms",
+        "errors=" + result.errors);
+}
+
+async function main()
+{
+    const options = parseArguments(process.argv.slice(2));
+
+    // The index is sent gzipped if the device has a precompressed variant
+    const index = await download(options, "/");
+    if (index.status !== 200)
+    {
+        throw new Error("Downloading the index failed with status " + index.status);
+    }
+    const html = index.body[0] === 0x1F ? zlib.gunzipSync(index.body).toString() : index.body.toString();
+    const paths = ["/", ...findAssets(html)];
+
+    console.log("Downloading", paths.length, "files", options.rounds, "times from", options.host + ":" + options.port);
+
+    for (const clients of options.clients.split(",").map(Number))
+    {
+        await measure(options, paths, clients);
+    }
+}
+
+main().catch((e) =>
+{
+    console.error(e.message);
+    process.exit(1);
+});
\ No newline at end of file
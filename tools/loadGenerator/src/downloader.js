@@ -0,0 +1,91 @@
+const http = require("http");
+
+// Downloads the web interface over and over like a browser with an empty cache would,
+// so there are always static file transfers in progress on the device
+function download(options, path)
+{
+    return new Promise((resolve, reject) =>
+    {
+        const request = http.get(
+            {
+                host: options.host,
+                port: options.port,
+                path,
+                agent: false,
+                headers: { "Accept-Encoding": "gzip" }
+            },
+            (response) =>
+            {
+                const chunks = [];
+                response.on("data", (chunk) => chunks.push(chunk));
+                response.on("end", () => resolve({ status: response.statusCode, body: Buffer.concat(chunks) }));
+            });
+
+        request.on("error", reject);
+    });
+}
+
+function findAssets(html)
+{
+    const assets = new Set();
+    for (const match of html.matchAll(/(?:src|href)="?([^" >]+\.(?:js|css))"?/g))
+    {
+        assets.add(match[1].startsWith("/") ? match[1] : "/" + match[1]);
+    }
+
+    return [...assets];
+}
+
+async function downloadLoop(options, state)
+{
+    while (!state.stopped)
+    {
+        const index = await download(options, "/");
+        state.bytes += index.body.length;
+
+        // The index is sent gzipped if the device has a precompressed variant, the asset names are only needed once
+        if (state.assets === undefined)
+        {
+            const html = index.body[0] === 0x1F ? require("zlib").gunzipSync(index.body).toString() : index.body.toString();
+            state.assets = findAssets(html);
+        }
+
+        for (const asset of state.assets)
+        {
+            if (state.stopped)
+            {
+                break;
+            }
+
+            const response = await download(options, asset);
+            state.bytes += response.body.length;
+            state.errors += response.status === 200 ? 0 : 1;
+        }
+    }
+}
+
+function startDownloads(options, count)
+{
+    const state = { stopped: false, bytes: 0, errors: 0, assets: undefined };
+    const loops = [];
+    for (let i = 0; i < count; ++i)
+    {
+        loops.push(downloadLoop(options, state).catch((e) =>
+        {
+            state.errors++;
+            console.error("Download failed:", e.message);
+        }));
+    }
+
+    return {
+        state,
+        stop: async () =>
+        {
+            state.stopped = true;
+            await Promise.all(loops);
+            return state;
+        }
+    };
+}
+
+module.exports = { download, findAssets, startDownloads };
\ No newline at end of file
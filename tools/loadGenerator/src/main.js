@@ -0,0 +1,206 @@
+const http = require("http");
+const WebSocket = require("ws");
+const { Opcode, Result, encodeFrame, decodeFrames } = require("./controlProtocol");
+const { startDownloads } = require("./downloader");
+
+// Usage: node src/main.js [--host tvlift.local] [--port 80] [--count 200] [--speed <speed>] [--downloads 4]
+function parseArguments(argv)
+{
+    const options = {
+        host: "tvlift.local",
+        port: 80,
+        count: 200,
+        speed: undefined,
+        downloads: 4
+    };
+
+    for (let i = 0; i < argv.length; i += 2)
+    {
+        const name = argv[i].replace(/^--/, "");
+        if (!(name in options) || argv[i + 1] === undefined)
+        {
+            console.error("Unknown or incomplete argument:", argv[i]);
+            process.exit(1);
+        }
+
+        options[name] = name === "host" ? argv[i + 1] : Number(argv[i + 1]);
+    }
+
+    return options;
+}
+
+function httpRequest(options, method, path, body)
+{
+    return new Promise((resolve, reject) =>
+    {
+        const data = body === undefined ? undefined : JSON.stringify(body);
+
+        // No agent, so every request pays for its own connection like the web interface does
+        const request = http.request(
+            {
+                host: options.host,
+                port: options.port,
+                method,
+                path,
+                agent: false,
+                headers: data === undefined ? {} : { "Content-Type": "application/json", "Content-Length": Buffer.byteLength(data) }
+            },
+            (response) =>
+            {
+                let responseBody = "";
+                response.on("data", (chunk) => responseBody += chunk);
+                response.on("end", () =>
+                {
+                    if (response.statusCode !== 200)
+                    {
+                        reject(new Error(method + " " + path + " failed with status " + response.statusCode));
+                        return;
+                    }
+
+                    resolve(responseBody);
+                });
+            });
+
+        request.on("error", reject);
+        request.end(data);
+    });
+}
+
+async function measureHttp(options, speed)
+{
+    const latencies = [];
+    for (let i = 0; i < options.count; ++i)
+    {
+        const start = process.hrtime.bigint();
+        await httpRequest(options, "POST", "/api/lift/speed", { speed });
+        latencies.push(Number(process.hrtime.bigint() - start) / 1e6);
+    }
+
+    return latencies;
+}
+
+async function measureStop(options)
+{
+    const latencies = [];
+    for (let i = 0; i < options.count; ++i)
+    {
+        const start = process.hrtime.bigint();
+        await httpRequest(options, "POST", "/api/lift/stop");
+        latencies.push(Number(process.hrtime.bigint() - start) / 1e6);
+    }
+
+    return latencies;
+}
+
+async function measureStopWhileDownloading(options)
+{
+    const downloads = startDownloads(options, options.downloads);
+
+    // Give the downloads time to get going, the first requests also calculate the etags
+    await new Promise((resolve) => setTimeout(resolve, 2000));
+
+    const start = process.hrtime.bigint();
+    const latencies = await measureStop(options);
+    const seconds = Number(process.hrtime.bigint() - start) / 1e9;
+
+    const state = await downloads.stop();
+    console.log(
+        "Downloaded",
+        (state.bytes / 1024).toFixed(0) + "KiB",
+        "at", (state.bytes / 1024 / seconds).toFixed(1) + "KiB/s",
+        "with", options.downloads, "clients,", state.errors, "errors");
+
+    return latencies;
+}
+
+function connectControlChannel(options)
+{
+    return new Promise((resolve, reject) =>
+    {
+        const ws = new WebSocket("ws://" + options.host + ":" + options.port + "/api/control");
+        ws.binaryType = "nodebuffer";
+        ws.once("open", () => resolve(ws));
+        ws.once("error", reject);
+    });
+}
+
+async function measureWebsocket(options, speed)
+{
+    const ws = await connectControlChannel(options);
+
+    const pending = new Map();
+    ws.on("message", (data) =>
+    {
+        for (const ack of decodeFrames(data))
+        {
+            const callback = pending.get(ack.sequence);
+            pending.delete(ack.sequence);
+            callback?.(ack);
+        }
+    });
+
+    const latencies = [];
+    for (let sequence = 0; sequence < options.count; ++sequence)
+    {
+        const start = process.hrtime.bigint();
+        const ack = await new Promise((resolve) =>
+        {
+            pending.set(sequence & 0xFFFF, resolve);
+            ws.send(encodeFrame(Opcode.SET_SPEED, sequence, speed));
+        });
+        latencies.push(Number(process.hrtime.bigint() - start) / 1e6);
+
+        if (ack.result !== Result.OK)
+        {
+            ws.close();
+            throw new Error("Command " + sequence + " failed with result " + ack.result);
+        }
+    }
+
+    ws.close();
+    return latencies;
+}
+
+function printStatistics(name, latencies)
+{
+    const sorted = [...latencies].sort((a, b) => a - b);
+    const percentile = (p) => sorted[Math.min(sorted.length - 1, Math.floor(p / 100 * sorted.length))];
+    const total = latencies.reduce((sum, latency) => sum + latency, 0);
+
+    console.log(
+        name.padEnd(10),
+        "n=" + sorted.length,
+        "min=" + sorted[0].toFixed(2) + "ms",
+        "mean=" + (total / sorted.length).toFixed(2) + "ms",
+        "p50=" + percentile(50).toFixed(2) + "ms",
+        "p90=" + percentile(90).toFixed(2) + "ms",
+        "p99=" + percentile(99).toFixed(2) + "ms",
+        "max=" + sorted[sorted.length - 1].toFixed(2) + "ms",
+        "rate=" + (sorted.length / total * 1000).toFixed(1) + "/s");
+}
+
+async function main()
+{
+    const options = parseArguments(process.argv.slice(2));
+
+    // Set the speed the lift already has, so the measurement does not change anything
+    const speed = options.speed ?? JSON.parse(await httpRequest(options, "GET", "/api/lift/speed")).speed;
+    console.log("Sending", options.count, "set speed commands with speed", speed, "to", options.host + ":" + options.port);
+
+    printStatistics("http", await measureHttp(options, speed));
+    printStatistics("websocket", await measureWebsocket(options, speed));
+
+    // Stop must get through no matter what else the device is doing, compare it idle and while the web interface is downloaded
+    if (options.downloads > 0)
+    {
+        console.log("Sending", options.count, "stop commands, idle and while", options.downloads, "clients download the web interface");
+        printStatistics("stop", await measureStop(options));
+        printStatistics("stop+dl", await measureStopWhileDownloading(options));
+    }
+}
+
+main().catch((e) =>
+{
+    console.error(e.message);
+    process.exit(1);
+});
\ No newline at end of file
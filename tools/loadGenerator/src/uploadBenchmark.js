@@ -0,0 +1,146 @@
+const fs = require("fs");
+const http = require("http");
+
+// Usage: node src/uploadBenchmark.js --firmware <ota.bin> [--compressed <ota.bin.z>] [--host tvlift.local] [--port 80] [--modes raw,compressed]
+// Every upload is flashed and restarts the device, the benchmark waits for it to come back before the next upload.
+// The compressed mode uploads the compressed update file raw, it only runs if a compressed file is given.
+function parseArguments(argv)
+{
+    const options = {
+        host: "tvlift.local",
+        port: 80,
+        firmware: undefined,
+        compressed: undefined,
+        modes: "raw,compressed"
+    };
+
+    for (let i = 0; i < argv.length; i += 2)
+    {
+        const name = argv[i].replace(/^--/, "");
+        if (!(name in options) || argv[i + 1] === undefined)
+        {
+            console.error("Unknown or incomplete argument:", argv[i]);
+            process.exit(1);
+        }
+
+        options[name] = name === "port" ? Number(argv[i + 1]) : argv[i + 1];
+    }
+
+    if (options.firmware === undefined)
+    {
+        console.error("No firmware file given");
+        process.exit(1);
+    }
+
+    return options;
+}
+
+function upload(options, mode, firmware)
+{
+    return new Promise((resolve, reject) =>
+    {
+        const start = process.hrtime.bigint();
+        const req = http.request(
+            {
+                host: options.host,
+                port: options.port,
+                method: "PUT",
+                path: "/api/upload/firmware",
+                agent: false,
+                headers: { "Content-Type": "application/octet-stream", "Content-Length": firmware.length }
+            },
+            (response) =>
+            {
+                response.resume();
+                response.on("end", () =>
+                {
+                    if (response.statusCode !== 200)
+                    {
+                        reject(new Error(mode + " upload failed with status " + response.statusCode));
+                        return;
+                    }
+
+                    resolve(Number(process.hrtime.bigint() - start) / 1e9);
+                });
+            });
+
+        req.on("error", reject);
+        req.end(firmware);
+    });
+}
+
+function isOnline(options)
+{
+    return new Promise((resolve) =>
+    {
+        const req = http.get({ host: options.host, port: options.port, path: "/api/lift/status", agent: false, timeout: 1000 }, (response) =>
+        {
+            response.resume();
+            resolve(response.statusCode === 200);
+        });
+
+        req.on("timeout", () => req.destroy());
+        req.on("error", () => resolve(false));
+    });
+}
+
+async function waitForRestart(options)
+{
+    const start = process.hrtime.bigint();
+    // Wait for the device to go down first, then for it to come back
+    const sleep = (ms) => new Promise((resolve) => setTimeout(resolve, ms));
+    const deadline = Date.now() + 120000;
+
+    while (Date.now() < deadline && await isOnline(options))
+    {
+        await sleep(250);
+    }
+
+    while (Date.now() < deadline)
+    {
+        if (await isOnline(options))
+        {
+            return Number(process.hrtime.bigint() - start) / 1e9;
+        }
+        await sleep(1000);
+    }
+
+    throw new Error("Device did not come back after the update");
+}
+
+async function main()
+{
+    const options = parseArguments(process.argv.slice(2));
+    const firmware = fs.readFileSync(options.firmware);
+    const compressed = options.compressed === undefined ? undefined : fs.readFileSync(options.compressed);
+
+    console.log("Uploading", (firmware.length / 1024).toFixed(0) + "KiB", "to", options.host + ":" + options.port);
+    if (compressed !== undefined)
+    {
+        console.log("Compressed to", (compressed.length / 1024).toFixed(0) + "KiB", "(" + (100 * compressed.length / firmware.length).toFixed(1) + "%)");
+    }
+
+    for (const mode of options.modes.split(","))
+    {
+        const file = mode === "compressed" ? compressed : firmware;
+        if (file === undefined)
+        {
+            continue;
+        }
+
+        // Throughput is in update bytes, so compressed uploads can be compared with plain ones
+        const seconds = await upload(options, mode, file);
+        const restartSeconds = await waitForRestart(options);
+        console.log(
+            mode.padEnd(10),
+            "upload=" + seconds.toFixed(2) + "s",
+            "throughput=" + (firmware.length / 1024 / seconds).toFixed(1) + "KiB/s",
+            "endToEnd=" + (seconds + restartSeconds).toFixed(2) + "s");
+    }
+}
+
+main().catch((e) =>
+{
+    console.error(e.message);
+    process.exit(1);
+});
\ No newline at end of file
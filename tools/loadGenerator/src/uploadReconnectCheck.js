@@ -0,0 +1,136 @@
+const crypto = require("crypto");
+const fs = require("fs");
+const http = require("http");
+const net = require("net");
+
+// Usage: node src/uploadReconnectCheck.js [--host tvlift.local] [--port 80] [--firmware <ota.bin>]
+// Checks that a client can continue its upload session while its old connection still holds the upload, like after
+// the client lost its network without the device noticing. The old connection is left open, it sends nothing more.
+// Without a firmware file random data is uploaded, which only the simulator takes, a device refuses it as soon as it
+// reads the manifest. A device installs the firmware file and restarts.
+function parseArguments(argv)
+{
+    const options = {
+        host: "tvlift.local",
+        port: 80,
+        firmware: undefined
+    };
+
+    for (let i = 0; i < argv.length; i += 2)
+    {
+        const name = argv[i].replace(/^--/, "");
+        if (!(name in options) || argv[i + 1] === undefined)
+        {
+            console.error("Unknown or incomplete argument:", argv[i]);
+            process.exit(1);
+        }
+
+        options[name] = name === "port" ? Number(argv[i + 1]) : argv[i + 1];
+    }
+
+    return options;
+}
+
+const sleep = (ms) => new Promise((resolve) => setTimeout(resolve, ms));
+
+function request(options, method, path, headers, body)
+{
+    return new Promise((resolve, reject) =>
+    {
+        const req = http.request({ host: options.host, port: options.port, method, path, agent: false, headers }, (response) =>
+        {
+            const chunks = [];
+            response.on("data", (chunk) => chunks.push(chunk));
+            response.on("end", () => resolve({ status: response.statusCode, body: Buffer.concat(chunks).toString() }));
+        });
+
+        req.on("error", reject);
+        req.end(body);
+    });
+}
+
+function requestJson(options, method, path, body)
+{
+    const data = body === undefined ? undefined : JSON.stringify(body);
+    const headers = data === undefined ? {} : { "Content-Type": "application/json", "Content-Length": Buffer.byteLength(data) };
+    return request(options, method, path, headers, data);
+}
+
+// Sends the header and the first part of the body, then stops sending without closing the connection
+function startStalledUpload(options, session, firmware, length)
+{
+    return new Promise((resolve, reject) =>
+    {
+        const socket = net.connect(options.port, options.host, () =>
+        {
+            socket.write(
+                "PUT /api/upload/firmware HTTP/1.1\r\n" +
+                "Host: " + options.host + "\r\n" +
+                "Content-Type: application/octet-stream\r\n" +
+                "Content-Length: " + firmware.length + "\r\n" +
+                "Upload-Session: " + session.id + "\r\n" +
+                "Upload-Offset: 0\r\n\r\n");
+            socket.write(firmware.subarray(0, length));
+            resolve(stalled);
+        });
+
+        const stalled = { socket, closed: false };
+        socket.on("close", () => stalled.closed = true);
+        socket.on("error", reject);
+    });
+}
+
+function expect(condition, message)
+{
+    if (!condition)
+    {
+        throw new Error(message);
+    }
+    console.log("ok  ", message);
+}
+
+async function main()
+{
+    const options = parseArguments(process.argv.slice(2));
+    const firmware = options.firmware === undefined ? crypto.randomBytes(256 * 1024) : fs.readFileSync(options.firmware);
+
+    const created = await requestJson(options, "POST", "/api/upload/firmware/session", { length: firmware.length });
+    expect(created.status === 201, "session created (" + created.status + ")");
+    const session = JSON.parse(created.body);
+
+    const stalled = await startStalledUpload(options, session, firmware, Math.floor(firmware.length / 4));
+    // Time for the device to take the data that was sent
+    await sleep(1000);
+
+    const other = await request(options, "PUT", "/api/upload/firmware", { "Content-Type": "application/octet-stream" }, Buffer.alloc(16));
+    expect(other.status === 503, "an upload without the session is refused while the old connection holds it (" + other.status + ")");
+
+    const current = await requestJson(options, "GET", "/api/upload/firmware/session");
+    const offset = JSON.parse(current.body).offset;
+    expect(current.status === 200 && offset > 0, "session is at " + offset + " of " + firmware.length + " bytes");
+
+    const continued = await request(
+        options,
+        "PUT",
+        "/api/upload/firmware",
+        {
+            "Content-Type": "application/octet-stream",
+            "Upload-Session": session.id,
+            "Upload-Offset": offset.toString()
+        },
+        firmware.subarray(offset));
+    expect(continued.status !== 503 && continued.status !== 404 && continued.status !== 409,
+        "the session is continued on a new connection (" + continued.status + " " + continued.body.trim() + ")");
+
+    for (let i = 0; i < 20 && !stalled.closed; ++i)
+    {
+        await sleep(100);
+    }
+    expect(stalled.closed, "the old connection was closed by the server");
+}
+
+main().catch((e) =>
+{
+    console.error("FAIL", e.message);
+    process.exit(1);
+});
\ No newline at end of file
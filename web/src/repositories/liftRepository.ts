@@ -2,6 +2,8 @@ import { singleton, inject } from "tsyringe";
 import { AxiosInstance } from "axios";
 
 export type LiftStatus = "unknown" | "offline" | "online";
+export type LiftState = "unknown" | "down" | "up" | "stopped" | "moving_up" | "moving_down";
+export type LiftEventType = "snapshot" | "state" | "speed" | "position" | "endstop";
 
 export interface LiftStatusMessage
 {
@@ -13,6 +15,21 @@ export interface LiftSpeedMessage
     speed: number;
 }
 
+export interface LiftEventMessage
+{
+    type: LiftEventType;
+    status: LiftStatus;
+
+    // Only present when the lift is online
+    state?: LiftState;
+    speed?: number;
+    position?: number;
+    endstops?: {
+        down: boolean;
+        up: boolean;
+    };
+}
+
 @singleton()
 export class LiftRepository
 {
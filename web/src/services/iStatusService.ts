@@ -1,4 +1,23 @@
-import { LiftStatus } from "@/repositories/liftRepository";
+import { LiftStatus, LiftState } from "@/repositories/liftRepository";
+
+export type OtaState = "manifest" | "signature" | "spiffs" | "app_header" | "app_data" | "app_delta" | "done" | "failed";
+
+// Progress of a firmware update, pushed over the event channel and served at /api/upload/status
+export interface OtaProgress
+{
+    running: boolean;
+    state: OtaState;
+    result: number;
+    // Bytes of the update package
+    done: number;
+    total: number;
+    // Bytes of the update file, less then done for a compressed package
+    received: number;
+    throughput: number;
+    elapsedMs: number;
+    eraseMs: number;
+    writeMs: number;
+}
 
 export enum ConnectionStatus
 {
@@ -14,4 +33,10 @@ export interface IStatusService
 
     readonly liftStatus: LiftStatus;
     readonly isLiftOnline: boolean;
+
+    readonly liftState: LiftState;
+    readonly liftSpeed: number;
+    readonly liftPosition: number;
+
+    readonly otaProgress: OtaProgress | null;
 }
@@ -5,8 +5,15 @@ export interface MessageReceivedCallback
     (event: MessageEvent): void
 }
 
+export interface ConnectedCallback
+{
+    (): void
+}
+
 export interface IWebsocketService
 {
     readonly connectionStatus: ConnectionStatus;
     onMessageRecieved(callback: MessageReceivedCallback): void;
+    onConnected(callback: ConnectedCallback): void;
+    send(data: string): boolean;
 }
@@ -1,16 +1,15 @@
 import { injectable, inject } from "tsyringe";
 
-import { IStatusService, ConnectionStatus } from "@/services/iStatusService";
+import { IStatusService, ConnectionStatus, OtaProgress } from "@/services/iStatusService";
 import { IWebsocketService } from "@/services/iWebsocketService";
-import { LiftRepository, LiftStatus } from "@/repositories/liftRepository";
-import { sleep } from "@/services/sleep";
+import { LiftStatus, LiftState, LiftEventMessage } from "@/repositories/liftRepository";
 
 @injectable()
 export class StatusService implements IStatusService
 {
     public get connectionStatus(): ConnectionStatus
     {
-        return this.websocketService.connectionStatus;
+        return this.eventWebsocketService.connectionStatus;
     }
 
     public get isConnected(): boolean
@@ -29,21 +28,52 @@ export class StatusService implements IStatusService
         return this.liftStatus === "online";
     }
 
-    public constructor(
-        @inject("IWebsocketService") private readonly websocketService: IWebsocketService,
-        private readonly liftRepository: LiftRepository)
+    public _liftState: LiftState = "unknown";
+    public get liftState(): LiftState
     {
-        this.pollLiftStatus();
+        return this._liftState;
     }
 
-    private pollLiftStatus(): Promise<void>
+    public _liftSpeed = 0;
+    public get liftSpeed(): number
     {
-        return this.liftRepository.getStatus()
-            .then(async (status) =>
+        return this._liftSpeed;
+    }
+
+    public _liftPosition = 0;
+    public get liftPosition(): number
+    {
+        return this._liftPosition;
+    }
+
+    public _otaProgress: OtaProgress | null = null;
+    public get otaProgress(): OtaProgress | null
+    {
+        return this._otaProgress;
+    }
+
+    public constructor(@inject("IEventWebsocketService") private readonly eventWebsocketService: IWebsocketService)
+    {
+        // The lift pushes its status on connect and whenever it changes, firmware updates push their progress
+        this.eventWebsocketService.onMessageRecieved((event) =>
+        {
+            const message = JSON.parse(event.data);
+            if (message.type === "ota")
+            {
+                this._otaProgress = message as OtaProgress;
+            }
+            else
             {
-                this._liftStatus = status.status;
-            })
-            .then(() => sleep(1000))
-            .then(() => this.pollLiftStatus());
+                this.onLiftEvent(message as LiftEventMessage);
+            }
+        });
+    }
+
+    private onLiftEvent(message: LiftEventMessage): void
+    {
+        this._liftStatus = message.status;
+        this._liftState = message.state ?? "unknown";
+        this._liftSpeed = message.speed ?? this._liftSpeed;
+        this._liftPosition = message.position ?? this._liftPosition;
     }
 }
@@ -1,6 +1,6 @@
 import { injectable, inject } from "tsyringe";
 import { ConnectionStatus } from "@/services/iStatusService";
-import { IWebsocketService, MessageReceivedCallback } from "@/services/iWebsocketService";
+import { IWebsocketService, MessageReceivedCallback, ConnectedCallback } from "@/services/iWebsocketService";
 import { sleep, promiseWithTimeout } from "@/services/sleep";
 
 enum WebsocketPromiseRejectionReasons
@@ -18,6 +18,7 @@ export class WebsocketService implements IWebsocketService
 
     private webSocket: WebSocket | null = null;
     private messageRecievedCallbacks: MessageReceivedCallback[] = [];
+    private connectedCallbacks: ConnectedCallback[] = [];
 
     private _connectionStatus: ConnectionStatus = ConnectionStatus.Disconnected;
     public get connectionStatus(): ConnectionStatus
@@ -27,8 +28,9 @@ export class WebsocketService implements IWebsocketService
 
     public constructor(@inject("apiUri") apiUri: URL)
     {
-        apiUri.protocol = "ws";
-        this.websocketUri = apiUri;
+        // Copy the uri, the injected instance is shared
+        this.websocketUri = new URL(apiUri.toString());
+        this.websocketUri.protocol = "ws";
 
         console.info("websocketuri: ", this.websocketUri);
 
@@ -40,6 +42,22 @@ export class WebsocketService implements IWebsocketService
         this.messageRecievedCallbacks.push(callback);
     }
 
+    public onConnected(callback: ConnectedCallback): void
+    {
+        this.connectedCallbacks.push(callback);
+    }
+
+    public send(data: string): boolean
+    {
+        if(this.webSocket === null || this.webSocket.readyState !== WebSocket.OPEN)
+        {
+            return false;
+        }
+
+        this.webSocket.send(data);
+        return true;
+    }
+
     private async initialiseWebSocket(): Promise<void>
     {
         this.webSocket = await this.connectWebSocket();
@@ -54,6 +72,12 @@ export class WebsocketService implements IWebsocketService
         };
 
         this.webSocket.onmessage = this.onWebSocketMessage.bind(this);
+
+        // State set up by messages, like subscriptions, does not survive a reconnect
+        for(const callback of this.connectedCallbacks)
+        {
+            callback();
+        }
     }
 
     private destroyWebSocket(): void
@@ -1,4 +1,4 @@
-// const CompressionPlugin = require("compression-webpack-plugin");
+const CompressionPlugin = require("compression-webpack-plugin");
 
 // Set environment variables
 process.env.VUE_APP_VERSION = Date().toString();
@@ -6,7 +6,8 @@ process.env.VUE_APP_VERSION = Date().toString();
 // Modify configuration
 module.exports = {
     outputDir: "../firmware/data/www",
-    filenameHashing: false,
+    // Hashed filenames let the device serve assets with an immutable cache policy
+    filenameHashing: true,
     chainWebpack: config => {
         // Remove splitChunks
         config
@@ -30,11 +31,14 @@ module.exports = {
                 },
             ]);
 
-        // config
-        //     .plugin("compression")
-        //     .use(CompressionPlugin, 
-        //         [{
-        //             deleteOriginalAssets: true,
-        //         }]);
+        // Precompress assets, the device serves the .gz variant to clients that accept gzip
+        config
+            .plugin("compression")
+            .use(CompressionPlugin, 
+                [{
+                    test: /\.(js|css|html|svg|ico|json)$/,
+                    threshold: 1024,
+                    deleteOriginalAssets: false,
+                }]);
     }
 }